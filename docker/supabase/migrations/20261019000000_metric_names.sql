@@ -0,0 +1,8 @@
+--
+-- Metric names written by the MQTT domain service since the schema dump:
+-- periodic firmware metrics snapshots and staged credit latency samples.
+-- tests/database/metric_names.test.sql inserts one row of each name.
+--
+
+ALTER TYPE public.metric_name ADD VALUE IF NOT EXISTS 'snapshot';
+ALTER TYPE public.metric_name ADD VALUE IF NOT EXISTS 'credit_latency';
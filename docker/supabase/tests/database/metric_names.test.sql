@@ -0,0 +1,15 @@
+-- Every metric the MQTT domain service (docker/volumes/mqtt/domain) inserts must be a valid metric_name.
+BEGIN;
+CREATE EXTENSION IF NOT EXISTS pgtap WITH SCHEMA extensions;
+
+SELECT plan(6);
+
+SELECT lives_ok($$INSERT INTO public.metrics (name, value) VALUES ('online', 1)$$, 'status online');
+SELECT lives_ok($$INSERT INTO public.metrics (name, value) VALUES ('offline', 1)$$, 'status offline');
+SELECT lives_ok($$INSERT INTO public.metrics (name, value, payload) VALUES ('paxcounter', 3, '{"returning": 1}')$$, 'paxcounter report');
+SELECT lives_ok($$INSERT INTO public.metrics (name, payload) VALUES ('vend_fail', '{"item_price": 250, "item_number": 12}')$$, 'vend failure');
+SELECT lives_ok($$INSERT INTO public.metrics (name, payload) VALUES ('snapshot', '{"ble.scan_ms": 42}')$$, 'metrics snapshot');
+SELECT lives_ok($$INSERT INTO public.metrics (name, value, payload) VALUES ('credit_latency', 12.5, '{"corr": "0a1b2c3d", "outcome": "vend"}')$$, 'credit latency');
+
+SELECT * FROM finish();
+ROLLBACK;
@@ -29,7 +29,7 @@ Deno.serve(async (req) => {
         const client = new Client({ url: `mqtt://mqtt.vmflow.xyz` });
         await client.connect();
 
-        await client.publish(`${embeddedData[0].subdomain}.vmflow.xyz/rpc`, creditLine);
+        await client.publish(`${embeddedData[0].subdomain}.vmflow.xyz/rpc`, creditLine, { qos: 1 });
         await client.disconnect();
 
         let salesId: string | null = null;
@@ -131,7 +131,7 @@ Deno.serve(async (req) => {
 
     const client = new Client({ url: 'mqtt://mqtt.vmflow.xyz' })
     await client.connect()
-    await client.publish(`${embeddedData.subdomain}.vmflow.xyz/rpc`, creditLine)
+    await client.publish(`${embeddedData.subdomain}.vmflow.xyz/rpc`, creditLine, { qos: 1 })
     await client.disconnect()
 
     // 6. Record sale
@@ -2,6 +2,8 @@
 # supabase
 
 import os
+import json
+import logging
 import re
 import hmac
 import hashlib
@@ -11,6 +13,9 @@ from supabase import create_client, Client
 from datetime import datetime, timezone
 import time
 
+logging.basicConfig(level=logging.INFO, format="%(asctime)s %(levelname)s %(message)s")
+log = logging.getLogger("mqtt_domain")
+
 # Freshness window for signed device->server messages (must match firmware RPC_FRESHNESS_SEC).
 FRESHNESS_SEC = 10
 
@@ -40,6 +45,10 @@ def verify_signed_line(passkey: str, line: str):
 
     return fields[:-1]
 
+def sign_line(passkey: str, msg: str) -> str:
+    """Append ":<hmac_hex>" to msg, the firmware's signed-text envelope."""
+    return msg + ":" + hmac.new(passkey.encode(), msg.encode(), hashlib.sha256).hexdigest()
+
 role_key = os.environ.get('SERVICE_ROLE_KEY')
 
 supabaseUrl = os.environ.get('SUPABASE_PUBLIC_URL')
@@ -64,10 +73,25 @@ def on_connect(client, userdata, flags, rc):
 
 def on_message(client, userdata, msg):
     try:
-        match = re.match(r"^domain.vmflow.xyz/(\d+)/(sale|status|paxcounter|vend_fail)$", msg.topic)
+        match = re.match(r"^domain.vmflow.xyz/(\d+)/(sale|status|paxcounter|vend_fail|time|metrics|latency)$", msg.topic)
         if match:
             domain_id = int(match.group(1))
-            event_type = match.group(2)  # "sale", "status" or "paxcounter"
+            event_type = match.group(2)  # "sale", "status", "paxcounter", "vend_fail", "time", "metrics" or "latency"
+
+            # Time request "<nonce>" from a device whose clock is not set yet (it cannot sign a fresh
+            # message). Answered as the signed RPC "time:<nonce>:<now>"; the nonce makes it single-use.
+            if event_type == "time":
+                nonce = msg.payload.decode('utf-8', errors='ignore')
+                if not re.fullmatch(r"[0-9a-f]{8}", nonce):
+                    return
+
+                res = supabase.table("embedded").select("passkey").eq("subdomain", domain_id).execute()
+                if not res.data:
+                    return
+
+                line = sign_line(res.data[0]["passkey"], f"time:{nonce}:{int(time.time())}")
+                client.publish(f"{domain_id}.vmflow.xyz/rpc", line, qos=1)
+                return
 
             if event_type == "status":
                 raw = msg.payload.decode('utf-8', errors='ignore')
@@ -103,12 +127,21 @@ def on_message(client, userdata, msg):
 
                 fields = verify_signed_line(embedded["passkey"], line)
                 if fields and len(fields) == 1:
-                    pax_counter = int(fields[0])
+                    # "<unique>" (older firmware) or "<unique>,<returning>,<d1>/<d2>/<d3-4>/<d5-8>/<d9-12>,<near>/<mid>/<far>[/<radio_ms>],..."
+                    parts = fields[0].split(",")
+                    pax_counter = int(parts[0])
 
-                    supabase.table("metrics").insert([{"embedded_id": embedded["id"],
-                                                     "machine_id": embedded["machine_id"],
-                                                     "name": "paxcounter",
-                                                     "value": pax_counter}]).execute()
+                    row = {"embedded_id": embedded["id"],
+                           "machine_id": embedded["machine_id"],
+                           "name": "paxcounter",
+                           "value": pax_counter}
+
+                    if len(parts) > 3:
+                        row["payload"] = {"returning": int(parts[1]),
+                                          "dwell_slots": dict(zip(["1", "2", "3-4", "5-8", "9-12"], map(int, parts[2].split("/")))),
+                                          "slots": [dict(zip(["near", "mid", "far", "radio_ms"], map(int, p.split("/")))) for p in parts[3:]]}
+
+                    supabase.table("metrics").insert([row]).execute()
 
             if event_type == "sale":
                 res = supabase.table("embedded").select("passkey,subdomain,id,owner_id,machine_id").eq("subdomain", domain_id).execute()
@@ -145,8 +178,51 @@ def on_message(client, userdata, msg):
                             "name":        "vend_fail",
                             "payload":     {"item_price": vf_price, "item_number": vf_item}
                         }]).execute()
-    except Exception as e:
-        print(f"An unexpected error occurred: {e}")
+
+            # Metrics snapshot "<json>:<ts>:<hmac>" (metrics.h); the JSON itself contains ':'.
+            if event_type == "metrics":
+                res = supabase.table("embedded").select("passkey, id, machine_id").eq("subdomain", domain_id).execute()
+                if not res.data:
+                    return
+                embedded = res.data[0]
+
+                fields = verify_signed_line(embedded["passkey"], line)
+                if fields:
+                    snapshot = json.loads(":".join(fields))
+
+                    supabase.table("metrics").insert([{
+                        "embedded_id": embedded["id"],
+                        "machine_id":  embedded["machine_id"],
+                        "name":        "snapshot",
+                        "payload":     snapshot
+                    }]).execute()
+
+            # Credit latency "<corr>,<outcome>,<age_ms>,<stage us>...:<ts>:<hmac>" (credit-probe.h);
+            # stages are microseconds after the RPC reached the device, -1 if not reached.
+            if event_type == "latency":
+                res = supabase.table("embedded").select("passkey, id, machine_id").eq("subdomain", domain_id).execute()
+                if not res.data:
+                    return
+                embedded = res.data[0]
+
+                fields = verify_signed_line(embedded["passkey"], line)
+                if fields and len(fields) == 1:
+                    parts = fields[0].split(",")
+                    if len(parts) == 9:
+                        stages = ["verified", "queued", "begin", "vend_request", "vend_done", "end"]
+                        payload = {"corr": parts[0], "outcome": parts[1], "age_ms": int(parts[2])}
+                        payload.update({f"{s}_us": int(v) for s, v in zip(stages, parts[3:])})
+
+                        supabase.table("metrics").insert([{
+                            "embedded_id": embedded["id"],
+                            "machine_id":  embedded["machine_id"],
+                            "name":        "credit_latency",
+                            "value":       payload["begin_us"] / 1000 if payload["begin_us"] >= 0 else None,
+                            "payload":     payload
+                        }]).execute()
+    except Exception:
+        # A failed insert (a name missing from metric_name, a constraint) lands here: never drop it silently.
+        log.exception("%s: message not stored", msg.topic)
 
 client = mqtt.Client()
 
@@ -0,0 +1,69 @@
+/*
+ * cashless-host.c — the MDB cashless state machine as a Linux process.
+ *
+ * Runs main/mdb-cashless.c unmodified on the default POSIX HAL: VMC frames
+ * come in on stdin and the replies go out on stdout, one 9-bit word per
+ * 2 bytes little-endian (mode bit in bit 8); sales and vend failures are
+ * printed on stderr as they would be published. With -c, one credit is
+ * waiting for the first POLL after the reader is enabled, as a phone or
+ * the credit RPC would leave it. The process ends when stdin does.
+ *
+ *   cashless-host [-c funds] [-k passkey] [-s subdomain] < frames > replies
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hal-posix.h"
+#include "mdb-cashless.h"
+#include "credit-probe.h"
+#include "rpc-auth.h"
+
+// Read by the core, as on the board (the main translation unit there).
+char my_passkey[19] = "000000000000000000";
+char my_subdomain[32] = "host";
+
+static long s_credit = -1;
+
+static bool host_take_credit(mdb_credit_t *credit) {
+	if (s_credit < 0) return false;
+
+	memset(credit, 0, sizeof(*credit));
+	credit->funds = (uint16_t) s_credit;
+	credit->ble_conn = 0xffff;
+	s_credit = -1;
+	return true;
+}
+
+static void host_reader_changed(bool enabled) {
+	fprintf(stderr, "reader %s\n", enabled ? "enabled" : "disabled");
+}
+
+int main(int argc, char **argv) {
+	int opt;
+	while ((opt = getopt(argc, argv, "c:k:s:")) != -1) {
+		switch (opt) {
+		case 'c': s_credit = strtol(optarg, NULL, 0); break;
+		case 'k': snprintf(my_passkey, sizeof(my_passkey), "%s", optarg); break;
+		case 's': snprintf(my_subdomain, sizeof(my_subdomain), "%s", optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-c funds] [-k passkey] [-s subdomain]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	rpc_auth_set_key(my_passkey);
+	credit_probe_init();
+
+	mdb_cashless_hooks_t hooks = {
+		.take_credit = host_take_credit,
+		.reader_changed = host_reader_changed,
+	};
+	hal_mdb_init();
+	mdb_cashless_init(&hooks);
+
+	for (;;) {
+		mdb_cashless_poll();
+	}
+}
@@ -0,0 +1,116 @@
+/*
+ * core-bench-host.c — main/core-bench.c on Linux, plus the MDB frame kernels.
+ *
+ * Runs the built-in kernels (core-bench.h), then times mdb_cashless_poll()
+ * reading and answering whole frames: the bus hooks hand it a canned VMC
+ * frame and swallow the reply, so the time is the firmware's parse, checksum,
+ * state machine and reply encoding. On the board the bus is bit-banged at
+ * 104 us a bit, so those kernels run on Linux only.
+ *
+ *   core-bench [-f kernel-prefix] [-o results.json] [-k passkey]
+ *
+ * One JSON object per line (core-bench.h), on stdout or into -o. Compare two
+ * runs with tools/bench-diff.py.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sdkconfig.h>
+
+#include "hal-posix.h"
+#include "core-bench.h"
+#include "mdb-cashless.h"
+#include "credit-probe.h"
+#include "rpc-auth.h"
+
+// Read by the core, as on the board (the main translation unit there).
+char my_passkey[19] = "000000000000000000";
+char my_subdomain[32] = "host";
+
+#define ADDR    CONFIG_CASHLESS_DEVICE_ADDRESS
+
+// POLL, idle reader: the reply is a lone ACK.
+static const uint16_t s_poll[] = { BIT_MODE_SET | ADDR | POLL, (ADDR | POLL) & 0xff };
+
+// SETUP CONFIG DATA, level 3, 32x2 display: answered with the 8-byte reader config.
+static const uint16_t s_setup[] = { BIT_MODE_SET | ADDR | SETUP, CONFIG_DATA, 3, 32, 2, 0,
+	((ADDR | SETUP) + CONFIG_DATA + 3 + 32 + 2 + 0) & 0xff };
+
+typedef struct {
+	const uint16_t *words;
+	size_t len, pos;
+} frame_feed_t;
+
+static frame_feed_t s_feed;
+static uint32_t s_written;
+
+static uint16_t feed_read(void *ctx) {
+	uint16_t w = s_feed.words[s_feed.pos];
+	if (++s_feed.pos == s_feed.len) s_feed.pos = 0;
+	return w;
+}
+
+static void feed_write(uint16_t word, void *ctx) {
+	s_written += word;
+}
+
+static uint32_t feed_pending(void *ctx) {
+	return 0;
+}
+
+static void k_mdb_frame(uint32_t n, void *arg) {
+	const frame_feed_t *frame = arg;
+	s_feed = *frame;
+	for (uint32_t i = 0; i < n; i++) mdb_cashless_poll();
+}
+
+static void print_line(const char *line, void *ctx) {
+	fprintf(ctx, "%s\n", line);
+}
+
+int main(int argc, char **argv) {
+	const char *filter = NULL, *path = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "f:o:k:")) != -1) {
+		switch (opt) {
+		case 'f': filter = optarg; break;
+		case 'o': path = optarg; break;
+		case 'k': snprintf(my_passkey, sizeof(my_passkey), "%s", optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-f kernel-prefix] [-o results.json] [-k passkey]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	FILE *out = stdout;
+	if (path && (out = fopen(path, "w")) == NULL) {
+		perror(path);
+		return 1;
+	}
+
+	rpc_auth_set_key(my_passkey);
+	credit_probe_init();
+
+	hal_posix_hooks_t hooks = {
+		.mdb_read = feed_read,
+		.mdb_write = feed_write,
+		.mdb_rx_pending = feed_pending,
+	};
+	hal_posix_set_hooks(&hooks);
+	mdb_cashless_init(NULL);
+
+	static frame_feed_t poll = { s_poll, sizeof(s_poll) / sizeof(s_poll[0]), 0 };
+	static frame_feed_t setup = { s_setup, sizeof(s_setup) / sizeof(s_setup[0]), 0 };
+
+	const core_bench_kernel_t mdb[] = {
+		{ "mdb.poll", k_mdb_frame, &poll },
+		{ "mdb.setup_config", k_mdb_frame, &setup },
+	};
+	core_bench_run(filter, mdb, sizeof(mdb) / sizeof(mdb[0]), print_line, out);
+
+	if (out != stdout) fclose(out);
+	return 0;
+}
@@ -0,0 +1,612 @@
+/*
+ * core-test.c — unit tests of the firmware core, run by ctest.
+ *
+ *   core-test <case> [cashless-host]
+ *
+ * One case per ctest entry (CMakeLists.txt). Each drives one module through
+ * its public API, with the HAL hooked where it needs a clock or a UART, and
+ * checks the results against independent values: published HMAC and CRC test
+ * vectors, the MQTT-SN and MDB wire formats, counts worked out by hand. The
+ * session case runs the cashless-host binary on a scripted VMC conversation,
+ * as a VMC simulator would. Every failed check is printed; the exit status is
+ * non-zero if there was one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <sdkconfig.h>
+
+#include "hal-posix.h"
+#include "mdb-cashless.h"
+#include "eva-dts-link.h"
+#include "rpc-auth.h"
+#include "rpc-admit.h"
+#include "pax-set.h"
+#include "pax-stats.h"
+#include "mqtt-sn-packet.h"
+
+// Read by the core, as on the board (the main translation unit there).
+char my_passkey[19] = "000000000000000000";
+char my_subdomain[32] = "host";
+
+static int s_failed;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		s_failed++; \
+	} \
+} while (0)
+
+// ------------------------------------------------------------------ virtual clock
+
+static int64_t s_now_us;
+static int64_t s_time_s = 1700000000;
+static int s_slack_s;
+
+static int64_t clock_now_us(void *ctx) { return s_now_us; }
+static int64_t clock_time_s(void *ctx) { return s_time_s; }
+static int clock_slack_s(void *ctx) { return s_slack_s; }
+
+static void use_virtual_clock(void) {
+	hal_posix_hooks_t hooks = {
+		.now_us = clock_now_us,
+		.time_s = clock_time_s,
+		.time_slack_s = clock_slack_s,
+	};
+	hal_posix_set_hooks(&hooks);
+}
+
+// ------------------------------------------------------------------ rpc-auth
+
+static void test_rpc_auth(void) {
+	// Known answer: HMAC-SHA256("key", "The quick brown fox jumps over the lazy dog").
+	static const char fox[] = "The quick brown fox jumps over the lazy dog";
+	static const char fox_hex[] = "f7bc83f430538424b13298e6aa6fb143ef4d59a14946175997479dbc2d1a3cd8";
+
+	rpc_auth_set_key("key");
+	CHECK(rpc_auth_has_key());
+
+	unsigned char mac[32];
+	calculate_hmac(fox, strlen(fox), mac);
+	CHECK(memcmp(mac, "\xf7\xbc\x83\xf4\x30\x53\x84\x24\xb1\x32\x98\xe6\xaa\x6f\xb1\x43"
+	                  "\xef\x4d\x59\xa1\x49\x46\x17\x59\x97\x47\x9d\xbc\x2d\x1a\x3c\xd8", 32) == 0);
+
+	CHECK(rpc_verify_hmac(fox, strlen(fox), fox_hex));
+	CHECK(!rpc_verify_hmac(fox, strlen(fox) - 1, fox_hex));
+	CHECK(!rpc_verify_hmac(fox, strlen(fox), "F7BC83F430538424B13298E6AA6FB143EF4D59A14946175997479DBC2D1A3CD8"));
+	CHECK(!rpc_verify_hmac(fox, strlen(fox), "f7bc83f4"));
+	CHECK(!rpc_verify_hmac(fox, strlen(fox), ""));
+
+	// Sign, then verify with the device passkey.
+	rpc_auth_set_key(my_passkey);
+
+	char line[160];
+	rpc_sign_text("150:7:1700000000", line, sizeof(line));
+	CHECK(strlen(line) == 16 + 1 + 64);
+	CHECK(strncmp(line, "150:7:1700000000:", 17) == 0);
+	CHECK(rpc_verify_hmac(line, 16, line + 17));
+	CHECK(!rpc_verify_hmac("150:7:1700000001", 16, line + 17));
+
+	// The BLE payload tag: 4 bytes of the HMAC over the first 15.
+	uint8_t payload[19];
+	ble_encode_with_passkey(0x0a, 150, 7, payload);
+	CHECK(payload[0] == 0x0a);
+	CHECK(read_u32(&payload[1]) == 150);
+	CHECK(read_u16(&payload[5]) == 7);
+	CHECK(ble_payload_verify(payload));
+	payload[6] ^= 1;
+	CHECK(!ble_payload_verify(payload));
+}
+
+// ------------------------------------------------------------------ rpc-admit
+
+static bool fake_fleet_verify(const char *topic, const char *msg, size_t msg_len, const char *sig_hex) {
+	return strcmp(topic, "fleet.vmflow.xyz/f1/rpc") == 0 && strcmp(sig_hex, "goodsig") == 0;
+}
+
+static void test_rpc_admit(void) {
+	use_virtual_clock();
+	rpc_auth_set_key(my_passkey);
+	rpc_admit_init(NULL);
+
+	char prefix[96], msg[192];
+	rpc_request_t req;
+	uint32_t jitter = 99;
+
+	// A signed unicast request.
+	snprintf(prefix, sizeof(prefix), "credit:150:%lld", (long long) s_time_s);
+	rpc_sign_text(prefix, msg, sizeof(msg));
+
+	CHECK(rpc_admit_parse("", msg, &req, &jitter) == RPC_ADMIT_OK);
+	CHECK(strcmp(req.cmd, "credit") == 0);
+	CHECK(strcmp(req.args, "150") == 0);
+	CHECK(req.ts == (uint32_t) s_time_s);
+	CHECK(jitter == 0);
+	CHECK(strlen(req.corr) == 8 && strncmp(req.corr, strrchr(msg, ':') + 1, 8) == 0);
+
+	// Anything changed under the HMAC, or not signed at all.
+	msg[7] = '9';
+	CHECK(rpc_admit_parse("", msg, &req, &jitter) == RPC_ADMIT_BAD_SIGNATURE);
+	CHECK(rpc_admit_parse("", "credit", &req, &jitter) == RPC_ADMIT_MALFORMED);
+
+	// Signed, but without a timestamp.
+	rpc_sign_text("credit", msg, sizeof(msg));
+	CHECK(rpc_admit_parse("", msg, &req, &jitter) == RPC_ADMIT_MALFORMED);
+
+	// Broadcasts: refused without a verifier, need the jitter field with one.
+	snprintf(msg, sizeof(msg), "ota:-:%lld:30:goodsig", (long long) s_time_s);
+	CHECK(rpc_admit_parse("fleet.vmflow.xyz/f1/rpc", msg, &req, &jitter) == RPC_ADMIT_BAD_SIGNATURE);
+
+	rpc_admit_init(fake_fleet_verify);
+	CHECK(rpc_admit_parse("fleet.vmflow.xyz/f1/rpc", msg, &req, &jitter) == RPC_ADMIT_OK);
+	CHECK(strcmp(req.cmd, "ota") == 0 && jitter == 30);
+	CHECK(strcmp(req.corr, "goodsig") == 0);
+	CHECK(rpc_admit_parse("fleet.vmflow.xyz/f1/g2/rpc", msg, &req, &jitter) == RPC_ADMIT_BAD_SIGNATURE);
+
+	snprintf(msg, sizeof(msg), "ota:-:%lld:goodsig", (long long) s_time_s);
+	CHECK(rpc_admit_parse("fleet.vmflow.xyz/f1/rpc", msg, &req, &jitter) == RPC_ADMIT_MALFORMED);
+
+	// Freshness: RPC_FRESHNESS_SEC either way, widened by the clock's slack.
+	uint32_t now = (uint32_t) s_time_s;
+
+	s_slack_s = -1;
+	CHECK(rpc_admit_fresh(now) == RPC_ADMIT_NO_CLOCK);
+
+	s_slack_s = 0;
+	CHECK(rpc_admit_fresh(now) == RPC_ADMIT_OK);
+	CHECK(rpc_admit_fresh(now - RPC_FRESHNESS_SEC) == RPC_ADMIT_OK);
+	CHECK(rpc_admit_fresh(now + RPC_FRESHNESS_SEC) == RPC_ADMIT_OK);
+	CHECK(rpc_admit_fresh(now - RPC_FRESHNESS_SEC - 1) == RPC_ADMIT_STALE);
+	CHECK(rpc_admit_fresh(now + RPC_FRESHNESS_SEC + 1) == RPC_ADMIT_STALE);
+
+	s_slack_s = HAL_TIME_SLACK_MAX_S;
+	CHECK(rpc_admit_fresh(now - RPC_FRESHNESS_SEC - HAL_TIME_SLACK_MAX_S) == RPC_ADMIT_OK);
+	CHECK(rpc_admit_fresh(now - RPC_FRESHNESS_SEC - HAL_TIME_SLACK_MAX_S - 1) == RPC_ADMIT_STALE);
+	s_slack_s = 0;
+
+	// Run once: a request is remembered for as long as it can be fresh.
+	rpc_admit_init(NULL);
+	CHECK(rpc_admit_once("0000abcd") == RPC_ADMIT_OK);
+	CHECK(rpc_admit_once("0000abcd") == RPC_ADMIT_REPEATED);
+
+	char corr[9];
+	for (int i = 1; i < RPC_SEEN_MAX; i++) {
+		snprintf(corr, sizeof(corr), "%08x", i);
+		CHECK(rpc_admit_once(corr) == RPC_ADMIT_OK);
+	}
+	CHECK(rpc_admit_once("ffffffff") == RPC_ADMIT_BUSY);
+	CHECK(rpc_admit_once("0000abcd") == RPC_ADMIT_REPEATED);
+
+	int64_t hold_us = 2LL * (RPC_FRESHNESS_SEC + HAL_TIME_SLACK_MAX_S) * 1000000;
+	s_now_us += hold_us - 1;
+	CHECK(rpc_admit_once("ffffffff") == RPC_ADMIT_BUSY);
+	s_now_us += 1;
+	CHECK(rpc_admit_once("ffffffff") == RPC_ADMIT_OK);
+	CHECK(rpc_admit_once("ffffffff") == RPC_ADMIT_REPEATED);
+
+	// Reply tags: a suffix, or a member of a JSON object.
+	char reply[64] = "ok";
+	rpc_admit_tag_reply(reply, sizeof(reply), "0123abcd");
+	CHECK(strcmp(reply, "ok:0123abcd") == 0);
+
+	strcpy(reply, "{\"a\":1}");
+	rpc_admit_tag_reply(reply, sizeof(reply), "0123abcd");
+	CHECK(strcmp(reply, "{\"a\":1,\"corr\":\"0123abcd\"}") == 0);
+
+	strcpy(reply, "{}");
+	rpc_admit_tag_reply(reply, sizeof(reply), "0123abcd");
+	CHECK(strcmp(reply, "{\"corr\":\"0123abcd\"}") == 0);
+
+	char tight[8 + RPC_TAG_MAX] = "{\"a\":1}";
+	rpc_admit_tag_reply(tight, sizeof(tight), "0123abcd");
+	CHECK(strcmp(tight, "{\"a\":1,\"corr\":\"0123abcd\"}") == 0);
+
+	// Stock argument parsers.
+	rpc_arg_t arg;
+	CHECK(rpc_arg_int("42", &arg) && arg.num == 42);
+	CHECK(rpc_arg_int("-5", &arg) && arg.num == -5);
+	CHECK(!rpc_arg_int("4x", &arg));
+	CHECK(!rpc_arg_int("", &arg));
+	CHECK(rpc_arg_text("-", &arg) && arg.text == NULL);
+	CHECK(rpc_arg_text("", &arg) && arg.text == NULL);
+	CHECK(rpc_arg_text("mqtt", &arg) && strcmp(arg.text, "mqtt") == 0);
+
+	hal_posix_set_hooks(NULL);
+}
+
+// ------------------------------------------------------------------ pax-set, pax-stats
+
+static void phone(uint8_t addr[6], uint32_t i) {
+	addr[0] = 0x42;
+	addr[1] = 0x17;
+	addr[2] = i >> 24;
+	addr[3] = i >> 16;
+	addr[4] = i >> 8;
+	addr[5] = i;
+}
+
+static void test_pax(void) {
+	static pax_set_t set;
+	uint8_t addr[6];
+
+	// Exact while the set is at most 3/4 full.
+	pax_set_reset(&set, 0x5eed);
+	CHECK(pax_set_count(&set) == 0);
+
+	uint32_t exact = PAX_SET_SLOTS * 3 / 4;
+	uint32_t fresh = 0;
+	for (uint32_t i = 0; i < exact; i++) {
+		phone(addr, i);
+		fresh += pax_set_add(&set, addr);
+	}
+	CHECK(fresh == exact);
+	CHECK(pax_set_count(&set) == exact);
+	CHECK(!set.full);
+
+	fresh = 0;
+	for (uint32_t i = 0; i < exact; i++) {
+		phone(addr, i);
+		fresh += pax_set_add(&set, addr);
+	}
+	CHECK(fresh == 0);
+	CHECK(pax_set_count(&set) == exact);
+
+	// Past that the sketch counts: within 3.5 standard errors of 5000.
+	for (uint32_t i = exact; i < 5000; i++) {
+		phone(addr, i);
+		pax_set_add(&set, addr);
+	}
+	uint32_t estimate = pax_set_count(&set);
+	CHECK(set.full);
+	CHECK(estimate > 5000 * 84 / 100 && estimate < 5000 * 116 / 100);
+
+	pax_set_reset(&set, 0x5eed + 1);
+	CHECK(pax_set_count(&set) == 0 && !set.full);
+
+	// One window: A near in slots 0-1, B mid in slots 0 and 2 (a return), C far in slot 0 only.
+	static pax_stats_t stats;
+	uint8_t a[6], b[6], c[6];
+	phone(a, 1);
+	phone(b, 2);
+	phone(c, 3);
+
+	pax_stats_reset(&stats, 0xfeed);
+	pax_stats_begin_scan(&stats, 0);
+	pax_stats_add(&stats, a, -50);
+	pax_stats_add(&stats, a, -52);
+	pax_stats_add(&stats, b, -70);
+	pax_stats_add(&stats, c, -90);
+	pax_stats_end_scan(&stats, 3500);
+
+	// A boosted scan, then a passive one.
+	pax_stats_begin_scan(&stats, 1);
+	pax_stats_add(&stats, a, -55);
+	pax_stats_end_scan(&stats, 14000);
+
+	pax_stats_begin_scan(&stats, 2);
+	pax_stats_add(&stats, b, -70);
+	pax_stats_end_scan(&stats, 1750);
+
+	CHECK(pax_stats_unique(&stats) == 3);
+	CHECK(pax_stats_radio_ms(&stats) == 19250);
+
+	char expect[320] = "3,1,1/1/1/0/0,1/1/1/3500,1/0/0/14000,0/1/0/1750";
+	for (int s = 3; s < PAX_SLOTS; s++) strcat(expect, ",0/0/0/0");
+
+	char line[320];
+	int n = pax_stats_format(&stats, line, sizeof(line));
+	CHECK(n == (int) strlen(expect));
+	CHECK(strcmp(line, expect) == 0);
+}
+
+// ------------------------------------------------------------------ mqtt-sn-packet
+
+static void test_mqtt_sn(void) {
+	uint8_t buf[512];
+	mqttsn_packet_t p, q;
+
+	// CONNECT: length, type, flags, protocol id, duration, client id.
+	p = (mqttsn_packet_t) { .type = MQTTSN_CONNECT, .flags = MQTTSN_FLAG_CLEAN, .duration = 60,
+		.data = (const uint8_t *) "vmflow-x", .data_len = 8 };
+	size_t n = mqttsn_encode(buf, sizeof(buf), &p);
+	CHECK(n == 14);
+	CHECK(memcmp(buf, "\x0e\x04\x04\x01\x00\x3c" "vmflow-x", 14) == 0);
+
+	CHECK(mqttsn_decode(buf, n, &q));
+	CHECK(q.type == MQTTSN_CONNECT && q.flags == MQTTSN_FLAG_CLEAN && q.duration == 60);
+	CHECK(q.data_len == 8 && memcmp(q.data, "vmflow-x", 8) == 0);
+
+	// PUBLISH on a predefined topic, round trip.
+	p = (mqttsn_packet_t) { .type = MQTTSN_PUBLISH, .flags = MQTTSN_FLAG_QOS1 | MQTTSN_TOPIC_PREDEFINED,
+		.topic_id = 3, .msg_id = 0x1234, .data = (const uint8_t *) "150:7", .data_len = 5 };
+	n = mqttsn_encode(buf, sizeof(buf), &p);
+	CHECK(n == 12);
+	CHECK(memcmp(buf, "\x0c\x0c\x21\x00\x03\x12\x34" "150:7", 12) == 0);
+
+	CHECK(mqttsn_decode(buf, n, &q));
+	CHECK(q.type == MQTTSN_PUBLISH && q.flags == p.flags && q.topic_id == 3 && q.msg_id == 0x1234);
+	CHECK(q.data == buf + 7 && q.data_len == 5);
+
+	CHECK(mqttsn_encode(buf, 11, &p) == 0);
+
+	// A datagram over 255 bytes takes the 3-byte length.
+	static uint8_t big[300];
+	memset(big, 'x', sizeof(big));
+	p.data = big;
+	p.data_len = sizeof(big);
+	n = mqttsn_encode(buf, sizeof(buf), &p);
+	CHECK(n == 3 + 6 + sizeof(big));
+	CHECK(buf[0] == 0x01 && buf[1] == (n >> 8) && buf[2] == (n & 0xff) && buf[3] == MQTTSN_PUBLISH);
+	CHECK(mqttsn_decode(buf, n, &q));
+	CHECK(q.data_len == sizeof(big) && q.msg_id == 0x1234);
+
+	// PUBACK carries the rc and no data.
+	p = (mqttsn_packet_t) { .type = MQTTSN_PUBACK, .topic_id = 3, .msg_id = 0x1234, .rc = MQTTSN_RC_INVALID_TOPIC };
+	n = mqttsn_encode(buf, sizeof(buf), &p);
+	CHECK(n == 7);
+	CHECK(mqttsn_decode(buf, n, &q));
+	CHECK(q.type == MQTTSN_PUBACK && q.topic_id == 3 && q.msg_id == 0x1234 && q.rc == MQTTSN_RC_INVALID_TOPIC);
+
+	// Malformed: the length field disagrees with the datagram, or nothing to read.
+	CHECK(!mqttsn_decode(buf, n - 1, &q));
+	buf[0] = 20;
+	CHECK(!mqttsn_decode(buf, n, &q));
+	CHECK(!mqttsn_decode(buf, 1, &q));
+}
+
+// ------------------------------------------------------------------ eva-dts-link
+
+typedef struct {
+	const uint8_t *rx;
+	size_t rx_len, rx_pos;
+	uint8_t tx[256];
+	size_t tx_len;
+	uint8_t audit[256];
+	size_t audit_len;
+} dex_vmc_t;
+
+static int dex_uart_read(void *data, size_t len, uint32_t timeout_ms, void *ctx) {
+	dex_vmc_t *vmc = ctx;
+	if (timeout_ms == 0) return 0;     // the input flush: nothing stale on the line
+
+	size_t n = vmc->rx_len - vmc->rx_pos < len ? vmc->rx_len - vmc->rx_pos : len;
+	memcpy(data, vmc->rx + vmc->rx_pos, n);
+	vmc->rx_pos += n;
+	return (int) n;
+}
+
+static int dex_uart_write(const void *data, size_t len, void *ctx) {
+	dex_vmc_t *vmc = ctx;
+	if (vmc->tx_len + len <= sizeof(vmc->tx)) memcpy(vmc->tx + vmc->tx_len, data, len);
+	vmc->tx_len += len;
+	return (int) len;
+}
+
+static void dex_sink(const uint8_t *data, size_t len, void *ctx) {
+	dex_vmc_t *vmc = ctx;
+	if (vmc->audit_len + len <= sizeof(vmc->audit)) memcpy(vmc->audit + vmc->audit_len, data, len);
+	vmc->audit_len += len;
+}
+
+// CRC-16/ARC, bit by bit, to check calc_crc_16 against.
+static uint16_t crc16_arc(const uint8_t *data, size_t len) {
+	uint16_t crc = 0;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return crc;
+}
+
+static void test_eva_dts(void) {
+	uint16_t crc = 0;
+	for (const char *c = "123456789"; *c; c++) calc_crc_16(&crc, (char *) c);
+	CHECK(crc == 0xBB3D);
+
+	// The VMC's side of a DEX/UCS read: both handshakes, then the audit in two blocks.
+	static const char vmc_side[] =
+		"\x10" "0"                              // DLE 0
+		"\x10" "1"                              // DLE 1
+		"\x05"                                  // ENQ
+		"\x10\x01" "00" "1234567890" "R00L06"   // DLE SOH, response code, communication id, revision & level
+		"\x10\x03" "\x00\x00"                   // DLE ETX, CRC
+		"\x04"                                  // EOT
+		"\x05"                                  // ENQ: the audit is ready
+		"\x10\x02" "DXS*VMF0000001*VA*V0/6*1\r\n" "\x10\x17" "\x00\x00"
+		"\x10\x02" "DXE*1*1\r\n" "\x10\x03" "\x00\x00"
+		"\x04";
+
+	static dex_vmc_t vmc;
+	vmc.rx = (const uint8_t *) vmc_side;
+	vmc.rx_len = sizeof(vmc_side) - 1;
+
+	hal_posix_hooks_t hooks = { .uart_read = dex_uart_read, .uart_write = dex_uart_write, .ctx = &vmc };
+	hal_posix_set_hooks(&hooks);
+	eva_dts_read_dex(dex_sink, &vmc);
+	hal_posix_set_hooks(NULL);
+
+	static const char audit[] = "DXS*VMF0000001*VA*V0/6*1\r\nDXE*1*1\r\n";
+	CHECK(vmc.audit_len == sizeof(audit) - 1);
+	CHECK(memcmp(vmc.audit, audit, sizeof(audit) - 1) == 0);
+	CHECK(vmc.rx_pos == vmc.rx_len);
+
+	// ENQ, DLE SOH, the request, DLE ETX and its CRC (over the request and ETX).
+	static const char request[] = "1234567890RR00L06\x03";
+	uint16_t want = crc16_arc((const uint8_t *) request, sizeof(request) - 1);
+
+	CHECK(vmc.tx_len == 35);
+	CHECK(memcmp(vmc.tx, "\x05\x10\x01" "1234567890RR00L06" "\x10\x03", 22) == 0);
+	CHECK(vmc.tx[22] == (want & 0xff) && vmc.tx[23] == (want >> 8));
+
+	// EOT, DLE 0 / DLE 1 of the second handshake, then one DLE 0/1 per block and for the end.
+	CHECK(memcmp(vmc.tx + 24, "\x04" "\x10\x30" "\x10\x31" "\x10\x30" "\x10\x31" "\x10\x30", 11) == 0);
+}
+
+// ------------------------------------------------------------------ MDB session through cashless-host
+
+#define ADDR    CONFIG_CASHLESS_DEVICE_ADDRESS
+
+typedef struct {
+	uint16_t w[256];
+	size_t n;
+} words_t;
+
+// A VMC frame: the command with the mode bit, its data, the checksum.
+static void vmc_frame(words_t *f, uint8_t cmd, const uint8_t *data, size_t len) {
+	uint8_t sum = ADDR | cmd;
+	f->w[f->n++] = BIT_MODE_SET | ADDR | cmd;
+	for (size_t i = 0; i < len; i++) {
+		f->w[f->n++] = data[i];
+		sum += data[i];
+	}
+	f->w[f->n++] = sum;
+}
+
+// The reader's answer: its data, then the checksum with the mode bit (a bare ACK without data).
+static void reader_reply(words_t *r, const uint8_t *data, size_t len) {
+	uint8_t sum = 0;
+	for (size_t i = 0; i < len; i++) {
+		r->w[r->n++] = data[i];
+		sum += data[i];
+	}
+	r->w[r->n++] = BIT_MODE_SET | sum;
+}
+
+static size_t read_all(int fd, void *buf, size_t size) {
+	size_t got = 0;
+	ssize_t n;
+	while (got < size && (n = read(fd, (uint8_t *) buf + got, size - got)) > 0) got += n;
+	return got;
+}
+
+static void test_session(const char *cashless_host) {
+	words_t frames = { 0 }, want = { 0 };
+
+	vmc_frame(&frames, RESET, NULL, 0);
+	reader_reply(&want, NULL, 0);
+
+	vmc_frame(&frames, POLL, NULL, 0);
+	reader_reply(&want, (const uint8_t[]) { 0x00 }, 1);                                  // JUST RESET
+
+	vmc_frame(&frames, SETUP, (const uint8_t[]) { CONFIG_DATA, 3, 32, 2, 0 }, 5);
+	reader_reply(&want, (const uint8_t[]) { 0x01, 1, CONFIG_MDB_CURRENCY_CODE >> 8, CONFIG_MDB_CURRENCY_CODE & 0xff,
+		CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES, 3, 0b00001001 }, 8);       // READER CONFIG
+
+	vmc_frame(&frames, SETUP, (const uint8_t[]) { MAX_MIN_PRICES, 0xff, 0xff, 0x00, 0x00 }, 5);
+	reader_reply(&want, NULL, 0);
+
+	vmc_frame(&frames, READER, (const uint8_t[]) { READER_ENABLE }, 1);
+	reader_reply(&want, NULL, 0);
+
+	vmc_frame(&frames, POLL, NULL, 0);
+	reader_reply(&want, (const uint8_t[]) { 0x03, 0x00, 200 }, 3);                       // BEGIN SESSION, funds 200
+
+	vmc_frame(&frames, VEND, (const uint8_t[]) { VEND_REQUEST, 0x00, 150, 0x00, 7 }, 5);
+	reader_reply(&want, NULL, 0);
+
+	vmc_frame(&frames, POLL, NULL, 0);
+	reader_reply(&want, (const uint8_t[]) { 0x05, 0x00, 150 }, 3);                       // VEND APPROVED
+
+	vmc_frame(&frames, VEND, (const uint8_t[]) { VEND_SUCCESS, 0x00, 7 }, 3);
+	reader_reply(&want, NULL, 0);
+
+	vmc_frame(&frames, VEND, (const uint8_t[]) { SESSION_COMPLETE }, 1);
+	reader_reply(&want, NULL, 0);
+
+	vmc_frame(&frames, POLL, NULL, 0);
+	reader_reply(&want, (const uint8_t[]) { 0x07 }, 1);                                  // END SESSION
+
+	vmc_frame(&frames, VEND, (const uint8_t[]) { CASH_SALE, 0x00, 100, 0x00, 3 }, 5);
+	reader_reply(&want, NULL, 0);
+
+	// Frames for another device on the bus are not answered.
+	frames.w[frames.n++] = BIT_MODE_SET | 0x08 | POLL;
+	frames.w[frames.n++] = 0x08 | POLL;
+
+	int in[2], out[2], err[2];
+	if (pipe(in) != 0 || pipe(out) != 0 || pipe(err) != 0) {
+		perror("pipe");
+		s_failed++;
+		return;
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		dup2(err[1], STDERR_FILENO);
+		close(in[1]);
+		close(out[0]);
+		close(err[0]);
+		execl(cashless_host, cashless_host, "-c", "200", (char *) NULL);
+		_exit(127);
+	}
+	close(in[0]);
+	close(out[1]);
+	close(err[1]);
+
+	uint8_t le[2 * 256];
+	for (size_t i = 0; i < frames.n; i++) {
+		le[2 * i] = frames.w[i];
+		le[2 * i + 1] = frames.w[i] >> 8;
+	}
+	CHECK(write(in[1], le, 2 * frames.n) == (ssize_t) (2 * frames.n));
+	close(in[1]);
+
+	size_t got = read_all(out[0], le, sizeof(le));
+	static char log[8192];
+	size_t log_len = read_all(err[0], log, sizeof(log) - 1);
+	log[log_len] = '\0';
+	close(out[0]);
+	close(err[0]);
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	CHECK(got == 2 * want.n);
+	for (size_t i = 0; i < want.n && 2 * i + 1 < got; i++) {
+		uint16_t w = le[2 * i] | le[2 * i + 1] << 8;
+		if (w != want.w[i]) fprintf(stderr, "reply word %zu: %03x, want %03x\n", i, w, want.w[i]);
+		CHECK(w == want.w[i]);
+	}
+
+	CHECK(strstr(log, "reader enabled\n") != NULL);
+
+	// The cash sale, published as a signed "<price>:<item>:<ts>:<hmac>" line.
+	rpc_auth_set_key(my_passkey);
+	const char *sale = strstr(log, "money domain.vmflow.xyz/host/sale ");
+	CHECK(sale != NULL);
+	if (sale) {
+		sale = strchr(sale, ' ') + 1;
+		sale = strchr(sale, ' ') + 1;
+
+		char line[160];
+		snprintf(line, sizeof(line), "%.*s", (int) strcspn(sale, "\n"), sale);
+		char *sig = strrchr(line, ':');
+		CHECK(strncmp(line, "100:3:", 6) == 0);
+		CHECK(sig && rpc_verify_hmac(line, sig - line, sig + 1));
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *name = argc > 1 ? argv[1] : "";
+
+	if (strcmp(name, "rpc-auth") == 0) test_rpc_auth();
+	else if (strcmp(name, "rpc-admit") == 0) test_rpc_admit();
+	else if (strcmp(name, "pax") == 0) test_pax();
+	else if (strcmp(name, "mqtt-sn") == 0) test_mqtt_sn();
+	else if (strcmp(name, "eva-dts") == 0) test_eva_dts();
+	else if (strcmp(name, "session") == 0 && argc > 2) test_session(argv[2]);
+	else {
+		fprintf(stderr, "usage: %s rpc-auth|rpc-admit|pax|mqtt-sn|eva-dts|session <cashless-host>\n", argv[0]);
+		return 2;
+	}
+
+	if (s_failed) fprintf(stderr, "%s: %d check(s) failed\n", name, s_failed);
+	return s_failed ? 1 : 0;
+}
@@ -0,0 +1,1395 @@
+/*
+ * fleet-load.c — a fleet of virtual vending machines against the broker and the backend.
+ *
+ * Every virtual device holds its own MQTT connection and speaks the board's wire
+ * protocol through the firmware's own code: the sale and vend_fail lines come from
+ * mdb_sale_line() / mdb_vend_fail_line(), the PAX report from pax-stats, every
+ * signature from rpc-auth and the credit latency line from credit-probe, all on the
+ * POSIX HAL with the device's passkey, subdomain and clock swapped in around each
+ * call. Per device:
+ *
+ *   connect   client id "vmflow-<sub>", persistent session, LWT "offline" (retained)
+ *             on .../status; subscribe <sub>.vmflow.xyz/rpc, then "online,1" on .../status
+ *   clock     --skew: off by up to +-N s; --unsynced: that fraction boots at 0 and asks
+ *             .../time until the backend's signed "time:<nonce>:<now>" sets it
+ *   sales     Poisson at --sales-per-hour, --fail-ratio of them on .../vend_fail
+ *   pax, dex  every --pax-s / --dex-s, the first one at a random offset
+ *   RPCs      verified and answered as rpc-exec.c does: echo, info, credit (a simulated
+ *             session that ends with a .../latency line), oos, buzzer and time
+ *
+ * One more connection, the observer, subscribes domain.vmflow.xyz/+/# as the backend
+ * does, times every device publish from send to delivery, and sends signed RPCs
+ * (--rpc-rate, --rpc-mix) whose replies it times the same way. --storm-every drops
+ * --storm-frac of the fleet without a DISCONNECT, so the broker fires the wills, and
+ * the devices come back within --reconnect-ms.
+ *
+ * Subdomains count up from --first-sub and the passkeys derive from --seed; the
+ * backend verifies the devices once --seed-sql's rows are in public.embedded.
+ * Without it, everything but the time path runs against the broker alone.
+ *
+ *   fleet-load -n 2000 -d 300 --sales-per-hour 30 --rpc-rate 20 --storm-every 60
+ *   fleet-load -n 2000 --seed-sql | psql ...
+ */
+#define _GNU_SOURCE     /* memrchr */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "hal-posix.h"
+#include "mdb-cashless.h"
+#include "credit-probe.h"
+#include "pax-stats.h"
+#include "rpc-auth.h"
+
+#define FRESHNESS_SEC       10      /* RPC_FRESHNESS_SEC (rpc-admit.h), FRESHNESS_SEC in mqtt_domain.py */
+#define PEND_MAX            8       /* uplinks per device waiting for the observer */
+#define RPC_PEND_MAX        4       /* RPCs per device waiting for a reply */
+#define TIME_RETRY_US       (10 * 1000000LL)
+#define MQTT_RX_MAX         (1024 * 1024)  /* largest packet taken from the broker */
+
+// Read by the core, as on the board (the main translation unit there); set per device around each call.
+char my_passkey[19];
+char my_subdomain[32];
+
+// ------------------------------------------------------------------ options
+
+static struct {
+	const char *host;
+	const char *port;
+	uint32_t devices;
+	uint32_t duration_s;
+	uint32_t first_sub;
+	uint64_t seed;
+	double connect_rate;
+	uint32_t keepalive_s;
+	double sales_per_hour;
+	double fail_ratio;
+	uint32_t pax_s;
+	uint32_t pax_phones;
+	uint32_t dex_s;
+	uint32_t dex_bytes;
+	uint32_t skew_s;
+	double unsynced;
+	double rpc_rate;
+	const char *rpc_mix;
+	uint32_t storm_every_s;
+	double storm_frac;
+	uint32_t reconnect_ms;
+	uint32_t timeout_ms;
+	uint32_t report_s;
+	const char *json;
+	bool seed_sql;
+} s_opt = {
+	.host = "localhost", .port = "1883", .devices = 100, .duration_s = 60, .first_sub = 100000,
+	.seed = 1, .connect_rate = 200, .keepalive_s = 120, .sales_per_hour = 6, .fail_ratio = 0.02,
+	.pax_phones = 20, .dex_bytes = 4096, .rpc_rate = 1, .rpc_mix = "echo=6,info=2,credit=2",
+	.storm_frac = 0.1, .reconnect_ms = 10000, .timeout_ms = 5000, .report_s = 10,
+};
+
+// ------------------------------------------------------------------ latency series
+
+typedef enum {
+	S_CONNACK = 0,
+	S_STATUS, S_SALE, S_VEND_FAIL, S_PAX, S_DEX, S_LATENCY, S_TIME_REQ,    /* uplinks, as the observer sees them */
+	S_LWT,
+	S_RPC_ECHO, S_RPC_INFO, S_RPC_CREDIT, S_RPC_OOS, S_RPC_BUZZER,         /* RPC round trips */
+	S_BACKEND_TIME,
+	S_MAX
+} series_id_t;
+
+#define S_UPLINK_FIRST  S_STATUS
+#define S_UPLINK_LAST   S_TIME_REQ
+#define S_RPC_FIRST     S_RPC_ECHO
+#define S_RPC_LAST      S_RPC_BUZZER
+
+typedef struct {
+	const char *name;
+	const char *topic;          /* subtopic under domain.vmflow.xyz/<sub>/ (uplinks, RPC replies) */
+	const char *cmd;            /* RPC command */
+	uint32_t *us;
+	size_t n, cap;
+	size_t mark;                /* first sample of the current report window */
+	uint64_t sent, timeouts;
+} series_t;
+
+static series_t s_series[S_MAX] = {
+	[S_CONNACK]      = { "connack" },
+	[S_STATUS]       = { "status",      "status" },
+	[S_SALE]         = { "sale",        "sale" },
+	[S_VEND_FAIL]    = { "vend_fail",   "vend_fail" },
+	[S_PAX]          = { "paxcounter",  "paxcounter" },
+	[S_DEX]          = { "dex",         "rpc/dex" },
+	[S_LATENCY]      = { "latency",     "latency" },
+	[S_TIME_REQ]     = { "time",        "time" },
+	[S_LWT]          = { "lwt" },
+	[S_RPC_ECHO]     = { "rpc.echo",    "rpc/echo",    "echo" },
+	[S_RPC_INFO]     = { "rpc.info",    "rpc/info",    "info" },
+	[S_RPC_CREDIT]   = { "rpc.credit",  "rpc/confirm", "credit" },
+	[S_RPC_OOS]      = { "rpc.oos",     "rpc/confirm", "oos" },
+	[S_RPC_BUZZER]   = { "rpc.buzzer",  "rpc/confirm", "buzzer" },
+	[S_BACKEND_TIME] = { "backend.time" },
+};
+
+static void series_add(series_id_t id, int64_t us) {
+	series_t *s = &s_series[id];
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		s->us = realloc(s->us, s->cap * sizeof(*s->us));
+		if (s->us == NULL) abort();
+	}
+	s->us[s->n++] = us < 0 ? 0 : (us > UINT32_MAX ? UINT32_MAX : (uint32_t) us);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
+
+typedef struct {
+	size_t n;
+	double p50, p90, p99, max;      /* ms */
+} pct_t;
+
+// Percentiles of samples [from, s->n); sorts a copy so the series stays in arrival order.
+static pct_t series_pct(const series_t *s, size_t from) {
+	pct_t p = { .n = s->n - from };
+	if (p.n == 0) return p;
+
+	uint32_t *v = malloc(p.n * sizeof(*v));
+	if (v == NULL) abort();
+	memcpy(v, s->us + from, p.n * sizeof(*v));
+	qsort(v, p.n, sizeof(*v), cmp_u32);
+
+	p.p50 = v[(p.n - 1) * 50 / 100] / 1000.0;
+	p.p90 = v[(p.n - 1) * 90 / 100] / 1000.0;
+	p.p99 = v[(p.n - 1) * 99 / 100] / 1000.0;
+	p.max = v[p.n - 1] / 1000.0;
+	free(v);
+	return p;
+}
+
+static struct {
+	uint64_t connects, connect_fail, drops, storm_drops;
+	uint64_t published, pub_bytes, received, rx_bytes;
+	uint64_t stale_signed;          /* device lines whose ts the backend will call stale */
+	uint64_t rpc_rejected_hmac, rpc_rejected_stale, rpc_rejected_clock, rpc_busy;
+	uint64_t unmatched;
+} s_count;
+
+// ------------------------------------------------------------------ clock, random
+
+static int64_t mono_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t s_rng = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t splitmix64(uint64_t *x) {
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static double rnd(void) {
+	return (splitmix64(&s_rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t rnd_below(uint32_t n) {
+	return n ? (uint32_t) (rnd() * n) : 0;
+}
+
+// Exponential gap for a Poisson process of rate_per_s; INT64_MAX when the rate is 0.
+static int64_t poisson_gap_us(double rate_per_s) {
+	if (rate_per_s <= 0) return INT64_MAX / 2;
+	return (int64_t) (-log(1.0 - rnd()) / rate_per_s * 1e6);
+}
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len) {
+	const uint8_t *p = data;
+	for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+static uint32_t payload_hash(series_id_t id, const void *data, size_t len) {
+	uint8_t tag = (uint8_t) id;
+	return fnv1a(fnv1a(2166136261u, &tag, 1), data, len);
+}
+
+// ------------------------------------------------------------------ MQTT 3.1.1 connection
+
+enum { MQTT_CONNECT = 1, MQTT_CONNACK, MQTT_PUBLISH, MQTT_PUBACK, MQTT_SUBSCRIBE = 8, MQTT_SUBACK,
+	MQTT_PINGREQ = 12, MQTT_PINGRESP, MQTT_DISCONNECT };
+
+typedef enum { CONN_OFF, CONN_CONNECTING, CONN_CONNACK, CONN_UP } conn_state_t;
+
+struct device;
+
+typedef struct {
+	int fd;
+	conn_state_t state;
+	bool subscribed;
+	bool want_out;
+	uint16_t next_pid;
+	uint16_t sub_pid;
+	int64_t start_us;           /* connect() */
+	int64_t last_tx_us;
+	uint8_t *rx, *tx;
+	size_t rx_len, rx_cap, tx_len, tx_cap;
+	struct device *dev;         /* NULL: the observer */
+} conn_t;
+
+typedef struct {
+	uint32_t hash;
+	uint8_t series;
+	int64_t us;
+} pending_t;
+
+typedef struct {
+	char corr[9];
+	uint8_t series;
+	int64_t us;
+} rpc_pending_t;
+
+typedef struct device {
+	conn_t conn;
+	uint32_t sub;
+	char passkey[19];
+	char subdomain[12];
+	int32_t skew_s;
+	bool clock_set;
+	int64_t boot_us;
+	int64_t reconnect_us;
+	int64_t drop_us;            /* storm drop waiting for its LWT */
+	int64_t next_sale_us, next_pax_us, next_dex_us;
+	char nonce[9];
+	int64_t nonce_us;
+	pending_t pend[PEND_MAX];
+	uint8_t pend_next;
+	rpc_pending_t rpc[RPC_PEND_MAX];
+	uint8_t rpc_next;
+	credit_probe_t probe;       /* credit session in progress when probe.corr[0] */
+	credit_probe_stage_t probe_next;
+	int64_t probe_due_us;
+	uint16_t last_sale_price, last_sale_item;
+	int64_t last_vend_success_time;
+} device_t;
+
+static int s_epoll = -1;
+static struct sockaddr_storage s_addr;
+static socklen_t s_addr_len;
+
+static device_t *s_dev;
+static conn_t s_obs;
+static device_t *s_cur;             /* device the core is running for */
+static pax_stats_t s_pax;
+
+static void buf_reserve(uint8_t **buf, size_t *cap, size_t need) {
+	if (need <= *cap) return;
+	size_t cap2 = *cap ? *cap : 512;
+	while (cap2 < need) cap2 *= 2;
+	*buf = realloc(*buf, cap2);
+	if (*buf == NULL) abort();
+	*cap = cap2;
+}
+
+static void conn_epoll(conn_t *c, bool want_out) {
+	struct epoll_event ev = { .events = EPOLLIN | (want_out ? EPOLLOUT : 0), .data.ptr = c };
+	epoll_ctl(s_epoll, EPOLL_CTL_MOD, c->fd, &ev);
+	c->want_out = want_out;
+}
+
+static void conn_flush(conn_t *c) {
+	while (c->tx_len > 0) {
+		ssize_t n = send(c->fd, c->tx, c->tx_len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		memmove(c->tx, c->tx + n, c->tx_len - n);
+		c->tx_len -= n;
+	}
+	if ((c->tx_len > 0) != c->want_out) conn_epoll(c, c->tx_len > 0);
+}
+
+// Queue one packet: fixed header (type/flags, remaining length), then the parts.
+static void conn_packet(conn_t *c, uint8_t type_flags, const uint8_t *body, size_t body_len) {
+	uint8_t hdr[5];
+	size_t h = 0, rem = body_len;
+	hdr[h++] = type_flags;
+	do {
+		uint8_t b = rem & 0x7f;
+		rem >>= 7;
+		hdr[h++] = b | (rem ? 0x80 : 0);
+	} while (rem);
+
+	buf_reserve(&c->tx, &c->tx_cap, c->tx_len + h + body_len);
+	memcpy(c->tx + c->tx_len, hdr, h);
+	memcpy(c->tx + c->tx_len + h, body, body_len);
+	c->tx_len += h + body_len;
+	c->last_tx_us = mono_us();
+	if (c->state != CONN_CONNECTING) conn_flush(c);
+}
+
+static size_t put_str(uint8_t *p, const char *s, size_t len) {
+	p[0] = len >> 8;
+	p[1] = len;
+	memcpy(p + 2, s, len);
+	return 2 + len;
+}
+
+static uint16_t conn_pid(conn_t *c) {
+	if (++c->next_pid == 0) c->next_pid = 1;
+	return c->next_pid;
+}
+
+static void mqtt_connect(conn_t *c, const char *client_id, const char *will_topic, const char *will_msg, bool clean) {
+	uint8_t body[256];
+	size_t n = put_str(body, "MQTT", 4);
+	body[n++] = 4;                              /* 3.1.1 */
+	uint8_t flags = clean ? 0x02 : 0;
+	if (will_topic) flags |= 0x04 | 0x08 | 0x20;    /* will, QoS 1, retained */
+	body[n++] = flags;
+	body[n++] = s_opt.keepalive_s >> 8;
+	body[n++] = s_opt.keepalive_s;
+	n += put_str(body + n, client_id, strlen(client_id));
+	if (will_topic) {
+		n += put_str(body + n, will_topic, strlen(will_topic));
+		n += put_str(body + n, will_msg, strlen(will_msg));
+	}
+	conn_packet(c, MQTT_CONNECT << 4, body, n);
+}
+
+static void mqtt_publish(conn_t *c, const char *topic, const void *data, size_t len, int qos, bool retain) {
+	size_t tl = strlen(topic);
+	uint8_t stack[1024];
+	uint8_t *body = tl + len + 4 <= sizeof(stack) ? stack : malloc(tl + len + 4);
+	if (body == NULL) abort();
+
+	size_t n = put_str(body, topic, tl);
+	if (qos > 0) {
+		uint16_t pid = conn_pid(c);
+		body[n++] = pid >> 8;
+		body[n++] = pid;
+	}
+	memcpy(body + n, data, len);
+	n += len;
+	conn_packet(c, MQTT_PUBLISH << 4 | qos << 1 | (retain ? 1 : 0), body, n);
+	if (body != stack) free(body);
+
+	s_count.published++;
+	s_count.pub_bytes += len;
+}
+
+static void mqtt_subscribe(conn_t *c, const char *filter, int qos) {
+	uint8_t body[128];
+	c->sub_pid = conn_pid(c);
+	body[0] = c->sub_pid >> 8;
+	body[1] = c->sub_pid;
+	size_t n = 2 + put_str(body + 2, filter, strlen(filter));
+	body[n++] = qos;
+	conn_packet(c, MQTT_SUBSCRIBE << 4 | 0x02, body, n);
+}
+
+static void mqtt_puback(conn_t *c, uint16_t pid) {
+	uint8_t body[2] = { pid >> 8, pid };
+	conn_packet(c, MQTT_PUBACK << 4, body, 2);
+}
+
+static bool conn_open(conn_t *c) {
+	c->fd = socket(s_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (c->fd < 0) return false;
+
+	int one = 1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (connect(c->fd, (struct sockaddr*) &s_addr, s_addr_len) != 0 && errno != EINPROGRESS) {
+		close(c->fd);
+		c->fd = -1;
+		return false;
+	}
+
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = c };
+	epoll_ctl(s_epoll, EPOLL_CTL_ADD, c->fd, &ev);
+	c->want_out = true;
+	c->state = CONN_CONNECTING;
+	c->subscribed = false;
+	c->rx_len = c->tx_len = 0;
+	c->start_us = c->last_tx_us = mono_us();
+	return true;
+}
+
+static void conn_close(conn_t *c) {
+	if (c->fd >= 0) close(c->fd);     /* also leaves the epoll set */
+	c->fd = -1;
+	c->state = CONN_OFF;
+	c->subscribed = false;
+	c->rx_len = c->tx_len = 0;
+}
+
+// ------------------------------------------------------------------ device: the core's context
+
+static int64_t dev_time(const device_t *d) {
+	// Before the broker time reply, the board's clock counts from 0 at boot, as after a cold start.
+	if (!d->clock_set) return (mono_us() - d->boot_us) / 1000000;
+	return (int64_t) time(NULL) + d->skew_s;
+}
+
+static void dev_enter(device_t *d) {
+	s_cur = d;
+	memcpy(my_passkey, d->passkey, sizeof(my_passkey));
+	snprintf(my_subdomain, sizeof(my_subdomain), "%s", d->subdomain);
+	rpc_auth_set_key(my_passkey);
+}
+
+static void dev_expect(device_t *d, series_id_t id, const void *data, size_t len) {
+	pending_t *p = &d->pend[d->pend_next];
+	if (p->us) s_series[p->series].timeouts++;      /* overwritten before the observer saw it */
+
+	*p = (pending_t) { .hash = payload_hash(id, data, len), .series = id, .us = mono_us() };
+	d->pend_next = (d->pend_next + 1) % PEND_MAX;
+	s_series[id].sent++;
+}
+
+static series_id_t topic_series(const char *topic) {
+	const char *rest = strchr(topic, '/');
+	if (rest == NULL || (rest = strchr(rest + 1, '/')) == NULL) return S_MAX;
+	rest++;
+
+	for (int id = S_UPLINK_FIRST; id <= S_UPLINK_LAST; id++) {
+		if (strcmp(rest, s_series[id].topic) == 0) return id;
+	}
+	return S_MAX;
+}
+
+// HAL publish hook: the device's connection, QoS by class as mqtt-outbox.c assigns it.
+static bool fleet_publish(hal_pub_class_t cls, const char *topic, const char *data, int len, void *ctx) {
+	device_t *d = s_cur;
+	if (d == NULL || d->conn.state != CONN_UP) return false;
+
+	series_id_t id = topic_series(topic);
+	if (id != S_MAX) dev_expect(d, id, data, len);
+
+	// The signed lines end in ":<ts>:<hmac>"; count those the backend's freshness check will drop.
+	if (id == S_SALE || id == S_VEND_FAIL || id == S_PAX || id == S_LATENCY) {
+		const char *sig = memrchr(data, ':', len);
+		const char *ts = sig ? memrchr(data, ':', sig - data) : NULL;
+		if (ts && llabs(strtoll(ts + 1, NULL, 10) - (long long) time(NULL)) > FRESHNESS_SEC) s_count.stale_signed++;
+	}
+
+	mqtt_publish(&d->conn, topic, data, len, cls == HAL_PUB_BULK ? 0 : 1, false);
+	return true;
+}
+
+static int64_t fleet_time_s(void *ctx) {
+	return s_cur ? dev_time(s_cur) : time(NULL);
+}
+
+static void dev_topic(char *topic, size_t size, const device_t *d, const char *sub) {
+	snprintf(topic, size, "domain.vmflow.xyz/%s/%s", d->subdomain, sub);
+}
+
+// ------------------------------------------------------------------ device: traffic
+
+static void dev_schedule(device_t *d, int64_t now) {
+	d->next_sale_us = now + poisson_gap_us(s_opt.sales_per_hour / 3600.0);
+	d->next_pax_us = s_opt.pax_s ? now + (int64_t) rnd_below(s_opt.pax_s * 1000) * 1000 : INT64_MAX;
+	d->next_dex_us = s_opt.dex_s ? now + (int64_t) rnd_below(s_opt.dex_s * 1000) * 1000 : INT64_MAX;
+}
+
+static void dev_time_request(device_t *d) {
+	char topic[64];
+	dev_topic(topic, sizeof(topic), d, "time");
+	snprintf(d->nonce, sizeof(d->nonce), "%08lx", (unsigned long) (splitmix64(&s_rng) & 0xffffffff));
+	d->nonce_us = mono_us();
+	s_series[S_BACKEND_TIME].sent++;
+	hal_publish(HAL_PUB_CONTROL, topic, d->nonce, 0);
+}
+
+static void dev_sale(device_t *d) {
+	char topic[64], line[160];
+	uint16_t item = 1 + rnd_below(60);
+	uint16_t price = 100 + 50 * rnd_below(9);     /* VMC units (host sdkconfig.h: scale 1, 2 decimals) */
+
+	if (rnd() < s_opt.fail_ratio) {
+		mdb_vend_fail_line(line, sizeof(line), price, item, dev_time(d));
+		dev_topic(topic, sizeof(topic), d, "vend_fail");
+		hal_publish(HAL_PUB_MONEY, topic, line, 0);
+		return;
+	}
+
+	mdb_sale_line(line, sizeof(line), price, item, dev_time(d));
+	dev_topic(topic, sizeof(topic), d, "sale");
+	hal_publish(HAL_PUB_MONEY, topic, line, 0);
+
+	d->last_sale_price = price;
+	d->last_sale_item = item;
+	d->last_vend_success_time = dev_time(d);
+}
+
+// An hour of scans as nimble.c would fill them: a crowd of --pax-phones, some of it coming back.
+static void dev_pax(device_t *d) {
+	pax_stats_reset(&s_pax, splitmix64(&s_rng));
+
+	uint32_t regulars = s_opt.pax_phones / 3 + 1;
+	for (uint8_t slot = 0; slot < PAX_SLOTS; slot++) {
+		pax_stats_begin_scan(&s_pax, slot);
+		uint32_t seen = rnd_below(s_opt.pax_phones + 1);
+		for (uint32_t i = 0; i < seen; i++) {
+			uint64_t id = rnd() < 0.3 ? rnd_below(regulars) : splitmix64(&s_rng);
+			uint8_t addr[6] = { id, id >> 8, id >> 16, id >> 24, id >> 32, (id >> 40) | 0xc0 };
+			pax_stats_add(&s_pax, addr, (int8_t) (-45 - (int) rnd_below(50)));
+		}
+		pax_stats_end_scan(&s_pax, 3500);     // a 7 s active scan at 50% duty
+	}
+
+	char report[400], msg[432], line[512], topic[64];
+	pax_stats_format(&s_pax, report, sizeof(report));
+	snprintf(msg, sizeof(msg), "%s:%lld", report, (long long) dev_time(d));
+	rpc_sign_text(msg, line, sizeof(line));
+
+	dev_topic(topic, sizeof(topic), d, "paxcounter");
+	hal_publish(HAL_PUB_TELEMETRY, topic, line, 0);
+}
+
+// A DEX audit of about --dex-bytes: header, per-column product records, totals.
+static void dev_dex(device_t *d) {
+	size_t cap = s_opt.dex_bytes + 128;
+	char *dex = malloc(cap);
+	if (dex == NULL) abort();
+
+	size_t n = snprintf(dex, cap, "DXS*VMFLOW%s*VA*V0/6*1\r\nST*001*0001\r\nID1*%s*FLEET*0001\r\n", d->subdomain, d->subdomain);
+	for (int col = 1; n + 96 < s_opt.dex_bytes; col++) {
+		n += snprintf(dex + n, cap - n, "PA1*%d*%u\r\nPA2*%u*%u*0*0\r\n",
+			col, 100 + 50 * rnd_below(9), rnd_below(5000), rnd_below(500000));
+	}
+	n += snprintf(dex + n, cap - n, "VA1*%u*%u*0*0\r\nSE*%u*0001\r\nDXE*1*1\r\n",
+		rnd_below(9000000), rnd_below(90000), rnd_below(2000));
+
+	char topic[64];
+	dev_topic(topic, sizeof(topic), d, "rpc/dex");
+	hal_publish(HAL_PUB_BULK, topic, dex, (int) n);
+	free(dex);
+}
+
+// ------------------------------------------------------------------ device: RPCs and the credit session
+
+static void dev_reply(device_t *d, const char *reply_topic, const char *result, const char *corr) {
+	char topic[64], reply[1200];
+	dev_topic(topic, sizeof(topic), d, reply_topic);
+	size_t n = strlen(result);
+	if (n >= 2 && result[0] == '{' && result[n - 1] == '}') {
+		snprintf(reply, sizeof(reply), "%.*s,\"corr\":\"%s\"}", (int) n - 1, result, corr);     /* as rpc-exec.c */
+	} else {
+		snprintf(reply, sizeof(reply), "%s:%s", result, corr);
+	}
+	hal_publish(HAL_PUB_CONTROL, topic, reply, 0);
+}
+
+static void dev_info(const device_t *d, char *out, size_t size) {
+	snprintf(out, size,
+		"{\"version\":\"fleet-load\",\"uptime_s\":%lld,"
+		"\"free_heap\":%lu,\"min_free_heap\":%lu,\"machine_state\":%d,"
+		"\"last_sale_price\":%u,\"last_sale_item\":%u,"
+		"\"last_vend_success_time\":%lld,"
+		"\"ip_wifi\":\"10.0.0.%u\",\"ip_ppp\":\"0.0.0.0\","
+		"\"uplink\":\"wifi\",\"uplink_switches\":0,"
+		"\"rtt_wifi_ms\":%u,\"rtt_ppp_ms\":-1,"
+		"\"modem_attaches\":0,\"modem_attach_ms\":0,\"modem_attach_cold\":false,"
+		"\"modem_oper\":\"\",\"modem_band\":0,\"modem_rat\":0,"
+		"\"mqtt_transport\":\"tcp\",\"mqtt_connects\":%lu,\"mqtt_resumes\":0,\"mqtt_ready_ms\":0,"
+		"\"mqtt_offline_ms\":0,\"mqtt_reconnect_bytes\":0,"
+		"\"ota_running\":false,\"ota_pending_verify\":false,\"ota_bytes\":0,\"ota_total\":0,\"ota_attempts\":0,"
+		"\"fleet\":\"\",\"time_source\":\"%s\",\"time_uncertainty_ms\":%u,\"time_ready_ms\":0}",
+		(long long) ((mono_us() - d->boot_us) / 1000000),
+		150000ul + rnd_below(20000), 120000ul, d->probe.corr[0] ? (int) VEND_STATE : (int) ENABLED_STATE,
+		d->last_sale_price, d->last_sale_item, (long long) d->last_vend_success_time,
+		d->sub % 250 + 2, 20 + rnd_below(40), (unsigned long) s_count.connects,
+		d->clock_set ? "broker" : "none", d->clock_set ? 500u : 0u);
+}
+
+// Credit stages after QUEUED, from the VMC's side: next POLL, customer's choice, dispensing, SESSION COMPLETE.
+static int64_t probe_gap_us(credit_probe_stage_t next) {
+	switch (next) {
+	case PROBE_BEGIN:        return 25000 + rnd_below(200000);
+	case PROBE_VEND_REQUEST: return 1000000 + rnd_below(3000000);
+	case PROBE_VEND_DONE:    return 500000 + rnd_below(1500000);
+	default:                 return 100000 + rnd_below(100000);
+	}
+}
+
+static void dev_credit_step(device_t *d, int64_t now) {
+	if (d->probe.corr[0] == '\0' || now < d->probe_due_us) return;
+
+	if (d->probe_next == PROBE_VEND_DONE) credit_probe_outcome(&d->probe, rnd() < s_opt.fail_ratio ? "fail" : "vend");
+	credit_probe_mark(&d->probe, d->probe_next);
+
+	if (d->probe_next == PROBE_END) {
+		credit_probe_finish(&d->probe);
+		d->probe.corr[0] = '\0';
+		return;
+	}
+	d->probe_next++;
+	d->probe_due_us = now + probe_gap_us(d->probe_next);
+}
+
+// rpc_accept() / rpc_admit() / rpc_run() on one message from <sub>.vmflow.xyz/rpc.
+static void dev_rpc(device_t *d, const char *data, size_t len, int64_t rx_us) {
+	char msg[256];
+	if (len >= sizeof(msg)) return;
+	memcpy(msg, data, len);
+	msg[len] = '\0';
+
+	char *last_colon = strrchr(msg, ':');
+	if (last_colon == NULL) return;
+	if (!rpc_verify_hmac(msg, last_colon - msg, last_colon + 1)) {
+		s_count.rpc_rejected_hmac++;
+		return;
+	}
+
+	char corr[9], cmd[32], args[64];
+	snprintf(corr, sizeof(corr), "%.8s", last_colon + 1);
+	unsigned int ts;
+	if (sscanf(msg, "%31[^:]:%63[^:]:%u", cmd, args, &ts) < 3) return;
+
+	if (strcmp(cmd, "time") == 0) {
+		if (d->nonce[0] == '\0' || strcmp(args, d->nonce) != 0) return;
+
+		series_add(S_BACKEND_TIME, rx_us - d->nonce_us);
+		d->nonce[0] = '\0';
+		d->clock_set = true;
+		d->skew_s = (int32_t) ((int64_t) ts - time(NULL));
+		dev_schedule(d, rx_us);
+		return;
+	}
+
+	if (!d->clock_set) {
+		s_count.rpc_rejected_clock++;
+		return;
+	}
+	if (llabs(dev_time(d) - (int64_t) ts) > FRESHNESS_SEC + 1) {
+		s_count.rpc_rejected_stale++;
+		return;
+	}
+
+	char result[1100];
+	if (strcmp(cmd, "echo") == 0) {
+		snprintf(result, sizeof(result), "%u", ts);
+		dev_reply(d, "rpc/echo", result, corr);
+	} else if (strcmp(cmd, "info") == 0) {
+		dev_info(d, result, sizeof(result));
+		dev_reply(d, "rpc/info", result, corr);
+	} else if (strcmp(cmd, "credit") == 0) {
+		char *end;
+		strtol(args, &end, 10);
+		if (end == args || *end != '\0') {
+			dev_reply(d, "rpc/confirm", "error,ESP_ERR_INVALID_ARG", corr);
+		} else if (d->probe.corr[0] != '\0') {
+			s_count.rpc_busy++;
+			dev_reply(d, "rpc/confirm", "error,ESP_ERR_INVALID_STATE", corr);
+		} else {
+			credit_probe_start(&d->probe, corr, ts, rx_us, mono_us());
+			credit_probe_mark(&d->probe, PROBE_QUEUED);
+			d->probe_next = PROBE_BEGIN;
+			d->probe_due_us = mono_us() + probe_gap_us(PROBE_BEGIN);
+			dev_reply(d, "rpc/confirm", "ok", corr);
+		}
+	} else if (strcmp(cmd, "oos") == 0 || strcmp(cmd, "buzzer") == 0) {
+		dev_reply(d, "rpc/confirm", "ok", corr);
+	}
+}
+
+// ------------------------------------------------------------------ device: connection
+
+static void dev_connect(device_t *d) {
+	char client_id[32], will[64];
+	snprintf(client_id, sizeof(client_id), "vmflow-%s", d->subdomain);
+	dev_topic(will, sizeof(will), d, "status");
+
+	if (!conn_open(&d->conn)) {
+		s_count.connect_fail++;
+		d->reconnect_us = mono_us() + 1000 + rnd_below(s_opt.reconnect_ms) * 1000LL;
+		return;
+	}
+	mqtt_connect(&d->conn, client_id, will, "offline", false);
+	s_series[S_CONNACK].sent++;
+}
+
+static void dev_lost(device_t *d, bool storm) {
+	conn_close(&d->conn);
+	if (storm) {
+		s_count.storm_drops++;
+		s_series[S_LWT].sent++;
+		d->drop_us = mono_us();
+	} else {
+		s_count.drops++;
+	}
+	d->reconnect_us = mono_us() + 1000 + rnd_below(s_opt.reconnect_ms) * 1000LL;
+}
+
+static void dev_connack(device_t *d) {
+	int64_t now = mono_us();
+	series_add(S_CONNACK, now - d->conn.start_us);
+	s_count.connects++;
+
+	char topic[64], status[16];
+	snprintf(topic, sizeof(topic), "%s.vmflow.xyz/rpc", d->subdomain);
+	mqtt_subscribe(&d->conn, topic, 1);
+
+	dev_enter(d);
+	dev_topic(topic, sizeof(topic), d, "status");
+	snprintf(status, sizeof(status), "online,%d", 1);
+	dev_expect(d, S_STATUS, status, strlen(status));
+	mqtt_publish(&d->conn, topic, status, strlen(status), 1, true);
+
+	if (!d->clock_set) dev_time_request(d);
+	dev_schedule(d, now);
+}
+
+static void dev_tick(device_t *d, int64_t now) {
+	if (d->conn.state == CONN_OFF) {
+		if (now >= d->reconnect_us) dev_connect(d);
+		return;
+	}
+	if (d->conn.state == CONN_CONNECTING || d->conn.state == CONN_CONNACK) {
+		if (now - d->conn.start_us > (int64_t) s_opt.timeout_ms * 1000) {
+			s_series[S_CONNACK].timeouts++;
+			dev_lost(d, false);
+		}
+		return;
+	}
+
+	bool time_due = !d->clock_set && now - d->nonce_us > TIME_RETRY_US;
+	bool credit_due = d->probe.corr[0] != '\0' && now >= d->probe_due_us;
+	if (time_due || credit_due || now >= d->next_sale_us || now >= d->next_pax_us || now >= d->next_dex_us) dev_enter(d);
+
+	if (time_due) {
+		if (d->nonce[0]) s_series[S_BACKEND_TIME].timeouts++;
+		dev_time_request(d);
+	}
+	if (now >= d->next_sale_us) {
+		dev_sale(d);
+		d->next_sale_us = now + poisson_gap_us(s_opt.sales_per_hour / 3600.0);
+	}
+	if (now >= d->next_pax_us) {
+		dev_pax(d);
+		d->next_pax_us = now + (int64_t) s_opt.pax_s * 1000000;
+	}
+	if (now >= d->next_dex_us) {
+		dev_dex(d);
+		d->next_dex_us = now + (int64_t) s_opt.dex_s * 1000000;
+	}
+	dev_credit_step(d, now);
+
+	if (now - d->conn.last_tx_us > (int64_t) s_opt.keepalive_s * 1000000) conn_packet(&d->conn, MQTT_PINGREQ << 4, NULL, 0);
+}
+
+// ------------------------------------------------------------------ observer
+
+static struct {
+	series_id_t cmd[S_MAX];
+	uint32_t weight[S_MAX];
+	uint32_t total;
+	int count;
+} s_mix;
+
+static void mix_parse(const char *spec) {
+	char buf[128];
+	snprintf(buf, sizeof(buf), "%s", spec);
+
+	for (char *save, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		char *eq = strchr(tok, '=');
+		uint32_t w = eq ? (uint32_t) strtoul(eq + 1, NULL, 10) : 1;
+		if (eq) *eq = '\0';
+
+		series_id_t id = S_MAX;
+		for (int i = S_RPC_FIRST; i <= S_RPC_LAST; i++) {
+			if (strcmp(tok, s_series[i].cmd) == 0) id = i;
+		}
+		if (id == S_MAX || w == 0) {
+			fprintf(stderr, "--rpc-mix: unknown command '%s'\n", tok);
+			exit(2);
+		}
+		s_mix.cmd[s_mix.count] = id;
+		s_mix.weight[s_mix.count++] = w;
+		s_mix.total += w;
+	}
+}
+
+static device_t *device_by_sub(const char *sub, size_t len) {
+	char num[12];
+	if (len == 0 || len >= sizeof(num)) return NULL;
+	memcpy(num, sub, len);
+	num[len] = '\0';
+
+	char *end;
+	unsigned long v = strtoul(num, &end, 10);
+	if (*end != '\0' || v < s_opt.first_sub || v - s_opt.first_sub >= s_opt.devices) return NULL;
+	return &s_dev[v - s_opt.first_sub];
+}
+
+static void observer_send_rpc(void) {
+	device_t *d = NULL;
+	for (int tries = 0; tries < 8 && d == NULL; tries++) {
+		device_t *c = &s_dev[rnd_below(s_opt.devices)];
+		if (c->conn.state == CONN_UP && c->conn.subscribed && c->clock_set) d = c;
+	}
+	if (d == NULL || s_mix.total == 0) return;
+
+	uint32_t pick = rnd_below(s_mix.total);
+	int i = 0;
+	while (pick >= s_mix.weight[i]) pick -= s_mix.weight[i++];
+	series_id_t id = s_mix.cmd[i];
+
+	char msg[96], line[192], topic[64];
+	if (id == S_RPC_CREDIT) {
+		snprintf(msg, sizeof(msg), "credit:%u:%lld", 100 + 50 * rnd_below(9), (long long) time(NULL));
+	} else {
+		snprintf(msg, sizeof(msg), "%s:-:%lld", s_series[id].cmd, (long long) time(NULL));
+	}
+	rpc_auth_set_key(d->passkey);
+	rpc_sign_text(msg, line, sizeof(line));
+
+	rpc_pending_t *p = &d->rpc[d->rpc_next];
+	if (p->us) s_series[p->series].timeouts++;
+	snprintf(p->corr, sizeof(p->corr), "%.8s", strrchr(line, ':') + 1);
+	p->series = id;
+	p->us = mono_us();
+	d->rpc_next = (d->rpc_next + 1) % RPC_PEND_MAX;
+	s_series[id].sent++;
+
+	snprintf(topic, sizeof(topic), "%s.vmflow.xyz/rpc", d->subdomain);
+	mqtt_publish(&s_obs, topic, line, strlen(line), 1, false);
+}
+
+// A publish on domain.vmflow.xyz/<sub>/<rest>: an uplink, a will or an RPC reply.
+static void observer_publish(const char *topic, const uint8_t *data, size_t len, int64_t rx_us) {
+	const char *prefix = "domain.vmflow.xyz/";
+	if (strncmp(topic, prefix, strlen(prefix)) != 0) return;
+
+	const char *sub = topic + strlen(prefix);
+	const char *slash = strchr(sub, '/');
+	if (slash == NULL) return;
+	device_t *d = device_by_sub(sub, slash - sub);
+	if (d == NULL) return;
+	const char *rest = slash + 1;
+
+	if (strcmp(rest, "status") == 0 && len == 7 && memcmp(data, "offline", 7) == 0) {
+		if (d->drop_us) series_add(S_LWT, rx_us - d->drop_us);
+		d->drop_us = 0;
+		return;
+	}
+
+	if (strncmp(rest, "rpc/", 4) == 0 && strcmp(rest, "rpc/dex") != 0) {
+		// "<result>:<corr>", or a JSON object ending in "corr":"<corr>"}.
+		const char *corr;
+		if (len >= 18 && memcmp(data + len - 18, "\"corr\":\"", 8) == 0 && memcmp(data + len - 2, "\"}", 2) == 0) {
+			corr = (const char *) data + len - 10;
+		} else {
+			const char *colon = memrchr(data, ':', len);
+			if (colon == NULL || (size_t) (data + len - (const uint8_t*) colon - 1) != 8) return;
+			corr = colon + 1;
+		}
+
+		for (int i = 0; i < RPC_PEND_MAX; i++) {
+			rpc_pending_t *p = &d->rpc[i];
+			if (p->us == 0 || memcmp(p->corr, corr, 8) != 0) continue;
+
+			series_add(p->series, rx_us - p->us);
+			p->us = 0;
+			return;
+		}
+		s_count.unmatched++;
+		return;
+	}
+
+	series_id_t id = topic_series(topic);
+	if (id == S_MAX) return;
+
+	uint32_t h = payload_hash(id, data, len);
+	for (int i = 0; i < PEND_MAX; i++) {
+		pending_t *p = &d->pend[i];
+		if (p->us == 0 || p->hash != h) continue;
+
+		series_add(id, rx_us - p->us);
+		p->us = 0;
+		return;
+	}
+	s_count.unmatched++;
+}
+
+// ------------------------------------------------------------------ receive
+
+static void conn_publish_in(conn_t *c, uint8_t flags, const uint8_t *p, size_t len, int64_t rx_us) {
+	if (len < 2) return;
+	size_t tl = p[0] << 8 | p[1];
+	if (2 + tl > len) return;
+
+	char topic[128];
+	if (tl >= sizeof(topic)) return;
+	memcpy(topic, p + 2, tl);
+	topic[tl] = '\0';
+
+	size_t off = 2 + tl;
+	int qos = (flags >> 1) & 3;
+	if (qos > 0) {
+		if (off + 2 > len) return;
+		mqtt_puback(c, p[off] << 8 | p[off + 1]);
+		off += 2;
+	}
+
+	s_count.received++;
+	s_count.rx_bytes += len - off;
+
+	if (c->dev) {
+		dev_enter(c->dev);
+		dev_rpc(c->dev, (const char*) p + off, len - off, rx_us);
+	} else if (!(flags & 1)) {
+		// Retained messages are last run's news.
+		observer_publish(topic, p + off, len - off, rx_us);
+	}
+}
+
+static void conn_packet_in(conn_t *c, uint8_t hdr, const uint8_t *p, size_t len, int64_t rx_us) {
+	switch (hdr >> 4) {
+	case MQTT_CONNACK:
+		if (len < 2 || p[1] != 0) {
+			fprintf(stderr, "%s: CONNACK refused (%d)\n", c->dev ? c->dev->subdomain : "observer", len >= 2 ? p[1] : -1);
+			s_count.connect_fail++;
+			if (c->dev) dev_lost(c->dev, false);
+			else exit(1);
+			return;
+		}
+		c->state = CONN_UP;
+		if (c->dev) {
+			dev_connack(c->dev);
+		} else {
+			mqtt_subscribe(c, "domain.vmflow.xyz/+/#", 0);
+		}
+		break;
+	case MQTT_SUBACK:
+		if (len >= 2 && (p[0] << 8 | p[1]) == c->sub_pid) c->subscribed = true;
+		break;
+	case MQTT_PUBLISH:
+		conn_publish_in(c, hdr & 0x0f, p, len, rx_us);
+		break;
+	default:    /* PUBACK, PINGRESP */
+		break;
+	}
+}
+
+static void conn_readable(conn_t *c) {
+	int64_t rx_us = mono_us();
+
+	for (;;) {
+		buf_reserve(&c->rx, &c->rx_cap, c->rx_len + 4096);
+		ssize_t n = recv(c->fd, c->rx + c->rx_len, c->rx_cap - c->rx_len, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if (n <= 0) {
+			if (c->dev) {
+				dev_lost(c->dev, false);
+			} else {
+				fprintf(stderr, "observer: connection lost\n");
+				exit(1);
+			}
+			return;
+		}
+		c->rx_len += n;
+	}
+
+	size_t off = 0;
+	while (c->rx_len - off >= 2) {
+		size_t rem = 0, i = 1;
+		int shift = 0;
+		bool whole = false;
+		while (off + i < c->rx_len && i <= 4) {
+			uint8_t b = c->rx[off + i++];
+			rem |= (size_t) (b & 0x7f) << shift;
+			shift += 7;
+			if (!(b & 0x80)) {
+				whole = true;
+				break;
+			}
+		}
+		if (whole && rem > MQTT_RX_MAX) {
+			if (c->dev) dev_lost(c->dev, false);
+			return;
+		}
+		if (!whole || c->rx_len - off - i < rem) break;
+
+		conn_packet_in(c, c->rx[off], c->rx + off + i, rem, rx_us);
+		if (c->fd < 0) return;          /* dropped while handling it */
+		off += i + rem;
+	}
+	memmove(c->rx, c->rx + off, c->rx_len - off);
+	c->rx_len -= off;
+}
+
+static void conn_writable(conn_t *c) {
+	if (c->state == CONN_CONNECTING) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		if (err != 0) {
+			if (c->dev == NULL) {
+				fprintf(stderr, "observer: %s\n", strerror(err));
+				exit(1);
+			}
+			s_count.connect_fail++;
+			dev_lost(c->dev, false);
+			return;
+		}
+		c->state = CONN_CONNACK;
+	}
+	conn_flush(c);
+}
+
+static void poll_events(int timeout_ms) {
+	struct epoll_event events[256];
+	int n = epoll_wait(s_epoll, events, 256, timeout_ms);
+	for (int i = 0; i < n; i++) {
+		conn_t *c = events[i].data.ptr;
+		if (c->fd < 0) continue;     /* dropped earlier in this batch */
+		if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) conn_writable(c);
+		if (c->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) conn_readable(c);
+	}
+}
+
+// ------------------------------------------------------------------ report
+
+static volatile sig_atomic_t s_stop;
+
+static void on_signal(int sig) {
+	s_stop = 1;
+}
+
+static uint32_t devices_up(void) {
+	uint32_t up = 0;
+	for (uint32_t i = 0; i < s_opt.devices; i++) up += s_dev[i].conn.state == CONN_UP;
+	return up;
+}
+
+// Pending entries older than --timeout-ms will not be answered any more.
+static void expire(int64_t now) {
+	int64_t limit = (int64_t) s_opt.timeout_ms * 1000;
+	for (uint32_t i = 0; i < s_opt.devices; i++) {
+		device_t *d = &s_dev[i];
+		for (int k = 0; k < PEND_MAX; k++) {
+			if (d->pend[k].us && now - d->pend[k].us > limit) {
+				s_series[d->pend[k].series].timeouts++;
+				d->pend[k].us = 0;
+			}
+		}
+		for (int k = 0; k < RPC_PEND_MAX; k++) {
+			if (d->rpc[k].us && now - d->rpc[k].us > limit) {
+				s_series[d->rpc[k].series].timeouts++;
+				d->rpc[k].us = 0;
+			}
+		}
+	}
+}
+
+static void report_window(double t_s, double window_s) {
+	static uint64_t last_pub, last_rx;
+
+	printf("t=%4.0fs up=%u/%u conn=%llu drop=%llu storm=%llu pub=%.0f/s rx=%.0f/s",
+		t_s, devices_up(), s_opt.devices, (unsigned long long) s_count.connects,
+		(unsigned long long) s_count.drops, (unsigned long long) s_count.storm_drops,
+		(s_count.published - last_pub) / window_s, (s_count.received - last_rx) / window_s);
+	last_pub = s_count.published;
+	last_rx = s_count.received;
+
+	for (int id = 0; id < S_MAX; id++) {
+		series_t *s = &s_series[id];
+		pct_t p = series_pct(s, s->mark);
+		s->mark = s->n;
+		if (p.n) printf(" | %s %zu p50 %.1f p99 %.1f", s->name, p.n, p.p50, p.p99);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static void report_final(double elapsed_s) {
+	printf("\n%-14s %8s %8s %9s %9s %9s %9s %9s\n", "series", "sent", "done", "timeout", "p50 ms", "p90 ms", "p99 ms", "max ms");
+	for (int id = 0; id < S_MAX; id++) {
+		series_t *s = &s_series[id];
+		pct_t p = series_pct(s, 0);
+		if (s->sent == 0 && p.n == 0 && s->timeouts == 0) continue;
+		printf("%-14s %8llu %8zu %9llu %9.2f %9.2f %9.2f %9.2f\n", s->name, (unsigned long long) s->sent, p.n,
+			(unsigned long long) s->timeouts, p.p50, p.p90, p.p99, p.max);
+	}
+	printf("\n%.0f s, %u devices: %llu connects (%llu failed), %llu drops, %llu storm drops\n",
+		elapsed_s, s_opt.devices, (unsigned long long) s_count.connects, (unsigned long long) s_count.connect_fail,
+		(unsigned long long) s_count.drops, (unsigned long long) s_count.storm_drops);
+	printf("published %llu (%.1f/s, %.1f KB/s), received %llu (%.1f/s, %.1f KB/s)\n",
+		(unsigned long long) s_count.published, s_count.published / elapsed_s, s_count.pub_bytes / elapsed_s / 1024,
+		(unsigned long long) s_count.received, s_count.received / elapsed_s, s_count.rx_bytes / elapsed_s / 1024);
+	printf("stale-signed lines %llu, RPC rejected: hmac %llu stale %llu no-clock %llu, credit busy %llu, late or unmatched %llu\n",
+		(unsigned long long) s_count.stale_signed, (unsigned long long) s_count.rpc_rejected_hmac,
+		(unsigned long long) s_count.rpc_rejected_stale, (unsigned long long) s_count.rpc_rejected_clock,
+		(unsigned long long) s_count.rpc_busy, (unsigned long long) s_count.unmatched);
+
+	if (s_opt.json == NULL) return;
+
+	FILE *f = strcmp(s_opt.json, "-") == 0 ? stdout : fopen(s_opt.json, "w");
+	if (f == NULL) {
+		perror(s_opt.json);
+		return;
+	}
+	fprintf(f, "{\"devices\":%u,\"duration_s\":%.1f,\"connects\":%llu,\"connect_fail\":%llu,\"drops\":%llu,"
+		"\"storm_drops\":%llu,\"published\":%llu,\"received\":%llu,\"pub_per_s\":%.2f,\"rx_per_s\":%.2f,"
+		"\"stale_signed\":%llu,\"rpc_rejected_hmac\":%llu,\"rpc_rejected_stale\":%llu,\"rpc_rejected_clock\":%llu,"
+		"\"rpc_busy\":%llu,\"unmatched\":%llu,\"series\":{",
+		s_opt.devices, elapsed_s, (unsigned long long) s_count.connects, (unsigned long long) s_count.connect_fail,
+		(unsigned long long) s_count.drops, (unsigned long long) s_count.storm_drops,
+		(unsigned long long) s_count.published, (unsigned long long) s_count.received,
+		s_count.published / elapsed_s, s_count.received / elapsed_s,
+		(unsigned long long) s_count.stale_signed, (unsigned long long) s_count.rpc_rejected_hmac,
+		(unsigned long long) s_count.rpc_rejected_stale, (unsigned long long) s_count.rpc_rejected_clock,
+		(unsigned long long) s_count.rpc_busy, (unsigned long long) s_count.unmatched);
+	for (int id = 0; id < S_MAX; id++) {
+		series_t *s = &s_series[id];
+		pct_t p = series_pct(s, 0);
+		fprintf(f, "%s\"%s\":{\"sent\":%llu,\"done\":%zu,\"timeouts\":%llu,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}",
+			id ? "," : "", s->name, (unsigned long long) s->sent, p.n, (unsigned long long) s->timeouts,
+			p.p50, p.p90, p.p99, p.max);
+	}
+	fprintf(f, "}}\n");
+	if (f != stdout) fclose(f);
+}
+
+// ------------------------------------------------------------------ main
+
+static void device_passkey(uint32_t sub, char out[19]) {
+	uint64_t x = s_opt.seed * 0x100000001b3ULL ^ sub;
+	snprintf(out, 19, "%016llx%02x", (unsigned long long) splitmix64(&x), (unsigned) (splitmix64(&x) & 0xff));
+}
+
+static void seed_sql(void) {
+	uint32_t last = s_opt.first_sub + s_opt.devices - 1;
+	printf("delete from public.embedded where subdomain between %u and %u;\n", s_opt.first_sub, last);
+	printf("insert into public.embedded (subdomain, passkey) values\n");
+	for (uint32_t sub = s_opt.first_sub; sub <= last; sub++) {
+		char passkey[19];
+		device_passkey(sub, passkey);
+		printf("  (%u, '%s')%s\n", sub, passkey, sub == last ? ";" : ",");
+	}
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -h, --host H            broker (localhost)\n"
+		"  -p, --port P            port (1883)\n"
+		"  -n, --devices N         virtual devices (100)\n"
+		"  -d, --duration S        run time, s (60)\n"
+		"      --first-sub N       first numeric subdomain (100000)\n"
+		"      --seed N            passkey seed (1)\n"
+		"      --connect-rate R    new connections per s while ramping up (200)\n"
+		"      --keepalive S       MQTT keepalive, s (120)\n"
+		"      --sales-per-hour R  per device (6)\n"
+		"      --fail-ratio F      share of sales that fail, and of credit vends (0.02)\n"
+		"      --pax-s S           PAX report period, s (0: off)\n"
+		"      --pax-phones N      phones per scan, at most (20)\n"
+		"      --dex-s S           DEX audit period, s (0: off)\n"
+		"      --dex-bytes N       DEX audit size (4096)\n"
+		"      --skew S            device clocks off by up to +-S s (0)\n"
+		"      --unsynced F        share of devices booting without a clock (0)\n"
+		"      --rpc-rate R        signed RPCs per s across the fleet (1)\n"
+		"      --rpc-mix SPEC      weights, e.g. echo=6,info=2,credit=2,oos=0,buzzer=0\n"
+		"      --storm-every S     drop part of the fleet every S s (0: never)\n"
+		"      --storm-frac F      share of the fleet a storm drops (0.1)\n"
+		"      --reconnect-ms MS   reconnect within, after a drop (10000)\n"
+		"      --timeout-ms MS     give up on a delivery or reply (5000)\n"
+		"      --report-s S        report period, s (10)\n"
+		"      --json FILE         final numbers as JSON ('-': stdout)\n"
+		"      --seed-sql          print the public.embedded rows for this fleet and exit\n",
+		argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	static const struct option longopts[] = {
+		{ "host", required_argument, 0, 'h' }, { "port", required_argument, 0, 'p' },
+		{ "devices", required_argument, 0, 'n' }, { "duration", required_argument, 0, 'd' },
+		{ "first-sub", required_argument, 0, 1 }, { "seed", required_argument, 0, 2 },
+		{ "connect-rate", required_argument, 0, 3 }, { "keepalive", required_argument, 0, 4 },
+		{ "sales-per-hour", required_argument, 0, 5 }, { "fail-ratio", required_argument, 0, 6 },
+		{ "pax-s", required_argument, 0, 7 }, { "pax-phones", required_argument, 0, 8 },
+		{ "dex-s", required_argument, 0, 9 }, { "dex-bytes", required_argument, 0, 10 },
+		{ "skew", required_argument, 0, 11 }, { "unsynced", required_argument, 0, 12 },
+		{ "rpc-rate", required_argument, 0, 13 }, { "rpc-mix", required_argument, 0, 14 },
+		{ "storm-every", required_argument, 0, 15 }, { "storm-frac", required_argument, 0, 16 },
+		{ "reconnect-ms", required_argument, 0, 17 }, { "timeout-ms", required_argument, 0, 18 },
+		{ "report-s", required_argument, 0, 19 }, { "json", required_argument, 0, 20 },
+		{ "seed-sql", no_argument, 0, 21 }, { "help", no_argument, 0, '?' },
+		{ 0 }
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h:p:n:d:", longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'h': s_opt.host = optarg; break;
+		case 'p': s_opt.port = optarg; break;
+		case 'n': s_opt.devices = strtoul(optarg, NULL, 0); break;
+		case 'd': s_opt.duration_s = strtoul(optarg, NULL, 0); break;
+		case 1:   s_opt.first_sub = strtoul(optarg, NULL, 0); break;
+		case 2:   s_opt.seed = strtoull(optarg, NULL, 0); break;
+		case 3:   s_opt.connect_rate = atof(optarg); break;
+		case 4:   s_opt.keepalive_s = strtoul(optarg, NULL, 0); break;
+		case 5:   s_opt.sales_per_hour = atof(optarg); break;
+		case 6:   s_opt.fail_ratio = atof(optarg); break;
+		case 7:   s_opt.pax_s = strtoul(optarg, NULL, 0); break;
+		case 8:   s_opt.pax_phones = strtoul(optarg, NULL, 0); break;
+		case 9:   s_opt.dex_s = strtoul(optarg, NULL, 0); break;
+		case 10:  s_opt.dex_bytes = strtoul(optarg, NULL, 0); break;
+		case 11:  s_opt.skew_s = strtoul(optarg, NULL, 0); break;
+		case 12:  s_opt.unsynced = atof(optarg); break;
+		case 13:  s_opt.rpc_rate = atof(optarg); break;
+		case 14:  s_opt.rpc_mix = optarg; break;
+		case 15:  s_opt.storm_every_s = strtoul(optarg, NULL, 0); break;
+		case 16:  s_opt.storm_frac = atof(optarg); break;
+		case 17:  s_opt.reconnect_ms = strtoul(optarg, NULL, 0); break;
+		case 18:  s_opt.timeout_ms = strtoul(optarg, NULL, 0); break;
+		case 19:  s_opt.report_s = strtoul(optarg, NULL, 0); break;
+		case 20:  s_opt.json = optarg; break;
+		case 21:  s_opt.seed_sql = true; break;
+		default:  usage(argv[0]);
+		}
+	}
+	if (s_opt.devices == 0 || s_opt.connect_rate <= 0 || s_opt.report_s == 0) usage(argv[0]);
+
+	if (s_opt.seed_sql) {
+		seed_sql();
+		return 0;
+	}
+	mix_parse(s_opt.rpc_mix);
+
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *ai;
+	int rc = getaddrinfo(s_opt.host, s_opt.port, &hints, &ai);
+	if (rc != 0) {
+		fprintf(stderr, "%s: %s\n", s_opt.host, gai_strerror(rc));
+		return 1;
+	}
+	memcpy(&s_addr, ai->ai_addr, ai->ai_addrlen);
+	s_addr_len = ai->ai_addrlen;
+	freeaddrinfo(ai);
+
+	// One descriptor per device, plus the observer and some slack.
+	struct rlimit rl;
+	getrlimit(RLIMIT_NOFILE, &rl);
+	if (rl.rlim_cur < s_opt.devices + 64) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if (rl.rlim_cur < s_opt.devices + 64) fprintf(stderr, "warning: RLIMIT_NOFILE %llu is short of %u devices\n",
+			(unsigned long long) rl.rlim_cur, s_opt.devices);
+	}
+
+	s_epoll = epoll_create1(EPOLL_CLOEXEC);
+	s_rng ^= s_opt.seed;
+
+	hal_posix_hooks_t hooks = { .time_s = fleet_time_s, .publish = fleet_publish };
+	hal_posix_set_hooks(&hooks);
+	credit_probe_init();
+
+	int64_t start = mono_us();
+	s_dev = calloc(s_opt.devices, sizeof(*s_dev));
+	if (s_dev == NULL) abort();
+	for (uint32_t i = 0; i < s_opt.devices; i++) {
+		device_t *d = &s_dev[i];
+		d->sub = s_opt.first_sub + i;
+		snprintf(d->subdomain, sizeof(d->subdomain), "%u", d->sub);
+		device_passkey(d->sub, d->passkey);
+		d->conn = (conn_t) { .fd = -1, .dev = d };
+		d->boot_us = start - (int64_t) rnd_below(3600) * 1000000;
+		d->clock_set = rnd() >= s_opt.unsynced;
+		d->skew_s = s_opt.skew_s ? (int32_t) rnd_below(2 * s_opt.skew_s + 1) - (int32_t) s_opt.skew_s : 0;
+		d->reconnect_us = start + (int64_t) (i / s_opt.connect_rate * 1e6);
+		d->next_sale_us = d->next_pax_us = d->next_dex_us = INT64_MAX;
+	}
+
+	s_obs = (conn_t) { .fd = -1 };
+	if (!conn_open(&s_obs)) {
+		perror("observer");
+		return 1;
+	}
+	char obs_id[32];
+	snprintf(obs_id, sizeof(obs_id), "fleet-load-%d", (int) getpid());
+	mqtt_connect(&s_obs, obs_id, NULL, NULL, true);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	int64_t end = start + (int64_t) s_opt.duration_s * 1000000;
+	int64_t next_report = start + (int64_t) s_opt.report_s * 1000000;
+	int64_t next_storm = s_opt.storm_every_s ? start + (int64_t) s_opt.storm_every_s * 1000000 : INT64_MAX;
+	int64_t last_tick = start;
+	double rpc_budget = 0;
+
+	while (!s_stop) {
+		poll_events(2);
+
+		int64_t now = mono_us();
+		if (now >= end) break;
+
+		for (uint32_t i = 0; i < s_opt.devices; i++) dev_tick(&s_dev[i], now);
+		s_cur = NULL;
+
+		if (s_obs.subscribed) {
+			rpc_budget += s_opt.rpc_rate * (now - last_tick) / 1e6;
+			while (rpc_budget >= 1) {
+				observer_send_rpc();
+				rpc_budget -= 1;
+			}
+		}
+		if (s_obs.state == CONN_UP && now - s_obs.last_tx_us > (int64_t) s_opt.keepalive_s * 1000000) {
+			conn_packet(&s_obs, MQTT_PINGREQ << 4, NULL, 0);
+		}
+		last_tick = now;
+
+		if (now >= next_storm) {
+			for (uint32_t i = 0; i < s_opt.devices; i++) {
+				if (s_dev[i].conn.state == CONN_UP && rnd() < s_opt.storm_frac) dev_lost(&s_dev[i], true);
+			}
+			next_storm += (int64_t) s_opt.storm_every_s * 1000000;
+		}
+
+		if (now >= next_report) {
+			expire(now);
+			report_window((now - start) / 1e6, s_opt.report_s);
+			next_report += (int64_t) s_opt.report_s * 1000000;
+		}
+	}
+
+	double run_s = (mono_us() - start) / 1e6;
+
+	// Let the last deliveries land before the totals.
+	int64_t drain_end = mono_us() + (int64_t) s_opt.timeout_ms * 1000;
+	while (!s_stop && mono_us() < drain_end) {
+		poll_events(10);
+	}
+	expire(INT64_MAX / 2);
+	report_final(run_s);
+
+	for (uint32_t i = 0; i < s_opt.devices; i++) {
+		if (s_dev[i].conn.state == CONN_UP) conn_packet(&s_dev[i].conn, MQTT_DISCONNECT << 4, NULL, 0);
+		conn_close(&s_dev[i].conn);
+	}
+	conn_close(&s_obs);
+	return 0;
+}
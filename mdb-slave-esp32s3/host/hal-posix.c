@@ -0,0 +1,235 @@
+#include "hal-posix.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
+
+#define KV_MAX          32
+#define KV_KEY_MAX      16      /* NVS key length, with the terminator */
+#define KV_VALUE_MAX    512
+
+static hal_posix_hooks_t s_hooks;
+
+static int s_mdb_in = STDIN_FILENO;
+static int s_mdb_out = STDOUT_FILENO;
+static int s_uart = -1;
+
+static struct {
+	char key[KV_KEY_MAX];
+	size_t len;
+	uint8_t value[KV_VALUE_MAX];
+} s_kv[KV_MAX];
+static int s_kv_count;
+
+static const char *s_pub_class[] = { "money", "control", "telemetry", "bulk" };
+
+void hal_posix_set_hooks(const hal_posix_hooks_t *hooks) {
+	if (hooks) {
+		s_hooks = *hooks;
+	} else {
+		memset(&s_hooks, 0, sizeof(s_hooks));
+	}
+}
+
+void hal_posix_set_fds(int mdb_in, int mdb_out, int uart) {
+	s_mdb_in = mdb_in;
+	s_mdb_out = mdb_out;
+	s_uart = uart;
+}
+
+// Whole reads and writes over short counts and EINTR; false on EOF or error.
+static bool fd_read_all(int fd, void *buf, size_t len) {
+	for (size_t got = 0; got < len;) {
+		ssize_t n = read(fd, (uint8_t*) buf + got, len - got);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		got += n;
+	}
+	return true;
+}
+
+static bool fd_write_all(int fd, const void *buf, size_t len) {
+	for (size_t put = 0; put < len;) {
+		ssize_t n = write(fd, (const uint8_t*) buf + put, len - put);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		put += n;
+	}
+	return true;
+}
+
+// ------------------------------------------------------------------ MDB bus
+
+void hal_mdb_init(void) {
+}
+
+uint16_t hal_mdb_read(void) {
+	if (s_hooks.mdb_read) return s_hooks.mdb_read(s_hooks.ctx);
+
+	uint8_t le[2];
+	if (!fd_read_all(s_mdb_in, le, sizeof(le))) exit(0);     // the bus is gone
+	return (le[0] | le[1] << 8) & 0x1ff;
+}
+
+void hal_mdb_write(uint16_t word) {
+	if (s_hooks.mdb_write) {
+		s_hooks.mdb_write(word, s_hooks.ctx);
+		return;
+	}
+
+	uint8_t le[2] = { word, word >> 8 };
+	fd_write_all(s_mdb_out, le, sizeof(le));
+}
+
+uint32_t hal_mdb_rx_pending(void) {
+	if (s_hooks.mdb_rx_pending) return s_hooks.mdb_rx_pending(s_hooks.ctx);
+
+	int n = 0;
+	if (ioctl(s_mdb_in, FIONREAD, &n) != 0) return 0;
+	return n / 2;
+}
+
+// ------------------------------------------------------------------ EVA-DTS UART
+
+void hal_uart_init(uint32_t baud) {
+}
+
+void hal_uart_set_baud(uint32_t baud) {
+}
+
+void hal_uart_flush_input(void) {
+	if (s_hooks.uart_read) {
+		uint8_t drop[64];
+		while (s_hooks.uart_read(drop, sizeof(drop), 0, s_hooks.ctx) > 0) {
+		}
+		return;
+	}
+	if (s_uart < 0) return;
+
+	uint8_t drop[64];
+	struct pollfd p = { .fd = s_uart, .events = POLLIN };
+	while (poll(&p, 1, 0) > 0 && read(s_uart, drop, sizeof(drop)) > 0) {
+	}
+}
+
+int hal_uart_write(const void *data, size_t len) {
+	if (s_hooks.uart_write) return s_hooks.uart_write(data, len, s_hooks.ctx);
+	if (s_uart < 0) return len;
+
+	return fd_write_all(s_uart, data, len) ? (int) len : -1;
+}
+
+int hal_uart_read(void *data, size_t len, uint32_t timeout_ms) {
+	if (s_hooks.uart_read) return s_hooks.uart_read(data, len, timeout_ms, s_hooks.ctx);
+	if (s_uart < 0) return 0;
+
+	// Like the ESP-IDF driver: the bytes that arrived before the timeout, possibly fewer than len.
+	int64_t deadline = hal_now_us() + (int64_t) timeout_ms * 1000;
+	size_t got = 0;
+	while (got < len) {
+		int64_t left_ms = (deadline - hal_now_us() + 999) / 1000;
+		struct pollfd p = { .fd = s_uart, .events = POLLIN };
+		if (left_ms <= 0 || poll(&p, 1, (int) left_ms) <= 0) break;
+
+		ssize_t n = read(s_uart, (uint8_t*) data + got, len - got);
+		if (n <= 0) break;
+		got += n;
+	}
+	return (int) got;
+}
+
+// ------------------------------------------------------------------ clock
+
+int64_t hal_now_us(void) {
+	if (s_hooks.now_us) return s_hooks.now_us(s_hooks.ctx);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t hal_time(void) {
+	if (s_hooks.time_s) return s_hooks.time_s(s_hooks.ctx);
+	return time(NULL);
+}
+
+int hal_time_slack_s(void) {
+	if (s_hooks.time_slack_s) return s_hooks.time_slack_s(s_hooks.ctx);
+	return 0;
+}
+
+void hal_delay_ms(uint32_t ms) {
+	if (s_hooks.delay_ms) {
+		s_hooks.delay_ms(ms, s_hooks.ctx);
+		return;
+	}
+
+	struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long) (ms % 1000) * 1000000 };
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+	}
+}
+
+// ------------------------------------------------------------------ KV
+
+bool hal_kv_get(const char *key, void *value, size_t *len) {
+	for (int i = 0; i < s_kv_count; i++) {
+		if (strcmp(s_kv[i].key, key) != 0) continue;
+
+		// NVS semantics: a short buffer is an error, the length is reported either way.
+		bool fits = *len >= s_kv[i].len;
+		if (fits) memcpy(value, s_kv[i].value, s_kv[i].len);
+		*len = s_kv[i].len;
+		return fits;
+	}
+	return false;
+}
+
+bool hal_kv_set(const char *key, const void *value, size_t len) {
+	if (strlen(key) >= KV_KEY_MAX || len > KV_VALUE_MAX) return false;
+
+	int i = 0;
+	while (i < s_kv_count && strcmp(s_kv[i].key, key) != 0) i++;
+	if (i == s_kv_count) {
+		if (s_kv_count == KV_MAX) return false;
+		s_kv_count++;
+		snprintf(s_kv[i].key, sizeof(s_kv[i].key), "%s", key);
+	}
+
+	memcpy(s_kv[i].value, value, len);
+	s_kv[i].len = len;
+	return true;
+}
+
+// ------------------------------------------------------------------ publish, BLE
+
+bool hal_publish(hal_pub_class_t cls, const char *topic, const char *data, int len) {
+	if (len == 0) len = strlen(data);
+	if (s_hooks.publish) return s_hooks.publish(cls, topic, data, len, s_hooks.ctx);
+
+	fprintf(stderr, "%s %s %.*s\n", s_pub_class[cls], topic, len, data);
+	return true;
+}
+
+void hal_ble_session_begin(uint16_t conn_handle) {
+}
+
+void hal_ble_session_end(void) {
+}
+
+void hal_ble_notify_session(const char *data, int len) {
+	if (s_hooks.ble_notify) s_hooks.ble_notify(data, len, s_hooks.ctx);
+}
+
+// ------------------------------------------------------------------ crypto
+
+void hal_hmac_sha256(const void *key, size_t key_len, const void *data, size_t len, uint8_t out[32]) {
+	unsigned int out_len = 32;
+	HMAC(EVP_sha256(), key, (int) key_len, data, len, out, &out_len);
+}
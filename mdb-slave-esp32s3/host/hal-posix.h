@@ -0,0 +1,45 @@
+/*
+ * hal_posix — the HAL (main/hal.h) on Linux, for the host build of the core.
+ *
+ * Out of the box the services map onto the process:
+ *
+ *   MDB bus     a file descriptor, one 9-bit word per 2 bytes little-endian
+ *               (stdin / stdout until hal_posix_set_fds()); EOF ends the process
+ *   UART        a file descriptor (none until hal_posix_set_fds()), poll() timeouts
+ *   clock       CLOCK_MONOTONIC, time() (taken as exact), nanosleep()
+ *   KV          in memory, empty at start
+ *   publish     one line on stderr: "<class> <topic> <payload>"
+ *   BLE         dropped
+ *   HMAC        OpenSSL
+ *
+ * A harness (a simulated VMC, a load generator, a benchmark) replaces any of
+ * them with hal_posix_set_hooks(); a NULL member keeps the default. With a
+ * simulated clock, the core sees only the harness's time.
+ */
+#ifndef HAL_POSIX_H
+#define HAL_POSIX_H
+
+#include "hal.h"
+
+typedef struct {
+	uint16_t (*mdb_read)(void *ctx);
+	void (*mdb_write)(uint16_t word, void *ctx);
+	uint32_t (*mdb_rx_pending)(void *ctx);
+	int (*uart_read)(void *data, size_t len, uint32_t timeout_ms, void *ctx);
+	int (*uart_write)(const void *data, size_t len, void *ctx);
+	int64_t (*now_us)(void *ctx);
+	int64_t (*time_s)(void *ctx);
+	int (*time_slack_s)(void *ctx);
+	void (*delay_ms)(uint32_t ms, void *ctx);
+	bool (*publish)(hal_pub_class_t cls, const char *topic, const char *data, int len, void *ctx);
+	void (*ble_notify)(const char *data, int len, void *ctx);
+	void *ctx;
+} hal_posix_hooks_t;
+
+/* Replace services (NULL: back to all defaults). The struct is copied. */
+void hal_posix_set_hooks(const hal_posix_hooks_t *hooks);
+
+/* Descriptors for the default MDB and UART services (-1: none). */
+void hal_posix_set_fds(int mdb_in, int mdb_out, int uart);
+
+#endif /* HAL_POSIX_H */
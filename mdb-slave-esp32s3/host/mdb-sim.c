@@ -0,0 +1,1076 @@
+/*
+ * mdb-sim.c — the MDB cashless state machine on a simulated 9600-baud bus, in virtual time.
+ *
+ * main/mdb-cashless.c runs unmodified: mdb_cashless_poll() in a loop, as the
+ * mdb_cashless task does, with the HAL's MDB, clock and publish services hooked
+ * into a discrete-event model of the board and the machine:
+ *
+ *   VMC       RESET, POLL for JUST RESET, SETUP config and prices, EXPANSION
+ *             REQUEST ID, READER ENABLE, then a POLL every --poll-ms, with
+ *             --peers other peripherals polled on the same bus. Sessions: a
+ *             credit (--sessions-per-hour, or --saturate for back to back),
+ *             BEGIN SESSION, VEND REQUEST after the customer's choice, VEND
+ *             APPROVED / DENIED, dispensing, VEND SUCCESS / FAILURE, SESSION
+ *             COMPLETE, END SESSION; cash sales (--cash-per-hour) in between.
+ *             A reply with a bad checksum gets a NAK (or a RET with --ret) and
+ *             the command again; no reply within --t-response-us, the command
+ *             again; --retries of those in a row, a RESET.
+ *   bus       11-bit words at 9600 baud, VMC side by the bit.
+ *   RX        hal-esp.c's falling-edge ISR: entered --isr-latency-us after an
+ *             edge while its interrupt is enabled, samples at +156 us and every
+ *             104 us after, posts to a --rxq deep queue (a full queue drops the
+ *             word) and re-enables itself after the ninth sample.
+ *   TX        hal-esp.c's bit-bang: a GPIO edge every 104 us from the task; the
+ *             VMC's UART samples mid-bit from the start edge.
+ *   core      interrupt load on the MDB core: --irq-rate bursts per s of mean
+ *             --irq-us (network ISRs), and --flash-rate stalls of --flash-us
+ *             (flash writes with the cache off). Either holds off the RX ISR's
+ *             entry and the task; a bit-bang delay that one outlasts stretches
+ *             its bit.
+ *   CPU       the task's own work is modelled, not measured: --read-us per
+ *             word read, --hmac-us per signature, --publish-us per publish.
+ *
+ * Everything comes from --seed, so a run is repeatable. The report gives the
+ * response time per command (end of the VMC's frame to our first start bit)
+ * against the 5 ms MDB limit, inter-byte gaps over 1 ms, word errors both ways,
+ * timeouts and retries, lost POLL replies and sessions per hour; --json writes
+ * the same numbers and --fail-on-miss exits 1 if any deadline was missed.
+ *
+ *   mdb-sim -d 3600 --saturate
+ *   mdb-sim -d 3600 --irq-rate 4000 --irq-us 30 --flash-rate 0.05 --flash-us 40000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <sdkconfig.h>
+
+#include "hal-posix.h"
+#include "mdb-cashless.h"
+#include "credit-probe.h"
+#include "rpc-auth.h"
+
+#define US              1000LL
+#define MS              1000000LL
+#define SEC             1000000000LL
+
+#define VMC_BIT_NS      104167      /* 9600 baud */
+#define FW_BIT_NS       (104 * US)  /* ets_delay_us(104) */
+#define ISR_FIRST_NS    (156 * US)  /* first sample after the edge */
+#define WORD_BITS       11          /* start, 8 data, mode, stop */
+#define WORD_NS         (WORD_BITS * VMC_BIT_NS)
+#define INTER_BYTE_NS   (1 * MS)    /* MDB t-inter-byte, max */
+#define FRAME_MAX       40
+#define RXQ_MAX         256
+#define VMC_SESSION_WAIT_NS (90 * SEC) /* VMC waiting for VEND APPROVED / END SESSION */
+
+// Read by the core, as on the board (the main translation unit there).
+char my_passkey[19] = "000000000000000000";
+char my_subdomain[32] = "sim";
+
+// ------------------------------------------------------------------ options
+
+static struct {
+	double duration_s;
+	uint64_t seed;
+	uint32_t poll_ms;
+	uint32_t peers;
+	uint32_t peer_resp_us;
+	uint32_t t_response_us;
+	uint32_t vmc_ack_us;
+	uint32_t frame_gap_us;
+	uint32_t retries;
+	bool ret;
+	double sessions_per_hour;
+	bool saturate;
+	double think_s;
+	double cash_per_hour;
+	double select_s, dispense_s;
+	double fail_ratio, deny_ratio;
+	uint32_t funds;
+	uint32_t reset_every_s;
+	uint32_t rxq;
+	uint32_t isr_latency_us;
+	double irq_rate, irq_us;
+	double flash_rate, flash_us;
+	double read_us, hmac_us, publish_us;
+	const char *json;
+	bool fail_on_miss;
+	bool verbose;
+} s_opt = {
+	.duration_s = 3600, .seed = 1, .poll_ms = 50, .peers = 2, .peer_resp_us = 400, .t_response_us = 5000,
+	.vmc_ack_us = 100, .frame_gap_us = 200, .retries = 3, .sessions_per_hour = 60, .think_s = 5,
+	.cash_per_hour = 30, .select_s = 3, .dispense_s = 4, .fail_ratio = 0.02, .deny_ratio = 0.05,
+	.funds = 500, .rxq = 16, .isr_latency_us = 2, .irq_rate = 1000, .irq_us = 3,
+	.read_us = 6, .hmac_us = 60, .publish_us = 40,
+};
+
+// ------------------------------------------------------------------ random
+
+static uint64_t s_rng;
+
+static uint64_t rnd64(void) {
+	uint64_t z = (s_rng += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static double rnd(void) {
+	return (rnd64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int64_t rnd_exp_ns(double mean_ns) {
+	return (int64_t) (-log(1.0 - rnd()) * mean_ns);
+}
+
+// Gap to the next event of a Poisson process; "never" for rate 0.
+static int64_t rnd_gap_ns(double rate_per_s) {
+	return rate_per_s > 0 ? rnd_exp_ns(SEC / rate_per_s) : INT64_MAX / 4;
+}
+
+// ------------------------------------------------------------------ samples
+
+typedef struct {
+	const char *name;
+	uint32_t *v;            /* us */
+	size_t n, cap;
+	uint64_t over;          /* samples past the limit the series is checked against */
+} series_t;
+
+static void series_add(series_t *s, int64_t ns, int64_t limit) {
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		s->v = realloc(s->v, s->cap * sizeof(*s->v));
+		if (s->v == NULL) abort();
+	}
+	int64_t us = ns / US;
+	s->v[s->n++] = us < 0 ? 0 : (us > UINT32_MAX ? UINT32_MAX : (uint32_t) us);
+	if (limit && ns > limit) s->over++;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
+
+// p in per mille, in ms; sorts the series in place (done only for the report).
+static double series_ms(series_t *s, int permille) {
+	if (s->n == 0) return 0;
+	return s->v[(s->n - 1) * permille / 1000] / 1e3;
+}
+
+// ------------------------------------------------------------------ core load
+
+typedef struct {
+	int64_t start, end;
+} burst_t;
+
+static struct {
+	burst_t *v;
+	size_t head, n, cap;        /* [head, n) live, sorted by start */
+	int64_t horizon;            /* generated up to */
+	int64_t next[2];            /* next start: network ISRs, flash stalls */
+	int64_t max_len;
+	uint64_t count[2];
+} s_load;
+
+static void load_generate(int64_t until) {
+	while (s_load.horizon < until) {
+		int src = s_load.next[0] <= s_load.next[1] ? 0 : 1;
+		int64_t start = s_load.next[src];
+		if (start >= until) {
+			s_load.horizon = until;
+			break;
+		}
+
+		int64_t len = src == 0 ? rnd_exp_ns(s_opt.irq_us * US) : (int64_t) (s_opt.flash_us * US);
+		if (src == 0 && len > 10 * s_opt.irq_us * US) len = 10 * s_opt.irq_us * US;
+		if (len > s_load.max_len) s_load.max_len = len;
+
+		if (s_load.n == s_load.cap) {
+			if (s_load.head > s_load.cap / 2) {
+				memmove(s_load.v, s_load.v + s_load.head, (s_load.n - s_load.head) * sizeof(burst_t));
+				s_load.n -= s_load.head;
+				s_load.head = 0;
+			} else {
+				s_load.cap = s_load.cap ? s_load.cap * 2 : 4096;
+				s_load.v = realloc(s_load.v, s_load.cap * sizeof(burst_t));
+				if (s_load.v == NULL) abort();
+			}
+		}
+		s_load.v[s_load.n++] = (burst_t) { start, start + len };
+		s_load.count[src]++;
+		s_load.next[src] = start + rnd_gap_ns(src == 0 ? s_opt.irq_rate : s_opt.flash_rate);
+		s_load.horizon = start;
+	}
+}
+
+// Forget bursts that ended before t; nothing asks about the past beyond one frame.
+static void load_prune(int64_t t) {
+	while (s_load.head < s_load.n && s_load.v[s_load.head].start + s_load.max_len < t) s_load.head++;
+}
+
+// Earliest time at or after t when no burst holds the core.
+static int64_t core_free_at(int64_t t) {
+	load_generate(t + SEC);
+
+	for (bool moved = true; moved;) {
+		moved = false;
+		size_t lo = s_load.head, hi = s_load.n;     /* first burst starting after t */
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (s_load.v[mid].start <= t) lo = mid + 1;
+			else hi = mid;
+		}
+		for (size_t k = lo; k-- > s_load.head && s_load.v[k].start + s_load.max_len >= t;) {
+			if (s_load.v[k].end > t) {
+				t = s_load.v[k].end;
+				moved = true;
+				break;
+			}
+		}
+	}
+	return t;
+}
+
+// Run cost_ns of task work from t, around the bursts; returns when it is done.
+static int64_t core_run(int64_t t, int64_t cost_ns) {
+	while (cost_ns > 0) {
+		t = core_free_at(t);
+
+		size_t lo = s_load.head, hi = s_load.n;
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (s_load.v[mid].start <= t) lo = mid + 1;
+			else hi = mid;
+		}
+		int64_t next = lo < s_load.n ? s_load.v[lo].start : INT64_MAX;
+		if (t + cost_ns <= next) return t + cost_ns;
+
+		cost_ns -= next - t;
+		t = next;
+	}
+	return t;
+}
+
+// ------------------------------------------------------------------ the board: RX ISR, queue, task clock
+
+typedef struct {
+	uint16_t word;
+	int64_t post;
+} rx_word_t;
+
+static struct {
+	rx_word_t q[RXQ_MAX];
+	size_t head, n;
+	int64_t enable_at;          /* the ISR re-enables its interrupt */
+	int64_t last_read;          /* when the task last took a word */
+	uint64_t words, errors, dropped;
+} s_rx;
+
+static int64_t s_now;           /* the task's clock */
+static int64_t s_end;
+
+// One VMC transmission on the bus: n words back to back from t0.
+typedef struct {
+	uint16_t w[FRAME_MAX];
+	int n;
+	int64_t start[FRAME_MAX];
+} wave_t;
+
+static int wave_level(const wave_t *wv, int64_t t) {
+	for (int i = 0; i < wv->n; i++) {
+		if (t < wv->start[i]) return 1;
+		int64_t j = (t - wv->start[i]) / VMC_BIT_NS;
+		if (j >= WORD_BITS) continue;
+		if (j == 0) return 0;
+		if (j <= 9) return (wv->w[i] >> (j - 1)) & 1;
+		return 1;
+	}
+	return 1;
+}
+
+// The first falling edge at or after t, or -1.
+static int64_t wave_next_fall(const wave_t *wv, int64_t t) {
+	for (int i = 0; i < wv->n; i++) {
+		int64_t s = wv->start[i];
+		if (s >= t) return s;
+		for (int k = 1; k < 9; k++) {
+			int64_t e = s + (int64_t) (k + 1) * VMC_BIT_NS;
+			if (e >= t && ((wv->w[i] >> (k - 1)) & 1) && !((wv->w[i] >> k) & 1)) return e;
+		}
+	}
+	return -1;
+}
+
+// The ISR's view of a transmission: a word per falling edge it is enabled for.
+static void rx_receive(const wave_t *wv) {
+	int64_t from = s_rx.enable_at;
+	for (;;) {
+		int64_t edge = wave_next_fall(wv, from);
+		if (edge < 0) break;
+
+		int64_t entry = core_free_at(edge + s_opt.isr_latency_us * US);
+		uint16_t word = 0;
+		for (int k = 0; k < 9; k++) word |= wave_level(wv, entry + ISR_FIRST_NS + k * FW_BIT_NS) << k;
+		int64_t post = entry + ISR_FIRST_NS + 9 * FW_BIT_NS;
+
+		// Garbled: sampled off the bit centres, or woken by an edge inside a word.
+		bool clean = false;
+		for (int i = 0; i < wv->n; i++) {
+			if (wv->start[i] == edge) clean = wv->w[i] == word;
+		}
+		if (!clean) s_rx.errors++;
+
+		s_rx.words++;
+		if (s_rx.n < RXQ_MAX) s_rx.q[(s_rx.head + s_rx.n++) % RXQ_MAX] = (rx_word_t) { word, post };
+		s_rx.enable_at = from = post;
+	}
+}
+
+// ------------------------------------------------------------------ VMC
+
+typedef enum { CMD_RESET, CMD_SETUP, CMD_POLL, CMD_VEND, CMD_READER, CMD_EXPANSION, CMD_KINDS } cmd_kind_t;
+
+static const char *s_cmd_name[CMD_KINDS] = { "RESET", "SETUP", "POLL", "VEND", "READER", "EXPANSION" };
+
+typedef enum { PH_RESET, PH_JUST_RESET, PH_CONFIG, PH_PRICES, PH_ID, PH_ENABLE, PH_RUN } phase_t;
+
+typedef enum { SES_NONE, SES_OPEN, SES_VEND_WAIT, SES_DISPENSE, SES_COMPLETE, SES_END_WAIT } session_t;
+
+static struct {
+	phase_t phase;
+	session_t session;
+	int64_t due;                /* session step due (OPEN, DISPENSE, COMPLETE) */
+	bool vend_ok;
+	uint16_t price, item;
+
+	uint16_t frame[FRAME_MAX];  /* last command to the cashless reader, for a retry */
+	int frame_n;
+	cmd_kind_t kind;
+	bool awaiting;
+	int64_t frame_end, deadline;
+	uint32_t fails;             /* in a row */
+
+	uint16_t reply[FRAME_MAX];
+	uint16_t reply_sent[FRAME_MAX];
+	int reply_n;
+	int64_t reply_first, reply_last_end;
+	bool reply_late;
+
+	int64_t bus_free;
+	int64_t next_poll;
+	int64_t next_cash;
+	int64_t next_reset;
+
+	int64_t credit_at;          /* next credit reaches the reader's queue */
+	int64_t idle_since;         /* last session ended (one customer at a time) */
+	int64_t credit_taken;       /* credit of the session in progress, when queued */
+	int64_t session_begin;
+	uint32_t credit_seq;
+} s_vmc;
+
+static struct {
+	series_t resp[CMD_KINDS];
+	series_t gap;               /* inter-byte gaps in our replies */
+	series_t credit_begin;      /* credit queued -> BEGIN SESSION on the bus */
+	series_t session;           /* BEGIN SESSION -> END SESSION */
+	uint64_t frames[CMD_KINDS];
+	uint64_t timeouts, late, bad_reply, retries, resets, tx_errors;
+	uint64_t early;             /* reply started inside the VMC's stop bit (reported as 0 ms) */
+	uint64_t lost_begin, lost_other;
+	uint64_t sessions, vends, fails, denied, cancelled, abandoned, cash, publishes, hmacs;
+	uint64_t peer_frames;
+} s_st;
+
+static void vmc_transmit(const uint16_t *w, int n, int64_t t0, wave_t *wv) {
+	wv->n = n;
+	for (int i = 0; i < n; i++) {
+		wv->w[i] = w[i];
+		wv->start[i] = t0 + (int64_t) i * WORD_NS;
+	}
+	rx_receive(wv);
+	s_vmc.bus_free = t0 + (int64_t) n * WORD_NS;
+}
+
+// Address word with the mode bit, data, checksum.
+static int vmc_frame(uint16_t *w, uint8_t addr_cmd, const uint8_t *data, int n) {
+	uint8_t chk = addr_cmd;
+	w[0] = BIT_MODE_SET | addr_cmd;
+	for (int i = 0; i < n; i++) {
+		w[1 + i] = data[i];
+		chk += data[i];
+	}
+	w[1 + n] = chk;
+	return n + 2;
+}
+
+static void vmc_send(cmd_kind_t kind, const uint16_t *w, int n, int64_t t) {
+	wave_t wv;
+	vmc_transmit(w, n, t, &wv);
+
+	memcpy(s_vmc.frame, w, n * sizeof(*w));
+	s_vmc.frame_n = n;
+	s_vmc.kind = kind;
+	s_vmc.awaiting = true;
+	s_vmc.frame_end = s_vmc.bus_free;
+	s_vmc.deadline = s_vmc.frame_end + s_opt.t_response_us * US;
+	s_vmc.reply_n = 0;
+	s_vmc.reply_late = false;
+	s_st.frames[kind]++;
+
+	if (s_opt.verbose) printf("%12.6f  VMC %-9s %d words\n", t / 1e9, s_cmd_name[kind], n);
+}
+
+static void vmc_command(cmd_kind_t kind, uint8_t cmd, const uint8_t *data, int n, int64_t t) {
+	uint16_t w[FRAME_MAX];
+	int len = vmc_frame(w, CONFIG_CASHLESS_DEVICE_ADDRESS | cmd, data, n);
+	vmc_send(kind, w, len, t);
+}
+
+// The other peripherals' POLLs: bus time, and RX ISRs on our side.
+static int64_t vmc_poll_peers(int64_t t) {
+	static const uint8_t addr[] = { 0x08, 0x30, 0x40, 0x58, 0x60 };
+	for (uint32_t i = 0; i < s_opt.peers && i < sizeof(addr); i++) {
+		uint16_t w[2];
+		vmc_frame(w, addr[i] | POLL, NULL, 0);
+		wave_t wv;
+		vmc_transmit(w, 2, t, &wv);
+		// Their ACK is on the peripheral line, which our receiver does not see.
+		t = s_vmc.bus_free + s_opt.peer_resp_us * US + WORD_NS + s_opt.frame_gap_us * US;
+		s_st.peer_frames++;
+	}
+	return t;
+}
+
+static void vmc_restart(void) {
+	s_vmc.phase = PH_RESET;
+	if (s_vmc.session != SES_NONE) s_st.cancelled++;
+	s_vmc.session = SES_NONE;
+	s_vmc.idle_since = s_now;
+	s_vmc.fails = 0;
+	s_st.resets++;
+}
+
+static void vmc_session_end(int64_t t) {
+	series_add(&s_st.session, t - s_vmc.session_begin, 0);
+	s_vmc.session = SES_NONE;
+	s_st.sessions++;
+	s_vmc.idle_since = t;
+	if (s_opt.saturate) s_vmc.credit_at = t + (int64_t) (s_opt.think_s * SEC);
+}
+
+// A valid reply from the reader to the last command.
+static void vmc_reply(int64_t t) {
+	const uint16_t *r = s_vmc.reply;
+	int n = s_vmc.reply_n - 1;      /* data words before the checksum */
+	s_vmc.fails = 0;
+
+	switch (s_vmc.phase) {
+	case PH_RESET:
+		s_vmc.phase = PH_JUST_RESET;
+		return;
+	case PH_CONFIG:
+		if (n >= 1 && r[0] == 0x01) s_vmc.phase = PH_PRICES;
+		return;
+	case PH_PRICES:
+		s_vmc.phase = PH_ID;
+		return;
+	case PH_ID:
+		if (n >= 1 && r[0] == 0x09) s_vmc.phase = PH_ENABLE;
+		return;
+	case PH_ENABLE:
+		s_vmc.phase = PH_RUN;
+		return;
+	default:
+		break;
+	}
+
+	if (s_vmc.kind != CMD_POLL || n < 1) return;
+
+	switch (r[0]) {
+	case 0x00:      /* JUST RESET */
+		s_vmc.phase = PH_CONFIG;
+		s_vmc.session = SES_NONE;
+		break;
+	case 0x03:      /* BEGIN SESSION */
+		if (s_vmc.session != SES_NONE || n < 3) break;
+		series_add(&s_st.credit_begin, t - s_vmc.credit_taken, 0);
+		s_vmc.session = SES_OPEN;
+		s_vmc.session_begin = t;
+		s_vmc.due = t + (int64_t) (s_opt.select_s * (0.5 + rnd()) * SEC);
+		{
+			uint16_t funds = r[1] << 8 | r[2];
+			uint16_t cheapest = funds > 50 ? 50 : 1;
+			s_vmc.price = rnd() < s_opt.deny_ratio ? funds + 50 : cheapest + (uint16_t) (rnd() * (funds - cheapest + 1));
+			s_vmc.item = 1 + (uint16_t) (rnd() * 60);
+		}
+		break;
+	case 0x04:      /* SESSION CANCEL REQUEST: answered even for a session the VMC never saw begin */
+		if (s_vmc.session == SES_END_WAIT || s_vmc.session == SES_COMPLETE) break;
+		s_st.cancelled++;
+		s_vmc.session = SES_COMPLETE;
+		s_vmc.due = t;
+		break;
+	case 0x05:      /* VEND APPROVED */
+		if (s_vmc.session != SES_VEND_WAIT) break;
+		s_vmc.session = SES_DISPENSE;
+		s_vmc.vend_ok = rnd() >= s_opt.fail_ratio;
+		s_vmc.due = t + (int64_t) (s_opt.dispense_s * (0.75 + 0.5 * rnd()) * SEC);
+		break;
+	case 0x06:      /* VEND DENIED */
+		if (s_vmc.session != SES_VEND_WAIT) break;
+		s_st.denied++;
+		s_vmc.session = SES_COMPLETE;
+		s_vmc.due = t;
+		break;
+	case 0x07:      /* END SESSION */
+		if (s_vmc.session == SES_END_WAIT) vmc_session_end(t);
+		break;
+	}
+}
+
+// The reader's reply is complete (last word has the mode bit), or the VMC gave up on it.
+static void vmc_reply_done(void) {
+	int64_t t = s_vmc.reply_last_end;
+	s_vmc.awaiting = false;
+
+	bool ok = s_vmc.reply_n > 0 && !s_vmc.reply_late;
+	uint8_t chk = 0;
+	for (int i = 0; i < s_vmc.reply_n; i++) {
+		if (s_vmc.reply[i] != s_vmc.reply_sent[i]) ok = false;
+		if (i < s_vmc.reply_n - 1) chk += s_vmc.reply[i];
+	}
+	if (ok && (!(s_vmc.reply[s_vmc.reply_n - 1] & BIT_MODE_SET) || (uint8_t) s_vmc.reply[s_vmc.reply_n - 1] != chk)) ok = false;
+
+	// A data reply the VMC never took: the reader already moved on.
+	bool data = s_vmc.reply_n > 1;
+	if (!ok && data && s_vmc.kind == CMD_POLL) {
+		if ((uint8_t) s_vmc.reply_sent[0] == 0x03) s_st.lost_begin++;
+		else s_st.lost_other++;
+	}
+
+	if (s_vmc.reply_late) {
+		s_vmc.bus_free = t;
+		s_vmc.fails++;
+		return;                     /* counted as a timeout; vmc_next() retries */
+	}
+
+	if (!ok) {
+		s_st.bad_reply++;
+		uint16_t w = s_opt.ret ? RET : NAK;
+		wave_t wv;
+		vmc_transmit(&w, 1, t + s_opt.vmc_ack_us * US, &wv);
+		s_vmc.awaiting = s_opt.ret;     /* RET: wait for the reader to send it again */
+		s_vmc.frame_end = s_vmc.bus_free;
+		s_vmc.deadline = s_vmc.frame_end + s_opt.t_response_us * US;
+		s_vmc.reply_n = 0;
+		s_vmc.fails++;
+		if (!s_opt.ret) s_vmc.bus_free += s_opt.frame_gap_us * US;
+		return;
+	}
+
+	if (data) {
+		uint16_t ack = ACK;
+		wave_t wv;
+		vmc_transmit(&ack, 1, t + s_opt.vmc_ack_us * US, &wv);
+	} else {
+		s_vmc.bus_free = t;
+	}
+	s_vmc.bus_free += s_opt.frame_gap_us * US;
+	s_vmc.frame_n = 0;
+	vmc_reply(t);
+}
+
+// Put the VMC's next transmission on the bus; the task has read everything before it.
+static void vmc_next(void) {
+	int64_t t = s_vmc.bus_free;
+
+	if (s_vmc.awaiting) {
+		// Nothing came back in time: retry after the response window.
+		s_st.timeouts++;
+		s_vmc.awaiting = false;
+		s_vmc.fails++;
+		if (s_vmc.deadline + s_opt.frame_gap_us * US > t) t = s_vmc.deadline + s_opt.frame_gap_us * US;
+	}
+
+	if (s_vmc.fails > s_opt.retries) {
+		vmc_restart();
+		s_vmc.frame_n = 0;
+	}
+
+	if (s_opt.reset_every_s && t >= s_vmc.next_reset) {
+		s_vmc.next_reset += (int64_t) s_opt.reset_every_s * SEC;
+		vmc_restart();
+		s_vmc.frame_n = 0;
+	}
+
+	if (s_vmc.frame_n > 0) {
+		s_st.retries++;
+		uint16_t w[FRAME_MAX];
+		int n = s_vmc.frame_n;
+		memcpy(w, s_vmc.frame, n * sizeof(*w));
+		vmc_send(s_vmc.kind, w, n, t);
+		return;
+	}
+
+	switch (s_vmc.phase) {
+	case PH_RESET:
+		vmc_command(CMD_RESET, RESET, NULL, 0, t);
+		return;
+	case PH_CONFIG: {
+		uint8_t d[] = { CONFIG_DATA, 3, 16, 2, 0 };      /* level 3, 16x2 display */
+		vmc_command(CMD_SETUP, SETUP, d, sizeof(d), t);
+		return;
+	}
+	case PH_PRICES: {
+		uint8_t d[] = { MAX_MIN_PRICES, 0xff, 0xff, 0x00, 0x00 };
+		vmc_command(CMD_SETUP, SETUP, d, sizeof(d), t);
+		return;
+	}
+	case PH_ID: {
+		uint8_t d[30] = { REQUEST_ID };
+		memcpy(d + 1, "SIM000000000001VMC-SIM     \x01\x00", 29);
+		vmc_command(CMD_EXPANSION, EXPANSION, d, sizeof(d), t);
+		return;
+	}
+	case PH_ENABLE: {
+		uint8_t d[] = { READER_ENABLE };
+		vmc_command(CMD_READER, READER, d, sizeof(d), t);
+		return;
+	}
+	default:
+		break;
+	}
+
+	// A VMC gives up on a reader that never approves or never ends the session.
+	if ((s_vmc.session == SES_VEND_WAIT || s_vmc.session == SES_END_WAIT) && t - s_vmc.due > VMC_SESSION_WAIT_NS) {
+		s_st.abandoned++;
+		s_vmc.session = SES_NONE;
+		s_vmc.idle_since = t;
+	}
+
+	// Session steps and cash sales go out as soon as they are due; otherwise the next POLL slot.
+	if (s_vmc.phase == PH_RUN) {
+		int64_t due = s_vmc.session == SES_OPEN || s_vmc.session == SES_DISPENSE || s_vmc.session == SES_COMPLETE ? s_vmc.due : INT64_MAX;
+		int64_t cash = s_vmc.session == SES_NONE ? s_vmc.next_cash : INT64_MAX;
+
+		if (due <= s_vmc.next_poll && due <= cash) {
+			if (due > t) t = due;
+			uint8_t d[5];
+			if (s_vmc.session == SES_OPEN) {
+				d[0] = VEND_REQUEST;
+				d[1] = s_vmc.price >> 8; d[2] = s_vmc.price;
+				d[3] = s_vmc.item >> 8; d[4] = s_vmc.item;
+				s_vmc.session = SES_VEND_WAIT;
+				s_vmc.due = t;
+				vmc_command(CMD_VEND, VEND, d, 5, t);
+			} else if (s_vmc.session == SES_DISPENSE) {
+				if (s_vmc.vend_ok) {
+					d[0] = VEND_SUCCESS;
+					d[1] = s_vmc.item >> 8; d[2] = s_vmc.item;
+					s_st.vends++;
+					vmc_command(CMD_VEND, VEND, d, 3, t);
+				} else {
+					d[0] = VEND_FAILURE;
+					s_st.fails++;
+					vmc_command(CMD_VEND, VEND, d, 1, t);
+				}
+				s_vmc.session = SES_COMPLETE;
+				s_vmc.due = t + 100 * MS;
+			} else {
+				d[0] = SESSION_COMPLETE;
+				s_vmc.session = SES_END_WAIT;
+				s_vmc.due = t;
+				vmc_command(CMD_VEND, VEND, d, 1, t);
+			}
+			return;
+		}
+		if (cash <= s_vmc.next_poll) {
+			if (cash > t) t = cash;
+			uint16_t price = 50 + 50 * (uint16_t) (rnd() * 8), item = 1 + (uint16_t) (rnd() * 60);
+			uint8_t d[] = { CASH_SALE, price >> 8, price, item >> 8, item };
+			s_vmc.next_cash = t + rnd_gap_ns(s_opt.cash_per_hour / 3600);
+			s_st.cash++;
+			vmc_command(CMD_VEND, VEND, d, sizeof(d), t);
+			return;
+		}
+	}
+
+	if (s_vmc.next_poll > t) t = s_vmc.next_poll;
+	s_vmc.next_poll = t + (int64_t) s_opt.poll_ms * MS;
+	t = vmc_poll_peers(t);
+	vmc_command(CMD_POLL, POLL, NULL, 0, t);
+}
+
+// ------------------------------------------------------------------ report
+
+static void report(FILE *f, bool json) {
+	double hours = s_end / 3600e9;
+	int64_t limit = s_opt.t_response_us * US;
+	uint64_t missed = 0;
+
+	for (int k = 0; k < CMD_KINDS; k++) {
+		qsort(s_st.resp[k].v, s_st.resp[k].n, sizeof(uint32_t), cmp_u32);
+		missed += s_st.resp[k].over;
+	}
+	series_t *ser[] = { &s_st.gap, &s_st.credit_begin, &s_st.session };
+	for (size_t i = 0; i < sizeof(ser) / sizeof(ser[0]); i++) qsort(ser[i]->v, ser[i]->n, sizeof(uint32_t), cmp_u32);
+
+	if (json) {
+		fprintf(f, "{\"virtual_s\":%.1f,\"seed\":%llu,\"deadline_ms\":%.3f,\"missed\":%llu,\"response\":{",
+			s_end / 1e9, (unsigned long long) s_opt.seed, limit / 1e6, (unsigned long long) missed);
+		for (int k = 0; k < CMD_KINDS; k++) {
+			series_t *s = &s_st.resp[k];
+			fprintf(f, "%s\"%s\":{\"n\":%zu,\"p50_ms\":%.4f,\"p90_ms\":%.4f,\"p99_ms\":%.4f,\"p999_ms\":%.4f,\"max_ms\":%.4f,\"missed\":%llu}",
+				k ? "," : "", s_cmd_name[k], s->n, series_ms(s, 500), series_ms(s, 900), series_ms(s, 990), series_ms(s, 999),
+				series_ms(s, 1000), (unsigned long long) s->over);
+		}
+		fprintf(f, "},\"inter_byte_over\":%llu,\"timeouts\":%llu,\"late\":%llu,\"bad_replies\":%llu,\"retries\":%llu,"
+			"\"resets\":%llu,\"early\":%llu,\"rx_words\":%llu,\"rx_errors\":%llu,\"rx_dropped\":%llu,\"tx_errors\":%llu,\"lost_begin\":%llu,\"lost_other\":%llu,"
+			"\"sessions\":%llu,\"sessions_per_hour\":%.1f,\"vends\":%llu,\"fails\":%llu,\"denied\":%llu,\"cancelled\":%llu,\"abandoned\":%llu,"
+			"\"cash\":%llu,\"credit_begin_p50_ms\":%.3f,\"credit_begin_p99_ms\":%.3f,\"session_p50_s\":%.3f}\n",
+			(unsigned long long) s_st.gap.over, (unsigned long long) s_st.timeouts, (unsigned long long) s_st.late,
+			(unsigned long long) s_st.bad_reply, (unsigned long long) s_st.retries, (unsigned long long) s_st.resets,
+			(unsigned long long) s_st.early, (unsigned long long) s_rx.words, (unsigned long long) s_rx.errors, (unsigned long long) s_rx.dropped, (unsigned long long) s_st.tx_errors,
+			(unsigned long long) s_st.lost_begin, (unsigned long long) s_st.lost_other,
+			(unsigned long long) s_st.sessions, s_st.sessions / hours, (unsigned long long) s_st.vends,
+			(unsigned long long) s_st.fails, (unsigned long long) s_st.denied, (unsigned long long) s_st.cancelled,
+			(unsigned long long) s_st.abandoned, (unsigned long long) s_st.cash, series_ms(&s_st.credit_begin, 500), series_ms(&s_st.credit_begin, 990),
+			series_ms(&s_st.session, 500) / 1000);
+		return;
+	}
+
+	fprintf(f, "%.0f s virtual, seed %llu: POLL every %u ms, %u peers; load %.0f/s x %.0f us ISRs, %.3g/s x %.0f us flash stalls\n\n",
+		s_end / 1e9, (unsigned long long) s_opt.seed, s_opt.poll_ms, s_opt.peers,
+		s_opt.irq_rate, s_opt.irq_us, s_opt.flash_rate, s_opt.flash_us);
+	fprintf(f, "response (ms)    frames    p50      p90      p99      p99.9    max      >%.0f ms\n", limit / 1e6);
+	for (int k = 0; k < CMD_KINDS; k++) {
+		series_t *s = &s_st.resp[k];
+		if (s_st.frames[k] == 0) continue;
+		fprintf(f, "%-12s %10llu  %-8.3f %-8.3f %-8.3f %-8.3f %-8.3f %llu\n", s_cmd_name[k], (unsigned long long) s_st.frames[k],
+			series_ms(s, 500), series_ms(s, 900), series_ms(s, 990), series_ms(s, 999), series_ms(s, 1000),
+			(unsigned long long) s->over);
+	}
+
+	double worst = 0;
+	for (int k = 0; k < CMD_KINDS; k++) if (series_ms(&s_st.resp[k], 1000) > worst) worst = series_ms(&s_st.resp[k], 1000);
+	fprintf(f, "\nmissed deadlines %llu, headroom %.3f ms (worst response %.3f ms); %llu replies began inside the VMC's stop bit\n",
+		(unsigned long long) missed, limit / 1e6 - worst, worst, (unsigned long long) s_st.early);
+	fprintf(f, "inter-byte gaps > 1 ms %llu (max %.3f ms)\n", (unsigned long long) s_st.gap.over, series_ms(&s_st.gap, 1000));
+	fprintf(f, "no reply %llu (late %llu), bad replies %llu, retries %llu, VMC resets %llu\n",
+		(unsigned long long) s_st.timeouts, (unsigned long long) s_st.late, (unsigned long long) s_st.bad_reply,
+		(unsigned long long) s_st.retries, (unsigned long long) s_st.resets);
+	fprintf(f, "RX words %llu (garbled %llu, dropped on a full queue %llu), TX words garbled %llu, POLL replies lost: BEGIN SESSION %llu, other %llu\n",
+		(unsigned long long) s_rx.words, (unsigned long long) s_rx.errors, (unsigned long long) s_rx.dropped, (unsigned long long) s_st.tx_errors,
+		(unsigned long long) s_st.lost_begin, (unsigned long long) s_st.lost_other);
+	fprintf(f, "sessions %llu (%.1f per hour): vend %llu, fail %llu, denied %llu, cancelled %llu, abandoned by the VMC %llu; cash sales %llu\n",
+		(unsigned long long) s_st.sessions, s_st.sessions / hours, (unsigned long long) s_st.vends,
+		(unsigned long long) s_st.fails, (unsigned long long) s_st.denied, (unsigned long long) s_st.cancelled,
+		(unsigned long long) s_st.abandoned,
+		(unsigned long long) s_st.cash);
+	fprintf(f, "credit -> BEGIN SESSION p50 %.1f ms p99 %.1f ms; session p50 %.2f s\n",
+		series_ms(&s_st.credit_begin, 500), series_ms(&s_st.credit_begin, 990), series_ms(&s_st.session, 500) / 1000);
+	fprintf(f, "task: %llu signatures, %llu publishes\n", (unsigned long long) s_st.hmacs, (unsigned long long) s_st.publishes);
+}
+
+static void finish(void) {
+	bool json_stdout = s_opt.json && strcmp(s_opt.json, "-") == 0;
+	if (!json_stdout) report(stdout, false);
+	if (s_opt.json) {
+		FILE *f = json_stdout ? stdout : fopen(s_opt.json, "w");
+		if (f) {
+			report(f, true);
+			if (f != stdout) fclose(f);
+		} else {
+			perror(s_opt.json);
+		}
+	}
+
+	uint64_t missed = 0;
+	for (int k = 0; k < CMD_KINDS; k++) missed += s_st.resp[k].over;
+	exit(s_opt.fail_on_miss && missed ? 1 : 0);
+}
+
+// ------------------------------------------------------------------ HAL hooks
+
+static uint16_t sim_mdb_read(void *ctx) {
+	for (;;) {
+		if (s_rx.n > 0) {
+			// Words that came in since the last read joined the queue until it was full.
+			int64_t at = s_now > s_rx.q[s_rx.head].post ? s_now : s_rx.q[s_rx.head].post;
+			size_t held = 0;
+			for (size_t i = 0; i < s_rx.n; i++) {
+				rx_word_t *w = &s_rx.q[(s_rx.head + i) % RXQ_MAX];
+				if (w->post > at) break;
+				if (w->post <= s_rx.last_read || held < s_opt.rxq) {
+					held++;
+					continue;
+				}
+				// Dropped: close the gap.
+				for (size_t j = i; j + 1 < s_rx.n; j++) s_rx.q[(s_rx.head + j) % RXQ_MAX] = s_rx.q[(s_rx.head + j + 1) % RXQ_MAX];
+				s_rx.n--;
+				s_rx.dropped++;
+				i--;
+			}
+
+			rx_word_t w = s_rx.q[s_rx.head];
+			s_rx.head = (s_rx.head + 1) % RXQ_MAX;
+			s_rx.n--;
+
+			s_now = core_run(at, (int64_t) (s_opt.read_us * US));
+			s_rx.last_read = at;
+			load_prune(s_now - SEC);
+			return w.word;
+		}
+
+		if (s_now >= s_end) finish();
+		vmc_next();
+	}
+}
+
+static void sim_mdb_write(uint16_t word, void *ctx) {
+	// gpio edges: start bit, 9 data bits, stop bit; each after a 104 us busy wait the load may outlast.
+	int64_t e[WORD_BITS + 1];
+	e[0] = core_free_at(s_now);
+	for (int i = 1; i <= WORD_BITS; i++) e[i] = core_free_at(e[i - 1] + FW_BIT_NS);
+	s_now = e[WORD_BITS];
+
+	// The VMC's UART: start edge, then the middle of each bit.
+	uint16_t got = 0;
+	for (int k = 0; k < 9; k++) {
+		int64_t t = e[0] + (int64_t) ((1.5 + k) * VMC_BIT_NS);
+		int seg = 0;
+		while (seg < WORD_BITS && e[seg + 1] <= t) seg++;
+		int level = seg == 0 ? 0 : (seg <= 9 ? (word >> (seg - 1)) & 1 : 1);
+		got |= level << k;
+	}
+	int64_t stop_t = e[0] + (int64_t) (10.5 * VMC_BIT_NS);
+	bool framing = stop_t < e[10];
+	if (got != word || framing) s_st.tx_errors++;
+
+	if (!s_vmc.awaiting) return;    /* after a timeout, or a reply the VMC did not ask for */
+
+	if (s_vmc.reply_n == 0) {
+		s_vmc.reply_first = e[0];
+		int64_t rt = e[0] - s_vmc.frame_end;
+		if (rt < 0) s_st.early++;
+		series_add(&s_st.resp[s_vmc.kind], rt, s_opt.t_response_us * US);
+		if (e[0] > s_vmc.deadline) {
+			s_vmc.reply_late = true;
+			s_st.late++;
+			s_st.timeouts++;
+		}
+		if (s_opt.verbose) printf("%12.6f  reply     %.3f ms\n", e[0] / 1e9, rt / 1e6);
+	} else {
+		series_add(&s_st.gap, e[0] - s_vmc.reply_last_end, INTER_BYTE_NS);
+	}
+
+	if (s_vmc.reply_n < FRAME_MAX) {
+		s_vmc.reply[s_vmc.reply_n] = framing ? 0xffff : got;
+		s_vmc.reply_sent[s_vmc.reply_n++] = word;
+	}
+	s_vmc.reply_last_end = e[WORD_BITS];
+
+	if (word & BIT_MODE_SET) vmc_reply_done();
+}
+
+static uint32_t sim_mdb_rx_pending(void *ctx) {
+	uint32_t n = 0;
+	for (size_t i = 0; i < s_rx.n && s_rx.q[(s_rx.head + i) % RXQ_MAX].post <= s_now; i++) n++;
+	return n;
+}
+
+static int64_t sim_now_us(void *ctx) {
+	return s_now / US;
+}
+
+static int64_t sim_time_s(void *ctx) {
+	return 1767225600 + s_now / SEC;     /* 2026-01-01 */
+}
+
+static void sim_delay_ms(uint32_t ms, void *ctx) {
+	s_now += (int64_t) ms * MS;
+}
+
+static bool sim_publish(hal_pub_class_t cls, const char *topic, const char *data, int len, void *ctx) {
+	// Every line the core publishes is signed first.
+	s_now = core_run(s_now, (int64_t) ((s_opt.hmac_us + s_opt.publish_us) * US));
+	s_st.hmacs++;
+	s_st.publishes++;
+	if (s_opt.verbose) printf("%12.6f  publish   %s %.*s\n", s_now / 1e9, topic, len, data);
+	return true;
+}
+
+static void sim_ble_notify(const char *data, int len, void *ctx) {
+	// ble_encode_with_passkey() signed the payload, whether or not a phone is connected.
+	s_now = core_run(s_now, (int64_t) (s_opt.hmac_us * US));
+	s_st.hmacs++;
+}
+
+static bool sim_take_credit(mdb_credit_t *credit) {
+	if (s_vmc.phase != PH_RUN || s_vmc.session != SES_NONE || s_vmc.credit_at > s_now) return false;
+
+	// One customer at a time: whoever came by during a session pays once it is over.
+	int64_t at = s_vmc.credit_at > s_vmc.idle_since ? s_vmc.credit_at : s_vmc.idle_since;
+	char corr[9];
+	snprintf(corr, sizeof(corr), "s%07u", s_vmc.credit_seq++ % 10000000);
+
+	memset(credit, 0, sizeof(*credit));
+	credit->funds = s_opt.funds;
+	credit->ble_conn = 0xffff;
+	credit_probe_start(&credit->probe, corr, 0, at / US, at / US);
+	credit_probe_mark(&credit->probe, PROBE_QUEUED);
+
+	s_vmc.credit_taken = at;
+	s_vmc.credit_at = s_opt.saturate ? INT64_MAX / 4 : s_now + rnd_gap_ns(s_opt.sessions_per_hour / 3600);
+	return true;
+}
+
+// ------------------------------------------------------------------ main
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d, --duration S          virtual run time, s (3600)\n"
+		"  -s, --seed N              (1)\n"
+		"  -v, --verbose             print every frame\n"
+		"VMC and bus:\n"
+		"      --poll-ms MS          POLL period (50)\n"
+		"      --peers N             other peripherals polled each cycle (2)\n"
+		"      --peer-resp-us US     their response time (400)\n"
+		"      --t-response-us US    reply deadline (5000)\n"
+		"      --vmc-ack-us US       VMC's ACK after a data reply (100)\n"
+		"      --frame-gap-us US     idle bus between frames (200)\n"
+		"      --retries N           retries before a RESET (3)\n"
+		"      --ret                 answer a bad reply with RET instead of NAK\n"
+		"      --reset-every-s S     RESET the reader every S s (0: never)\n"
+		"customers:\n"
+		"      --sessions-per-hour R credits, Poisson (60)\n"
+		"      --saturate            next credit --think-s after each session ends\n"
+		"      --think-s S           (5)\n"
+		"      --cash-per-hour R     cash sales (30)\n"
+		"      --select-s S          mean choice time (3)\n"
+		"      --dispense-s S        mean dispensing time (4)\n"
+		"      --fail-ratio F        vends that fail (0.02)\n"
+		"      --deny-ratio F        selections over the credit (0.05)\n"
+		"      --funds N             credit, in VMC units (500)\n"
+		"board:\n"
+		"      --rxq N               RX queue depth (16)\n"
+		"      --isr-latency-us US   edge to ISR entry (2)\n"
+		"      --irq-rate R          ISR bursts per s on the MDB core (1000: the tick)\n"
+		"      --irq-us US           their mean length (3)\n"
+		"      --flash-rate R        flash stalls per s (0)\n"
+		"      --flash-us US         their length (0)\n"
+		"      --read-us US          task time per word read (6)\n"
+		"      --hmac-us US          task time per signature (60; core-bench ble.encode)\n"
+		"      --publish-us US       task time per publish (40)\n"
+		"output:\n"
+		"      --json FILE           numbers as JSON ('-': stdout)\n"
+		"      --fail-on-miss        exit 1 if any reply missed its deadline\n",
+		argv0);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	static const struct option longopts[] = {
+		{ "duration", required_argument, 0, 'd' }, { "seed", required_argument, 0, 's' },
+		{ "verbose", no_argument, 0, 'v' },
+		{ "poll-ms", required_argument, 0, 1 }, { "peers", required_argument, 0, 2 },
+		{ "peer-resp-us", required_argument, 0, 3 }, { "t-response-us", required_argument, 0, 4 },
+		{ "vmc-ack-us", required_argument, 0, 5 }, { "frame-gap-us", required_argument, 0, 6 },
+		{ "retries", required_argument, 0, 7 }, { "ret", no_argument, 0, 8 },
+		{ "reset-every-s", required_argument, 0, 9 }, { "sessions-per-hour", required_argument, 0, 10 },
+		{ "saturate", no_argument, 0, 11 }, { "think-s", required_argument, 0, 12 },
+		{ "cash-per-hour", required_argument, 0, 13 }, { "select-s", required_argument, 0, 14 },
+		{ "dispense-s", required_argument, 0, 15 }, { "fail-ratio", required_argument, 0, 16 },
+		{ "deny-ratio", required_argument, 0, 17 }, { "funds", required_argument, 0, 18 },
+		{ "rxq", required_argument, 0, 19 }, { "isr-latency-us", required_argument, 0, 20 },
+		{ "irq-rate", required_argument, 0, 21 }, { "irq-us", required_argument, 0, 22 },
+		{ "flash-rate", required_argument, 0, 23 }, { "flash-us", required_argument, 0, 24 },
+		{ "read-us", required_argument, 0, 25 }, { "hmac-us", required_argument, 0, 26 },
+		{ "publish-us", required_argument, 0, 27 }, { "json", required_argument, 0, 28 },
+		{ "fail-on-miss", no_argument, 0, 29 }, { "help", no_argument, 0, 'h' },
+		{ 0 }
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "d:s:vh", longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'd': s_opt.duration_s = atof(optarg); break;
+		case 's': s_opt.seed = strtoull(optarg, NULL, 0); break;
+		case 'v': s_opt.verbose = true; break;
+		case 1:   s_opt.poll_ms = strtoul(optarg, NULL, 0); break;
+		case 2:   s_opt.peers = strtoul(optarg, NULL, 0); break;
+		case 3:   s_opt.peer_resp_us = strtoul(optarg, NULL, 0); break;
+		case 4:   s_opt.t_response_us = strtoul(optarg, NULL, 0); break;
+		case 5:   s_opt.vmc_ack_us = strtoul(optarg, NULL, 0); break;
+		case 6:   s_opt.frame_gap_us = strtoul(optarg, NULL, 0); break;
+		case 7:   s_opt.retries = strtoul(optarg, NULL, 0); break;
+		case 8:   s_opt.ret = true; break;
+		case 9:   s_opt.reset_every_s = strtoul(optarg, NULL, 0); break;
+		case 10:  s_opt.sessions_per_hour = atof(optarg); break;
+		case 11:  s_opt.saturate = true; break;
+		case 12:  s_opt.think_s = atof(optarg); break;
+		case 13:  s_opt.cash_per_hour = atof(optarg); break;
+		case 14:  s_opt.select_s = atof(optarg); break;
+		case 15:  s_opt.dispense_s = atof(optarg); break;
+		case 16:  s_opt.fail_ratio = atof(optarg); break;
+		case 17:  s_opt.deny_ratio = atof(optarg); break;
+		case 18:  s_opt.funds = strtoul(optarg, NULL, 0); break;
+		case 19:  s_opt.rxq = strtoul(optarg, NULL, 0); break;
+		case 20:  s_opt.isr_latency_us = strtoul(optarg, NULL, 0); break;
+		case 21:  s_opt.irq_rate = atof(optarg); break;
+		case 22:  s_opt.irq_us = atof(optarg); break;
+		case 23:  s_opt.flash_rate = atof(optarg); break;
+		case 24:  s_opt.flash_us = atof(optarg); break;
+		case 25:  s_opt.read_us = atof(optarg); break;
+		case 26:  s_opt.hmac_us = atof(optarg); break;
+		case 27:  s_opt.publish_us = atof(optarg); break;
+		case 28:  s_opt.json = optarg; break;
+		case 29:  s_opt.fail_on_miss = true; break;
+		default:  usage(argv[0]);
+		}
+	}
+	if (s_opt.duration_s <= 0 || s_opt.poll_ms == 0 || s_opt.rxq == 0 || s_opt.rxq > RXQ_MAX || s_opt.funds == 0 || s_opt.funds > 0xfffe) usage(argv[0]);
+	if (s_opt.irq_us <= 0) s_opt.irq_rate = 0;
+	if (s_opt.flash_us <= 0) s_opt.flash_rate = 0;
+
+	s_rng = s_opt.seed;
+	s_end = (int64_t) (s_opt.duration_s * SEC);
+	s_load.next[0] = rnd_gap_ns(s_opt.irq_rate);
+	s_load.next[1] = rnd_gap_ns(s_opt.flash_rate);
+
+	for (int k = 0; k < CMD_KINDS; k++) s_st.resp[k].name = s_cmd_name[k];
+
+	s_vmc.next_poll = 0;
+	s_vmc.next_cash = rnd_gap_ns(s_opt.cash_per_hour / 3600);
+	s_vmc.next_reset = (int64_t) s_opt.reset_every_s * SEC;
+	s_vmc.credit_at = s_opt.saturate ? 0 : rnd_gap_ns(s_opt.sessions_per_hour / 3600);
+	s_vmc.frame_end = s_vmc.deadline = 0;
+
+	hal_posix_hooks_t hooks = {
+		.mdb_read = sim_mdb_read,
+		.mdb_write = sim_mdb_write,
+		.mdb_rx_pending = sim_mdb_rx_pending,
+		.now_us = sim_now_us,
+		.time_s = sim_time_s,
+		.delay_ms = sim_delay_ms,
+		.publish = sim_publish,
+		.ble_notify = sim_ble_notify,
+	};
+	hal_posix_set_hooks(&hooks);
+
+	rpc_auth_set_key(my_passkey);
+	credit_probe_init();
+
+	mdb_cashless_hooks_t core_hooks = { .take_credit = sim_take_credit };
+	hal_mdb_init();
+	mdb_cashless_init(&core_hooks);
+
+	for (;;) {
+		mdb_cashless_poll();
+	}
+}
@@ -0,0 +1,29 @@
+/*
+ * sdkconfig.h — the Kconfig values the portable core reads, for the host build.
+ *
+ * Defaults of main/Kconfig.projbuild; override any of them on the compiler
+ * line (-DCONFIG_MDB_SCALE_FACTOR=10). Tracing is compiled out: trace.c and
+ * its rings are board-only.
+ */
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+#ifndef CONFIG_CASHLESS_DEVICE_ADDRESS
+#define CONFIG_CASHLESS_DEVICE_ADDRESS 16
+#endif
+
+#ifndef CONFIG_MDB_CURRENCY_CODE
+#define CONFIG_MDB_CURRENCY_CODE 65535
+#endif
+
+#ifndef CONFIG_MDB_SCALE_FACTOR
+#define CONFIG_MDB_SCALE_FACTOR 1
+#endif
+
+#ifndef CONFIG_MDB_DECIMAL_PLACES
+#define CONFIG_MDB_DECIMAL_PLACES 2
+#endif
+
+#define CONFIG_VMFLOW_TRACE_RECORDS 0
+
+#endif /* HOST_SDKCONFIG_H */
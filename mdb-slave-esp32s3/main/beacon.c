@@ -0,0 +1,83 @@
+#include "beacon.h"
+
+#include <string.h>
+#include <time.h>
+#include <sdkconfig.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+
+#include "mdb-cashless.h"
+#include "nimble.h"
+#include "rpc-auth.h"
+#include "timesync.h"
+
+static esp_timer_handle_t s_refresh;
+static esp_timer_handle_t s_now;
+static uint8_t s_state;
+static uint32_t s_nonce;
+
+static void beacon_put_u16(uint8_t *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void beacon_put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// esp_timer task: sign the current state and hand it to the advertiser.
+static void beacon_publish(void *arg) {
+	uint8_t state = __atomic_load_n(&s_state, __ATOMIC_RELAXED);
+	bool clock = timesync_source() != TIMESYNC_NONE;
+
+	uint8_t flags = 0;
+	if (state >= ENABLED_STATE) flags |= BEACON_F_READER;
+	if (state >= IDLE_STATE) flags |= BEACON_F_SESSION;
+	if (clock) flags |= BEACON_F_CLOCK;
+	if (ble_conn_slots_free() > 0) flags |= BEACON_F_SLOT_FREE;
+
+	uint8_t b[BEACON_LEN];
+	b[0] = 0xff;
+	b[1] = 0xff;
+	b[2] = BEACON_VERSION;
+	b[3] = state;
+	b[4] = flags;
+	beacon_put_u16(&b[5], CONFIG_MDB_CURRENCY_CODE);
+	b[7] = CONFIG_MDB_SCALE_FACTOR;
+	b[8] = CONFIG_MDB_DECIMAL_PLACES;
+	beacon_put_u32(&b[9], s_nonce++);
+	beacon_put_u32(&b[13], clock ? (uint32_t) time(NULL) : 0);
+
+	unsigned char hmac[32];
+	calculate_hmac((const char*) &b[2], 15, hmac);
+	memcpy(&b[17], hmac, 4);
+
+	ble_beacon_set(b, sizeof(b));
+}
+
+void beacon_init(void) {
+	s_nonce = esp_random();
+
+	const esp_timer_create_args_t refresh_args = {
+		.callback = &beacon_publish,
+		.name = "beacon",
+	};
+	esp_timer_create(&refresh_args, &s_refresh);
+	esp_timer_create(&refresh_args, &s_now);
+
+	esp_timer_start_periodic(s_refresh, BEACON_REFRESH_SEC * 1000000LL);
+}
+
+void beacon_refresh(void) {
+	// Already pending: that run reads the latest state.
+	if (s_now && !esp_timer_is_active(s_now)) esp_timer_start_once(s_now, 0);
+}
+
+void beacon_update(uint8_t machine_state) {
+	if (__atomic_exchange_n(&s_state, machine_state, __ATOMIC_RELAXED) == machine_state) return;
+
+	beacon_refresh();
+}
@@ -0,0 +1,46 @@
+/*
+ * beacon — signed machine status in a connectionless BLE advertisement.
+ *
+ * A phone learns whether the machine can sell before it connects: a second
+ * advertising set (BLE 5 extended, non-connectable, nimble.c) carries the
+ * service UUID and this manufacturer data, refreshed whenever machine_state
+ * changes and every BEACON_REFRESH_SEC:
+ *
+ *   [0-1] company 0xffff (none) | [2] version (1) | [3] machine state |
+ *   [4] flags | [5-6] currency u16 (MDB code) | [7] scale factor |
+ *   [8] decimal places | [9-12] nonce u32 | [13-16] TIME u32 |
+ *   [17-20] HMAC-SHA256(passkey, bytes 2-16)[:4]
+ *
+ * Multi-byte fields after the company id are big-endian, like the GATT
+ * payload. State: 0 inactive, 1 disabled, 2 enabled, 3 session idle, 4 vend.
+ * Flags: bit 0 reader enabled, bit 1 session open, bit 2 clock set (TIME
+ * valid), bit 3 a GATT connection slot is free. The nonce starts at a random
+ * value and steps on every refresh, so each advertisement is distinct and an
+ * app can drop a replayed one; TIME lets it check freshness like a credit.
+ */
+#ifndef BEACON_H
+#define BEACON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BEACON_LEN          21
+#define BEACON_VERSION      1
+#define BEACON_REFRESH_SEC  30
+
+#define BEACON_F_READER     0x01
+#define BEACON_F_SESSION    0x02
+#define BEACON_F_CLOCK      0x04
+#define BEACON_F_SLOT_FREE  0x08
+
+/* Start the refresh timer. Call before ble_init(). */
+void beacon_init(void);
+
+/* Re-sign and re-advertise now, e.g. once the BLE host has synced. */
+void beacon_refresh(void);
+
+/* Report the MDB state. Cheap and non-blocking (safe on the MDB task): the
+ * advertisement is re-signed and updated on the esp_timer task. */
+void beacon_update(uint8_t machine_state);
+
+#endif /* BEACON_H */
@@ -0,0 +1,228 @@
+#include "ble-cmd.h"
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "nimble.h"
+#include "metrics.h"
+#include "trace.h"
+#include "rpc-auth.h"
+
+#define TAG "ble_cmd"
+
+#define PASSKEY_MAX         18      // PASSKEY_LEN in the main translation unit
+
+typedef struct {
+	uint16_t conn_handle;
+	uint8_t len;
+	char data[BLE_CMD_MSG_MAX + 1];
+} ble_cmd_msg_t;
+
+// Messages move by pointer: s_free holds the unused ones, s_work the ones waiting for the worker.
+static ble_cmd_msg_t s_pool[BLE_CMD_POOL];
+static QueueHandle_t s_free;
+static QueueHandle_t s_work;
+
+static metric_t s_m_run = METRIC_COUNTER("ble.cmd");
+static metric_t s_m_failed = METRIC_COUNTER("ble.cmd_fail");
+static metric_t s_m_busy = METRIC_COUNTER("ble.cmd_busy");
+static metric_t s_m_ms = METRIC_HISTOGRAM("ble.cmd_ms", 10, 100, 1000);
+static metric_t s_m_frames = METRIC_COUNTER("ble.v2_frames");
+static metric_t s_m_bad = METRIC_COUNTER("ble.v2_bad");
+
+static const ble_command_t *s_commands;
+static size_t s_command_count;
+
+static void ble_cmd_ack(uint16_t conn_handle, uint8_t code, ble_cmd_result_t result) {
+	char ack[3] = { BLE_CMD_ACK, code, result };
+	ble_notify_send(conn_handle, ack, sizeof(ack));
+}
+
+static const ble_command_t *ble_cmd_lookup(uint8_t code) {
+	for (size_t i = 0; i < s_command_count; i++) {
+		if (s_commands[i].code == code) return &s_commands[i];
+	}
+	return NULL;
+}
+
+// Look the command up and run it; the caller reports the result.
+static ble_cmd_result_t ble_cmd_exec(const ble_cmd_req_t *req) {
+	uint8_t code = req->payload[0];
+	const ble_command_t *command = ble_cmd_lookup(code);
+
+	if (command == NULL) {
+		ESP_LOGW(TAG, "unknown command 0x%02x", code);
+		return BLE_CMD_UNKNOWN;
+	}
+
+	int64_t t0 = esp_timer_get_time();
+	esp_err_t err = req->len >= command->min_len ? command->handler(req) : ESP_ERR_INVALID_SIZE;
+
+	metric_inc(&s_m_run);
+	metric_observe(&s_m_ms, (esp_timer_get_time() - t0) / 1000);
+	trace_emit(TRACE_BLE_CMD, code, (uint32_t) err);
+
+	if (err != ESP_OK) {
+		metric_inc(&s_m_failed);
+		ESP_LOGW(TAG, "command 0x%02x failed: %s", code, esp_err_to_name(err));
+	}
+
+	return err == ESP_OK ? BLE_CMD_OK : BLE_CMD_REJECTED;
+}
+
+static uint32_t ble_cmd_get_u32(const uint8_t *p) {
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// Walk the records between the header and the tag. Returns the count, or -1 if they do not tile the body exactly.
+static int ble_v2_records(const uint8_t *body, size_t len, const uint8_t **records) {
+	int n = 0;
+	size_t at = 0;
+
+	while (at < len) {
+		if (n == BLE_V2_RECORDS_MAX || len - at < 2 || len - at - 2 < body[at + 1]) return -1;
+		records[n++] = &body[at];
+		at += 2 + body[at + 1];
+	}
+	return n;
+}
+
+// Verify a v2 frame and run its records; one notification answers the whole frame.
+static void ble_cmd_run_v2(const ble_cmd_msg_t *msg) {
+	const uint8_t *frame = (const uint8_t*) msg->data;
+	const uint8_t *records[BLE_V2_RECORDS_MAX];
+	uint8_t reply[7 + BLE_V2_RECORDS_MAX] = { BLE_V2_MAGIC };
+	int n = -1;
+
+	metric_inc(&s_m_frames);
+
+	if (msg->len >= 5 + BLE_V2_TAG_LEN) {
+		memcpy(&reply[1], &frame[1], 4);
+		n = ble_v2_records(&frame[5], msg->len - 5 - BLE_V2_TAG_LEN, records);
+	}
+
+	// Key: the device passkey, or while there is none the one this frame provisions (0x01 record).
+	const uint8_t *tofu = NULL;
+	uint8_t tofu_len = 0;
+	bool verified = false;
+	uint32_t nonce;
+
+	for (int i = 0; i < n && !rpc_auth_has_key(); i++) {
+		if (records[i][0] == 0x01 && records[i][1] >= 1 && records[i][1] <= PASSKEY_MAX && !memchr(&records[i][2], '\0', records[i][1])) {
+			tofu = &records[i][2];
+			tofu_len = records[i][1];
+		}
+	}
+
+	if (n >= 0 && (tofu || rpc_auth_has_key()) && ble_conn_nonce(msg->conn_handle, &nonce)) {
+		uint8_t signed_data[4 + BLE_CMD_MSG_MAX];
+		size_t signed_len = msg->len - BLE_V2_TAG_LEN;
+		signed_data[0] = nonce >> 24;
+		signed_data[1] = nonce >> 16;
+		signed_data[2] = nonce >> 8;
+		signed_data[3] = nonce;
+		memcpy(&signed_data[4], frame, signed_len);
+
+		unsigned char hmac[32];
+		if (tofu) calculate_hmac_with_key((const char*) tofu, tofu_len, signed_data, 4 + signed_len, hmac);
+		else calculate_hmac((const char*) signed_data, 4 + signed_len, hmac);
+
+		uint8_t diff = 0;
+		for (int x = 0; x < BLE_V2_TAG_LEN; x++) {
+			diff |= hmac[x] ^ frame[signed_len + x];
+		}
+
+		// The SEQ only moves for a genuine frame: a forged one cannot burn sequence numbers.
+		verified = diff == 0 && ble_conn_seq_advance(msg->conn_handle, ble_cmd_get_u32(&frame[1]));
+	}
+
+	if (!verified) {
+		metric_inc(&s_m_bad);
+		ESP_LOGW(TAG, "v2 frame rejected (%u bytes)", msg->len);
+		reply[5] = BLE_CMD_REJECTED;
+		ble_notify_send(msg->conn_handle, (const char*) reply, 7);
+		return;
+	}
+
+	for (int i = 0; i < n; i++) {
+		// Rebuilt in v1 layout, NUL-terminated, so the handlers read arguments the same way.
+		char payload[BLE_CMD_MSG_MAX + 1];
+		size_t len = 1 + records[i][1];
+		payload[0] = records[i][0];
+		memcpy(&payload[1], &records[i][2], records[i][1]);
+		payload[len] = '\0';
+
+		ble_cmd_req_t req = { .conn_handle = msg->conn_handle, .authenticated = true, .payload = payload, .len = len };
+		reply[7 + i] = ble_cmd_exec(&req);
+	}
+
+	reply[5] = BLE_CMD_OK;
+	reply[6] = n;
+	ble_notify_send(msg->conn_handle, (const char*) reply, 7 + n);
+}
+
+static void ble_cmd_run(const ble_cmd_msg_t *msg) {
+	if ((uint8_t) msg->data[0] == BLE_V2_MAGIC) {
+		ble_cmd_run_v2(msg);
+		return;
+	}
+
+	ble_cmd_req_t req = { .conn_handle = msg->conn_handle, .payload = msg->data, .len = msg->len };
+	ble_cmd_ack(msg->conn_handle, msg->data[0], ble_cmd_exec(&req));
+}
+
+static void ble_cmd_task(void *arg) {
+	ble_cmd_msg_t *msg;
+
+	for (;;) {
+		if (xQueueReceive(s_work, &msg, portMAX_DELAY) != pdTRUE) continue;
+
+		ble_cmd_run(msg);
+		xQueueSend(s_free, &msg, 0);
+	}
+}
+
+void ble_cmd_init(const ble_command_t *commands, size_t count) {
+	s_commands = commands;
+	s_command_count = count;
+
+	s_free = xQueueCreate(BLE_CMD_POOL, sizeof(ble_cmd_msg_t *));
+	s_work = xQueueCreate(BLE_CMD_POOL, sizeof(ble_cmd_msg_t *));
+
+	for (size_t i = 0; i < BLE_CMD_POOL; i++) {
+		ble_cmd_msg_t *msg = &s_pool[i];
+		xQueueSend(s_free, &msg, 0);
+	}
+
+	metrics_register(&s_m_run);
+	metrics_register(&s_m_failed);
+	metrics_register(&s_m_busy);
+	metrics_register(&s_m_ms);
+	metrics_register(&s_m_frames);
+	metrics_register(&s_m_bad);
+
+	xTaskCreatePinnedToCore(ble_cmd_task, "ble_cmd", 4096, NULL, 5, NULL, 0);
+}
+
+bool ble_cmd_submit(uint16_t conn_handle, const uint8_t *data, size_t len) {
+	ble_cmd_msg_t *msg;
+
+	if (s_free == NULL || xQueueReceive(s_free, &msg, 0) != pdTRUE) {
+		metric_inc(&s_m_busy);
+		ble_cmd_ack(conn_handle, data[0], BLE_CMD_BUSY);
+		return false;
+	}
+
+	msg->conn_handle = conn_handle;
+	msg->len = len;
+	memcpy(msg->data, data, len);
+	msg->data[len] = '\0';
+
+	// The work queue is as deep as the pool, so a message taken from s_free always fits.
+	xQueueSend(s_work, &msg, 0);
+	return true;
+}
@@ -0,0 +1,105 @@
+/*
+ * ble_cmd — phone commands, run off the NimBLE host task.
+ *
+ * A write to the GATT characteristic is only copied into a message from a
+ * fixed pool (BLE_CMD_POOL messages of up to BLE_CMD_MSG_MAX bytes) and
+ * queued; the write is acknowledged at once. A worker task takes the
+ * messages in order, looks the first byte up in a command table and runs its
+ * handler, so NVS commits and Wi-Fi reconfiguration never stall the host
+ * task: connection events and notifications keep flowing meanwhile, and
+ * a write can no longer overwrite a command still being handled.
+ *
+ * v1 — one command per write, byte 0 the command. When the handler returns,
+ * the phone that wrote gets a 3-byte notification
+ *
+ *   [0] 0x0e | [1] command | [2] result: 0 ok, 1 rejected, 2 unknown command, 3 busy
+ *
+ * "busy" is sent from the host task when no message is free. The 19-byte
+ * vend notifications (0x0a-0x0d) are unchanged. Adding a command is a table
+ * entry.
+ *
+ * v2 — several commands in one authenticated write. After connecting, the
+ * device starts the MTU exchange (BLE_V2_MTU), data length extension and a
+ * switch to the 2M PHY; a phone that does not support one simply stays on
+ * the default. Reading the characteristic returns the connection's hello
+ *
+ *   [0] 0xb2 | [1] version (2) | [2-5] NONCE u32 | [6-7] ATT MTU u16 |
+ *   [8] flags: bit 0 passkey provisioned, bit 1 2M PHY in use
+ *
+ * (read it again after the MTU exchange to see the final MTU). A v2 write is
+ *
+ *   [0] 0xb2 | [1-4] SEQ u32 | records... | TAG (16 bytes)
+ *   record: [0] command | [1] LEN | [2..2+LEN) arguments, as after the v1 command byte
+ *   TAG = HMAC-SHA256(passkey, NONCE || bytes 0..n-16)[:16]
+ *
+ * big-endian like the v1 payload. SEQ must grow on every frame of the
+ * connection and NONCE is fresh per connection, so a frame cannot be replayed
+ * on this or any other link; records are then trusted as is (0x03 needs no
+ * signed 19-byte payload). On a device without a passkey the frame is keyed
+ * with the passkey carried in its own 0x01 record, so domain, passkey, SSID
+ * and password provision in one write. The records run in order, even after
+ * one fails, and the phone gets a single notification
+ *
+ *   [0] 0xb2 | [1-4] SEQ | [5] frame result | [6] n | [7..7+n) result per record
+ *
+ * A frame that fails verification runs nothing: frame result 1, n = 0.
+ * Byte 0xb2 is outside the v1 command range, so both framings share the
+ * characteristic.
+ */
+#ifndef BLE_CMD_H
+#define BLE_CMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#define BLE_V2_MTU          247
+#define BLE_V2_DATA_LEN     251         /* LL payload octets (DLE) */
+#define BLE_V2_DATA_TIME    2120        /* us for BLE_V2_DATA_LEN on 1M; 2M needs less */
+
+#define BLE_CMD_MSG_MAX     (BLE_V2_MTU - 3)
+#define BLE_CMD_POOL        4
+
+#define BLE_CMD_ACK         0x0e
+
+#define BLE_V2_MAGIC        0xb2
+#define BLE_V2_VERSION      2
+#define BLE_V2_HELLO_LEN    9
+#define BLE_V2_TAG_LEN      16
+#define BLE_V2_RECORDS_MAX  8
+
+#define BLE_V2_F_PROVISIONED    0x01
+#define BLE_V2_F_PHY_2M         0x02
+
+typedef enum {
+	BLE_CMD_OK = 0,
+	BLE_CMD_REJECTED,
+	BLE_CMD_UNKNOWN,
+	BLE_CMD_BUSY,
+} ble_cmd_result_t;
+
+typedef struct {
+	uint16_t conn_handle;
+	bool authenticated;     /* a record of a verified v2 frame */
+	const char *payload;    /* [0] command byte, NUL-terminated after len bytes */
+	size_t len;
+} ble_cmd_req_t;
+
+/* Run a command written by req->conn_handle. */
+typedef esp_err_t (*ble_cmd_handler_t)(const ble_cmd_req_t *req);
+
+typedef struct {
+	uint8_t code;
+	uint8_t min_len;        /* shorter commands (command byte included) are rejected without running the handler */
+	ble_cmd_handler_t handler;
+} ble_command_t;
+
+/* Register the command table (kept by reference) and start the worker task. */
+void ble_cmd_init(const ble_command_t *commands, size_t count);
+
+/* Copy a write of 1..BLE_CMD_MSG_MAX bytes into a pooled message and queue it.
+ * Never blocks; called on the host task. Returns false, after notifying "busy", if no message is free. */
+bool ble_cmd_submit(uint16_t conn_handle, const uint8_t *data, size_t len);
+
+#endif /* BLE_CMD_H */
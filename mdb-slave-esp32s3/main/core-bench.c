@@ -0,0 +1,310 @@
+#include "core-bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "rpc-auth.h"
+#include "eva-dts-link.h"
+#include "mdb-cashless.h"
+#include "pax-set.h"
+#include "pax-stats.h"
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#include <esp_cpu.h>
+#include <esp_rom_sys.h>
+
+#define BENCH_TARGET    CONFIG_IDF_TARGET
+#define BENCH_CLOCK     "cycles"
+
+static inline uint32_t bench_ticks(void) {
+	return esp_cpu_get_cycle_count();
+}
+
+static double bench_tick_ns(void) {
+	return 1000.0 / esp_rom_get_cpu_ticks_per_us();
+}
+#else
+#include <time.h>
+
+#define BENCH_TARGET    "linux"
+#define BENCH_CLOCK     "ns"
+
+// Nanoseconds, wrapping like the cycle counter; a batch is far shorter than the 4 s period.
+static inline uint32_t bench_ticks(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+
+static double bench_tick_ns(void) {
+	return 1.0;
+}
+#endif
+
+#define BENCH_BATCH_NS      2000000.0
+#define BENCH_DEX_BYTES     8192
+#define BENCH_PAX_PHONES    1024
+
+// Results land here, so the compiler cannot drop a kernel.
+static volatile uint32_t s_sink;
+
+static struct {
+	char line[256];
+	char rpc[128];
+	size_t rpc_prefix;
+	char *dex;
+	uint8_t ble[19];
+	uint8_t (*phones)[6];
+	pax_set_t *set[4];
+	uint32_t set_fill[4];
+	pax_stats_t *stats;
+} s_fx;
+
+static void phone_addr(uint32_t i, uint8_t addr[6]) {
+	uint32_t x = i * 0x9e3779b9u;
+	addr[0] = x; addr[1] = x >> 8; addr[2] = x >> 16; addr[3] = x >> 24;
+	addr[4] = i >> 3;
+	addr[5] = 0x40 | (i & 0x3f);      /* resolvable private */
+}
+
+// ------------------------------------------------------------------ kernels
+
+static void k_hmac_ble(uint32_t n, void *arg) {
+	unsigned char hmac[32];
+	for (uint32_t i = 0; i < n; i++) {
+		calculate_hmac((const char *) s_fx.ble, 15, hmac);
+		s_sink += hmac[0];
+	}
+}
+
+static void k_hmac_256(uint32_t n, void *arg) {
+	unsigned char hmac[32];
+	for (uint32_t i = 0; i < n; i++) {
+		calculate_hmac(s_fx.line, 256, hmac);
+		s_sink += hmac[0];
+	}
+}
+
+static void k_rpc_verify(uint32_t n, void *arg) {
+	for (uint32_t i = 0; i < n; i++) {
+		s_sink += rpc_verify_hmac(s_fx.rpc, s_fx.rpc_prefix, s_fx.rpc + s_fx.rpc_prefix + 1);
+	}
+}
+
+static void k_rpc_sign(uint32_t n, void *arg) {
+	char out[96];
+	for (uint32_t i = 0; i < n; i++) {
+		rpc_sign_text("250:12:1760000000", out, sizeof(out));
+		s_sink += (uint8_t) out[20];
+	}
+}
+
+static void k_crc16_dex(uint32_t n, void *arg) {
+	for (uint32_t i = 0; i < n; i++) {
+		uint16_t crc = 0;
+		for (size_t b = 0; b < BENCH_DEX_BYTES; b++) calc_crc_16(&crc, &s_fx.dex[b]);
+		s_sink += crc;
+	}
+}
+
+static void k_ble_encode(uint32_t n, void *arg) {
+	uint8_t payload[19];
+	for (uint32_t i = 0; i < n; i++) {
+		ble_encode_with_passkey(0x0a, 250, i, payload);
+		s_sink += payload[15];
+	}
+}
+
+static void k_ble_verify(uint32_t n, void *arg) {
+	for (uint32_t i = 0; i < n; i++) {
+		s_sink += ble_payload_verify(s_fx.ble);
+	}
+}
+
+// A phone already in the set: the common case, every phone advertises many times a scan.
+static void k_pax_seen(uint32_t n, void *arg) {
+	uintptr_t k = (uintptr_t) arg;
+	uint32_t fill = s_fx.set_fill[k];
+	for (uint32_t i = 0, j = 0; i < n; i++) {
+		s_sink += pax_set_add(s_fx.set[k], s_fx.phones[j]);
+		if (++j == fill) j = 0;
+	}
+}
+
+// New phones on a full set: only the sketch takes them.
+static void k_pax_sketch(uint32_t n, void *arg) {
+	static uint32_t next = BENCH_PAX_PHONES;
+	uint8_t addr[6];
+	for (uint32_t i = 0; i < n; i++) {
+		phone_addr(next++, addr);
+		s_sink += pax_set_add(s_fx.set[3], addr);
+	}
+}
+
+static void k_pax_stats_add(uint32_t n, void *arg) {
+	for (uint32_t i = 0, j = 0; i < n; i++) {
+		pax_stats_add(s_fx.stats, s_fx.phones[j], -50 - (int8_t) (j & 31));
+		if (++j == 128) j = 0;
+	}
+}
+
+static void k_fmt_sale(uint32_t n, void *arg) {
+	char line[96];
+	for (uint32_t i = 0; i < n; i++) {
+		s_sink += mdb_sale_line(line, sizeof(line), 250, 12, 1760000000);
+	}
+}
+
+static void k_fmt_pax(uint32_t n, void *arg) {
+	char report[400];
+	for (uint32_t i = 0; i < n; i++) {
+		s_sink += pax_stats_format(s_fx.stats, report, sizeof(report));
+	}
+}
+
+static const core_bench_kernel_t s_kernels[] = {
+	{ "hmac.ble_payload",       k_hmac_ble, NULL },
+	{ "hmac.line_256",          k_hmac_256, NULL },
+	{ "rpc.verify_hmac",        k_rpc_verify, NULL },
+	{ "rpc.sign_text",          k_rpc_sign, NULL },
+	{ "crc16.dex_8k",           k_crc16_dex, NULL },
+	{ "ble.encode",             k_ble_encode, NULL },
+	{ "ble.verify",             k_ble_verify, NULL },
+	{ "pax_set.seen_16",        k_pax_seen, (void *) 0 },
+	{ "pax_set.seen_128",       k_pax_seen, (void *) 1 },
+	{ "pax_set.seen_384",       k_pax_seen, (void *) 2 },
+	{ "pax_set.sketch",         k_pax_sketch, NULL },
+	{ "pax_stats.add",          k_pax_stats_add, NULL },
+	{ "fmt.sale_line",          k_fmt_sale, NULL },
+	{ "fmt.pax_report",         k_fmt_pax, NULL },
+};
+
+// ------------------------------------------------------------------ fixtures
+
+static bool fixtures_init(void) {
+	for (size_t i = 0; i < sizeof(s_fx.line); i++) s_fx.line[i] = 'a' + i % 26;
+
+	snprintf(s_fx.rpc, sizeof(s_fx.rpc), "credit:500:1760000000");
+	s_fx.rpc_prefix = strlen(s_fx.rpc);
+	char signed_rpc[sizeof(s_fx.rpc)];
+	rpc_sign_text(s_fx.rpc, signed_rpc, sizeof(signed_rpc));
+	memcpy(s_fx.rpc, signed_rpc, sizeof(s_fx.rpc));
+
+	ble_encode_with_passkey(0x03, 250, 12, s_fx.ble);
+
+	s_fx.dex = malloc(BENCH_DEX_BYTES);
+	s_fx.phones = malloc(BENCH_PAX_PHONES * sizeof(*s_fx.phones));
+	s_fx.stats = malloc(sizeof(pax_stats_t));
+	for (int k = 0; k < 4; k++) s_fx.set[k] = malloc(sizeof(pax_set_t));
+	if (!s_fx.dex || !s_fx.phones || !s_fx.stats || !s_fx.set[0] || !s_fx.set[1] || !s_fx.set[2] || !s_fx.set[3]) return false;
+
+	// An audit is printable lines: "ID1*...\r\n".
+	for (size_t b = 0; b < BENCH_DEX_BYTES; b++) s_fx.dex[b] = b % 32 == 30 ? '\r' : b % 32 == 31 ? '\n' : '*' + b % 48;
+
+	for (uint32_t i = 0; i < BENCH_PAX_PHONES; i++) phone_addr(i, s_fx.phones[i]);
+
+	static const uint32_t fill[4] = { 16, 128, 384, BENCH_PAX_PHONES };
+	for (int k = 0; k < 4; k++) {
+		s_fx.set_fill[k] = fill[k];
+		pax_set_reset(s_fx.set[k], 0x5eed0000u + k);
+		for (uint32_t i = 0; i < fill[k]; i++) pax_set_add(s_fx.set[k], s_fx.phones[i]);
+	}
+
+	// A busy hour: 12 scans of 64 phones, half of them staying all hour.
+	pax_stats_reset(s_fx.stats, 0x5eed);
+	for (uint8_t slot = 0; slot < PAX_SLOTS; slot++) {
+		pax_stats_begin_scan(s_fx.stats, slot);
+		for (uint32_t i = 0; i < 64; i++) {
+			uint32_t phone = i < 32 ? i : 32 + slot * 32 + i;
+			pax_stats_add(s_fx.stats, s_fx.phones[phone % BENCH_PAX_PHONES], -45 - (int8_t) (i % 48));
+		}
+		pax_stats_end_scan(s_fx.stats, 3500);
+	}
+	return true;
+}
+
+static void fixtures_free(void) {
+	free(s_fx.dex);
+	free(s_fx.phones);
+	free(s_fx.stats);
+	for (int k = 0; k < 4; k++) free(s_fx.set[k]);
+	memset(&s_fx, 0, sizeof(s_fx));
+}
+
+// ------------------------------------------------------------------ timing
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+static void bench_one(const core_bench_kernel_t *k, double tick_ns, core_bench_out_t out, void *ctx) {
+	// Warm caches and lazy state, then grow the batch to BENCH_BATCH_NS.
+	k->run(1, k->arg);
+
+	uint32_t n = 1, ticks;
+	for (;;) {
+		uint32_t t0 = bench_ticks();
+		k->run(n, k->arg);
+		ticks = bench_ticks() - t0;
+		if (ticks * tick_ns >= BENCH_BATCH_NS || n >= (1u << 24)) break;
+		n *= 2;
+	}
+
+	uint32_t batch[BENCH_BATCHES];
+	for (int b = 0; b < BENCH_BATCHES; b++) {
+		uint32_t t0 = bench_ticks();
+		k->run(n, k->arg);
+		batch[b] = bench_ticks() - t0;
+	}
+	qsort(batch, BENCH_BATCHES, sizeof(batch[0]), cmp_u32);
+
+	double min = (double) batch[0] / n, p50 = (double) batch[BENCH_BATCHES / 2] / n;
+	char line[192];
+#ifdef ESP_PLATFORM
+	snprintf(line, sizeof(line), "{\"kernel\":\"%s\",\"n\":%lu,\"ns_min\":%.1f,\"ns_p50\":%.1f,\"cycles_min\":%.0f,\"cycles_p50\":%.0f}",
+		k->name, (unsigned long) n, min * tick_ns, p50 * tick_ns, min, p50);
+#else
+	snprintf(line, sizeof(line), "{\"kernel\":\"%s\",\"n\":%lu,\"ns_min\":%.1f,\"ns_p50\":%.1f}",
+		k->name, (unsigned long) n, min * tick_ns, p50 * tick_ns);
+#endif
+	out(line, ctx);
+
+	// Let the idle task run (task watchdog) between kernels.
+	hal_delay_ms(1);
+}
+
+static bool selected(const char *name, const char *filter) {
+	return filter == NULL || strncmp(name, filter, strlen(filter)) == 0;
+}
+
+void core_bench_run(const char *filter, const core_bench_kernel_t *extra, size_t n_extra, core_bench_out_t out, void *ctx) {
+	double tick_ns = bench_tick_ns();
+
+	char line[128];
+#ifdef ESP_PLATFORM
+	snprintf(line, sizeof(line), "{\"bench\":\"vmflow-core\",\"target\":\"%s\",\"clock\":\"%s\",\"cpu_mhz\":%.0f}",
+		BENCH_TARGET, BENCH_CLOCK, 1000.0 / tick_ns);
+#else
+	snprintf(line, sizeof(line), "{\"bench\":\"vmflow-core\",\"target\":\"%s\",\"clock\":\"%s\"}", BENCH_TARGET, BENCH_CLOCK);
+#endif
+	out(line, ctx);
+
+	if (!fixtures_init()) {
+		out("{\"error\":\"no memory for the fixtures\"}", ctx);
+		fixtures_free();
+		return;
+	}
+
+	for (size_t i = 0; i < sizeof(s_kernels) / sizeof(s_kernels[0]); i++) {
+		if (selected(s_kernels[i].name, filter)) bench_one(&s_kernels[i], tick_ns, out, ctx);
+	}
+	for (size_t i = 0; i < n_extra; i++) {
+		if (selected(extra[i].name, filter)) bench_one(&extra[i], tick_ns, out, ctx);
+	}
+
+	fixtures_free();
+}
@@ -0,0 +1,46 @@
+/*
+ * core_bench — microbenchmarks of the firmware core's hot kernels.
+ *
+ * The same kernels run on the board (CONFIG_VMFLOW_BENCH, at boot) and on
+ * Linux (host/core-bench):
+ *
+ *   hmac.*          calculate_hmac over a BLE payload and a 256-byte line
+ *   rpc.*           rpc_verify_hmac of a credit RPC, rpc_sign_text of a sale
+ *   crc16.*         calc_crc_16 over an 8 KB DEX audit
+ *   ble.*           ble_encode_with_passkey, ble_payload_verify
+ *   pax_set.*       pax_set_add of a phone already in the set, at several
+ *                   fill levels, and of new phones once the sketch counts
+ *   fmt.*           mdb_sale_line, pax_stats_format of a full hour
+ *
+ * Each kernel runs in batches of n calls, n doubled until a batch takes
+ * 2 ms; then BENCH_BATCHES batches are timed and the fastest and median
+ * per-call times reported. On the board the clock is the CPU cycle counter,
+ * on Linux CLOCK_MONOTONIC. One JSON object per line, after a header line:
+ *
+ *   {"bench":"vmflow-core","target":"esp32s3","clock":"cycles","cpu_mhz":240}
+ *   {"kernel":"ble.verify","n":64,"ns_min":45208.3,"ns_p50":45512.5,"cycles_min":10850,"cycles_p50":10923}
+ *
+ * (cpu_mhz and cycles_* on the board only.) tools/bench-diff.py compares two runs.
+ */
+#ifndef CORE_BENCH_H
+#define CORE_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_BATCHES       11
+
+typedef struct {
+	const char *name;
+	void (*run)(uint32_t n, void *arg);     /* n calls of the kernel */
+	void *arg;
+} core_bench_kernel_t;
+
+typedef void (*core_bench_out_t)(const char *line, void *ctx);
+
+/* Time the built-in kernels, then `extra` (a harness's own, may be NULL), whose
+ * name starts with `filter` (NULL: all). Every line goes to out, without '\n'.
+ * Uses the HMAC key set with rpc_auth_set_key(). */
+void core_bench_run(const char *filter, const core_bench_kernel_t *extra, size_t n_extra, core_bench_out_t out, void *ctx);
+
+#endif /* CORE_BENCH_H */
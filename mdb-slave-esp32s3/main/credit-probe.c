@@ -0,0 +1,70 @@
+#include "credit-probe.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "hal.h"
+#include "rpc-auth.h"
+#include "metrics.h"
+
+#define TAG "credit_probe"
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+static metric_t s_m_begin_ms = METRIC_HISTOGRAM("credit.begin_ms", 50, 100, 250, 500, 1000, 2500, 5000, 10000);
+
+void credit_probe_init(void) {
+	metrics_register(&s_m_begin_ms);
+}
+
+void credit_probe_start(credit_probe_t *p, const char *corr, uint32_t sent_s, int64_t received_us, int64_t verified_us) {
+	memset(p, 0, sizeof(*p));
+	snprintf(p->corr, sizeof(p->corr), "%s", corr);
+
+	p->t[PROBE_RECEIVED] = received_us;
+	p->t[PROBE_VERIFIED] = verified_us;
+
+	if (sent_s) {
+		// Wall time at receipt, in ms, against the sender's whole seconds.
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		int64_t received_ms = (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000 - (hal_now_us() - received_us) / 1000;
+		p->age_ms = (int32_t) (received_ms - (int64_t) sent_s * 1000);
+	}
+}
+
+void credit_probe_mark(credit_probe_t *p, credit_probe_stage_t stage) {
+	if (p->corr[0] == '\0' || p->t[stage] != 0) return;
+
+	p->t[stage] = hal_now_us();
+
+	if (stage == PROBE_BEGIN) metric_observe(&s_m_begin_ms, (uint32_t) ((p->t[PROBE_BEGIN] - p->t[PROBE_RECEIVED]) / 1000));
+}
+
+void credit_probe_outcome(credit_probe_t *p, const char *outcome) {
+	if (p->outcome == NULL) p->outcome = outcome;
+}
+
+void credit_probe_finish(credit_probe_t *p) {
+	if (p->corr[0] == '\0') return;
+
+	credit_probe_mark(p, PROBE_END);
+
+	char msg[160], line[240], topic[64];
+	int n = snprintf(msg, sizeof(msg), "%s,%s,%ld", p->corr, p->outcome ? p->outcome : "none", (long) p->age_ms);
+
+	for (int s = PROBE_VERIFIED; s < PROBE_STAGE_MAX; s++) {
+		long long dt = p->t[s] ? p->t[s] - p->t[PROBE_RECEIVED] : -1;
+		n += snprintf(msg + n, sizeof(msg) - n, ",%lld", dt);
+	}
+	snprintf(msg + n, sizeof(msg) - n, ":%lld", (long long) hal_time());
+
+	rpc_sign_text(msg, line, sizeof(line));
+	snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/latency", my_subdomain);
+	hal_publish(HAL_PUB_TELEMETRY, topic, line, 0);
+
+	p->corr[0] = '\0';
+}
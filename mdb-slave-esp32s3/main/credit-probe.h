@@ -0,0 +1,66 @@
+/*
+ * credit_probe — where the time goes between a credit and the vend.
+ *
+ * A credit carries a probe from the moment its RPC leaves the MQTT task to
+ * the end of the MDB session it opens. Each stage is stamped with hal_now_us():
+ *
+ *   received   RPC payload copied off the MQTT task (BLE: command written)
+ *   verified   HMAC and freshness checked on the rpc_exec task
+ *   queued     credit placed in the MDB session queue
+ *   begin      BEGIN SESSION answered to a VMC POLL
+ *   vend_req   first VEND REQUEST of the session
+ *   vend_done  VEND SUCCESS / FAILURE
+ *   end        SESSION COMPLETE (or RESET)
+ *
+ * The probe travels inside the session queue item, so the MDB task owns its
+ * copy once the session begins and no state is shared between cores. When
+ * the session ends, one signed line is published on
+ * domain.vmflow.xyz/<sub>/latency:
+ *
+ *   "<corr>,<outcome>,<age_ms>,<verified>,<queued>,<begin>,<vend_req>,<vend_done>,<end>:<ts>:<hmac>"
+ *
+ * <corr> is the RPC correlation id ("ble" for a phone credit), <outcome> one of
+ * vend / fail / denied / cancel / none / reset, <age_ms> the wall-clock age of
+ * the RPC's <ts> on receipt (broker and transit; whole-second resolution), and
+ * the stage fields microseconds since `received`, -1 when not reached.
+ */
+#ifndef CREDIT_PROBE_H
+#define CREDIT_PROBE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+	PROBE_RECEIVED = 0,
+	PROBE_VERIFIED,
+	PROBE_QUEUED,
+	PROBE_BEGIN,
+	PROBE_VEND_REQUEST,
+	PROBE_VEND_DONE,
+	PROBE_END,
+	PROBE_STAGE_MAX
+} credit_probe_stage_t;
+
+typedef struct {
+	char corr[9];           /* "" = no session being probed */
+	const char *outcome;
+	int32_t age_ms;
+	int64_t t[PROBE_STAGE_MAX];
+} credit_probe_t;
+
+/* Start a probe. sent_s is the sender's Unix time (0 if unknown); received_us and
+ * verified_us are hal_now_us() stamps. */
+void credit_probe_start(credit_probe_t *p, const char *corr, uint32_t sent_s, int64_t received_us, int64_t verified_us);
+
+/* Stamp a stage with the current time; a stage keeps its first stamp. */
+void credit_probe_mark(credit_probe_t *p, credit_probe_stage_t stage);
+
+/* Record how the vend went; the first outcome of the session wins. */
+void credit_probe_outcome(credit_probe_t *p, const char *outcome);
+
+/* Stamp `end`, publish the latency line and clear the probe. No-op on a cleared probe. */
+void credit_probe_finish(credit_probe_t *p);
+
+void credit_probe_init(void);
+
+#endif /* CREDIT_PROBE_H */
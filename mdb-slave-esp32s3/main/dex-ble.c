@@ -0,0 +1,204 @@
+#include "dex-ble.h"
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "eva-dts.h"
+#include "nimble.h"
+#include "ble-cmd.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define TAG "dex_ble"
+
+#define DEX_BLE_RETRY_MS    5       // host out of mbufs: let it drain
+#define DEX_BLE_RETRIES     200
+
+// Trace states (TRACE_DEX_BLE).
+enum { DEX_BLE_T_START, DEX_BLE_T_DONE, DEX_BLE_T_ABORT };
+
+typedef struct {
+	enum { DEX_BLE_OP_PULL, DEX_BLE_OP_CREDIT } op;
+	uint16_t conn_handle;
+	uint8_t credits;
+	uint32_t offset;
+	dex_audit_t *audit;     // PULL: a reference, handed over to the task
+} dex_ble_ctl_t;
+
+static QueueHandle_t s_ctl;
+
+static metric_t s_m_bytes = METRIC_COUNTER("dex.ble_bytes");
+static metric_t s_m_aborted = METRIC_COUNTER("dex.ble_abort");
+static metric_t s_m_ms = METRIC_HISTOGRAM("dex.ble_ms", 500, 1000, 2000, 5000, 10000, 30000);
+
+// The transfer in progress; only the task touches it.
+static dex_audit_t *s_audit;
+static uint16_t s_conn;
+static uint32_t s_offset;
+static uint32_t s_credits;
+static int64_t s_begin_us;
+
+static void dex_ble_put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// Notify, waiting out a full host buffer pool. False once the phone is gone or never drains.
+static bool dex_ble_send(const uint8_t *data, size_t len) {
+	for (int i = 0; i < DEX_BLE_RETRIES; i++) {
+		if (ble_notify_send(s_conn, (const char*) data, len)) return true;
+		if (ble_conn_mtu(s_conn) == 0) return false;
+		vTaskDelay(pdMS_TO_TICKS(DEX_BLE_RETRY_MS));
+	}
+	return false;
+}
+
+static void dex_ble_finish(bool done) {
+	uint32_t ms = (esp_timer_get_time() - s_begin_us) / 1000;
+
+	trace_emit(TRACE_DEX_BLE, done ? DEX_BLE_T_DONE : DEX_BLE_T_ABORT, s_offset);
+	if (done) {
+		metric_observe(&s_m_ms, ms);
+		ESP_LOGI(TAG, "audit sent: %u bytes in %lu ms", (unsigned) s_audit->size, (unsigned long) ms);
+	} else {
+		metric_inc(&s_m_aborted);
+		ESP_LOGW(TAG, "transfer dropped at %lu/%u", (unsigned long) s_offset, (unsigned) s_audit->size);
+	}
+
+	dex_audit_release(s_audit);
+	s_audit = NULL;
+}
+
+static void dex_ble_start(const dex_ble_ctl_t *ctl) {
+	if (s_audit) dex_ble_finish(false);    // taken over; that phone can resume
+
+	s_audit = ctl->audit;
+	s_conn = ctl->conn_handle;
+	s_offset = ctl->offset;
+	s_credits = ctl->credits;
+	s_begin_us = esp_timer_get_time();
+	trace_emit(TRACE_DEX_BLE, DEX_BLE_T_START, s_offset);
+
+	uint8_t start[17] = { DEX_BLE_START };
+	dex_ble_put_u32(&start[1], s_audit->size);
+	dex_ble_put_u32(&start[5], s_audit->id);
+	dex_ble_put_u32(&start[9], s_audit->time);
+	dex_ble_put_u32(&start[13], s_offset);
+	if (!dex_ble_send(start, sizeof(start))) dex_ble_finish(false);
+}
+
+// One chunk, or the end notification once every byte is out.
+static void dex_ble_step(void) {
+	uint8_t buf[BLE_V2_MTU - 3];
+
+	if (s_offset == s_audit->size) {
+		buf[0] = DEX_BLE_END;
+		dex_ble_put_u32(&buf[1], s_audit->size);
+		dex_ble_put_u32(&buf[5], s_audit->id);
+		dex_ble_put_u32(&buf[9], s_audit->time);
+		memcpy(&buf[13], s_audit->sig, sizeof(s_audit->sig));
+		dex_ble_finish(dex_ble_send(buf, 13 + sizeof(s_audit->sig)));
+		return;
+	}
+
+	uint16_t mtu = ble_conn_mtu(s_conn);
+	if (mtu == 0) {
+		dex_ble_finish(false);
+		return;
+	}
+
+	size_t room = (mtu < BLE_V2_MTU ? mtu : BLE_V2_MTU) - 3 - 5;
+	size_t n = s_audit->size - s_offset < room ? s_audit->size - s_offset : room;
+
+	buf[0] = DEX_BLE_CHUNK;
+	dex_ble_put_u32(&buf[1], s_offset);
+	memcpy(&buf[5], &s_audit->data[s_offset], n);
+
+	if (!dex_ble_send(buf, 5 + n)) {
+		dex_ble_finish(false);
+		return;
+	}
+
+	s_offset += n;
+	s_credits--;
+	metric_add(&s_m_bytes, n);
+}
+
+static void dex_ble_task(void *arg) {
+	for (;;) {
+		// Control first; send while there is credit, otherwise wait for it (bounded).
+		bool ready = s_audit && (s_credits > 0 || s_offset == s_audit->size);     // the end needs no credit
+		TickType_t wait = s_audit == NULL ? portMAX_DELAY : ready ? 0 : pdMS_TO_TICKS(DEX_BLE_IDLE_MS);
+		dex_ble_ctl_t ctl;
+
+		if (xQueueReceive(s_ctl, &ctl, wait) == pdTRUE) {
+			if (ctl.op == DEX_BLE_OP_PULL) {
+				dex_ble_start(&ctl);
+			} else if (s_audit && ctl.conn_handle == s_conn) {
+				s_credits = s_credits + ctl.credits < DEX_BLE_CREDITS_MAX ? s_credits + ctl.credits : DEX_BLE_CREDITS_MAX;
+			}
+			continue;
+		}
+
+		if (s_audit == NULL) continue;
+
+		if (!ready) {
+			dex_ble_finish(false);      // the phone stopped asking
+			continue;
+		}
+
+		dex_ble_step();
+	}
+}
+
+void dex_ble_init(void) {
+	s_ctl = xQueueCreate(4, sizeof(dex_ble_ctl_t));
+
+	metrics_register(&s_m_bytes);
+	metrics_register(&s_m_aborted);
+	metrics_register(&s_m_ms);
+
+	xTaskCreatePinnedToCore(dex_ble_task, "dex_ble", 3072, NULL, 4, NULL, 0);
+}
+
+esp_err_t dex_ble_pull(uint16_t conn_handle, uint32_t offset, uint8_t credits, uint32_t id) {
+	if (s_ctl == NULL) return ESP_ERR_INVALID_STATE;
+	if (ble_conn_mtu(conn_handle) < DEX_BLE_MTU_MIN) return ESP_ERR_INVALID_SIZE;
+
+	dex_audit_t *audit = dex_audit_acquire();
+	if (audit == NULL) {
+		request_telemetry_data(NULL);   // pull again once it is read
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	if (offset > audit->size || (offset > 0 && id != audit->id)) {
+		dex_audit_release(audit);
+		return ESP_ERR_INVALID_STATE;   // another audit: start over
+	}
+
+	dex_ble_ctl_t ctl = {
+		.op = DEX_BLE_OP_PULL,
+		.conn_handle = conn_handle,
+		.credits = credits < DEX_BLE_CREDITS_MAX ? credits : DEX_BLE_CREDITS_MAX,
+		.offset = offset,
+		.audit = audit,
+	};
+	if (xQueueSend(s_ctl, &ctl, 0) != pdTRUE) {
+		dex_audit_release(audit);
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+esp_err_t dex_ble_credit(uint16_t conn_handle, uint8_t credits) {
+	if (s_ctl == NULL) return ESP_ERR_INVALID_STATE;
+
+	dex_ble_ctl_t ctl = { .op = DEX_BLE_OP_CREDIT, .conn_handle = conn_handle, .credits = credits };
+	return xQueueSend(s_ctl, &ctl, 0) == pdTRUE ? ESP_OK : ESP_ERR_NO_MEM;
+}
@@ -0,0 +1,51 @@
+/*
+ * dex_ble — stream the last DEX audit to a phone over GATT notifications.
+ *
+ * Route staff at a machine without Wi-Fi or cellular pull the audit kept by
+ * eva-dts.c and forward it later; the signature lets the backend check it
+ * came from this board. The transfer runs on its own task, in chunks that
+ * fill the connection's MTU, paced by credits the phone grants (one credit =
+ * one chunk), so it never floods the host's buffers nor the phone's:
+ *
+ *   0x08 pull   [1-4] OFFSET u32 | [5] credits | [6-9] ID u32 (OFFSET > 0: resume this audit)
+ *   0x09 credit [1] credits
+ *
+ * Both are v2 records only (ble-cmd.h): the audit is business data. The
+ * phone is notified with
+ *
+ *   0x0f start  [1-4] SIZE u32 | [5-8] ID u32 | [9-12] TIME u32 | [13-16] OFFSET u32
+ *   0x10 chunk  [1-4] OFFSET u32 | data
+ *   0x11 end    [1-4] SIZE u32 | [5-8] ID u32 | [9-12] TIME u32 | [13-44] SIG
+ *
+ * with SIG = HMAC-SHA256(passkey, SIZE || ID || TIME || SHA-256(audit)), all
+ * big-endian. A dropped link is resumed by pulling again from the bytes
+ * received, with the ID from the start notification; a new audit has a new
+ * ID, and the pull is rejected so the phone starts over. A pull from another
+ * phone takes over the transfer; the first one can resume later. With no
+ * audit kept yet, the pull starts a DEX read and is rejected: pull again
+ * once it is done. The link must have negotiated an MTU of DEX_BLE_MTU_MIN.
+ */
+#ifndef DEX_BLE_H
+#define DEX_BLE_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#define DEX_BLE_MTU_MIN     64
+#define DEX_BLE_CREDITS_MAX 32
+#define DEX_BLE_IDLE_MS     15000   /* no credit for this long: the transfer is dropped */
+
+#define DEX_BLE_START       0x0f
+#define DEX_BLE_CHUNK       0x10
+#define DEX_BLE_END         0x11
+
+/* Start the transfer task. */
+void dex_ble_init(void);
+
+/* Start (OFFSET 0) or resume a transfer to conn_handle. Called from the ble_cmd worker. */
+esp_err_t dex_ble_pull(uint16_t conn_handle, uint32_t offset, uint8_t credits, uint32_t id);
+
+/* Let the transfer to conn_handle send more chunks. */
+esp_err_t dex_ble_credit(uint16_t conn_handle, uint8_t credits);
+
+#endif /* DEX_BLE_H */
@@ -0,0 +1,404 @@
+#include "eva-dts-link.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+
+char* calc_crc_16(uint16_t *p_crc, char *u_data) {
+	uint8_t data = *u_data;
+
+	for (uint8_t i_bit = 0; i_bit < 8; i_bit++, data >>= 1) {
+		if ((data ^ *p_crc) & 0x01) {
+			*p_crc >>= 1;
+			*p_crc ^= 0xA001;
+
+		} else
+			*p_crc >>= 1;
+	}
+
+	return u_data;
+}
+
+void eva_dts_read_dex(eva_dts_sink_t sink, void *ctx) {
+	hal_uart_set_baud(9600);
+	hal_uart_flush_input(); // drop stale RX bytes left by DDCMP attempt
+
+	// -------------------------------------- First Handshake --------------------------------------
+	uint8_t data[32];
+
+	// ENQ ->
+	hal_uart_write("\x05", 1);
+
+	// DLE 0 <-
+	hal_uart_read(data, 2, 100);
+	if( data[0] != 0x10 || data[1] != '0' ) return;
+
+	// DLE SOH ->
+	hal_uart_write("\x10\x01", 2);
+
+	uint16_t crc = 0x0000;
+
+	// Communication ID
+	hal_uart_write(calc_crc_16(&crc, "1"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "2"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "3"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "4"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "5"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "6"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "7"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "8"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "9"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "0"), 1 );
+	// Operation Request
+	hal_uart_write(calc_crc_16(&crc, "R"), 1 );
+	// Revision & Level
+	hal_uart_write(calc_crc_16(&crc, "R"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "0"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "0"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "L"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "0"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "6"), 1 );
+
+	hal_uart_write("\x10", 1 );						// DLE
+	hal_uart_write(calc_crc_16(&crc, "\x03"), 1 ); 	// ETX
+
+	data[0] = crc % 256;
+	data[1] = crc / 256;
+	hal_uart_write(data, 2 );
+
+	// DLE 1 <-
+	hal_uart_read(data, 2, 100);
+	if( data[0] != 0x10 || data[1] != '1' ) return;
+
+	// EOT ->
+	hal_uart_write("\x04", 1);
+
+	// -------------------------------------- Second Handshake --------------------------------------
+
+	// ENQ <-
+	hal_uart_read(data, 1, 1000);
+	if( data[0] != 0x05 ) return;
+
+	// DLE 0 ->
+	hal_uart_write("\x10\x30", 2);
+
+	// DLE SOH <-
+	hal_uart_read(data, 2, 100);
+	if( data[0] != 0x10 || data[1] != 0x01 ) return;
+
+	// Response Code <-
+	hal_uart_read(data, 2, 100);
+	// Communication ID <-
+	hal_uart_read(data, 10, 100);
+	// Revision & Level <-
+	hal_uart_read(data, 6, 100);
+
+	// DLE ETX <-
+	hal_uart_read(data, 2, 100);
+	if( data[0] != 0x10 || data[1] != 0x03 ) return;
+
+	// CRC <-
+	hal_uart_read(data, 2, 100);
+
+	// DLE 1 ->
+	hal_uart_write("\x10\x31", 2);
+
+	// EOT <-
+	hal_uart_read(data, 1, 100);
+	if( data[0] != 0x04 ) return;
+
+	// -------------------------------------- Data transfer --------------------------------------
+
+	// ENQ <- (machine may take a while to assemble the audit dump)
+	hal_uart_read(data, 1, 3000);
+	if (data[0] != 0x05) return;
+
+	uint8_t block = 0x00;
+	for (;;) {
+		data[0] = 0x10; 				// DLE
+		data[1] = ('0' + (block++ & 1)); 	// '0'|'1' ->
+		hal_uart_write(data, 2);
+
+		// DLE STX <-
+		hal_uart_read(data, 2, 1000);
+		if (data[0] != 0x10 || data[1] != 0x02) return;
+
+		for (;;) {
+			hal_uart_read(data, 1, 200);
+			if (data[0] == 0x10) { // DLE
+
+				hal_uart_read(data, 1, 200);
+
+				if (data[0] == 0x17) { // ETB
+
+					// <- CRC
+					hal_uart_read(data, 2, 200);
+
+					break;
+
+				} else if (data[0] == 0x03) { // ETX
+
+					// CRC <-
+					hal_uart_read(data, 2, 200);
+
+					data[0] = 0x10; 					// DLE
+					data[1] = ('0' + (block++ & 0x01)); 	// '0'|'1' ->
+					hal_uart_write(data, 2);
+
+					// EOT <-
+					hal_uart_read(data, 1, 200);
+
+					return;
+				}
+			}
+
+			sink(&data[0], 1, ctx);
+		}
+	}
+}
+
+void eva_dts_read_ddcmp(eva_dts_sink_t sink, void *ctx) {
+	hal_uart_set_baud(2400);
+	hal_uart_flush_input();
+
+	//-------------------------------------------------------
+	uint8_t buffer_rx[1024];
+	uint8_t seq_rr_ddcmp;
+	uint8_t seq_xx_ddcmp = 0;
+	int n_bytes_message;
+	uint16_t crc = 0x0000;
+	uint8_t last_package;
+
+	uint8_t crc_[2];
+
+	// start...
+	hal_uart_write(calc_crc_16(&crc, "\x05"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x06"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x40"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 ); // mbd
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 ); // sadd
+	crc_[0] = crc % 256;
+	crc_[1] = crc / 256;
+	hal_uart_write(crc_, 2 );
+
+	if( hal_uart_read(buffer_rx, 8, 200) != 8)
+		return;
+
+	if ((buffer_rx[0] != 0x05) || (buffer_rx[1] != 0x07)) {
+		return;
+	} // ...stack
+
+	crc = 0x0000;
+
+	// data message header...
+	hal_uart_write(calc_crc_16(&crc, "\x81"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x10"), 1 ); // nn
+	hal_uart_write(calc_crc_16(&crc, "\x40"), 1 ); // mm
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 ); // rr
+	++seq_xx_ddcmp;
+	hal_uart_write(calc_crc_16(&crc, (char*) &seq_xx_ddcmp), 1 ); // xx
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 ); // sadd
+	crc_[0] = crc % 256;
+	crc_[1] = crc / 256;
+	hal_uart_write(crc_, 2 );
+
+	crc = 0x0000;
+	// who are you...
+	hal_uart_write(calc_crc_16(&crc, "\x77"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\xe0"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 ); // security code
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 ); // pass code
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 ); // date dd mm yy
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x70"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 ); // time hh mm ss
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 ); // u2
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 ); // u1
+	hal_uart_write(calc_crc_16(&crc, "\x0c"), 1 ); // 0b-Maintenance 0c-Route Person
+
+	crc_[0] = crc % 256;
+	crc_[1] = crc / 256;
+	hal_uart_write(crc_, 2 );
+
+	if( hal_uart_read(buffer_rx, 8, 200) != 8)
+		return;
+
+	if ((buffer_rx[0] != 0x05) || (buffer_rx[1] != 0x01)) {
+		return;
+	} // ...ack
+
+	if( hal_uart_read(buffer_rx, 8, 200) != 8)
+		return;
+
+	if (buffer_rx[0] != 0x81) {
+		return;
+	} // ...data message header
+//
+	seq_rr_ddcmp = buffer_rx[4];
+//
+	n_bytes_message = ((buffer_rx[2] & 0x3f) * 256) + buffer_rx[1];
+	n_bytes_message += 2; // crc16
+
+	if( hal_uart_read(buffer_rx, n_bytes_message, 200) != n_bytes_message)
+		return;
+
+//  if (buffer_rx[2] != 0x01) {
+//    return;
+//  } ...not rejected
+
+	crc = 0x0000;
+
+	// ack...
+	hal_uart_write(calc_crc_16(&crc, "\x05"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x40"), 1 );
+	hal_uart_write(calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 ); 	// rr
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 ); 					// sadd
+	crc_[0] = crc % 256;
+	crc_[1] = crc / 256;
+	hal_uart_write(crc_, 2 ); // Transmitiu ACK (05 01 40 01 00 01 B8 55)
+
+	crc = 0x0000;
+
+	// data message header...
+	hal_uart_write(calc_crc_16(&crc, "\x81"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x09"), 1 ); 					// nn
+	hal_uart_write(calc_crc_16(&crc, "\x40"), 1 ); 					// mm
+	hal_uart_write(calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 ); 	// rr
+	++seq_xx_ddcmp;
+	hal_uart_write(calc_crc_16(&crc, (char*) &seq_xx_ddcmp), 1 ); 	// xx
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 ); 					// sadd
+	crc_[0] = crc % 256;
+	crc_[1] = crc / 256;
+	hal_uart_write(crc_, 2 ); // Transmitiu DATA_HEADER (81 09 40 01 02 01 46 B0)
+
+	crc = 0x0000;
+
+	hal_uart_write(calc_crc_16(&crc, "\x77"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\xE2"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x02"), 1 ); // security read list (Standard audit data is read without resetting the interim data. (Read only) )
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	crc_[0] = crc % 256;
+	crc_[1] = crc / 256;
+	hal_uart_write(crc_, 2 ); // Transmitiu READ_DATA/Audit Collection List (77 E2 00 01 01 00 00 00 00 F0 72)
+
+	if( hal_uart_read(buffer_rx, 8, 200) != 8)
+		return;
+
+	if ((buffer_rx[0] != 0x05) || (buffer_rx[1] != 0x01)) {
+		return;
+	} // ...ack
+
+	if( hal_uart_read(buffer_rx, 8, 200) != 8)
+		return;
+
+	if (buffer_rx[0] != 0x81) {
+		return;
+	} // DATA HEADER
+
+	seq_rr_ddcmp = buffer_rx[4];
+
+	n_bytes_message = ((buffer_rx[2] & 0x3f) * 256) + buffer_rx[1];
+	n_bytes_message += 2; // crc16
+
+	if( hal_uart_read(buffer_rx, n_bytes_message, 200) != n_bytes_message)
+		return;
+
+	if (buffer_rx[2] != 0x01) {
+		return;
+	}
+
+	crc = 0x0000;
+
+	hal_uart_write(calc_crc_16(&crc, "\x05"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x40"), 1 );
+	hal_uart_write(calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+	hal_uart_write(calc_crc_16(&crc, "\x01"), 1 );
+	crc_[0] = crc % 256;
+	crc_[1] = crc / 256;
+	hal_uart_write(crc_, 2 ); // Transmitiu ACK
+
+	do {
+		if( hal_uart_read(buffer_rx, 8, 200) != 8)
+			break;
+
+		if (buffer_rx[0] != 0x81) {
+			break;
+		} // ...data header
+
+		seq_rr_ddcmp = buffer_rx[4];
+		last_package = buffer_rx[2] & 0x80;
+
+		n_bytes_message = ((buffer_rx[2] & 0x3f) * 256) + buffer_rx[1];
+		n_bytes_message += 2; // crc16
+
+		if( hal_uart_read(buffer_rx, n_bytes_message, 200) != n_bytes_message)
+			break;
+		// ...data
+
+		// Os dados recebidos são: 99 nn "audit dada" crc crc, ou seja, as informaões de audit estão da posição 2 do buffer_rx à posição n_bytes-3
+		for (int x = 2; x < n_bytes_message - 2; x++)
+			sink(&buffer_rx[x], 1, ctx);
+
+		crc = 0x0000;
+
+		hal_uart_write(calc_crc_16(&crc, "\x05"), 1 );
+		hal_uart_write(calc_crc_16(&crc, "\x01"), 1 );
+		hal_uart_write(calc_crc_16(&crc, "\x40"), 1 );
+		hal_uart_write(calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 );
+		hal_uart_write(calc_crc_16(&crc, "\x00"), 1 );
+		hal_uart_write(calc_crc_16(&crc, "\x01"), 1 );
+		crc_[0] = crc % 256;
+		crc_[1] = crc / 256;
+		hal_uart_write(crc_, 2 ); // Transmitiu ACK
+
+		if (last_package) {
+			crc = 0x0000;
+
+			hal_uart_write(calc_crc_16(&crc, "\x81"), 1 );
+			hal_uart_write(calc_crc_16(&crc, "\x02"), 1 );					// nn
+			hal_uart_write(calc_crc_16(&crc, "\x40"), 1 ); 					// mm
+			hal_uart_write(calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 ); 	// rr
+			hal_uart_write(calc_crc_16(&crc, "\x03"), 1 ); 					// xx
+			hal_uart_write(calc_crc_16(&crc, "\x01"), 1 ); 					// sadd
+			crc_[0] = crc % 256;
+			crc_[1] = crc / 256;
+			hal_uart_write(crc_, 2 ); // Transmitiu DATA HEADER
+
+			hal_uart_write(calc_crc_16(&crc, "\x77"), 1 );
+			hal_uart_write(calc_crc_16(&crc, "\xFF"), 1 );
+			hal_uart_write(calc_crc_16(&crc, "\x67"), 1 );
+			hal_uart_write(calc_crc_16(&crc, "\xB0"), 1 ); // Transmitiu FINIS
+
+			if( hal_uart_read(buffer_rx, 8, 200) != 8)
+				break;
+
+			if ((buffer_rx[0] != 0x05) || (buffer_rx[1] != 0x01)) {
+				break;
+			} // ACK
+
+			break;
+		}
+
+		hal_delay_ms(10);
+
+	} while(1);
+}
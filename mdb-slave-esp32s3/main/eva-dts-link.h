@@ -0,0 +1,25 @@
+/*
+ * eva_dts_link — the EVA-DTS DDCMP and DEX/UCS audit readers.
+ *
+ * Both readers run the handshake with the VMC over the HAL UART (hal.h) and
+ * hand every audit byte to a sink as it arrives; eva-dts.c collects them in
+ * the audit it is reading, a host harness can collect them anywhere. They block for
+ * the whole exchange (seconds) and give up silently on the first unexpected
+ * answer, leaving whatever was read so far in the sink.
+ */
+#ifndef EVA_DTS_LINK_H
+#define EVA_DTS_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*eva_dts_sink_t)(const uint8_t *data, size_t len, void *ctx);
+
+/* DDCMP at 2400 baud, then DEX/UCS at 9600: eva-dts.c tries both in this order. */
+void eva_dts_read_ddcmp(eva_dts_sink_t sink, void *ctx);
+void eva_dts_read_dex(eva_dts_sink_t sink, void *ctx);
+
+/* Fold one byte into a CRC-16 (poly 0xA001, reflected); returns u_data so it can wrap a write. */
+char *calc_crc_16(uint16_t *p_crc, char *u_data);
+
+#endif /* EVA_DTS_LINK_H */
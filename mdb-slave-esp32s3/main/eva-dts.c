@@ -1,461 +1,168 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
-#include <freertos/ringbuf.h>
-#include <driver/uart.h>
-#include <driver/gpio.h>
-#include <mqtt_client.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+#include <mbedtls/sha256.h>
 
 #include "eva-dts.h"
-
-#define PIN_DEX_RX          GPIO_NUM_8
-#define PIN_DEX_TX          GPIO_NUM_9
+#include "eva-dts-link.h"
+#include "hal.h"
+#include "mqtt-outbox.h"
+#include "metrics.h"
+#include "rpc-auth.h"
+#include "timesync.h"
 
 // Owned by the main translation unit.
-extern esp_mqtt_client_handle_t mqtt_client;
 extern char my_subdomain[];
 
-// DEX/DDCMP audit bytes are accumulated here before being published.
-static RingbufHandle_t dex_ringbuf;
-
-// Single-flight guard: available = idle, taken = a read is in progress.
-static SemaphoreHandle_t eva_busy;
-
-static char* calc_crc_16(uint16_t *p_crc, char *u_data) {
-	uint8_t data = *u_data;
-
-	for (uint8_t i_bit = 0; i_bit < 8; i_bit++, data >>= 1) {
-		if ((data ^ *p_crc) & 0x01) {
-			*p_crc >>= 1;
-			*p_crc ^= 0xA001;
-
-		} else
-			*p_crc >>= 1;
-	}
-
-	return u_data;
-}
-
-static void read_telemetry_dex() {
-	uart_set_baudrate(UART_NUM_1, 9600);
-	uart_flush_input(UART_NUM_1); // drop stale RX bytes left by DDCMP attempt
-
-	// -------------------------------------- First Handshake --------------------------------------
-	uint8_t data[32];
-
-	// ENQ ->
-	uart_write_bytes(UART_NUM_1, "\x05", 1);
-
-	// DLE 0 <-
-	uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(100));
-	if( data[0] != 0x10 || data[1] != '0' ) return;
-
-	// DLE SOH ->
-	uart_write_bytes(UART_NUM_1, "\x10\x01", 2);
-
-	uint16_t crc = 0x0000;
-
-	// Communication ID
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "1"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "2"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "3"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "4"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "5"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "6"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "7"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "8"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "9"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "0"), 1 );
-	// Operation Request
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "R"), 1 );
-	// Revision & Level
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "R"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "0"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "0"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "L"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "0"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "6"), 1 );
-
-	uart_write_bytes( UART_NUM_1, "\x10", 1 );						// DLE
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x03"), 1 ); 	// ETX
-
-	data[0] = crc % 256;
-	data[1] = crc / 256;
-	uart_write_bytes( UART_NUM_1, data, 2 );
-
-	// DLE 1 <-
-	uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(100));
-	if( data[0] != 0x10 || data[1] != '1' ) return;
-
-	// EOT ->
-	uart_write_bytes(UART_NUM_1, "\x04", 1);
+// The audit being read, grown as the bytes arrive (doubling from this size, up
+// to DEX_AUDIT_MAX) and trimmed to fit once the read is over. Only the
+// eva_dts task touches it, so nothing stays allocated between reads.
+#define DEX_AUDIT_CHUNK     2048
 
-	// -------------------------------------- Second Handshake --------------------------------------
+static dex_audit_t *dex_read;
+static size_t dex_read_cap;
 
-	// ENQ <-
-	uart_read_bytes(UART_NUM_1, data, 1, pdMS_TO_TICKS(1000));
-	if( data[0] != 0x05 ) return;
+// The last audit, for dex_audit_acquire(); the lock only guards the pointer and the counts.
+static dex_audit_t *dex_audit;
+static portMUX_TYPE dex_audit_lock = portMUX_INITIALIZER_UNLOCKED;
 
-	// DLE 0 ->
-	uart_write_bytes(UART_NUM_1, "\x10\x30", 2);
-
-	// DLE SOH <-
-	uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(100));
-	if( data[0] != 0x10 || data[1] != 0x01 ) return;
-
-	// Response Code <-
-	uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(100));
-	// Communication ID <-
-	uart_read_bytes(UART_NUM_1, data, 10, pdMS_TO_TICKS(100));
-	// Revision & Level <-
-	uart_read_bytes(UART_NUM_1, data, 6, pdMS_TO_TICKS(100));
-
-	// DLE ETX <-
-	uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(100));
-	if( data[0] != 0x10 || data[1] != 0x03 ) return;
-
-	// CRC <-
-	uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(100));
-
-	// DLE 1 ->
-	uart_write_bytes(UART_NUM_1, "\x10\x31", 2);
-
-	// EOT <-
-	uart_read_bytes(UART_NUM_1, data, 1, pdMS_TO_TICKS(100));
-	if( data[0] != 0x04 ) return;
-
-	// -------------------------------------- Data transfer --------------------------------------
-
-	// ENQ <- (machine may take a while to assemble the audit dump)
-	uart_read_bytes(UART_NUM_1, data, 1, pdMS_TO_TICKS(3000));
-	if (data[0] != 0x05) return;
-
-	uint8_t block = 0x00;
-	for (;;) {
-		data[0] = 0x10; 				// DLE
-		data[1] = ('0' + (block++ & 1)); 	// '0'|'1' ->
-		uart_write_bytes(UART_NUM_1, data, 2);
-
-		// DLE STX <-
-		uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(1000));
-		if (data[0] != 0x10 || data[1] != 0x02) return;
-
-		for (;;) {
-			uart_read_bytes(UART_NUM_1, data, 1, pdMS_TO_TICKS(200));
-			if (data[0] == 0x10) { // DLE
-
-				uart_read_bytes(UART_NUM_1, data, 1, pdMS_TO_TICKS(200));
-
-				if (data[0] == 0x17) { // ETB
-
-					// <- CRC
-					uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(200));
-
-					break;
-
-				} else if (data[0] == 0x03) { // ETX
-
-					// CRC <-
-					uart_read_bytes(UART_NUM_1, data, 2, pdMS_TO_TICKS(200));
+// Single-flight guard: available = idle, taken = a read is in progress.
+static SemaphoreHandle_t eva_busy;
 
-					data[0] = 0x10; 					// DLE
-					data[1] = ('0' + (block++ & 0x01)); 	// '0'|'1' ->
-					uart_write_bytes(UART_NUM_1, data, 2);
+static metric_t s_m_dex_ms = METRIC_HISTOGRAM("dex.ms", 1000, 2000, 5000, 10000, 20000, 40000, 60000);
 
-					// EOT <-
-					uart_read_bytes(UART_NUM_1, data, 1, pdMS_TO_TICKS(200));
+// Feeds the DEX/DDCMP readers (eva-dts-link.h) into dex_read; bytes past
+// DEX_AUDIT_MAX, or past a failed grow, are dropped.
+static void dex_audit_sink(const uint8_t *data, size_t len, void *ctx) {
+	size_t size = dex_read ? dex_read->size : 0;
 
-					return;
-				}
-			}
+	if (size + len > dex_read_cap && dex_read_cap < DEX_AUDIT_MAX) {
+		size_t cap = dex_read_cap ? dex_read_cap : DEX_AUDIT_CHUNK;
+		while (cap < size + len && cap < DEX_AUDIT_MAX) cap *= 2;
+		if (cap > DEX_AUDIT_MAX) cap = DEX_AUDIT_MAX;
 
-			xRingbufferSend(dex_ringbuf, &data[0], 1, 0);
+		dex_audit_t *grown = realloc(dex_read, sizeof(dex_audit_t) + cap);
+		if (grown) {
+			dex_read = grown;
+			dex_read->size = size;
+			dex_read_cap = cap;
 		}
 	}
-}
-
-static void read_telemetry_ddcmp() {
-	uart_set_baudrate(UART_NUM_1, 2400);
-	uart_flush_input(UART_NUM_1);
-
-	//-------------------------------------------------------
-	uint8_t buffer_rx[1024];
-	uint8_t seq_rr_ddcmp;
-	uint8_t seq_xx_ddcmp = 0;
-	uint32_t n_bytes_message;
-	uint16_t crc = 0x0000;
-	uint8_t last_package;
-
-	uint8_t crc_[2];
-
-	// start...
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x05"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x06"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x40"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 ); // mbd
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 ); // sadd
-	crc_[0] = crc % 256;
-	crc_[1] = crc / 256;
-	uart_write_bytes(UART_NUM_1, crc_, 2 );
-
-	if( uart_read_bytes(UART_NUM_1, buffer_rx, 8, pdMS_TO_TICKS(200)) != 8)
-		return;
-
-	if ((buffer_rx[0] != 0x05) || (buffer_rx[1] != 0x07)) {
-		return;
-	} // ...stack
-
-	crc = 0x0000;
-
-	// data message header...
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x81"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x10"), 1 ); // nn
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x40"), 1 ); // mm
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 ); // rr
-	++seq_xx_ddcmp;
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, (char*) &seq_xx_ddcmp), 1 ); // xx
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 ); // sadd
-	crc_[0] = crc % 256;
-	crc_[1] = crc / 256;
-	uart_write_bytes(UART_NUM_1, crc_, 2 );
-
-	crc = 0x0000;
-	// who are you...
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x77"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\xe0"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 ); // security code
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 ); // pass code
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 ); // date dd mm yy
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x70"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 ); // time hh mm ss
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 ); // u2
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 ); // u1
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x0c"), 1 ); // 0b-Maintenance 0c-Route Person
-
-	crc_[0] = crc % 256;
-	crc_[1] = crc / 256;
-	uart_write_bytes(UART_NUM_1, crc_, 2 );
-
-	if( uart_read_bytes(UART_NUM_1, buffer_rx, 8, pdMS_TO_TICKS(200)) != 8)
-		return;
 
-	if ((buffer_rx[0] != 0x05) || (buffer_rx[1] != 0x01)) {
-		return;
-	} // ...ack
+	if (len > dex_read_cap - size) len = dex_read_cap - size;
+	if (len == 0) return;
 
-	if( uart_read_bytes(UART_NUM_1, buffer_rx, 8, pdMS_TO_TICKS(200)) != 8)
-		return;
+	memcpy(&dex_read->data[size], data, len);
+	dex_read->size = size + len;
+}
 
-	if (buffer_rx[0] != 0x81) {
-		return;
-	} // ...data message header
-//
-	seq_rr_ddcmp = buffer_rx[4];
-//
-	n_bytes_message = ((buffer_rx[2] & 0x3f) * 256) + buffer_rx[1];
-	n_bytes_message += 2; // crc16
-
-	if( uart_read_bytes(UART_NUM_1, buffer_rx, n_bytes_message, pdMS_TO_TICKS(200)) != n_bytes_message)
-		return;
+void telemetry_init(void) {
+	//---------------- UART1 - EVA DTS DEX/DDCMP ---------------//
+	//----------------------------------------------------------//
+	hal_uart_init(9600);
 
-//  if (buffer_rx[2] != 0x01) {
-//    return;
-//  } ...not rejected
-
-	crc = 0x0000;
-
-	// ack...
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x05"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x40"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 ); 	// rr
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 ); 					// sadd
-	crc_[0] = crc % 256;
-	crc_[1] = crc / 256;
-	uart_write_bytes(UART_NUM_1, crc_, 2 ); // Transmitiu ACK (05 01 40 01 00 01 B8 55)
-
-	crc = 0x0000;
-
-	// data message header...
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x81"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x09"), 1 ); 					// nn
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x40"), 1 ); 					// mm
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 ); 	// rr
-	++seq_xx_ddcmp;
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, (char*) &seq_xx_ddcmp), 1 ); 	// xx
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 ); 					// sadd
-	crc_[0] = crc % 256;
-	crc_[1] = crc / 256;
-	uart_write_bytes(UART_NUM_1, crc_, 2 ); // Transmitiu DATA_HEADER (81 09 40 01 02 01 46 B0)
-
-	crc = 0x0000;
-
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x77"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\xE2"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x02"), 1 ); // security read list (Standard audit data is read without resetting the interim data. (Read only) )
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	crc_[0] = crc % 256;
-	crc_[1] = crc / 256;
-	uart_write_bytes(UART_NUM_1, crc_, 2 ); // Transmitiu READ_DATA/Audit Collection List (77 E2 00 01 01 00 00 00 00 F0 72)
-
-	if( uart_read_bytes(UART_NUM_1, buffer_rx, 8, pdMS_TO_TICKS(200)) != 8)
-		return;
+	eva_busy = xSemaphoreCreateBinary();
+	xSemaphoreGive(eva_busy); // start idle
 
-	if ((buffer_rx[0] != 0x05) || (buffer_rx[1] != 0x01)) {
-		return;
-	} // ...ack
+	metrics_register(&s_m_dex_ms);
+}
 
-	if( uart_read_bytes(UART_NUM_1, buffer_rx, 8, pdMS_TO_TICKS(200)) != 8)
-		return;
+static void dex_put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
 
-	if (buffer_rx[0] != 0x81) {
-		return;
-	} // DATA HEADER
+// Trim the audit just read to fit and sign it. Hands over dex_read.
+static dex_audit_t *dex_audit_take(void) {
+	dex_audit_t *audit = dex_read;
+	dex_read = NULL;
+	dex_read_cap = 0;
 
-	seq_rr_ddcmp = buffer_rx[4];
+	if (audit == NULL) return NULL;
 
-	n_bytes_message = ((buffer_rx[2] & 0x3f) * 256) + buffer_rx[1];
-	n_bytes_message += 2; // crc16
+	size_t size = audit->size;
+	if (size == 0) {
+		free(audit);
+		return NULL;
+	}
 
-	if( uart_read_bytes(UART_NUM_1, buffer_rx, n_bytes_message, pdMS_TO_TICKS(200)) != n_bytes_message)
-		return;
+	dex_audit_t *fit = realloc(audit, sizeof(dex_audit_t) + size);
+	if (fit) audit = fit;
 
-	if (buffer_rx[2] != 0x01) {
-		return;
-	}
+	audit->refs = 1;
+	audit->id = esp_random();
+	audit->time = timesync_source() != TIMESYNC_NONE ? (uint32_t) time(NULL) : 0;
+	audit->size = size;
 
-	crc = 0x0000;
-
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x05"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x40"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-	uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 );
-	crc_[0] = crc % 256;
-	crc_[1] = crc / 256;
-	uart_write_bytes(UART_NUM_1, crc_, 2 ); // Transmitiu ACK
-
-	do {
-		if( uart_read_bytes(UART_NUM_1, buffer_rx, 8, pdMS_TO_TICKS(200)) != 8)
-			break;
-
-		if (buffer_rx[0] != 0x81) {
-			break;
-		} // ...data header
-
-		seq_rr_ddcmp = buffer_rx[4];
-		last_package = buffer_rx[2] & 0x80;
-
-		n_bytes_message = ((buffer_rx[2] & 0x3f) * 256) + buffer_rx[1];
-		n_bytes_message += 2; // crc16
-
-		if( uart_read_bytes(UART_NUM_1, buffer_rx, n_bytes_message, pdMS_TO_TICKS(200)) != n_bytes_message)
-			break;
-		// ...data
-
-		// Os dados recebidos são: 99 nn "audit dada" crc crc, ou seja, as informaões de audit estão da posição 2 do buffer_rx à posição n_bytes-3
-		for (int x = 2; x < n_bytes_message - 2; x++)
-			xRingbufferSend(dex_ringbuf, &buffer_rx[x], 1, 0);
-
-		crc = 0x0000;
-
-		uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x05"), 1 );
-		uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 );
-		uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x40"), 1 );
-		uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 );
-		uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x00"), 1 );
-		uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 );
-		crc_[0] = crc % 256;
-		crc_[1] = crc / 256;
-		uart_write_bytes(UART_NUM_1, crc_, 2 ); // Transmitiu ACK
-
-		if (last_package) {
-			crc = 0x0000;
-
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x81"), 1 );
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x02"), 1 );					// nn
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x40"), 1 ); 					// mm
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, (char*) &seq_rr_ddcmp), 1 ); 	// rr
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x03"), 1 ); 					// xx
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x01"), 1 ); 					// sadd
-			crc_[0] = crc % 256;
-			crc_[1] = crc / 256;
-			uart_write_bytes(UART_NUM_1, crc_, 2 ); // Transmitiu DATA HEADER
-
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x77"), 1 );
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\xFF"), 1 );
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\x67"), 1 );
-			uart_write_bytes( UART_NUM_1, calc_crc_16(&crc, "\xB0"), 1 ); // Transmitiu FINIS
-
-			if( uart_read_bytes(UART_NUM_1, buffer_rx, 8, pdMS_TO_TICKS(200)) != 8)
-				break;
-
-			if ((buffer_rx[0] != 0x05) || (buffer_rx[1] != 0x01)) {
-				break;
-			} // ACK
-
-			break;
-		}
+	uint8_t msg[12 + 32];
+	dex_put_u32(&msg[0], size);
+	dex_put_u32(&msg[4], audit->id);
+	dex_put_u32(&msg[8], audit->time);
+	mbedtls_sha256(audit->data, size, &msg[12], 0);
+	calculate_hmac((const char*) msg, sizeof(msg), audit->sig);
 
-		vTaskDelay(pdMS_TO_TICKS(10)); // ticks para ms
+	return audit;
+}
 
-	} while(1);
+dex_audit_t *dex_audit_acquire(void) {
+	taskENTER_CRITICAL(&dex_audit_lock);
+	dex_audit_t *audit = dex_audit;
+	if (audit) audit->refs++;
+	taskEXIT_CRITICAL(&dex_audit_lock);
+	return audit;
 }
 
-void telemetry_init(void) {
-	//---------------- UART1 - EVA DTS DEX/DDCMP ---------------//
-	//----------------------------------------------------------//
-	uart_config_t uart_config_1 = {
-			.baud_rate = 9600,
-			.data_bits = UART_DATA_8_BITS,
-			.parity = UART_PARITY_DISABLE,
-			.stop_bits = UART_STOP_BITS_1,
-			.flow_ctrl = UART_HW_FLOWCTRL_DISABLE };
+void dex_audit_release(dex_audit_t *audit) {
+	if (audit == NULL) return;
 
-	uart_param_config(UART_NUM_1, &uart_config_1);
-	uart_set_pin( UART_NUM_1, PIN_DEX_TX, PIN_DEX_RX, -1, -1);
-	uart_driver_install(UART_NUM_1, 256, 256, 0, NULL, 0);
+	taskENTER_CRITICAL(&dex_audit_lock);
+	bool last = --audit->refs == 0;
+	taskEXIT_CRITICAL(&dex_audit_lock);
 
-	dex_ringbuf = xRingbufferCreate(8 * 1024 /*8Kb*/, RINGBUF_TYPE_BYTEBUF);
+	if (last) free(audit);
+}
 
-	eva_busy = xSemaphoreCreateBinary();
-	xSemaphoreGive(eva_busy); // start idle
+// mqtt_outbox_publish_ref() release callback: the outbox holds its own reference.
+static void dex_audit_release_ref(void *ctx) {
+	dex_audit_release(ctx);
 }
 
 // Worker task: reads DDCMP+DEX and publishes the audit data, then exits.
 static void eva_dts_task(void *arg) {
-	read_telemetry_ddcmp();
-	read_telemetry_dex();
+	int64_t start_us = esp_timer_get_time();
+
+	eva_dts_read_ddcmp(dex_audit_sink, NULL);
+	eva_dts_read_dex(dex_audit_sink, NULL);
 
-	size_t dex_size;
-	uint8_t *dex = (uint8_t*) xRingbufferReceive(dex_ringbuf, &dex_size, 0);
+	metric_observe(&s_m_dex_ms, (uint32_t) ((esp_timer_get_time() - start_us) / 1000));
 
-    if(dex != NULL){
+	dex_audit_t *audit = dex_audit_take();
+
+    if(audit != NULL){
         char topic[64];
         snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/rpc/dex", my_subdomain);
 
-        esp_mqtt_client_publish(mqtt_client, topic, (char*) dex, dex_size, 0, 0);
-        printf("%.*s", dex_size, (char*) dex);
+        printf("%.*s", (int) audit->size, (char*) audit->data);
+
+        // Kept for a phone as well: without an uplink, this is the only way out.
+        taskENTER_CRITICAL(&dex_audit_lock);
+        dex_audit_t *old = dex_audit;
+        dex_audit = audit;
+        audit->refs++;
+        taskEXIT_CRITICAL(&dex_audit_lock);
+        dex_audit_release(old);
 
-        vRingbufferReturnItem(dex_ringbuf, (void*) dex);
+        // Bulk class: byte-budgeted and queued behind sales and RPC replies. Sent
+        // straight from the audit, without a copy; the outbox's reference keeps it alive.
+        mqtt_outbox_publish_ref(OUTBOX_BULK, topic, (char*) audit->data, audit->size, 0, dex_audit_release_ref, audit);
     }
 
 	xSemaphoreGive(eva_busy);
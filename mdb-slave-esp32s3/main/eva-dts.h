@@ -1,11 +1,32 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 // EVA-DTS DEX / DDCMP audit telemetry over UART1.
 
-// Configure UART1 and allocate the DEX ring buffer. Call once at startup.
+#define DEX_AUDIT_MAX       (20 * 1024)
+
+// The last audit read, kept in RAM so a phone can pull it over BLE (dex-ble.h)
+// when there is no uplink. Immutable once published; a newer read replaces it.
+typedef struct {
+	uint32_t refs;          // private: held by the store and each reader
+	uint32_t id;            // random, new for every read
+	uint32_t time;          // capture time, 0 if the clock was not set
+	uint8_t sig[32];        // HMAC-SHA256(passkey, size u32 || id u32 || time u32 || SHA-256(data))
+	size_t size;
+	uint8_t data[];
+} dex_audit_t;
+
+// Configure UART1. Call once at startup.
 void telemetry_init(void);
 
 // Read DDCMP + DEX audit data from the VMC and publish it to
 // domain.vmflow.xyz/<subdomain>/rpc/dex. Signature matches an esp_timer
 // callback (arg is unused), so it can also be called directly.
 void request_telemetry_data(void *arg);
+
+// Take a reference to the last audit (NULL if none yet); give it back with
+// dex_audit_release(). Safe from any task.
+dex_audit_t *dex_audit_acquire(void);
+void dex_audit_release(dex_audit_t *audit);
@@ -0,0 +1,202 @@
+#include "fleet.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <nvs_flash.h>
+#include <mbedtls/ecdsa.h>
+#include <mbedtls/ecp.h>
+#include <mbedtls/bignum.h>
+#include <mbedtls/sha256.h>
+
+#define TAG "fleet"
+
+#define FLEET_PUBKEY_LEN    65          // uncompressed P-256 point: 0x04 | X | Y
+#define FLEET_SIG_HEX_LEN   128         // r || s
+
+_Static_assert(sizeof("fleet.vmflow.xyz///rpc") + 2 * (FLEET_NAME_MAX - 1) <= FLEET_TOPIC_MAX, "a group topic must fit FLEET_TOPIC_MAX");
+
+static char s_membership[FLEET_NAME_MAX * (FLEET_GROUPS_MAX + 1)];
+static char s_topics[FLEET_GROUPS_MAX + 1][FLEET_TOPIC_MAX];
+static size_t s_topic_count;
+
+static bool s_key_ok;
+static mbedtls_ecp_group s_grp;
+static mbedtls_ecp_point s_pub;
+
+static bool fleet_name_ok(const char *p, size_t len) {
+	if (len == 0 || len >= FLEET_NAME_MAX) return false;
+	for (size_t i = 0; i < len; i++) {
+		char c = p[i];
+		if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-')) return false;
+	}
+	return true;
+}
+
+// "<fleet>[,<group>...]" -> true if every name is valid and there are at most FLEET_GROUPS_MAX groups.
+static bool fleet_spec_ok(const char *spec) {
+	size_t names = 0;
+	for (const char *p = spec; ; names++) {
+		const char *comma = strchr(p, ',');
+		size_t len = comma ? (size_t) (comma - p) : strlen(p);
+		if (!fleet_name_ok(p, len)) return false;
+		if (comma == NULL) break;
+		p = comma + 1;
+	}
+	return names <= FLEET_GROUPS_MAX;
+}
+
+static int hex_nibble(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static bool hex_decode(const char *hex, size_t hex_len, uint8_t *out) {
+	for (size_t i = 0; i < hex_len / 2; i++) {
+		int hi = hex_nibble(hex[2 * i]), lo = hex_nibble(hex[2 * i + 1]);
+		if (hi < 0 || lo < 0) return false;
+		out[i] = (uint8_t) ((hi << 4) | lo);
+	}
+	return true;
+}
+
+static void fleet_load_key(nvs_handle_t handle) {
+	uint8_t pub[FLEET_PUBKEY_LEN];
+	size_t len = sizeof(pub);
+	bool have = handle && nvs_get_blob(handle, "fleet_pub", pub, &len) == ESP_OK && len == sizeof(pub);
+
+	const char *hex = CONFIG_VMFLOW_FLEET_PUBKEY;
+	if (!have && strlen(hex) == 2 * FLEET_PUBKEY_LEN) have = hex_decode(hex, strlen(hex), pub);
+	if (!have) return;
+
+	mbedtls_ecp_group_init(&s_grp);
+	mbedtls_ecp_point_init(&s_pub);
+	s_key_ok = mbedtls_ecp_group_load(&s_grp, MBEDTLS_ECP_DP_SECP256R1) == 0 &&
+			mbedtls_ecp_point_read_binary(&s_grp, &s_pub, pub, sizeof(pub)) == 0 &&
+			mbedtls_ecp_check_pubkey(&s_grp, &s_pub) == 0;
+
+	if (!s_key_ok) ESP_LOGE(TAG, "invalid fleet public key");
+}
+
+void fleet_init(void) {
+	nvs_handle_t handle = 0;
+	char fleet[FLEET_NAME_MAX] = "";
+	char groups[FLEET_NAME_MAX * FLEET_GROUPS_MAX] = "";
+
+	if (nvs_open("vmflow", NVS_READONLY, &handle) == ESP_OK) {
+		size_t len = sizeof(fleet);
+		nvs_get_str(handle, "fleet", fleet, &len);
+		len = sizeof(groups);
+		nvs_get_str(handle, "groups", groups, &len);
+	} else {
+		handle = 0;
+	}
+
+	fleet_load_key(handle);
+	if (handle) nvs_close(handle);
+
+	if (fleet[0] == '\0') return;
+
+	snprintf(s_membership, sizeof(s_membership), "%s%s%s", fleet, groups[0] ? "," : "", groups);
+	if (!fleet_spec_ok(s_membership)) {
+		ESP_LOGE(TAG, "invalid membership \"%s\", ignored", s_membership);
+		s_membership[0] = '\0';
+		return;
+	}
+
+	if (!s_key_ok) {
+		ESP_LOGW(TAG, "member of %s but no fleet key; broadcasts disabled", s_membership);
+		return;
+	}
+
+	int n = snprintf(s_topics[s_topic_count], FLEET_TOPIC_MAX, "fleet.vmflow.xyz/%s/rpc", fleet);
+	if (n > 0 && n < FLEET_TOPIC_MAX) s_topic_count++;
+
+	for (char *g = groups, *next; g && *g && s_topic_count <= FLEET_GROUPS_MAX; g = next) {
+		next = strchr(g, ',');
+		if (next) *next++ = '\0';
+
+		// Never subscribe a truncated topic: it would be some other group's, or nobody's.
+		n = snprintf(s_topics[s_topic_count], FLEET_TOPIC_MAX, "fleet.vmflow.xyz/%s/%s/rpc", fleet, g);
+		if (n > 0 && n < FLEET_TOPIC_MAX) {
+			s_topic_count++;
+		} else {
+			ESP_LOGE(TAG, "group topic for %s/%s too long, not subscribed", fleet, g);
+		}
+	}
+
+	ESP_LOGI(TAG, "member of %s (%u broadcast topics)", s_membership, (unsigned) s_topic_count);
+}
+
+size_t fleet_topics(const char **topics, size_t max) {
+	size_t n = s_topic_count < max ? s_topic_count : max;
+	for (size_t i = 0; i < n; i++) topics[i] = s_topics[i];
+	return n;
+}
+
+bool fleet_match(const char *topic, size_t len) {
+	for (size_t i = 0; i < s_topic_count; i++) {
+		if (strlen(s_topics[i]) == len && strncmp(s_topics[i], topic, len) == 0) return true;
+	}
+	return false;
+}
+
+bool fleet_verify(const char *topic, const char *msg, size_t msg_len, const char *sig_hex) {
+	if (!s_key_ok || strlen(sig_hex) != FLEET_SIG_HEX_LEN) return false;
+
+	uint8_t sig[FLEET_SIG_HEX_LEN / 2];
+	if (!hex_decode(sig_hex, FLEET_SIG_HEX_LEN, sig)) return false;
+
+	// SHA-256 over "<topic>:<msg>" without building the concatenation.
+	uint8_t hash[32];
+	mbedtls_sha256_context sha;
+	mbedtls_sha256_init(&sha);
+	mbedtls_sha256_starts(&sha, 0);
+	mbedtls_sha256_update(&sha, (const unsigned char *) topic, strlen(topic));
+	mbedtls_sha256_update(&sha, (const unsigned char *) ":", 1);
+	mbedtls_sha256_update(&sha, (const unsigned char *) msg, msg_len);
+	mbedtls_sha256_finish(&sha, hash);
+	mbedtls_sha256_free(&sha);
+
+	mbedtls_mpi r, s;
+	mbedtls_mpi_init(&r);
+	mbedtls_mpi_init(&s);
+	bool ok = mbedtls_mpi_read_binary(&r, sig, 32) == 0 &&
+			mbedtls_mpi_read_binary(&s, sig + 32, 32) == 0 &&
+			mbedtls_ecdsa_verify(&s_grp, hash, sizeof(hash), &s_pub, &r, &s) == 0;
+	mbedtls_mpi_free(&r);
+	mbedtls_mpi_free(&s);
+
+	return ok;
+}
+
+esp_err_t fleet_set(const char *spec) {
+	if (spec && !fleet_spec_ok(spec)) return ESP_ERR_INVALID_ARG;
+
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open("vmflow", NVS_READWRITE, &handle);
+	if (err != ESP_OK) return err;
+
+	if (spec) {
+		const char *comma = strchr(spec, ',');
+		char fleet[FLEET_NAME_MAX];
+		snprintf(fleet, sizeof(fleet), "%.*s", comma ? (int) (comma - spec) : (int) strlen(spec), spec);
+
+		err = nvs_set_str(handle, "fleet", fleet);
+		if (err == ESP_OK) err = nvs_set_str(handle, "groups", comma ? comma + 1 : "");
+	} else {
+		nvs_erase_key(handle, "fleet");
+		nvs_erase_key(handle, "groups");
+	}
+	if (err == ESP_OK) err = nvs_commit(handle);
+
+	nvs_close(handle);
+	return err;
+}
+
+const char *fleet_membership(void) {
+	return s_membership;
+}
@@ -0,0 +1,54 @@
+/*
+ * fleet — fleet-wide and group broadcast RPC channels.
+ *
+ * A device can belong to one fleet and up to FLEET_GROUPS_MAX groups in it,
+ * stored in NVS ("fleet", "groups") at provisioning or with the fleet RPC.
+ * Besides its own RPC topic it then listens on
+ *
+ *   fleet.vmflow.xyz/<fleet>/rpc            every device in the fleet
+ *   fleet.vmflow.xyz/<fleet>/<group>/rpc    every device in the group
+ *
+ * so one message reaches all members. Broadcasts are signed by the backend
+ * with the fleet's ECDSA P-256 key instead of per-device passkeys; devices
+ * hold only the public key (menuconfig, or NVS "fleet_pub"), so a device that
+ * is taken apart cannot command the others. The signature covers the topic,
+ * so a group command cannot be replayed to the whole fleet:
+ *
+ *   payload  "<cmd>:<args>:<ts>:<jitter_s>:<sig_hex>"
+ *   sig_hex  r||s of ECDSA-P256-SHA256("<topic>:<cmd>:<args>:<ts>:<jitter_s>")
+ *
+ * rpc_exec runs a broadcast command after a random delay within jitter_s, so
+ * a fleet-wide ota or dex does not reach the servers all at once.
+ */
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#define FLEET_GROUPS_MAX    4
+#define FLEET_NAME_MAX      24      /* a fleet or group name, NUL included */
+#define FLEET_TOPIC_MAX     72      /* a group topic with both names at their longest, NUL included */
+
+/* Load membership and the fleet public key. Call before mqtt_session_config(). */
+void fleet_init(void);
+
+/* Broadcast topics to subscribe; returns how many were written to topics[]
+ * (0 when the device is in no fleet or has no fleet key). */
+size_t fleet_topics(const char **topics, size_t max);
+
+/* True if topic[0..len) is one of this device's broadcast topics. */
+bool fleet_match(const char *topic, size_t len);
+
+/* Check a broadcast signature: sig_hex over "<topic>:<msg[0..msg_len)>". */
+bool fleet_verify(const char *topic, const char *msg, size_t msg_len, const char *sig_hex);
+
+/* Persist membership for the next boot: "<fleet>[,<group>...]", or NULL to
+ * leave the fleet. Names are [a-z0-9_-]. */
+esp_err_t fleet_set(const char *spec);
+
+/* "<fleet>[,<group>...]" or "" (for rpc/info). */
+const char *fleet_membership(void);
+
+#endif /* FLEET_H */
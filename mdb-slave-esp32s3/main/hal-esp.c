@@ -0,0 +1,191 @@
+#include "hal.h"
+
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <rom/ets_sys.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <nvs.h>
+#include <mbedtls/md.h>
+
+#include "mqtt-outbox.h"
+#include "nimble.h"
+#include "timesync.h"
+
+#define PIN_MDB_RX          GPIO_NUM_4
+#define PIN_MDB_TX          GPIO_NUM_5
+#define PIN_DEX_RX          GPIO_NUM_8
+#define PIN_DEX_TX          GPIO_NUM_9
+
+_Static_assert((int) HAL_PUB_BULK == (int) OUTBOX_BULK, "hal_pub_class_t mirrors outbox_class_t");
+_Static_assert(HAL_TIME_SLACK_MAX_S == TIMESYNC_SLACK_MAX_S, "hal_time_slack_s() is timesync_slack_s()");
+
+static QueueHandle_t mdb_rx_queue;
+
+// ------------------------------------------------------------------ MDB bus
+
+static void IRAM_ATTR mdb_rx_falling_isr(void *arg) {
+	gpio_intr_disable(PIN_MDB_RX);
+
+	uint16_t coming_read = 0x0000;
+
+	ets_delay_us(156);
+	for (int x = 0; x < 9; x++) {
+		coming_read |= (gpio_get_level(PIN_MDB_RX) << x);
+		ets_delay_us(104);
+	}
+	xQueueSendFromISR(mdb_rx_queue, &coming_read, NULL);
+
+	gpio_intr_enable(PIN_MDB_RX);
+}
+
+void hal_mdb_init(void) {
+	gpio_set_direction(PIN_MDB_TX, GPIO_MODE_OUTPUT);
+	gpio_set_level(PIN_MDB_TX, 1);
+
+	mdb_rx_queue = xQueueCreate(16, sizeof(uint16_t));
+
+	gpio_config_t io_conf = {
+		.pin_bit_mask = (1ULL << PIN_MDB_RX),
+		.mode         = GPIO_MODE_INPUT,
+		.pull_up_en   = GPIO_PULLUP_ENABLE,
+		.pull_down_en = GPIO_PULLDOWN_DISABLE,
+		.intr_type    = GPIO_INTR_NEGEDGE,
+	};
+	gpio_config(&io_conf);
+
+	// Installed from the calling task so the GPIO interrupt is allocated on its core,
+	// isolated from the network ISRs that would otherwise skew the bit sampling.
+	gpio_install_isr_service(0);
+	gpio_isr_handler_add(PIN_MDB_RX, mdb_rx_falling_isr, NULL);
+}
+
+uint16_t hal_mdb_read(void) {
+	uint16_t coming_read = 0;
+	xQueueReceive(mdb_rx_queue, &coming_read, portMAX_DELAY);
+	return coming_read;
+}
+
+void hal_mdb_write(uint16_t nth9) {
+	gpio_set_level(PIN_MDB_TX, 0);
+	ets_delay_us(104);
+
+	for (uint8_t x = 0; x < 9; x++) {
+		gpio_set_level(PIN_MDB_TX, (nth9 >> x) & 1);
+		ets_delay_us(104);
+	}
+
+	gpio_set_level(PIN_MDB_TX, 1);
+	ets_delay_us(104);
+}
+
+uint32_t hal_mdb_rx_pending(void) {
+	return uxQueueMessagesWaiting(mdb_rx_queue);
+}
+
+// ------------------------------------------------------------------ EVA-DTS UART
+
+void hal_uart_init(uint32_t baud) {
+	uart_config_t uart_config_1 = {
+			.baud_rate = baud,
+			.data_bits = UART_DATA_8_BITS,
+			.parity = UART_PARITY_DISABLE,
+			.stop_bits = UART_STOP_BITS_1,
+			.flow_ctrl = UART_HW_FLOWCTRL_DISABLE };
+
+	uart_param_config(UART_NUM_1, &uart_config_1);
+	uart_set_pin( UART_NUM_1, PIN_DEX_TX, PIN_DEX_RX, -1, -1);
+	uart_driver_install(UART_NUM_1, 256, 256, 0, NULL, 0);
+}
+
+void hal_uart_set_baud(uint32_t baud) {
+	uart_set_baudrate(UART_NUM_1, baud);
+}
+
+void hal_uart_flush_input(void) {
+	uart_flush_input(UART_NUM_1);
+}
+
+int hal_uart_write(const void *data, size_t len) {
+	return uart_write_bytes(UART_NUM_1, data, len);
+}
+
+int hal_uart_read(void *data, size_t len, uint32_t timeout_ms) {
+	int n = uart_read_bytes(UART_NUM_1, data, len, pdMS_TO_TICKS(timeout_ms));
+	return n < 0 ? 0 : n;
+}
+
+// ------------------------------------------------------------------ clock
+
+int64_t hal_now_us(void) {
+	return esp_timer_get_time();
+}
+
+int64_t hal_time(void) {
+	return time(NULL);
+}
+
+int hal_time_slack_s(void) {
+	return timesync_source() == TIMESYNC_NONE ? -1 : timesync_slack_s();
+}
+
+void hal_delay_ms(uint32_t ms) {
+	vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+// ------------------------------------------------------------------ KV
+
+bool hal_kv_get(const char *key, void *value, size_t *len) {
+	nvs_handle_t handle;
+	if (nvs_open("vmflow", NVS_READONLY, &handle) != ESP_OK) return false;
+
+	esp_err_t err = nvs_get_blob(handle, key, value, len);
+	nvs_close(handle);
+	return err == ESP_OK;
+}
+
+bool hal_kv_set(const char *key, const void *value, size_t len) {
+	nvs_handle_t handle;
+	if (nvs_open("vmflow", NVS_READWRITE, &handle) != ESP_OK) return false;
+
+	esp_err_t err = nvs_set_blob(handle, key, value, len);
+	if (err == ESP_OK) err = nvs_commit(handle);
+	nvs_close(handle);
+	return err == ESP_OK;
+}
+
+// ------------------------------------------------------------------ publish, BLE
+
+bool hal_publish(hal_pub_class_t cls, const char *topic, const char *data, int len) {
+	return mqtt_outbox_publish((outbox_class_t) cls, topic, data, len, 0);
+}
+
+void hal_ble_session_begin(uint16_t conn_handle) {
+	ble_session_begin(conn_handle);
+}
+
+void hal_ble_session_end(void) {
+	ble_session_end();
+}
+
+void hal_ble_notify_session(const char *data, int len) {
+	ble_notify_session(data, len);
+}
+
+// ------------------------------------------------------------------ crypto
+
+void hal_hmac_sha256(const void *key, size_t key_len, const void *data, size_t len, uint8_t out[32]) {
+	mbedtls_md_context_t ctx;
+	mbedtls_md_init(&ctx);
+
+	mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+	mbedtls_md_hmac_starts(&ctx, (const unsigned char *) key, key_len);
+	mbedtls_md_hmac_update(&ctx, (const unsigned char *) data, len);
+	mbedtls_md_hmac_finish(&ctx, out);
+
+	mbedtls_md_free(&ctx);
+}
@@ -0,0 +1,80 @@
+/*
+ * hal — the few board services the firmware core needs.
+ *
+ * The MDB cashless state machine (mdb-cashless.c), the EVA-DTS link
+ * (eva-dts-link.c), rpc-auth, rpc-admit, credit-probe, the PAX dedupe and the
+ * MQTT-SN packet code reach the hardware and the network only through this header,
+ * so they build unchanged for the board and for Linux:
+ *
+ *   hal-esp.c           ESP-IDF: bit-banged MDB on GPIO, UART1, esp_timer,
+ *                       NVS, the MQTT outbox, NimBLE, mbedtls
+ *   host/hal-posix.c    POSIX: file descriptors, clock_gettime, an in-memory
+ *                       KV store, stdout, OpenSSL; every service can be
+ *                       replaced by a harness (host/hal-posix.h)
+ *
+ * Everything else (Wi-Fi, the modem, OTA, NimBLE itself) stays ESP-IDF only.
+ * The calls mirror what the core used before, so the board behaves exactly
+ * as it did.
+ */
+#ifndef HAL_H
+#define HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#define HAL_CORES           portNUM_PROCESSORS
+#define hal_core_id()       xPortGetCoreID()
+#else
+#define HAL_CORES           1
+#define hal_core_id()       0
+#endif
+
+/* MDB bus: 9-bit words (bit 8 = mode bit) at 9600 baud. */
+void hal_mdb_init(void);                /* board: call on the task that reads the bus (its ISR lands on that core) */
+uint16_t hal_mdb_read(void);            /* blocks until the next word */
+void hal_mdb_write(uint16_t word);
+uint32_t hal_mdb_rx_pending(void);      /* words received and not yet read */
+
+/* EVA-DTS UART (DEX / DDCMP). Reads return the bytes read, 0 on timeout. */
+void hal_uart_init(uint32_t baud);
+void hal_uart_set_baud(uint32_t baud);
+void hal_uart_flush_input(void);
+int hal_uart_write(const void *data, size_t len);
+int hal_uart_read(void *data, size_t len, uint32_t timeout_ms);
+
+/* Clock: monotonic microseconds since boot, and wall-clock Unix seconds. */
+int64_t hal_now_us(void);
+int64_t hal_time(void);
+
+/* How far hal_time() may be off, in seconds (0 to HAL_TIME_SLACK_MAX_S), or
+ * -1 while the wall clock is not set yet (timesync.h on the board). */
+#define HAL_TIME_SLACK_MAX_S    2
+int hal_time_slack_s(void);
+void hal_delay_ms(uint32_t ms);
+
+/* KV storage, namespace "vmflow". *len: buffer size in, value size out. */
+bool hal_kv_get(const char *key, void *value, size_t *len);
+bool hal_kv_set(const char *key, const void *value, size_t len);
+
+/* Publish (len 0 = strlen): the classes are the MQTT outbox's (mqtt-outbox.h), in the same order. */
+typedef enum {
+	HAL_PUB_MONEY,
+	HAL_PUB_CONTROL,
+	HAL_PUB_TELEMETRY,
+	HAL_PUB_BULK,
+} hal_pub_class_t;
+
+bool hal_publish(hal_pub_class_t cls, const char *topic, const char *data, int len);
+
+/* BLE: notifications to the phone running the MDB session (nimble.h). */
+void hal_ble_session_begin(uint16_t conn_handle);
+void hal_ble_session_end(void);
+void hal_ble_notify_session(const char *data, int len);
+
+/* HMAC-SHA256 (rpc-auth.h builds on it). */
+void hal_hmac_sha256(const void *key, size_t key_len, const void *data, size_t len, uint8_t out[32]);
+
+#endif /* HAL_H */
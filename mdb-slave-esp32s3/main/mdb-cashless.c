@@ -0,0 +1,470 @@
+#include "mdb-cashless.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sdkconfig.h>
+
+#include "hal.h"
+#include "rpc-auth.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define TAG "mdb_cashless"
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+machine_state_t machine_state = INACTIVE_STATE;
+
+bool session_begin_todo = false;
+bool session_cancel_todo = false;
+bool session_end_todo = false;
+bool vend_approved_todo = false;
+bool vend_denied_todo = false;
+bool cashless_reset_todo = false;
+bool out_of_sequence_todo = false;
+
+uint16_t last_sale_price = 0;
+uint16_t last_sale_item = 0;
+
+time_t   last_vend_success_time = 0;
+
+static mdb_cashless_hooks_t s_hooks;
+
+// Frames addressed to us, by command (the low three bits of the address byte).
+static metric_t s_m_mdb_frames[8] = {
+	[RESET]     = METRIC_COUNTER("mdb.reset"),
+	[SETUP]     = METRIC_COUNTER("mdb.setup"),
+	[POLL]      = METRIC_COUNTER("mdb.poll"),
+	[VEND]      = METRIC_COUNTER("mdb.vend"),
+	[READER]    = METRIC_COUNTER("mdb.reader"),
+	[0x05]      = METRIC_COUNTER("mdb.cmd5"),
+	[0x06]      = METRIC_COUNTER("mdb.cmd6"),
+	[EXPANSION] = METRIC_COUNTER("mdb.expansion"),
+};
+static metric_t s_m_mdb_chk_err = METRIC_COUNTER("mdb.chk_err");
+static metric_t s_m_mdb_rxq = METRIC_GAUGE("mdb.rxq");
+
+uint16_t read_9(uint8_t *checksum) {
+    uint16_t coming_read = hal_mdb_read();
+
+    if (checksum)
+        *checksum += coming_read;
+
+    return coming_read;
+}
+
+// Read the frame's checksum byte and compare it with the running sum.
+static bool mdb_checksum_ok(uint8_t checksum) {
+	uint16_t got = read_9(NULL);
+	if (got == checksum) return true;
+
+	metric_inc(&s_m_mdb_chk_err);
+	trace_emit(TRACE_MDB_CHK_ERR, checksum, got);
+	return false;
+}
+
+void write_9(uint16_t nth9) {
+	hal_mdb_write(nth9);
+}
+
+void write_payload_9(uint8_t *mdb_payload, uint8_t length) {
+	uint8_t checksum = 0x00;
+
+	for (int x = 0; x < length; x++) {
+		checksum += mdb_payload[x];
+		write_9(mdb_payload[x]);
+	}
+
+	write_9(BIT_MODE_SET | checksum);
+}
+
+void ble_encode_with_passkey(uint8_t cmd, uint16_t item_price, uint16_t item_number, uint8_t *payload) {
+    uint32_t item_price_32 = TO_SCALE_FACTOR( FROM_SCALE_FACTOR(item_price, CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES), 1, 2);
+
+	time_t now = hal_time();
+
+    payload[0] = cmd;
+
+	write_u32(&payload[1], item_price_32);
+	write_u16(&payload[5], item_number);
+	write_u32(&payload[7], (uint32_t) now);
+	write_u32(&payload[11], 0);
+
+	unsigned char hmac[32];
+	calculate_hmac((const char*) payload, 15, hmac);
+	memcpy(payload + 15, hmac, 4);
+}
+
+bool ble_payload_verify(const uint8_t *payload) {
+	unsigned char hmac[32];
+	calculate_hmac((const char*) payload, 15, hmac);
+
+	uint8_t diff = 0;
+	for (int x = 0; x < 4; x++) {
+		diff |= hmac[x] ^ payload[15 + x];
+	}
+	return diff == 0;
+}
+
+
+int mdb_sale_line(char *line, size_t size, uint16_t item_price, uint16_t item_number, int64_t ts) {
+	uint32_t price_wire = TO_SCALE_FACTOR( FROM_SCALE_FACTOR(item_price, CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES), 1, 2);
+
+	char msg[64];
+	snprintf(msg, sizeof(msg), "%lu:%u:%lld", (unsigned long) price_wire, item_number, (long long) ts);
+	rpc_sign_text(msg, line, size);
+	return strlen(line);
+}
+
+int mdb_vend_fail_line(char *line, size_t size, uint16_t item_price, uint16_t item_number, int64_t ts) {
+	char msg[64];
+	snprintf(msg, sizeof(msg), "%u,%u:%lld", item_price, item_number, (long long) ts);
+	rpc_sign_text(msg, line, size);
+	return strlen(line);
+}
+
+void mdb_cashless_init(const mdb_cashless_hooks_t *hooks) {
+	if (hooks) s_hooks = *hooks;
+
+	for (int i = 0; i < 8; i++) metrics_register(&s_m_mdb_frames[i]);
+	metrics_register(&s_m_mdb_chk_err);
+	metrics_register(&s_m_mdb_rxq);
+}
+
+void mdb_cashless_poll(void) {
+	// Session state, kept from one frame to the next.
+	static time_t session_begin_time = 0;
+
+	static uint16_t funds_available = 0;
+	static mdb_credit_t credit;
+	static credit_probe_t *probe = &credit.probe;
+
+	static uint16_t item_price = 0;
+	static uint16_t item_number = 0;
+
+	static uint8_t mdb_payload[36];
+
+	uint8_t checksum = 0x00;
+	uint8_t available_tx = 0;
+	bool session_probe_done = false;
+
+	uint16_t coming_read = read_9(&checksum);
+
+	if (!(coming_read & BIT_MODE_SET)) return;
+
+	if ((uint8_t) coming_read == ACK) return;
+	if ((uint8_t) coming_read == RET) return;
+	if ((uint8_t) coming_read == NAK) return;
+
+	if ((coming_read & BIT_ADD_SET) != CONFIG_CASHLESS_DEVICE_ADDRESS) return;
+
+	metric_inc(&s_m_mdb_frames[coming_read & BIT_CMD_SET]);
+	metric_set(&s_m_mdb_rxq, hal_mdb_rx_pending());
+
+	switch (coming_read & BIT_CMD_SET) {
+	case RESET: {
+		if (!mdb_checksum_ok(checksum)) return;
+
+		cashless_reset_todo = true;
+		machine_state = INACTIVE_STATE;
+
+		credit_probe_outcome(probe, "reset");
+		session_probe_done = true;
+
+		if (s_hooks.reader_changed) s_hooks.reader_changed(false);
+
+		trace_emit(TRACE_MDB_RESET, 0, 0);
+		break;
+	}
+	case SETUP: {
+		switch (read_9(&checksum)) {
+		case CONFIG_DATA: {
+			uint8_t vmc_feature_level = read_9(&checksum);
+			read_9(&checksum);  // display columns
+			read_9(&checksum);  // display rows
+			read_9(&checksum);  // display info
+			
+			if (!mdb_checksum_ok(checksum)) return;
+
+			machine_state = DISABLED_STATE;
+
+			mdb_payload[0] = 0x01;
+			mdb_payload[1] = 1;
+			mdb_payload[2] = CONFIG_MDB_CURRENCY_CODE >> 8;
+			mdb_payload[3] = CONFIG_MDB_CURRENCY_CODE & 0xff;
+			mdb_payload[4] = CONFIG_MDB_SCALE_FACTOR;
+			mdb_payload[5] = CONFIG_MDB_DECIMAL_PLACES;
+			mdb_payload[6] = 3;
+			mdb_payload[7] = 0b00001001;
+			available_tx = 8;
+
+			trace_emit(TRACE_MDB_SETUP, vmc_feature_level, 0);
+			break;
+		}
+		case MAX_MIN_PRICES: {
+			uint16_t max_price = (read_9(&checksum) << 8) | read_9(&checksum);
+			uint16_t min_price = (read_9(&checksum) << 8) | read_9(&checksum);
+
+			if (!mdb_checksum_ok(checksum)) return;
+
+			trace_emit(TRACE_MDB_PRICES, max_price, min_price);
+			break;
+		}
+		}
+
+		break;
+	}
+	case POLL: {
+		if (!mdb_checksum_ok(checksum)) return;
+
+		if (cashless_reset_todo) {
+			cashless_reset_todo = false;
+			mdb_payload[0] = 0x00;
+			available_tx = 1;
+
+		} else if (machine_state <= ENABLED_STATE && s_hooks.take_credit && s_hooks.take_credit(&credit)) {
+			session_begin_todo = false;
+
+			funds_available = credit.funds;
+			credit_probe_mark(probe, PROBE_BEGIN);
+			hal_ble_session_begin(credit.ble_conn);
+
+			machine_state = IDLE_STATE;
+
+			mdb_payload[0] = 0x03;
+			mdb_payload[1] = funds_available >> 8;
+			mdb_payload[2] = funds_available;
+			available_tx = 3;
+
+			session_begin_time = hal_time();
+
+		} else if (session_cancel_todo) {
+			session_cancel_todo = false;
+
+			mdb_payload[0] = 0x04;
+			available_tx = 1;
+
+		} else if (vend_approved_todo) {
+			vend_approved_todo = false;
+
+			mdb_payload[0] = 0x05;
+			mdb_payload[1] = item_price >> 8;
+			mdb_payload[2] = item_price;
+			available_tx = 3;
+
+		} else if (vend_denied_todo) {
+			vend_denied_todo = false;
+
+			mdb_payload[0] = 0x06;
+			available_tx = 1;
+			machine_state = IDLE_STATE;
+
+		} else if (session_end_todo) {
+			session_end_todo = false;
+
+			mdb_payload[0] = 0x07;
+			available_tx = 1;
+			machine_state = ENABLED_STATE;
+
+		} else if (out_of_sequence_todo) {
+			out_of_sequence_todo = false;
+
+			mdb_payload[0] = 0x0b;
+			available_tx = 1;
+
+		} else {
+			time_t now = hal_time();
+
+			if (machine_state >= IDLE_STATE && (now - session_begin_time) > 60) {
+				session_cancel_todo = true;
+			}
+		}
+
+		break;
+	}
+	case VEND: {
+		switch (read_9(&checksum)) {
+		case VEND_REQUEST: {
+			item_price = (read_9(&checksum) << 8) | read_9(&checksum);
+			item_number = (read_9(&checksum) << 8) | read_9(&checksum);
+
+			if (!mdb_checksum_ok(checksum)) return;
+
+			machine_state = VEND_STATE;
+
+			if(funds_available && (funds_available != 0xffff)){
+				if (item_price <= funds_available) {
+                    funds_available -= item_price;
+                    vend_approved_todo = true;
+				} else {
+					vend_denied_todo = true;
+					credit_probe_outcome(probe, "denied");
+				}
+			}
+
+			credit_probe_mark(probe, PROBE_VEND_REQUEST);
+
+			uint8_t payload[19];
+			ble_encode_with_passkey(0x0a, item_price, item_number, payload);
+			hal_ble_notify_session((char*) payload, sizeof(payload));
+
+			trace_emit(TRACE_MDB_VEND_REQUEST, item_price, item_number);
+			break;
+		}
+		case VEND_CANCEL: {
+			if (!mdb_checksum_ok(checksum)) return;
+
+			vend_denied_todo = true;
+
+			credit_probe_outcome(probe, "cancel");
+			trace_emit(TRACE_MDB_VEND_CANCEL, 0, 0);
+			break;
+		}
+		case VEND_SUCCESS: {
+			item_number = (read_9(&checksum) << 8) | read_9(&checksum);
+
+			if (!mdb_checksum_ok(checksum)) return;
+
+			machine_state = IDLE_STATE;
+
+			last_sale_price = item_price;
+			last_sale_item  = item_number;
+			last_vend_success_time = hal_time();
+
+			credit_probe_mark(probe, PROBE_VEND_DONE);
+			credit_probe_outcome(probe, "vend");
+
+			uint8_t payload[19];
+			ble_encode_with_passkey(0x0b, item_price, item_number, payload);
+			hal_ble_notify_session((char*) payload, sizeof(payload));
+
+			trace_emit(TRACE_MDB_VEND_SUCCESS, item_price, item_number);
+			break;
+		}
+		case VEND_FAILURE: {
+			if (!mdb_checksum_ok(checksum)) return;
+
+			machine_state = IDLE_STATE;
+
+			credit_probe_mark(probe, PROBE_VEND_DONE);
+			credit_probe_outcome(probe, "fail");
+
+			uint8_t payload[19];
+			ble_encode_with_passkey(0x0c, item_price, item_number, payload);
+			hal_ble_notify_session((char*) payload, sizeof(payload));
+
+            char topic[64], line[160];
+            mdb_vend_fail_line(line, sizeof(line), item_price, item_number, hal_time());
+            snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/vend_fail", my_subdomain);
+            hal_publish(HAL_PUB_MONEY, topic, line, 0);
+
+			trace_emit(TRACE_MDB_VEND_FAILURE, item_price, item_number);
+			break;
+		}
+		case SESSION_COMPLETE: {
+			if (!mdb_checksum_ok(checksum)) return;
+
+			session_end_todo = true;
+			session_probe_done = true;
+
+			uint8_t payload[19];
+			ble_encode_with_passkey(0x0d, item_price, item_number, payload);
+			hal_ble_notify_session((char*) payload, sizeof(payload));
+
+			trace_emit(TRACE_MDB_SESSION_END, 0, 0);
+			break;
+		}
+		case CASH_SALE: {
+			uint16_t item_price = (read_9(&checksum) << 8) | read_9(&checksum);
+			uint16_t item_number = (read_9(&checksum) << 8) | read_9(&checksum);
+
+			if (!mdb_checksum_ok(checksum)) return;
+
+			char topic[64], line[160];
+			mdb_sale_line(line, sizeof(line), item_price, item_number, hal_time());
+
+			snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/sale", my_subdomain);
+			hal_publish(HAL_PUB_MONEY, topic, line, 0);
+
+			trace_emit(TRACE_MDB_CASH_SALE, item_price, item_number);
+			break;
+		}
+		}
+
+		break;
+	}
+	case READER: {
+		switch (read_9(&checksum)) {
+		case READER_DISABLE: {
+			if (!mdb_checksum_ok(checksum)) return;
+
+			machine_state = DISABLED_STATE;
+
+			if (s_hooks.reader_changed) s_hooks.reader_changed(false);
+
+			trace_emit(TRACE_MDB_READER, 0, 0);
+			break;
+		}
+		case READER_ENABLE: {
+			if (!mdb_checksum_ok(checksum)) return;
+
+			machine_state = ENABLED_STATE;
+
+			if (s_hooks.reader_changed) s_hooks.reader_changed(true);
+
+			trace_emit(TRACE_MDB_READER, 1, 0);
+			break;
+		}
+		case READER_CANCEL: {
+			if (!mdb_checksum_ok(checksum)) return;
+
+			mdb_payload[ 0 ] = 0x08;
+			available_tx = 1;
+
+			trace_emit(TRACE_MDB_READER, 2, 0);
+			break;
+		}
+		}
+
+		break;
+	}
+	case EXPANSION: {
+		switch (read_9(&checksum)) {
+		case REQUEST_ID: {
+			for(uint8_t x= 0; x < 29; x++) read_9(&checksum);
+
+			if (!mdb_checksum_ok(checksum)) return;
+
+			mdb_payload[ 0 ] = 0x09;
+
+			memcpy( &mdb_payload[1], "VMF", 3);
+			memcpy( &mdb_payload[4], "            ", 12);
+			memcpy( &mdb_payload[16], "            ", 12);
+			mdb_payload[28] = 0x00;
+			mdb_payload[29] = 0x03;
+
+			available_tx = 30;
+
+			trace_emit(TRACE_MDB_REQUEST_ID, 0, 0);
+			break;
+		}
+		}
+
+		break;
+	}
+	}
+
+	write_payload_9(mdb_payload, available_tx);
+
+	if (available_tx) trace_emit(TRACE_MDB_REPLY, mdb_payload[0], available_tx);
+
+	// Signed and queued after the reply so it never eats into the VMC's response window.
+	if (session_probe_done) {
+		session_probe_done = false;
+		credit_probe_finish(probe);
+		hal_ble_session_end();
+	}
+
+	if (s_hooks.frame_done) s_hooks.frame_done(machine_state);
+}
@@ -0,0 +1,146 @@
+/*
+ * mdb_cashless — the MDB cashless device (level 1) state machine.
+ *
+ * One call to mdb_cashless_poll() reads a frame from the bus, answers it
+ * within the VMC's response window and updates the session state below. It
+ * reaches the bus, the clock, the phone and the outbox only through hal.h,
+ * so the same code runs on the board (the mdb_cashless task on core 1) and
+ * against a simulated VMC on Linux (host/).
+ *
+ * The rest of the firmware steers a session through the *_todo flags, which
+ * the next POLL answers, and hands over credits through the take_credit hook:
+ *
+ *   session_cancel_todo     SESSION CANCEL REQUEST
+ *   vend_approved_todo      VEND APPROVED (the price of the pending request)
+ *   vend_denied_todo        VEND DENIED
+ *   out_of_sequence_todo    COMMAND OUT OF SEQUENCE
+ *
+ * A session left idle for 60 s is cancelled.
+ */
+#ifndef MDB_CASHLESS_H
+#define MDB_CASHLESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <math.h>
+
+#include "credit-probe.h"
+
+#define TO_SCALE_FACTOR(p, scale_to, dec_to) (p / scale_to / pow(10, -(dec_to) ))
+#define FROM_SCALE_FACTOR(p, scale_from, dec_from) (p * scale_from * pow(10, -(dec_from) ))
+
+// Big-endian (de)serialization helpers for the BLE wire payload.
+static inline uint32_t read_u32(const uint8_t *p) {
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+static inline uint16_t read_u16(const uint8_t *p) {
+	return ((uint16_t) p[0] << 8) | p[1];
+}
+static inline void write_u32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+static inline void write_u16(uint8_t *p, uint16_t v) {
+	p[0] = v >> 8; p[1] = v;
+}
+
+#define ACK 	0x00
+#define RET 	0xAA
+#define NAK 	0xFF
+
+#define BIT_MODE_SET 	0b100000000
+#define BIT_ADD_SET   	0b011111000
+#define BIT_CMD_SET   	0b000000111
+
+enum MDB_COMMAND_FLOW {
+	RESET       = 0x00,
+	SETUP       = 0x01,
+	POLL        = 0x02,
+	VEND        = 0x03,
+	READER      = 0x04,
+	EXPANSION   = 0x07
+};
+
+enum MDB_SETUP_FLOW {
+	CONFIG_DATA = 0x00, MAX_MIN_PRICES = 0x01
+};
+
+enum MDB_VEND_FLOW {
+	VEND_REQUEST        = 0x00,
+	VEND_CANCEL         = 0x01,
+	VEND_SUCCESS        = 0x02,
+	VEND_FAILURE        = 0x03,
+	SESSION_COMPLETE    = 0x04,
+	CASH_SALE           = 0x05
+};
+
+enum MDB_READER_FLOW {
+	READER_DISABLE  = 0x00,
+	READER_ENABLE   = 0x01,
+	READER_CANCEL   = 0x02
+};
+
+enum MDB_EXPANSION_FLOW {
+	REQUEST_ID = 0x00, DIAGNOSTICS = 0xFF
+};
+
+typedef enum MACHINE_STATE {
+	INACTIVE_STATE, DISABLED_STATE, ENABLED_STATE, IDLE_STATE, VEND_STATE
+} machine_state_t;
+
+// A credit waiting for the next POLL, with the latency probe that follows it through the session.
+typedef struct {
+	uint16_t funds;
+	uint16_t ble_conn;      /* phone that sent the credit, BLE_CONN_NONE for an RPC credit */
+	credit_probe_t probe;
+} mdb_credit_t;
+
+typedef struct {
+	/* Next credit to open a session with, if any. Called on POLL; must not block. */
+	bool (*take_credit)(mdb_credit_t *credit);
+	/* The VMC enabled or disabled the reader (RESET counts as disabled). */
+	void (*reader_changed)(bool enabled);
+	/* After every frame addressed to us, once the reply is out. */
+	void (*frame_done)(machine_state_t state);
+} mdb_cashless_hooks_t;
+
+extern machine_state_t machine_state;
+
+extern bool session_begin_todo;
+extern bool session_cancel_todo;
+extern bool session_end_todo;
+extern bool vend_approved_todo;
+extern bool vend_denied_todo;
+extern bool cashless_reset_todo;
+extern bool out_of_sequence_todo;
+
+extern uint16_t last_sale_price;
+extern uint16_t last_sale_item;
+
+extern time_t   last_vend_success_time;
+
+/* Register the MDB metrics and keep the hooks (any may be NULL). */
+void mdb_cashless_init(const mdb_cashless_hooks_t *hooks);
+
+/* Read and answer one frame; blocks until a word arrives. */
+void mdb_cashless_poll(void);
+
+/* Bus words: read_9 adds the word into *checksum (when not NULL);
+ * write_payload_9 appends the checksum with the mode bit set. */
+uint16_t read_9(uint8_t *checksum);
+void write_9(uint16_t nth9);
+void write_payload_9(uint8_t *mdb_payload, uint8_t length);
+
+/* Signed lines for .../sale (a cash sale, price in 1/100 units) and .../vend_fail
+ * (price as the VMC sent it), stamped ts. Return the line length. */
+int mdb_sale_line(char *line, size_t size, uint16_t item_price, uint16_t item_number, int64_t ts);
+int mdb_vend_fail_line(char *line, size_t size, uint16_t item_price, uint16_t item_number, int64_t ts);
+
+/* 19-byte BLE wire payload for a session event (see the main translation unit). */
+void ble_encode_with_passkey(uint8_t cmd, uint16_t item_price, uint16_t item_number, uint8_t *payload);
+
+/* True if the payload's 4-byte tag matches its first 15 bytes (constant time). */
+bool ble_payload_verify(const uint8_t *payload);
+
+#endif /* MDB_CASHLESS_H */
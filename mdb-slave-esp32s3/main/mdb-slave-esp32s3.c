@@ -17,69 +17,45 @@
 #include <esp_log.h>
 #include <esp_system.h>
 #include <esp_app_desc.h>
-#include <esp_ota_ops.h>
-#include <esp_https_ota.h>
-#include <esp_http_client.h>
-#include <esp_crt_bundle.h>
 #include <esp_event.h>
 #include <esp_netif.h>
 #include <esp_timer.h>
 #include <nvs_flash.h>
-#include <rom/ets_sys.h>
 #include <driver/gpio.h>
-#include <driver/uart.h>
 #include <esp_wifi.h>
 #include <mqtt_client.h>
-#include <esp_sntp.h>
-#include <esp_netif_ppp.h>
-#include <esp_modem_api.h>
 #include <led_strip.h>
 
+#include "hal.h"
+#include "mdb-cashless.h"
 #include "nimble.h"
 #include "eva-dts.h"
 #include "rpc-auth.h"
+#include "mqtt-outbox.h"
+#include "mqtt-session.h"
+#include "rpc-exec.h"
+#include "uplink.h"
+#include "sim7080g.h"
+#include "ota.h"
+#include "fleet.h"
+#include "timesync.h"
+#include "metrics.h"
+#include "trace.h"
+#include "credit-probe.h"
+#include "scan-sched.h"
+#include "ble-cmd.h"
+#include "beacon.h"
+#include "dex-ble.h"
+#include "core-bench.h"
 
 #define TAG "mdb_cashless"
 
-#define STRINGIFY_IMPL(x)   #x
-#define STRINGIFY(x)        STRINGIFY_IMPL(x)
-
 #define PIN_I2C_SDA         GPIO_NUM_10
 #define PIN_I2C_SCL         GPIO_NUM_11
 #define PIN_PULSE_1         GPIO_NUM_13
-#define PIN_MDB_RX          GPIO_NUM_4
-#define PIN_MDB_TX          GPIO_NUM_5
 #define PIN_MDB_LED         GPIO_NUM_21
-#define PIN_SIM7080G_RX     GPIO_NUM_18
-#define PIN_SIM7080G_TX     GPIO_NUM_17
-#define PIN_SIM7080G_PWR    GPIO_NUM_14
 #define PIN_BUZZER_PWR      GPIO_NUM_12
 
-#define TO_SCALE_FACTOR(p, scale_to, dec_to) (p / scale_to / pow(10, -(dec_to) ))
-#define FROM_SCALE_FACTOR(p, scale_from, dec_from) (p * scale_from * pow(10, -(dec_from) ))
-
-// Big-endian (de)serialization helpers for the BLE wire payload.
-static inline uint32_t read_u32(const uint8_t *p) {
-	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
-}
-static inline uint16_t read_u16(const uint8_t *p) {
-	return ((uint16_t) p[0] << 8) | p[1];
-}
-static inline void write_u32(uint8_t *p, uint32_t v) {
-	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
-}
-static inline void write_u16(uint8_t *p, uint16_t v) {
-	p[0] = v >> 8; p[1] = v;
-}
-
-#define ACK 	0x00
-#define RET 	0xAA
-#define NAK 	0xFF
-
-#define BIT_MODE_SET 	0b100000000
-#define BIT_ADD_SET   	0b011111000
-#define BIT_CMD_SET   	0b000000111
-
 enum BIT_STATUS {
     BIT_STATUS_MQTT         = (1 << 0),
     BIT_STATUS_MDB          = (1 << 1),
@@ -113,432 +89,51 @@ static void wifi_retry_cb(void *arg) {
 char my_passkey[PASSKEY_LEN + 1];
 char my_subdomain[32];
 
-enum MDB_COMMAND_FLOW {
-	RESET       = 0x00,
-	SETUP       = 0x01,
-	POLL        = 0x02,
-	VEND        = 0x03,
-	READER      = 0x04,
-	EXPANSION   = 0x07
-};
-
-enum MDB_SETUP_FLOW {
-	CONFIG_DATA = 0x00, MAX_MIN_PRICES = 0x01
-};
-
-enum MDB_VEND_FLOW {
-	VEND_REQUEST        = 0x00,
-	VEND_CANCEL         = 0x01,
-	VEND_SUCCESS        = 0x02,
-	VEND_FAILURE        = 0x03,
-	SESSION_COMPLETE    = 0x04,
-	CASH_SALE           = 0x05
-};
-
-enum MDB_READER_FLOW {
-	READER_DISABLE  = 0x00,
-	READER_ENABLE   = 0x01,
-	READER_CANCEL   = 0x02
-};
-
-enum MDB_EXPANSION_FLOW {
-	REQUEST_ID = 0x00, DIAGNOSTICS = 0xFF
-};
-
-typedef enum MACHINE_STATE {
-	INACTIVE_STATE, DISABLED_STATE, ENABLED_STATE, IDLE_STATE, VEND_STATE
-} machine_state_t;
-
-machine_state_t machine_state = INACTIVE_STATE;
-
 led_strip_handle_t led_strip;
 
-bool session_begin_todo = false;
-bool session_cancel_todo = false;
-bool session_end_todo = false;
-bool vend_approved_todo = false;
-bool vend_denied_todo = false;
-bool cashless_reset_todo = false;
-bool out_of_sequence_todo = false;
-
-uint16_t last_sale_price = 0;
-uint16_t last_sale_item = 0;
-
-time_t   last_vend_success_time = 0;
-
 static char s_ip_wifi[16] = "";
 static char s_ip_ppp[16]  = "";
 
-#define RPC_FRESHNESS_SEC   10
+static esp_netif_t *s_wifi_netif;
+
 #define BLE_FRESHNESS_SEC   60
 
 esp_mqtt_client_handle_t mqtt_client = NULL;
 
 static QueueHandle_t mdb_session_queue = NULL;
-static QueueHandle_t mdb_rx_queue;
 
-void ble_encode_with_passkey(uint8_t cmd, uint16_t item_price, uint16_t item_number, uint8_t *payload);
 esp_err_t ble_decode_with_passkey(uint16_t *item_price, uint16_t *item_number, uint8_t *payload);
 
-static void IRAM_ATTR mdb_rx_falling_isr(void *arg) {
-    gpio_intr_disable(PIN_MDB_RX);
-
-    uint16_t coming_read = 0x0000;
-
-    ets_delay_us(156);
-    for (int x = 0; x < 9; x++) {
-        coming_read |= (gpio_get_level(PIN_MDB_RX) << x);
-        ets_delay_us(104);
-    }
-    xQueueSendFromISR(mdb_rx_queue, &coming_read, NULL);
-
-    gpio_intr_enable(PIN_MDB_RX);
-}
-
-uint16_t read_9(uint8_t *checksum) {
-    uint16_t coming_read = 0;
-    xQueueReceive(mdb_rx_queue, &coming_read, portMAX_DELAY);
-
-    if (checksum)
-        *checksum += coming_read;
-
-    return coming_read;
+static bool mdb_take_credit(mdb_credit_t *credit) {
+	return xQueueReceive(mdb_session_queue, credit, 0) == pdTRUE;
 }
 
-void write_9(uint16_t nth9) {
-    gpio_set_level(PIN_MDB_TX, 0);
-    ets_delay_us(104);
-
-	for (uint8_t x = 0; x < 9; x++) {
-		gpio_set_level(PIN_MDB_TX, (nth9 >> x) & 1);
-		ets_delay_us(104);
+static void mdb_reader_changed(bool enabled) {
+	if (enabled) {
+		xEventGroupSetBits(xLedEventGroup, BIT_STATUS_MDB | BIT_STATUS_TRIGGER);
+	} else {
+		xEventGroupClearBits(xLedEventGroup, BIT_STATUS_MDB);
+		xEventGroupSetBits(xLedEventGroup, BIT_STATUS_TRIGGER);
 	}
-
-    gpio_set_level(PIN_MDB_TX, 1);
-    ets_delay_us(104);
 }
 
-void write_payload_9(uint8_t *mdb_payload, uint8_t length) {
-	uint8_t checksum = 0x00;
-
-	for (int x = 0; x < length; x++) {
-		checksum += mdb_payload[x];
-		write_9(mdb_payload[x]);
-	}
-
-	write_9(BIT_MODE_SET | checksum);
+static void mdb_frame_done(machine_state_t state) {
+	beacon_update(state);
 }
-void mdb_cashless_task(void *pvParameters) {
-	// Install the RX edge ISR from this task so the GPIO interrupt is allocated
-	// on this task's core (APP_CPU/core 1), isolated from core-0 network ISRs
-	// that would otherwise skew the bit-sampling timing.
-	gpio_install_isr_service(0);
-	gpio_isr_handler_add(PIN_MDB_RX, mdb_rx_falling_isr, NULL);
-
-	time_t session_begin_time = 0;
 
-	uint16_t funds_available = 0;
-	uint16_t item_price = 0;
-	uint16_t item_number = 0;
+void mdb_cashless_task(void *pvParameters) {
+	// The bus is set up from this task so the RX edge interrupt lands on its core (hal.h).
+	hal_mdb_init();
 
-	uint8_t mdb_payload[36];
-	uint8_t available_tx = 0;
+	static const mdb_cashless_hooks_t hooks = {
+		.take_credit = mdb_take_credit,
+		.reader_changed = mdb_reader_changed,
+		.frame_done = mdb_frame_done,
+	};
+	mdb_cashless_init(&hooks);
 
 	for (;;) {
-		uint8_t checksum = 0x00;
-
-		uint16_t coming_read = read_9(&checksum);
-
-		if (!(coming_read & BIT_MODE_SET)) continue;
-
-		if ((uint8_t) coming_read == ACK) continue;
-		if ((uint8_t) coming_read == RET) continue;
-		if ((uint8_t) coming_read == NAK) continue;
-
-		if ((coming_read & BIT_ADD_SET) != CONFIG_CASHLESS_DEVICE_ADDRESS) continue;
-
-		available_tx = 0;
-
-		switch (coming_read & BIT_CMD_SET) {
-		case RESET: {
-			if (read_9(NULL) != checksum) continue;
-
-			cashless_reset_todo = true;
-			machine_state = INACTIVE_STATE;
-
-			xEventGroupClearBits(xLedEventGroup, BIT_STATUS_MDB);
-			xEventGroupSetBits(xLedEventGroup, BIT_STATUS_TRIGGER);
-
-			ESP_LOGI( TAG, "RESET");
-			break;
-		}
-		case SETUP: {
-			switch (read_9(&checksum)) {
-			case CONFIG_DATA: {
-				uint8_t vmc_feature_level = read_9(&checksum);
-				uint8_t vmc_columns_on_display = read_9(&checksum);
-				uint8_t vmc_rows_on_display = read_9(&checksum);
-				uint8_t vmc_display_info = read_9(&checksum);
-				
-				if (read_9(NULL) != checksum) continue;
-
-				machine_state = DISABLED_STATE;
-
-				mdb_payload[0] = 0x01;
-				mdb_payload[1] = 1;
-				mdb_payload[2] = CONFIG_MDB_CURRENCY_CODE >> 8;
-				mdb_payload[3] = CONFIG_MDB_CURRENCY_CODE & 0xff;
-				mdb_payload[4] = CONFIG_MDB_SCALE_FACTOR;
-				mdb_payload[5] = CONFIG_MDB_DECIMAL_PLACES;
-				mdb_payload[6] = 3;
-				mdb_payload[7] = 0b00001001;
-				available_tx = 8;
-
-				ESP_LOGI( TAG, "CONFIG_DATA");
-				break;
-			}
-			case MAX_MIN_PRICES: {
-				uint16_t max_price = (read_9(&checksum) << 8) | read_9(&checksum);
-				uint16_t min_price = (read_9(&checksum) << 8) | read_9(&checksum);
-
-				(void) max_price;
-				(void) min_price;
-
-				if (read_9(NULL) != checksum) continue;
-
-				ESP_LOGI( TAG, "MAX_MIN_PRICES");
-				break;
-			}
-			}
-
-			break;
-		}
-		case POLL: {
-			if (read_9(NULL) != checksum) continue;
-
-			if (cashless_reset_todo) {
-				cashless_reset_todo = false;
-				mdb_payload[0] = 0x00;
-				available_tx = 1;
-
-			} else if (machine_state <= ENABLED_STATE && xQueueReceive(mdb_session_queue, &funds_available, 0)) {
-				session_begin_todo = false;
-
-				machine_state = IDLE_STATE;
-
-				mdb_payload[0] = 0x03;
-				mdb_payload[1] = funds_available >> 8;
-				mdb_payload[2] = funds_available;
-				available_tx = 3;
-
-				time( &session_begin_time);
-
-			} else if (session_cancel_todo) {
-				session_cancel_todo = false;
-
-				mdb_payload[0] = 0x04;
-				available_tx = 1;
-
-			} else if (vend_approved_todo) {
-				vend_approved_todo = false;
-
-				mdb_payload[0] = 0x05;
-				mdb_payload[1] = item_price >> 8;
-				mdb_payload[2] = item_price;
-				available_tx = 3;
-
-			} else if (vend_denied_todo) {
-				vend_denied_todo = false;
-
-				mdb_payload[0] = 0x06;
-				available_tx = 1;
-				machine_state = IDLE_STATE;
-
-			} else if (session_end_todo) {
-				session_end_todo = false;
-
-				mdb_payload[0] = 0x07;
-				available_tx = 1;
-				machine_state = ENABLED_STATE;
-
-			} else if (out_of_sequence_todo) {
-				out_of_sequence_todo = false;
-
-				mdb_payload[0] = 0x0b;
-				available_tx = 1;
-
-			} else {
-				time_t now = time(NULL);
-
-				if (machine_state >= IDLE_STATE && (now - session_begin_time) > 60) {
-					session_cancel_todo = true;
-				}
-			}
-
-			break;
-		}
-		case VEND: {
-			switch (read_9(&checksum)) {
-			case VEND_REQUEST: {
-				item_price = (read_9(&checksum) << 8) | read_9(&checksum);
-				item_number = (read_9(&checksum) << 8) | read_9(&checksum);
-
-				if (read_9(NULL) != checksum) continue;
-
-				machine_state = VEND_STATE;
-
-				if(funds_available && (funds_available != 0xffff)){
-					if (item_price <= funds_available) {
-                        funds_available -= item_price;
-                        vend_approved_todo = true;
-					} else {
-						vend_denied_todo = true;
-					}
-				}
-
-				uint8_t payload[19];
-				ble_encode_with_passkey(0x0a, item_price, item_number, payload);
-				ble_notify_send((char*) payload, sizeof(payload));
-
-				ESP_LOGI( TAG, "VEND_REQUEST");
-				break;
-			}
-			case VEND_CANCEL: {
-				if (read_9(NULL) != checksum) continue;
-
-				vend_denied_todo = true;
-				break;
-			}
-			case VEND_SUCCESS: {
-				item_number = (read_9(&checksum) << 8) | read_9(&checksum);
-
-				if (read_9(NULL) != checksum) continue;
-
-				machine_state = IDLE_STATE;
-
-				last_sale_price = item_price;
-				last_sale_item  = item_number;
-				last_vend_success_time = time(NULL);
-
-				uint8_t payload[19];
-				ble_encode_with_passkey(0x0b, item_price, item_number, payload);
-				ble_notify_send((char*) payload, sizeof(payload));
-
-				ESP_LOGI( TAG, "VEND_SUCCESS");
-				break;
-			}
-			case VEND_FAILURE: {
-				if (read_9(NULL) != checksum) continue;
-
-				machine_state = IDLE_STATE;
-
-				uint8_t payload[19];
-				ble_encode_with_passkey(0x0c, item_price, item_number, payload);
-				ble_notify_send((char*) payload, sizeof(payload));
-
-                char topic[64], msg[64], line[160];
-                snprintf(msg, sizeof(msg), "%u,%u:%lld", item_price, item_number, (long long) time(NULL));
-                rpc_sign_text(msg, line, sizeof(line));
-                snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/vend_fail", my_subdomain);
-                esp_mqtt_client_enqueue(mqtt_client, topic, line, 0, 1, 0, 1);
-
-				break;
-			}
-			case SESSION_COMPLETE: {
-				if (read_9(NULL) != checksum) continue;
-
-				session_end_todo = true;
-
-				uint8_t payload[19];
-				ble_encode_with_passkey(0x0d, item_price, item_number, payload);
-				ble_notify_send((char*) payload, sizeof(payload));
-
-				ESP_LOGI( TAG, "SESSION_COMPLETE");
-				break;
-			}
-			case CASH_SALE: {
-				uint16_t item_price = (read_9(&checksum) << 8) | read_9(&checksum);
-				uint16_t item_number = (read_9(&checksum) << 8) | read_9(&checksum);
-
-				if (read_9(NULL) != checksum) continue;
-
-				uint32_t price_wire = TO_SCALE_FACTOR( FROM_SCALE_FACTOR(item_price, CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES), 1, 2);
-
-				char topic[64], msg[64], line[160];
-				snprintf(msg, sizeof(msg), "%lu:%u:%lld", (unsigned long) price_wire, item_number, (long long) time(NULL));
-				rpc_sign_text(msg, line, sizeof(line));
-
-				snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/sale", my_subdomain);
-				esp_mqtt_client_enqueue(mqtt_client, topic, line, 0, 1, 0, 1);
-
-				ESP_LOGI( TAG, "CASH_SALE");
-				break;
-			}
-			}
-
-			break;
-		}
-		case READER: {
-			switch (read_9(&checksum)) {
-			case READER_DISABLE: {
-				if (read_9(NULL) != checksum) continue;
-
-				machine_state = DISABLED_STATE;
-
-				xEventGroupClearBits(xLedEventGroup, BIT_STATUS_MDB);
-				xEventGroupSetBits(xLedEventGroup, BIT_STATUS_TRIGGER);
-
-				break;
-			}
-			case READER_ENABLE: {
-				if (read_9(NULL) != checksum) continue;
-
-				machine_state = ENABLED_STATE;
-
-				xEventGroupSetBits(xLedEventGroup, BIT_STATUS_MDB | BIT_STATUS_TRIGGER);
-
-				break;
-			}
-			case READER_CANCEL: {
-				if (read_9(NULL) != checksum) continue;
-
-				mdb_payload[ 0 ] = 0x08;
-				available_tx = 1;
-
-				ESP_LOGI( TAG, "READER_CANCEL");
-				break;
-			}
-			}
-
-			break;
-		}
-		case EXPANSION: {
-			switch (read_9(&checksum)) {
-			case REQUEST_ID: {
-				for(uint8_t x= 0; x < 29; x++) read_9(&checksum);
-
-				if (read_9(NULL) != checksum) continue;
-
-				mdb_payload[ 0 ] = 0x09;
-
-				memcpy( &mdb_payload[1], "VMF", 3);
-				memcpy( &mdb_payload[4], "            ", 12);
-				memcpy( &mdb_payload[16], "            ", 12);
-				mdb_payload[28] = 0x00;
-				mdb_payload[29] = 0x03;
-
-				available_tx = 30;
-
-				ESP_LOGI( TAG, "REQUEST_ID");
-				break;
-			}
-			}
-
-			break;
-		}
-		}
-
-		write_payload_9(mdb_payload, available_tx);
+		mdb_cashless_poll();
 	}
 }
 
@@ -555,28 +150,34 @@ void mdb_cashless_task(void *pvParameters) {
  *     oos:-            send MDB "command out of sequence" to the VMC
  *     echo:-           reply <ts> on .../rpc/echo (liveness + RTT probe)
  *     buzzer:-         1s beep
- *     restart:-        ack on .../rpc/restart, then reboot
+ *     restart:-        ack on .../rpc/confirm, then reboot
  *     ota:<tag>        pull app image from GitHub release (ota:- = latest, or pinned tag)
- *                      over HTTPS; progress on .../rpc/ota, then reboot
+ *                      over HTTPS, as a delta patch when one exists for the running
+ *                      version, else the full image with Range resume; progress on
+ *                      .../rpc/ota, then reboot into it pending a health check (ota.h)
+ *     transport:<name> select "mqtt" (TCP) or "mqtt-sn" (UDP) for the next boot
+ *     fleet:<spec>     join "<fleet>[,<group>...]" (or leave: "-") from the next boot
+ *     time:<nonce>     backend time answer; <ts> is the server clock, not freshness-checked
+ *     metrics:-        publish a metrics snapshot now on .../metrics (metrics.h)
+ *     trace:-          publish the binary event trace on .../rpc/trace (trace.h), ack on .../rpc/confirm
+ *   Commands run on the rpc_exec task (see rpc-exec.h); each reply is "<result>:<corr>",
+ *   <corr> = first 8 hex chars of the request HMAC. Failures reply "error,<esp_err>:<corr>".
  *
  * Outbound — signed text "<fields>:<ts>:<hmac_hex>":
  *     sale  "<price>:<item>:<ts>:<hmac>"  on  .../sale
- *     pax   "<count>:<ts>:<hmac>"         on  .../paxcounter
+ *     pax   "<count>,<returning>,<dwell>,<bands/radio...>:<ts>:<hmac>"  on  .../paxcounter, hourly (pax-stats.h)
+ *     metrics "<json>:<ts>:<hmac>"        on  .../metrics (every CONFIG_VMFLOW_METRICS_INTERVAL s)
+ *     latency "<corr>,<outcome>,<stages...>:<ts>:<hmac>"  on  .../latency, one per credit session (credit-probe.h)
  *
  * BLE wire payload (phone app) — 19 bytes:
  *   [0] CMD | [1-4] PRICE u32 | [5-6] ITEM u16 | [7-10] TIME u32 |
  *   [11-14] reserved=0 | [15-18] HMAC-SHA256(passkey, bytes 0-14)[:4]
+ * Every phone command is answered with [0] 0x0e | [1] CMD | [2] result (ble-cmd.h).
+ * v2: [0] 0xb2 | [1-4] SEQ u32 | [cmd][len][args]... | HMAC-SHA256(passkey, NONCE || frame)[:16],
+ * several commands per write, keyed per connection by the NONCE read from the characteristic (ble-cmd.h).
  */
 esp_err_t ble_decode_with_passkey(uint16_t *item_price, uint16_t *item_number, uint8_t *payload) {
-	unsigned char hmac[32];
-	calculate_hmac((const char*) payload, 15, hmac);
-
-	uint8_t diff = 0;
-	for(int x = 0; x < 4; x++){
-		diff |= hmac[x] ^ payload[15 + x];
-	}
-
-    if(diff != 0){
+    if(!ble_payload_verify(payload)){
         return ESP_ERR_INVALID_CRC;
     }
 
@@ -584,7 +185,7 @@ esp_err_t ble_decode_with_passkey(uint16_t *item_price, uint16_t *item_number, u
 
     time_t now = time(NULL);
 
-    if( abs((int32_t) now - timestamp) > BLE_FRESHNESS_SEC ){
+    if( timesync_source() == TIMESYNC_NONE || abs((int32_t) now - timestamp) > BLE_FRESHNESS_SEC + timesync_slack_s() ){
         return ESP_ERR_TIMEOUT;
     }
 
@@ -599,23 +200,6 @@ esp_err_t ble_decode_with_passkey(uint16_t *item_price, uint16_t *item_number, u
     return ESP_OK;
 }
 
-void ble_encode_with_passkey(uint8_t cmd, uint16_t item_price, uint16_t item_number, uint8_t *payload) {
-    uint32_t item_price_32 = TO_SCALE_FACTOR( FROM_SCALE_FACTOR(item_price, CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES), 1, 2);
-
-	time_t now = time(NULL);
-
-    payload[0] = cmd;
-
-	write_u32(&payload[1], item_price_32);
-	write_u16(&payload[5], item_number);
-	write_u32(&payload[7], (uint32_t) now);
-	write_u32(&payload[11], 0);
-
-	unsigned char hmac[32];
-	calculate_hmac((const char*) payload, 15, hmac);
-	memcpy(payload + 15, hmac, 4);
-}
-
 #define LED_LVL 30   // per-channel brightness; same level on every lit channel
 
 void led_status_task(void *pvParameters) {
@@ -643,143 +227,196 @@ void led_status_task(void *pvParameters) {
     }
 }
 
-void ble_pax_event_handler(uint16_t devices_count){
-    char topic[64], msg[48], line[128];
-    snprintf(msg, sizeof(msg), "%u:%lld", devices_count, (long long) time(NULL));
+// An open or queued payment session pauses the PAX scan (scan-sched.h).
+static bool mdb_session_active(void) {
+    return machine_state >= IDLE_STATE || (mdb_session_queue && uxQueueMessagesWaiting(mdb_session_queue) > 0);
+}
+
+void ble_pax_event_handler(uint32_t devices_count, const char *report){
+    trace_emit(TRACE_BLE_PAX, 0, devices_count);
+
+    char topic[64], msg[432], line[512];
+    snprintf(msg, sizeof(msg), "%s:%lld", report, (long long) time(NULL));
     rpc_sign_text(msg, line, sizeof(line));
 
     snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/paxcounter", my_subdomain);
-    esp_mqtt_client_enqueue(mqtt_client, topic, line, 0, 1, 0, 1);
+    mqtt_outbox_publish(OUTBOX_TELEMETRY, topic, line, 0, 0);
 }
 
-void ble_event_handler(char *ble_payload) {
-    printf("ble_event_handler %x\n", (uint8_t) ble_payload[0]);
+// Phone commands (ble-cmd.h): run on the ble_cmd worker, one at a time; req->payload[0] is the command byte.
+static esp_err_t ble_cmd_domain(const ble_cmd_req_t *req) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("vmflow", NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
 
-	switch ( (uint8_t) ble_payload[0] ) {
-    case 0x00: {
-        nvs_handle_t handle;
-		nvs_open("vmflow", NVS_READWRITE, &handle);
+    size_t s_len;
+    if (nvs_get_str(handle, "domain", NULL, &s_len) == ESP_OK) {
+        nvs_close(handle);
+        return ESP_ERR_INVALID_STATE;   // provisioned once
+    }
 
-		size_t s_len;
-		if (nvs_get_str(handle, "domain", NULL, &s_len) != ESP_OK) {
-			strcpy(my_subdomain, ble_payload + 1);
+    snprintf(my_subdomain, sizeof(my_subdomain), "%s", req->payload + 1);
 
-			nvs_set_str(handle, "domain", my_subdomain);
-			nvs_commit(handle);
+    err = nvs_set_str(handle, "domain", my_subdomain);
+    if (err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+    if (err != ESP_OK) return err;
 
-			char myhost[64];
-			snprintf(myhost, sizeof(myhost), "%s.vmflow.xyz", my_subdomain);
+    char myhost[64];
+    snprintf(myhost, sizeof(myhost), "%s.vmflow.xyz", my_subdomain);
 
-			ble_set_device_name(myhost);
+    ble_set_device_name(myhost);
 
-            xEventGroupSetBits(xLedEventGroup, BIT_STATUS_DOMAIN | BIT_STATUS_TRIGGER);
+    xEventGroupSetBits(xLedEventGroup, BIT_STATUS_DOMAIN | BIT_STATUS_TRIGGER);
 
-			ESP_LOGI( TAG, "HOST= %s", myhost);
-		}
-		nvs_close(handle);
-		break;
+    ESP_LOGI( TAG, "HOST= %s", myhost);
+    return ESP_OK;
+}
+
+static esp_err_t ble_cmd_passkey(const ble_cmd_req_t *req) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("vmflow", NVS_READWRITE, &handle);
+    if (err != ESP_OK) return err;
+
+    size_t s_len;
+    if (nvs_get_str(handle, "passkey", NULL, &s_len) == ESP_OK) {
+        nvs_close(handle);
+        return ESP_ERR_INVALID_STATE;   // provisioned once
     }
-    case 0x01: {
-        nvs_handle_t handle;
-		nvs_open("vmflow", NVS_READWRITE, &handle);
 
-		size_t s_len;
-		if (nvs_get_str(handle, "passkey", NULL, &s_len) != ESP_OK) {
-			strcpy(my_passkey, ble_payload + 1);
+    snprintf(my_passkey, sizeof(my_passkey), "%s", req->payload + 1);
 
-			nvs_set_str(handle, "passkey", my_passkey);
-			nvs_commit(handle);
+    err = nvs_set_str(handle, "passkey", my_passkey);
+    if (err == ESP_OK) err = nvs_commit(handle);
+    nvs_close(handle);
+    if (err != ESP_OK) return err;
 
-            xEventGroupSetBits(xLedEventGroup, BIT_STATUS_PSSKEY | BIT_STATUS_TRIGGER);
+    xEventGroupSetBits(xLedEventGroup, BIT_STATUS_PSSKEY | BIT_STATUS_TRIGGER);
 
-			ESP_LOGI( TAG, "PASSKEY= %s", my_passkey);
-		}
-		nvs_close(handle);
+    ESP_LOGI( TAG, "PASSKEY= %s", my_passkey);
+    return ESP_OK;
+}
 
-        break;
-    }
-    case 0x02:
-        uint16_t funds_available = 0xffff;
-		xQueueSend(mdb_session_queue, &funds_available, 0);
-		break;
-	case 0x03:
+static esp_err_t ble_cmd_credit(const ble_cmd_req_t *req) {
+    if (mdb_session_queue == NULL) return ESP_ERR_INVALID_STATE;
 
-        if(ble_decode_with_passkey(NULL, NULL, (uint8_t*) ble_payload) == ESP_OK){
-            vend_approved_todo = (machine_state == VEND_STATE) ? true : false;
-        }
-        break;
-    case 0x04:
-    	session_cancel_todo = (machine_state >= IDLE_STATE) ? true : false;
-        break;
-    case 0x05:
-        break;
-    case 0x06: {
-        esp_wifi_disconnect();
+    mdb_credit_t credit = { .funds = 0xffff, .ble_conn = req->conn_handle };
+    int64_t now = esp_timer_get_time();
+    credit_probe_start(&credit.probe, "ble", 0, now, now);
+    credit_probe_mark(&credit.probe, PROBE_QUEUED);
 
-		wifi_config_t wifi_config = {0};
-		esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+    return xQueueSend(mdb_session_queue, &credit, 0) == pdTRUE ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
 
-		strcpy((char*) wifi_config.sta.ssid, ble_payload + 1);
-		esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+static esp_err_t ble_cmd_vend_approve(const ble_cmd_req_t *req) {
+    if (!ble_session_allows(req->conn_handle)) return ESP_ERR_INVALID_STATE;   // another phone's session
 
-	    ESP_LOGI( TAG, "SSID= %s", wifi_config.sta.ssid);
-        break;
+    // v1: the signed 19-byte payload; v2: the frame was verified already (ble-cmd.h).
+    if (!req->authenticated) {
+        if (req->len < 19) return ESP_ERR_INVALID_SIZE;
+
+        esp_err_t err = ble_decode_with_passkey(NULL, NULL, (uint8_t*) req->payload);
+        if (err != ESP_OK) return err;
     }
-    case 0x07: {
-        wifi_config_t wifi_config = {0};
-		esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
 
-		strcpy((char*) wifi_config.sta.password, ble_payload + 1);
-		esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    vend_approved_todo = (machine_state == VEND_STATE) ? true : false;
+    return vend_approved_todo ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
 
-		esp_wifi_connect();
+static esp_err_t ble_cmd_session_cancel(const ble_cmd_req_t *req) {
+    if (!ble_session_allows(req->conn_handle)) return ESP_ERR_INVALID_STATE;
 
-	    ESP_LOGI( TAG, "PASSWORD= %s", wifi_config.sta.password);
-		break;
-    }
-	}
+    session_cancel_todo = (machine_state >= IDLE_STATE) ? true : false;
+    return session_cancel_todo ? ESP_OK : ESP_ERR_INVALID_STATE;
 }
 
-// OTA worker: pulls the app image from a GitHub release asset over HTTPS, writes the inactive slot, then reboots.
-// Runs in its own task because the download blocks for tens of seconds and must not stall the MQTT handler.
-static void ota_task(void *arg) {
-	const char *url = (const char *) arg;
-
-	esp_http_client_config_t http_cfg = {
-		.url = url,
-		.crt_bundle_attach = esp_crt_bundle_attach,  // GitHub redirects to release-assets.githubusercontent.com (S3)
-		.timeout_ms = 30000,
-		.keep_alive_enable = true,
-		// The S3 redirect target is a ~900-char signed URL; the default 512 B tx buffer can't hold the request line, yielding "HTTP_CLIENT: Out of buffer".
-		.buffer_size = 2048,
-		.buffer_size_tx = 4096,
-	};
-	esp_https_ota_config_t ota_cfg = {
-		.http_config = &http_cfg,
-	};
+static esp_err_t ble_cmd_wifi_ssid(const ble_cmd_req_t *req) {
+    esp_wifi_disconnect();
 
-	esp_err_t err = esp_https_ota(&ota_cfg);
-	if (err == ESP_OK) {
-		ESP_LOGW(TAG, "OTA success, rebooting into new image");
-		vTaskDelay(pdMS_TO_TICKS(1000));
-		esp_restart();
-	} else {
-		ESP_LOGE(TAG, "OTA failed: %s", esp_err_to_name(err));
-		vTaskDelete(NULL);
-	}
+    wifi_config_t wifi_config = {0};
+    esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+
+    snprintf((char*) wifi_config.sta.ssid, sizeof(wifi_config.sta.ssid), "%s", req->payload + 1);
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+
+    ESP_LOGI( TAG, "SSID= %s", wifi_config.sta.ssid);
+    return err;
+}
+
+static esp_err_t ble_cmd_wifi_password(const ble_cmd_req_t *req) {
+    wifi_config_t wifi_config = {0};
+    esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+
+    snprintf((char*) wifi_config.sta.password, sizeof(wifi_config.sta.password), "%s", req->payload + 1);
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    if (err != ESP_OK) return err;
+
+    esp_wifi_connect();
+
+    ESP_LOGI( TAG, "PASSWORD= %s", wifi_config.sta.password);
+    return ESP_OK;
+}
+
+// DEX audit over BLE (dex-ble.h); v2 frames only.
+static esp_err_t ble_cmd_dex_pull(const ble_cmd_req_t *req) {
+    if (!req->authenticated) return ESP_ERR_NOT_SUPPORTED;
+
+    const uint8_t *p = (const uint8_t*) req->payload;
+    uint32_t id = req->len >= 10 ? read_u32(&p[6]) : 0;
+    return dex_ble_pull(req->conn_handle, read_u32(&p[1]), p[5], id);
 }
 
+static esp_err_t ble_cmd_dex_credit(const ble_cmd_req_t *req) {
+    if (!req->authenticated) return ESP_ERR_NOT_SUPPORTED;
+
+    return dex_ble_credit(req->conn_handle, (uint8_t) req->payload[1]);
+}
+
+static const ble_command_t ble_commands[] = {
+    { 0x00, 2,  ble_cmd_domain },
+    { 0x01, 2,  ble_cmd_passkey },
+    { 0x02, 1,  ble_cmd_credit },
+    { 0x03, 1,  ble_cmd_vend_approve },      // v1 writes carry the 19-byte signed payload
+    { 0x04, 1,  ble_cmd_session_cancel },
+    { 0x06, 2,  ble_cmd_wifi_ssid },
+    { 0x07, 1,  ble_cmd_wifi_password },     // empty password: open network
+    { 0x08, 6,  ble_cmd_dex_pull },
+    { 0x09, 2,  ble_cmd_dex_credit },
+};
+
 // Device snapshot (JSON) on .../rpc/info for AI agents to consume.
-static void rpc_publish_info(void) {
+static esp_err_t rpc_cmd_info(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
 	const esp_app_desc_t *app = esp_app_get_description();
 
-	char topic[64], json[384];
-	int n = snprintf(json, sizeof(json),
+	uplink_stats_t up;
+	uplink_get_stats(&up);
+
+	sim7080g_stats_t mdm;
+	sim7080g_get_stats(&mdm);
+
+	mqtt_session_stats_t ses;
+	mqtt_session_get_stats(&ses);
+
+	ota_stats_t ota;
+	ota_get_stats(&ota);
+
+	timesync_stats_t ts;
+	timesync_get_stats(&ts);
+
+	snprintf(reply, reply_sz,
 		"{\"version\":\"%s\",\"uptime_s\":%lld,"
 		"\"free_heap\":%lu,\"min_free_heap\":%lu,\"machine_state\":%d,"
 		"\"last_sale_price\":%u,\"last_sale_item\":%u,"
 		"\"last_vend_success_time\":%lld,"
-		"\"ip_wifi\":\"%s\",\"ip_ppp\":\"%s\"}",
+		"\"ip_wifi\":\"%s\",\"ip_ppp\":\"%s\","
+		"\"uplink\":\"%s\",\"uplink_switches\":%lu,"
+		"\"rtt_wifi_ms\":%ld,\"rtt_ppp_ms\":%ld,"
+		"\"modem_attaches\":%lu,\"modem_attach_ms\":%lu,\"modem_attach_cold\":%s,"
+		"\"modem_oper\":\"%s\",\"modem_band\":%u,\"modem_rat\":%u,"
+		"\"mqtt_transport\":\"%s\",\"mqtt_connects\":%lu,\"mqtt_resumes\":%lu,\"mqtt_ready_ms\":%lu,"
+		"\"mqtt_offline_ms\":%lu,\"mqtt_reconnect_bytes\":%lu,"
+		"\"ota_running\":%s,\"ota_pending_verify\":%s,\"ota_bytes\":%lu,\"ota_total\":%lu,\"ota_attempts\":%lu,"
+		"\"fleet\":\"%s\",\"time_source\":\"%s\",\"time_uncertainty_ms\":%lu,\"time_ready_ms\":%lu}",
 		app->version,
 		(long long) (esp_timer_get_time() / 1000000),
 		(unsigned long) esp_get_free_heap_size(),
@@ -787,140 +424,164 @@ static void rpc_publish_info(void) {
 		(int) machine_state,
 		last_sale_price, last_sale_item,
 		(long long) last_vend_success_time,
-		s_ip_wifi, s_ip_ppp);
+		s_ip_wifi, s_ip_ppp,
+		uplink_name(up.active), (unsigned long) up.switches,
+		(long) up.rtt_ms[UPLINK_WIFI], (long) up.rtt_ms[UPLINK_PPP],
+		(unsigned long) mdm.attach_count, (unsigned long) mdm.last_attach_ms, mdm.last_attach_cold ? "true" : "false",
+		mdm.oper, mdm.band, mdm.rat,
+		mqtt_session_transport(), (unsigned long) ses.connects, (unsigned long) ses.resumes, (unsigned long) ses.last_ready_ms,
+		(unsigned long) ses.last_offline_ms, (unsigned long) ses.last_tx_bytes,
+		ota.running ? "true" : "false", ota.pending_verify ? "true" : "false",
+		(unsigned long) ota.bytes, (unsigned long) ota.total, (unsigned long) ota.attempts,
+		fleet_membership(), timesync_source_name(ts.source), (unsigned long) ts.uncertainty_ms, (unsigned long) ts.ready_ms);
+
+	return ESP_OK;
+}
 
-	snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/rpc/info", my_subdomain);
-	esp_mqtt_client_enqueue(mqtt_client, topic, json, n, 1, 0, 1);
+static esp_err_t rpc_cmd_dex(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	request_telemetry_data(NULL);
+	ESP_LOGI(TAG, "RPC dex request started");
+	return ESP_OK;
 }
 
-static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
-	esp_mqtt_event_handle_t event = event_data;
-	esp_mqtt_client_handle_t mqtt_client = event->client;
+static esp_err_t rpc_cmd_credit(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	mdb_credit_t credit = { .funds = TO_SCALE_FACTOR( FROM_SCALE_FACTOR(arg->num, 1, 2), CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES), .ble_conn = BLE_CONN_NONE };
+	credit_probe_start(&credit.probe, req->corr, req->ts, req->rx_us, req->verified_us);
+	credit_probe_mark(&credit.probe, PROBE_QUEUED);
 
-	switch ((esp_mqtt_event_id_t) event_id) {
-	case MQTT_EVENT_CONNECTED:
+	if (xQueueSend(mdb_session_queue, &credit, 0) != pdTRUE) return ESP_ERR_INVALID_STATE;
+	ble_scan_stop();	// the session gets the radio and the CPU
+	xEventGroupSetBits(xLedEventGroup, BIT_STATUS_BUZZER | BIT_STATUS_TRIGGER);
 
-    	char topic[64], buf[32];
-    	snprintf(topic, sizeof(topic), "%s.vmflow.xyz/#", my_subdomain);
+	snprintf(reply, reply_sz, "ok");
+	ESP_LOGI( TAG, "RPC credit: Amount= %f", FROM_SCALE_FACTOR(credit.funds, CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES) );
+	return ESP_OK;
+}
 
-    	esp_mqtt_client_subscribe(mqtt_client, topic, 0);
+static esp_err_t rpc_cmd_oos(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	out_of_sequence_todo = true;
 
-    	snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/status", my_subdomain);
-    	snprintf(buf, sizeof(buf), "online,%d", (int)esp_reset_reason());
-    	esp_mqtt_client_enqueue(mqtt_client, topic, buf, 0, 1, 1, 1);
+	snprintf(reply, reply_sz, "ok");
+	ESP_LOGI(TAG, "RPC out-of-sequence queued");
+	return ESP_OK;
+}
 
-        xEventGroupSetBits(xLedEventGroup, BIT_STATUS_MQTT | BIT_STATUS_TRIGGER);
+static esp_err_t rpc_cmd_echo(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	snprintf(reply, reply_sz, "%lu", (unsigned long) req->ts);
+	return ESP_OK;
+}
 
-		break;
-	case MQTT_EVENT_DISCONNECTED:
+static esp_err_t rpc_cmd_buzzer(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	xEventGroupSetBits(xLedEventGroup, BIT_STATUS_BUZZER | BIT_STATUS_TRIGGER);
 
-        xEventGroupClearBits(xLedEventGroup, BIT_STATUS_MQTT);
-        xEventGroupSetBits(xLedEventGroup, BIT_STATUS_TRIGGER);
+	snprintf(reply, reply_sz, "ok");
+	ESP_LOGI(TAG, "RPC buzzer triggered");
+	return ESP_OK;
+}
 
-		break;
-	case MQTT_EVENT_SUBSCRIBED: {
-		char sub_topic[64];
-		snprintf(sub_topic, sizeof(sub_topic), "%s.vmflow.xyz/#", my_subdomain);
-		ESP_LOGI(TAG, "mqtt subscribed: %s", sub_topic);
-		break;
-	}
-	case MQTT_EVENT_UNSUBSCRIBED:
-		break;
+static void restart_timer_cb(void *arg) {
+	esp_restart();
+}
+
+static esp_err_t rpc_cmd_restart(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	// Reboot from a one-shot timer so the "ok" reply has time to leave through the outbox.
+	static esp_timer_handle_t restart_timer;
+
+	const esp_timer_create_args_t restart_timer_args = {
+		.callback = restart_timer_cb,
+		.name = "rpc_restart",
+	};
+	if (restart_timer == NULL && esp_timer_create(&restart_timer_args, &restart_timer) != ESP_OK) return ESP_ERR_NO_MEM;
+	esp_timer_start_once(restart_timer, 1000 * 1000);
+
+	snprintf(reply, reply_sz, "ok");
+	ESP_LOGW(TAG, "RPC restart requested");
+	return ESP_OK;
+}
+
+static esp_err_t rpc_cmd_ota(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	// "ota:-" -> latest release; "ota:<tag>" -> pinned tag. Progress follows on .../rpc/ota.
+	esp_err_t err = ota_start(arg->text, req->corr);
+	if (err != ESP_OK) return err;
+
+	snprintf(reply, reply_sz, "ok");
+	return ESP_OK;
+}
+
+// "transport:mqtt" / "transport:mqtt-sn": persisted, takes effect on the next restart.
+static esp_err_t rpc_cmd_transport(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	if (arg->text == NULL) return ESP_ERR_INVALID_ARG;
+
+	esp_err_t err = mqtt_session_set_transport(arg->text);
+	if (err != ESP_OK) return err;
+
+	snprintf(reply, reply_sz, "ok,%s", arg->text);
+	ESP_LOGW(TAG, "RPC transport -> %s (after restart)", arg->text);
+	return ESP_OK;
+}
+
+// "fleet:<fleet>[,<group>...]" / "fleet:-": persisted, takes effect on the next restart.
+static esp_err_t rpc_cmd_fleet(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	esp_err_t err = fleet_set(arg->text);
+	if (err != ESP_OK) return err;
+
+	mqtt_session_leave_fleet();
+
+	snprintf(reply, reply_sz, "ok,%s", arg->text ? arg->text : "-");
+	ESP_LOGW(TAG, "RPC fleet -> %s (after restart)", arg->text ? arg->text : "none");
+	return ESP_OK;
+}
+
+// "time:<nonce>:<server unix>": the backend's answer to timesync_request_broker(). Not freshness-checked
+// (the clock is what it sets); the nonce makes it single-use.
+static esp_err_t rpc_cmd_time(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	esp_err_t err = timesync_broker_reply(arg->text, req->ts);
+	if (err != ESP_OK) ESP_LOGW(TAG, "RPC time ignored: %s", esp_err_to_name(err));
+	return ESP_OK;
+}
+
+// "metrics:-": snapshot on .../metrics without waiting for the next interval.
+static esp_err_t rpc_cmd_metrics(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	metrics_publish_now();
+	return ESP_OK;
+}
+
+// "trace:-": the binary trace rings on .../rpc/trace; tools/trace-decode.py renders them.
+static esp_err_t rpc_cmd_trace(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz) {
+	esp_err_t err = trace_dump(req->corr);
+	if (err != ESP_OK) return err;
+
+	snprintf(reply, reply_sz, "ok");
+	return ESP_OK;
+}
+
+// RPC registry: name, argument parser, handler, reply subtopic under .../rpc/, accepted on fleet / group topics[, untimed].
+// Money, the VMC session and the device's own settings stay unicast-only.
+static const rpc_command_t rpc_commands[] = {
+	{ "dex",       rpc_arg_none, rpc_cmd_dex,       NULL,      true  },
+	{ "info",      rpc_arg_none, rpc_cmd_info,      "info",    true  },
+	{ "credit",    rpc_arg_int,  rpc_cmd_credit,    "confirm", false },
+	{ "oos",       rpc_arg_none, rpc_cmd_oos,       "confirm", false },
+	{ "echo",      rpc_arg_none, rpc_cmd_echo,      "echo",    true  },
+	{ "buzzer",    rpc_arg_none, rpc_cmd_buzzer,    "confirm", false },
+	{ "restart",   rpc_arg_none, rpc_cmd_restart,   "confirm", true  },
+	{ "ota",       rpc_arg_text, rpc_cmd_ota,       "confirm", true  },
+	{ "transport", rpc_arg_text, rpc_cmd_transport, "confirm", false },
+	{ "fleet",     rpc_arg_text, rpc_cmd_fleet,     "confirm", false },
+	{ "time",      rpc_arg_text, rpc_cmd_time,      NULL,      false, true },
+	{ "metrics",   rpc_arg_none, rpc_cmd_metrics,   NULL,      true  },
+	{ "trace",     rpc_arg_none, rpc_cmd_trace,     "confirm", false },
+};
+
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
+	esp_mqtt_event_handle_t event = event_data;
+
+	switch ((esp_mqtt_event_id_t) event_id) {
 	case MQTT_EVENT_PUBLISHED:
-		ESP_LOGI(TAG, "MQTT published msg_id=%d", event->msg_id);
+		trace_emit(TRACE_MQTT_PUBLISHED, 0, event->msg_id);
 		break;
 	case MQTT_EVENT_DATA:
-
-	    ESP_LOGI(TAG, "MQTT data topic=%.*s len=%d data=%.*s", event->topic_len, event->topic, event->data_len, event->data_len, event->data);
-
-		if (event->topic_len > 4 && strncmp(event->topic + event->topic_len - 4, "/rpc", 4) == 0) {
-			// Wire format "<cmd>:<args>:<ts>:<hmac>".
-			int len = event->data_len < 127 ? event->data_len : 127;
-
-			// HMAC = hex over everything before the last ':'.
-			char *last_colon = memrchr(event->data, ':', len);
-			if (last_colon == NULL) break;
-
-			int prefix_len = last_colon - event->data;
-			char hmac[65];  // 64 hex chars + NUL
-			snprintf(hmac, sizeof(hmac), "%.*s", len - prefix_len - 1, last_colon + 1);
-
-			if (!rpc_verify_hmac(event->data, prefix_len, hmac)) {
-				ESP_LOGW(TAG, "RPC rejected: bad HMAC");
-				break;
-			}
-
-			char cmd[32], args[64];
-			unsigned int ts;
-			if (sscanf(event->data, "%31[^:]:%63[^:]:%u", cmd, args, &ts) != 3) {
-				ESP_LOGW(TAG, "RPC rejected: malformed");
-				break;
-			}
-
-			long dt = (long) (time(NULL) - (time_t) ts);
-			if (labs(dt) > RPC_FRESHNESS_SEC) {
-				ESP_LOGW(TAG, "RPC rejected: stale ts (dt=%ld)", dt);
-				break;
-			}
-
-			bool has_args = (args[0] != '\0' && strcmp(args, "-") != 0);
-
-            char topic_confirm[64];
-            snprintf(topic_confirm, sizeof(topic_confirm), "domain.vmflow.xyz/%s/rpc/confirm", my_subdomain);
-
-			if (strcmp(cmd, "dex") == 0) {
-				request_telemetry_data(NULL);
-				ESP_LOGI(TAG, "RPC dex request started");
-			} else if (strcmp(cmd, "info") == 0) {
-				rpc_publish_info();
-				ESP_LOGI(TAG, "RPC info published");
-			} else if (strcmp(cmd, "credit") == 0 && has_args) {
-				int32_t price_wire = (int32_t) strtol(args, NULL, 10);
-				uint16_t funds_available = TO_SCALE_FACTOR( FROM_SCALE_FACTOR(price_wire, 1, 2), CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES);
-
-				xQueueSend(mdb_session_queue, &funds_available, 0);
-				xEventGroupSetBits(xLedEventGroup, BIT_STATUS_BUZZER | BIT_STATUS_TRIGGER);
-
-                esp_mqtt_client_enqueue(mqtt_client, topic_confirm, "ok", 0, 1, 0, 1);
-				ESP_LOGI( TAG, "RPC credit: Amount= %f", FROM_SCALE_FACTOR(funds_available, CONFIG_MDB_SCALE_FACTOR, CONFIG_MDB_DECIMAL_PLACES) );
-			} else if (strcmp(cmd, "oos") == 0) {
-				out_of_sequence_todo = true;
-
-                esp_mqtt_client_enqueue(mqtt_client, topic_confirm, "ok", 0, 1, 0, 1);
-				ESP_LOGI(TAG, "RPC out-of-sequence queued");
-			} else if (strcmp(cmd, "echo") == 0) {
-				char topic[64], buf[24];
-				snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/rpc/echo", my_subdomain);
-				snprintf(buf, sizeof(buf), "%u", ts);
-				esp_mqtt_client_enqueue(mqtt_client, topic, buf, 0, 0, 0, 1);
-				ESP_LOGI(TAG, "RPC echo");
-			} else if (strcmp(cmd, "buzzer") == 0) {
-				xEventGroupSetBits(xLedEventGroup, BIT_STATUS_BUZZER | BIT_STATUS_TRIGGER);
-
-                esp_mqtt_client_enqueue(mqtt_client, topic_confirm, "ok", 0, 1, 0, 1);
-				ESP_LOGI(TAG, "RPC buzzer triggered");
-			} else if (strcmp(cmd, "restart") == 0) {
-                esp_mqtt_client_publish(mqtt_client, topic_confirm, "ok", 0, 1, 0);
-				ESP_LOGW(TAG, "RPC restart requested");
-
-				vTaskDelay(pdMS_TO_TICKS(500));
-				esp_restart();
-			} else if (strcmp(cmd, "ota") == 0) {
-				// "ota:-" -> latest release; "ota:<tag>" -> pinned tag.
-				static char ota_url[160];
-				if (has_args)
-					snprintf(ota_url, sizeof(ota_url), "https://github.com/nodestark/mdb-esp32-cashless/releases/download/%s/mdb-slave-esp32s3.bin", args);
-				else
-					snprintf(ota_url, sizeof(ota_url), "https://github.com/nodestark/mdb-esp32-cashless/releases/latest/download/mdb-slave-esp32s3.bin");
-
-                esp_mqtt_client_enqueue(mqtt_client, topic_confirm, "ok", 0, 1, 0, 1);
-				ESP_LOGW(TAG, "RPC ota: %s", ota_url);
-				xTaskCreate(ota_task, "ota_task", 8192, ota_url, 5, NULL);
-			} else {
-				ESP_LOGW(TAG, "RPC unknown command: %s", cmd);
-			}
-		}
-
+		trace_emit(TRACE_MQTT_DATA, event->topic_len, event->data_len);
 		break;
 	case MQTT_EVENT_ERROR:
 	    if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
@@ -930,11 +591,23 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 	    }
 		break;
 	default:
-	    ESP_LOGI( TAG, "Other event id: %d", event->event_id);
 		break;
 	}
 }
 
+// Session up/down for either transport (esp-mqtt or MQTT-SN); subscription, status and RPC intake live in mqtt_session.
+static void mqtt_state_handler(bool connected) {
+	mqtt_outbox_set_connected(connected);
+
+	if (connected) {
+		timesync_request_broker();
+		xEventGroupSetBits(xLedEventGroup, BIT_STATUS_MQTT | BIT_STATUS_TRIGGER);
+	} else {
+		xEventGroupClearBits(xLedEventGroup, BIT_STATUS_MQTT);
+		xEventGroupSetBits(xLedEventGroup, BIT_STATUS_TRIGGER);
+	}
+}
+
 static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
     switch (event_id) {
         case IP_EVENT_PPP_GOT_IP: {
@@ -942,11 +615,13 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t eve
             snprintf(s_ip_ppp, sizeof(s_ip_ppp), IPSTR, IP2STR(&event->ip_info.ip));
             ESP_LOGI(TAG, "ppp got IP: %s", s_ip_ppp);
             xEventGroupSetBits(xInternetEventGroup, BIT_PPP_GOT_IP);
+            uplink_set_ip(UPLINK_PPP, true);
             break;
         }
         case IP_EVENT_PPP_LOST_IP:
             s_ip_ppp[0] = '\0';
-            ESP_LOGW(TAG, "ppp lost IP, restarting sim7080g_task");
+            ESP_LOGW(TAG, "ppp lost IP");
+            uplink_set_ip(UPLINK_PPP, false);
             xEventGroupClearBits(xInternetEventGroup, BIT_PPP_GOT_IP);
             xEventGroupSetBits(xInternetEventGroup, BIT_PPP_LOST_IP);
             break;
@@ -955,10 +630,12 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t eve
             snprintf(s_ip_wifi, sizeof(s_ip_wifi), IPSTR, IP2STR(&event->ip_info.ip));
             ESP_LOGI(TAG, "wifi got IP: %s", s_ip_wifi);
             xEventGroupSetBits(xInternetEventGroup, BIT_STA_GOT_IP);
+            uplink_set_ip(UPLINK_WIFI, true);
             break;
         }
         case IP_EVENT_STA_LOST_IP:
             s_ip_wifi[0] = '\0';
+            uplink_set_ip(UPLINK_WIFI, false);
             xEventGroupClearBits(xInternetEventGroup, BIT_STA_GOT_IP);
             xEventGroupSetBits(xInternetEventGroup, BIT_STA_LOST_IP);
             ESP_LOGW(TAG, "wifi lost IP");
@@ -975,6 +652,8 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
         wifi_backoff_ms = WIFI_BACKOFF_MIN_MS;   // reset na conexão
         break;
     case WIFI_EVENT_STA_DISCONNECTED:
+        // STA_LOST_IP only fires after a long grace timer; fail over on the disconnect itself.
+        uplink_set_ip(UPLINK_WIFI, false);
         ESP_LOGW(TAG, "WiFi disconnected, retry in %lu ms", wifi_backoff_ms);
         esp_timer_start_once(wifi_retry_timer, (uint64_t) wifi_backoff_ms * 1000);
         wifi_backoff_ms *= 2;
@@ -983,65 +662,10 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
     }
 }
 
-static void sim7080g_pulse_power(void) {
-    gpio_set_level(PIN_SIM7080G_PWR, 1);
-    vTaskDelay(pdMS_TO_TICKS(1200));
-    gpio_set_level(PIN_SIM7080G_PWR, 0);
-
-    ESP_LOGI(TAG, "waiting for SIM7080G boot...");
-    vTaskDelay(pdMS_TO_TICKS(5000));
-}
-
-static esp_err_t sim7080g_wait_registered(esp_modem_dce_t *dce) {
-    char resp[64];
-    for (int i = 0; i < 30; i++) {
-        memset(resp, 0, sizeof(resp));
-        esp_modem_at(dce, "AT+CEREG?", resp, 3000);
-        if (strstr(resp, ",1") || strstr(resp, ",5")) {
-            ESP_LOGI(TAG, "registered: %s", resp);
-            return ESP_OK;
-        }
-        ESP_LOGW(TAG, "not registered: %s", resp);
-        vTaskDelay(pdMS_TO_TICKS(2000));
-    }
-    ESP_LOGE(TAG, "registration timeout");
-
-    return ESP_ERR_TIMEOUT;
-}
-
-// Owns SIM7080G + MQTT lifecycle. MQTT stays off while the modem (re)connects:
-// on IP_EVENT_PPP_LOST_IP the task stops MQTT and re-runs the modem bring-up.
-static void sim7080g_task(void *pvParameters) {
-    gpio_set_direction(PIN_SIM7080G_PWR, GPIO_MODE_OUTPUT);
-    gpio_set_level(PIN_SIM7080G_PWR, 0);
-
-    esp_modem_dte_config_t dte_config = ESP_MODEM_DTE_DEFAULT_CONFIG();
-    dte_config.uart_config.port_num   = UART_NUM_2;
-    dte_config.uart_config.baud_rate  = 115200;
-    dte_config.uart_config.tx_io_num  = PIN_SIM7080G_TX;
-    dte_config.uart_config.rx_io_num  = PIN_SIM7080G_RX;
-    dte_config.uart_config.rts_io_num = -1;
-    dte_config.uart_config.cts_io_num = -1;
-
-    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG(CONFIG_SIM7080G_APN);
-
-    esp_netif_config_t netif_cfg = ESP_NETIF_DEFAULT_PPP();
-    esp_netif_t *ppp_netif = esp_netif_new(&netif_cfg);
-    esp_netif_set_route_prio(ppp_netif, 100);
-
-    esp_modem_dce_t *dce = esp_modem_new_dev(ESP_MODEM_DCE_SIM7070, &dte_config, &dce_config, ppp_netif);
-    assert(dce);
-
-    //-------------------------- MQTT --------------------------//
-    char lwt_topic[64];
-    snprintf(lwt_topic, sizeof(lwt_topic), "domain.vmflow.xyz/%s/status", my_subdomain);
-
-    const esp_mqtt_client_config_t mqtt_cfg = {
+static void mqtt_init(void) {
+    esp_mqtt_client_config_t mqtt_cfg = {
         .broker.address.uri = "mqtt://mqtt.vmflow.xyz",
-        .session.last_will.topic = lwt_topic,
-        .session.last_will.msg = "offline",
-        .session.last_will.qos = 1,
-        .session.last_will.retain = 1,
+        // Long, for the modem's sleep: a silent Wi-Fi link is caught by the uplink manager's heartbeat instead.
         .session.keepalive = 120,
         .network.timeout_ms = 30000,
         .network.reconnect_timeout_ms = 15000,
@@ -1050,48 +674,33 @@ static void sim7080g_task(void *pvParameters) {
         .buffer.out_size = 6144,
     };
 
-    mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
-    esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
-
-    while (1) {
-        esp_modem_set_mode(dce, ESP_MODEM_MODE_COMMAND);
-
-        esp_err_t ret = esp_modem_sync(dce);
-        if (ret != ESP_OK) {
-            sim7080g_pulse_power();
-
-            ret = esp_modem_sync(dce);
-            if (ret != ESP_OK) {
-                vTaskDelay(pdMS_TO_TICKS(2000));
-                ret = esp_modem_sync(dce);
-            }
-        } else {
-            ESP_LOGI(TAG, "modem already on");
-            esp_modem_at(dce, "AT+CFUN=1,1", NULL, 3000);
-            vTaskDelay(pdMS_TO_TICKS(8000));
-        }
-
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "modem not found, skip PPP");
-        } else {
-            ESP_LOGI(TAG, "modem ok");
-
-            esp_modem_at(dce, "AT+CNMP=38", NULL, 3000);
-            esp_modem_at(dce, "AT+CMNB=" STRINGIFY(CONFIG_SIM7080G_CMNB), NULL, 3000);
-            esp_modem_at(dce, "AT+CEREG=1", NULL, 3000);
+    // Fleet / group membership decides which broadcast topics the session subscribes.
+    fleet_init();
+
+    // Client id, clean-session flag, protocol version and LWT come from the session policy,
+    // which also decides between esp-mqtt and MQTT-SN.
+    if (mqtt_session_config(&mqtt_cfg)) {
+        mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+        mqtt_session_init(mqtt_client, mqtt_state_handler);
+        esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    } else {
+        mqtt_session_init(NULL, mqtt_state_handler);
+    }
 
-            if (sim7080g_wait_registered(dce) == ESP_OK) {
-                esp_modem_set_mode(dce, ESP_MODEM_MODE_DATA);
-            }
-        }
+    // Sales, RPC replies, telemetry and DEX dumps all go through the priority outbox.
+    mqtt_outbox_init();
+    metrics_init();
+    rpc_exec_init(rpc_commands, sizeof(rpc_commands) / sizeof(rpc_commands[0]));
 
-        xEventGroupWaitBits(xInternetEventGroup, BIT_PPP_GOT_IP | BIT_STA_GOT_IP, pdFALSE, pdFALSE, portMAX_DELAY);
-        esp_mqtt_client_start(mqtt_client);
+    // The modem task runs on its own; MQTT start and link selection belong to the uplink manager.
+    uplink_init(s_wifi_netif, sim7080g_start());
+}
 
-        xEventGroupWaitBits(xInternetEventGroup, BIT_PPP_LOST_IP, pdTRUE, pdTRUE, portMAX_DELAY);
-        esp_mqtt_client_stop(mqtt_client);
-    }
+#if CONFIG_VMFLOW_BENCH
+static void bench_print_line(const char *line, void *ctx) {
+    printf("%s\n", line);
 }
+#endif
 
 void app_main(void) {
     gpio_set_direction(PIN_BUZZER_PWR, GPIO_MODE_OUTPUT);
@@ -1132,8 +741,8 @@ void app_main(void) {
 	esp_netif_init();
 	esp_event_loop_create_default();
 
-	esp_netif_t *wifi_netif = esp_netif_create_default_wifi_sta();
-    esp_netif_set_route_prio(wifi_netif, 200);
+	s_wifi_netif = esp_netif_create_default_wifi_sta();
+    esp_netif_set_route_prio(s_wifi_netif, 200);
 
 	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 	esp_wifi_init(&cfg);
@@ -1150,11 +759,10 @@ void app_main(void) {
 	esp_wifi_set_mode(WIFI_MODE_STA);
 	esp_wifi_start();
 
-    //-------------------------- SNTP --------------------------//
+    //-------------------------- TIME --------------------------//
     //----------------------------------------------------------//
-    esp_sntp_setoperatingmode(ESP_SNTP_OPMODE_POLL);
-    esp_sntp_setservername(0, "pool.ntp.org");
-    esp_sntp_init();
+    // Clock kept across a warm reboot, then modem / broker / SNTP as they come up.
+    timesync_init();
 
 	//------------------------ BLUETOOTH -----------------------//
 	//----------------------------------------------------------//
@@ -1182,7 +790,15 @@ void app_main(void) {
 	// HMAC key tracks the passkey buffer by reference; later BLE provisioning writes into the same buffer and takes effect without re-registering.
 	rpc_auth_set_key(my_passkey);
 
-	ble_init(myhost, ble_event_handler, ble_pax_event_handler);
+#if CONFIG_VMFLOW_BENCH
+	core_bench_run(NULL, NULL, 0, bench_print_line, NULL);
+#endif
+
+	scan_sched_init(mdb_session_active);
+	ble_cmd_init(ble_commands, sizeof(ble_commands) / sizeof(ble_commands[0]));
+	dex_ble_init();
+	beacon_init();
+	ble_init(myhost, ble_pax_event_handler);
 
     esp_timer_handle_t periodic_pax_timer;
 
@@ -1196,26 +812,20 @@ void app_main(void) {
 
     //------------------------ MAIN TASKS ----------------------//
     //----------------------------------------------------------//
-    gpio_set_direction(PIN_MDB_TX, GPIO_MODE_OUTPUT);
-    gpio_set_level(PIN_MDB_TX, 1);
-
-    mdb_rx_queue = xQueueCreate(16, sizeof(uint16_t));
-
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << PIN_MDB_RX),
-        .mode         = GPIO_MODE_INPUT,
-        .pull_up_en   = GPIO_PULLUP_ENABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type    = GPIO_INTR_NEGEDGE,
-    };
-    gpio_config(&io_conf);
-
-    mdb_session_queue = xQueueCreate(1, sizeof(uint16_t));
+    mdb_session_queue = xQueueCreate(1, sizeof(mdb_credit_t));
+    credit_probe_init();
 
     // Bit-banged MDB pinned alone to core 1 at high prio so core-0 network never preempts a frame.
     xTaskCreatePinnedToCore(mdb_cashless_task, "mdb_cashless_task", 8192, NULL, configMAX_PRIORITIES - 2, NULL, 1);
 
-    //------------------- SIM7080g STACK -----------------------//
+    //---------------- SIM7080g STACK / MQTT -------------------//
 	//----------------------------------------------------------//
-    xTaskCreatePinnedToCore(sim7080g_task, "sim7080g_task", 4096, NULL, 5, NULL, 0);
+    mqtt_init();
+
+    // A freshly updated image stays pending until it is back on MQTT (and the VMC has enabled the reader).
+#if CONFIG_VMFLOW_OTA_HEALTH_MDB
+    ota_health_check(xLedEventGroup, BIT_STATUS_MQTT | BIT_STATUS_MDB);
+#else
+    ota_health_check(xLedEventGroup, BIT_STATUS_MQTT);
+#endif
 }
\ No newline at end of file
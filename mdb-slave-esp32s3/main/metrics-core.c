@@ -0,0 +1,34 @@
+#include "metrics.h"
+
+static metric_t *s_head;
+
+void metrics_register(metric_t *m) {
+	if (__atomic_exchange_n(&m->registered, true, __ATOMIC_RELAXED)) return;
+
+	m->next = __atomic_load_n(&s_head, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&s_head, &m->next, m, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+}
+
+metric_t *metrics_list(void) {
+	return __atomic_load_n(&s_head, __ATOMIC_ACQUIRE);
+}
+
+void metric_set(metric_t *m, int32_t value) {
+	__atomic_store_n(&m->value, value, __ATOMIC_RELAXED);
+
+	int32_t max = __atomic_load_n(&m->max, __ATOMIC_RELAXED);
+	while (value > max && !__atomic_compare_exchange_n(&m->max, &max, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+void metric_observe(metric_t *m, uint32_t value) {
+	int core = hal_core_id();
+
+	uint8_t i = 0;
+	while (i < m->nbounds && value > m->bounds[i]) i++;
+
+	__atomic_fetch_add(&m->bucket[core][i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&m->sum[core], value, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&m->count[core], 1, __ATOMIC_RELAXED);
+}
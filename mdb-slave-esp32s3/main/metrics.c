@@ -0,0 +1,187 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include "rpc-auth.h"
+#include "mqtt-outbox.h"
+
+#define TAG "metrics"
+
+#define METRICS_LINE_MAX    2048
+#define METRICS_SUFFIX_MAX  (1 + 20 + 1 + 64)   /* ":<ts>:<hmac>": any int64 ts, hex HMAC-SHA256 */
+#define METRICS_TASKS_MAX   32
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#define METRICS_TASK_STATS  1
+#endif
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+static TaskHandle_t s_task;
+
+typedef struct {
+	char *buf;
+	size_t size, len;
+} metrics_buf_t;
+
+static void put(metrics_buf_t *b, const char *fmt, ...) {
+	if (b->len >= b->size) return;
+
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(b->buf + b->len, b->size - b->len, fmt, ap);
+	va_end(ap);
+
+	b->len = n < 0 ? b->size : b->len + n;
+}
+
+// Drop a trailing ',' left by the last entry of an object or list.
+static void unput_comma(metrics_buf_t *b) {
+	if (b->len > 0 && b->len < b->size && b->buf[b->len - 1] == ',') b->len--;
+}
+
+static uint32_t per_core_sum(const uint32_t *slots) {
+	uint32_t total = 0;
+	for (int c = 0; c < portNUM_PROCESSORS; c++) total += __atomic_load_n(&slots[c], __ATOMIC_RELAXED);
+	return total;
+}
+
+static void metrics_put_type(metrics_buf_t *b, metric_t *head, metric_type_t type, const char *key) {
+	put(b, "\"%s\":{", key);
+
+	for (metric_t *m = head; m; m = m->next) {
+		if (m->type != type) continue;
+
+		switch (type) {
+		case METRIC_TYPE_COUNTER:
+			put(b, "\"%s\":%lu,", m->name, (unsigned long) per_core_sum(m->count));
+			break;
+
+		case METRIC_TYPE_GAUGE:
+			put(b, "\"%s\":[%ld,%ld],", m->name, (long) m->value, (long) m->max);
+			break;
+
+		case METRIC_TYPE_HISTOGRAM:
+			put(b, "\"%s\":[%lu,%lu,[", m->name, (unsigned long) per_core_sum(m->count), (unsigned long) per_core_sum(m->sum));
+			for (uint8_t i = 0; i <= m->nbounds; i++) {
+				uint32_t n = 0;
+				for (int c = 0; c < portNUM_PROCESSORS; c++) n += __atomic_load_n(&m->bucket[c][i], __ATOMIC_RELAXED);
+				put(b, "%lu,", (unsigned long) n);
+			}
+			unput_comma(b);
+			put(b, "]],");
+			break;
+		}
+	}
+
+	unput_comma(b);
+	put(b, "},");
+}
+
+#ifdef METRICS_TASK_STATS
+// Run-time counters from the previous snapshot, to turn totals into CPU share per interval.
+static struct {
+	TaskHandle_t handle;
+	configRUN_TIME_COUNTER_TYPE run_time;
+} s_prev[METRICS_TASKS_MAX];
+static configRUN_TIME_COUNTER_TYPE s_prev_total;
+
+static configRUN_TIME_COUNTER_TYPE metrics_prev_run_time(TaskHandle_t handle) {
+	for (int i = 0; i < METRICS_TASKS_MAX; i++) {
+		if (s_prev[i].handle == handle) return s_prev[i].run_time;
+	}
+	return 0;
+}
+
+static void metrics_put_tasks(metrics_buf_t *b) {
+	TaskStatus_t *tasks = malloc(METRICS_TASKS_MAX * sizeof(TaskStatus_t));
+	if (tasks == NULL) return;
+
+	configRUN_TIME_COUNTER_TYPE total;
+	UBaseType_t n = uxTaskGetSystemState(tasks, METRICS_TASKS_MAX, &total);
+
+	// The counter is wall time in esp_timer microseconds; each core contributes that much.
+	// A 32-bit counter wraps after ~71 min, longer than some intervals: use the 64-bit one.
+	uint64_t elapsed = (uint64_t) (total - s_prev_total) * portNUM_PROCESSORS;
+
+	put(b, "\"t\":{");
+	for (UBaseType_t i = 0; i < n; i++) {
+		uint64_t ran = tasks[i].ulRunTimeCounter - metrics_prev_run_time(tasks[i].xHandle);
+		uint32_t permille = elapsed ? (uint32_t) (ran * 1000 / elapsed) : 0;
+
+		put(b, "\"%s\":[%lu,%lu],", tasks[i].pcTaskName, (unsigned long) tasks[i].usStackHighWaterMark, (unsigned long) permille);
+	}
+	unput_comma(b);
+	put(b, "},");
+
+	memset(s_prev, 0, sizeof(s_prev));
+	for (UBaseType_t i = 0; i < n; i++) {
+		s_prev[i].handle = tasks[i].xHandle;
+		s_prev[i].run_time = tasks[i].ulRunTimeCounter;
+	}
+	s_prev_total = total;
+
+	free(tasks);
+}
+#endif
+
+static void metrics_publish(void) {
+	static char line[METRICS_LINE_MAX];
+	char *json = malloc(METRICS_LINE_MAX);
+	if (json == NULL) return;
+
+	metrics_buf_t b = { .buf = json, .size = METRICS_LINE_MAX - METRICS_SUFFIX_MAX };   // the signed line must still fit
+	metric_t *head = metrics_list();
+
+	put(&b, "{\"up\":%lld,\"heap\":[%lu,%lu],", (long long) (esp_timer_get_time() / 1000000),
+		(unsigned long) esp_get_free_heap_size(), (unsigned long) esp_get_minimum_free_heap_size());
+	metrics_put_type(&b, head, METRIC_TYPE_COUNTER, "c");
+	metrics_put_type(&b, head, METRIC_TYPE_GAUGE, "g");
+	metrics_put_type(&b, head, METRIC_TYPE_HISTOGRAM, "h");
+#ifdef METRICS_TASK_STATS
+	metrics_put_tasks(&b);
+#endif
+	unput_comma(&b);
+	put(&b, "}");
+
+	if (b.len >= b.size) {
+		ESP_LOGW(TAG, "snapshot truncated at %u B", (unsigned) b.size);
+	} else {
+		snprintf(json + b.len, METRICS_LINE_MAX - b.len, ":%lld", (long long) time(NULL));
+		rpc_sign_text(json, line, sizeof(line));
+
+		char topic[64];
+		snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/metrics", my_subdomain);
+		mqtt_outbox_publish(OUTBOX_TELEMETRY, topic, line, 0, 0);
+	}
+
+	free(json);
+}
+
+static void metrics_task(void *arg) {
+	TickType_t interval = CONFIG_VMFLOW_METRICS_INTERVAL ? pdMS_TO_TICKS(CONFIG_VMFLOW_METRICS_INTERVAL * 1000) : portMAX_DELAY;
+
+	for (;;) {
+		ulTaskNotifyTake(pdTRUE, interval);
+		metrics_publish();
+	}
+}
+
+void metrics_init(void) {
+	xTaskCreatePinnedToCore(metrics_task, "metrics", 4096, NULL, 2, &s_task, 0);
+}
+
+void metrics_publish_now(void) {
+	if (s_task) xTaskNotifyGive(s_task);
+}
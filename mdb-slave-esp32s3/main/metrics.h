@@ -0,0 +1,96 @@
+/*
+ * metrics — counters, gauges and histograms published as a periodic snapshot.
+ *
+ * Each module defines its metrics statically and registers them once at init:
+ *
+ *   static metric_t s_m_polls = METRIC_COUNTER("mdb.poll");
+ *   static metric_t s_m_dex_ms = METRIC_HISTOGRAM("dex.ms", 1000, 5000, 20000);
+ *   metrics_register(&s_m_polls);
+ *   ...
+ *   metric_inc(&s_m_polls);
+ *
+ * Updates are lock-free: every metric keeps one slot per core and a caller
+ * adds atomically into the slot of the core it runs on, so the MDB task on
+ * core 1 never contends with the network tasks on core 0. The snapshot sums
+ * the slots. Counters and histograms are cumulative since boot; gauges report
+ * their last value and high-water mark.
+ *
+ * Every CONFIG_VMFLOW_METRICS_INTERVAL seconds (and on the metrics RPC) one
+ * JSON line is published on domain.vmflow.xyz/<sub>/metrics, signed like the
+ * other telemetry ("<json>:<ts>:<hmac>"):
+ *
+ *   {"up":<s>,"heap":[<free>,<min free>],
+ *    "c":{"<name>":<n>,...},
+ *    "g":{"<name>":[<value>,<max>],...},
+ *    "h":{"<name>":[<count>,<sum>,[<n per bucket>...,<n over last bound>]],...},
+ *    "t":{"<task>":[<free stack B>,<cpu per mille since last snapshot>],...}}
+ *
+ * "t" needs FreeRTOS trace facility and run-time stats (sdkconfig.defaults).
+ *
+ * metrics-core.c (registration and updates) is portable and part of the host
+ * build; metrics.c (snapshot task, publish) is ESP-IDF only.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hal.h"
+
+#define METRIC_BUCKETS_MAX  8
+
+typedef enum {
+	METRIC_TYPE_COUNTER,
+	METRIC_TYPE_GAUGE,
+	METRIC_TYPE_HISTOGRAM,
+} metric_type_t;
+
+typedef struct metric {
+	const char *name;
+	metric_type_t type;
+	const uint32_t *bounds;     /* histogram: ascending upper bounds (inclusive) */
+	uint8_t nbounds;
+	bool registered;
+	struct metric *next;
+
+	uint32_t count[HAL_CORES];     /* counter value / histogram samples */
+	uint32_t sum[HAL_CORES];       /* histogram */
+	uint32_t bucket[HAL_CORES][METRIC_BUCKETS_MAX + 1];
+	int32_t value, max;                     /* gauge */
+} metric_t;
+
+#define METRIC_COUNTER(name_)   { .name = (name_), .type = METRIC_TYPE_COUNTER }
+#define METRIC_GAUGE(name_)     { .name = (name_), .type = METRIC_TYPE_GAUGE }
+#define METRIC_HISTOGRAM(name_, ...) { \
+	.name = (name_), .type = METRIC_TYPE_HISTOGRAM, \
+	.bounds = (const uint32_t[]) { __VA_ARGS__ }, \
+	.nbounds = sizeof((const uint32_t[]) { __VA_ARGS__ }) / sizeof(uint32_t) }
+
+/* Add a metric to the snapshot. Safe from any task; registering twice is a no-op. */
+void metrics_register(metric_t *m);
+
+static inline void metric_add(metric_t *m, uint32_t n) {
+	__atomic_fetch_add(&m->count[hal_core_id()], n, __ATOMIC_RELAXED);
+}
+
+static inline void metric_inc(metric_t *m) {
+	metric_add(m, 1);
+}
+
+/* Gauge: set the current value; the high-water mark follows. */
+void metric_set(metric_t *m, int32_t value);
+
+/* Histogram: record one sample. */
+void metric_observe(metric_t *m, uint32_t value);
+
+/* Registered metrics, most recent first (follow ->next). */
+metric_t *metrics_list(void);
+
+/* Start the snapshot task. Call after mqtt_outbox_init(). */
+void metrics_init(void);
+
+/* Publish a snapshot now (metrics RPC). Never blocks. */
+void metrics_publish_now(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,324 @@
+#include "mqtt-outbox.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include "mqtt-session.h"
+#include "metrics.h"
+
+#define TAG "mqtt_outbox"
+
+// Bulk (DEX) may spend this many bytes per interval; a larger message is still
+// sent whole and the deficit is paid back by the following intervals.
+#define OUTBOX_BULK_BUDGET_BYTES    2048
+#define OUTBOX_BULK_INTERVAL_US     (1000 * 1000)
+
+// Below this much free heap, queued telemetry/bulk is shed (oldest first) before a new message is copied in.
+#define OUTBOX_LOW_HEAP_BYTES       (24 * 1024)
+
+// Money that overflows its queue waits in a spill list, in order; past this many it is dropped (and counted).
+#define OUTBOX_MONEY_SPILL_MAX      64
+
+// A failed publish is retried after 1, 2, 4... s while the other messages go on; non-money gives up after this many.
+#define OUTBOX_RETRY_MAX            5
+#define OUTBOX_RETRY_BACKOFF_MAX_US (30 * 1000 * 1000)
+
+typedef struct outbox_msg {
+	struct outbox_msg *next;    /* money spill list */
+	int len;
+	uint8_t retain;
+	uint8_t tries;
+	char *data;                 /* after topic[], or the caller's buffer until release(ctx) */
+	void (*release)(void *ctx);
+	void *ctx;
+	char topic[];
+} outbox_msg_t;
+
+// Per-class policy: queue depth, MQTT QoS and whether the oldest message may be dropped to make room.
+static const struct {
+	uint8_t depth;
+	uint8_t qos;
+	bool shed;
+} s_class_cfg[OUTBOX_CLASS_MAX] = {
+	[OUTBOX_MONEY]      = { 16, 1, false },
+	[OUTBOX_CONTROL]    = {  8, 1, false },
+	[OUTBOX_TELEMETRY]  = {  8, 1, true  },
+	[OUTBOX_BULK]       = {  2, 0, true  },
+};
+
+static const char *s_class_name[OUTBOX_CLASS_MAX] = { "money", "control", "telemetry", "bulk" };
+
+static QueueHandle_t s_queue[OUTBOX_CLASS_MAX];
+static TaskHandle_t s_task;
+static volatile bool s_connected;
+
+static int32_t s_bulk_tokens = OUTBOX_BULK_BUDGET_BYTES;
+static int64_t s_bulk_refill_us;
+
+static uint32_t s_dropped[OUTBOX_CLASS_MAX];
+
+// Filled by publishers only while the money queue is full or the list is not empty; drained by outbox_task alone.
+static SemaphoreHandle_t s_spill_lock;
+static outbox_msg_t *s_spill_head, *s_spill_tail;
+static uint32_t s_spill_count;
+
+// One failed message waits out its backoff here, so it holds up neither its class nor the ones below.
+static outbox_msg_t *s_retry;
+static outbox_class_t s_retry_cls;
+static int64_t s_retry_at_us;
+
+static metric_t s_m_published = METRIC_COUNTER("mqtt.pub");
+static metric_t s_m_requeued = METRIC_COUNTER("mqtt.pub_fail");
+static metric_t s_m_dropped = METRIC_COUNTER("mqtt.drop");
+
+static void outbox_free(outbox_msg_t *m) {
+	if (m->release) m->release(m->ctx);
+	free(m);
+}
+
+static void outbox_drop(outbox_class_t cls, outbox_msg_t *m) {
+	s_dropped[cls]++;
+	metric_inc(&s_m_dropped);
+	if (cls == OUTBOX_MONEY) {
+		ESP_LOGE(TAG, "dropped money msg (%d B) on %s, total %lu", m->len, m->topic, (unsigned long) s_dropped[cls]);
+	} else {
+		ESP_LOGW(TAG, "dropped %s msg (%d B) on %s, total %lu", s_class_name[cls], m->len, m->topic, (unsigned long) s_dropped[cls]);
+	}
+	outbox_free(m);
+}
+
+// Queue a money message behind every earlier one: in the queue while it has room and nothing is spilled, else in the spill list.
+static bool outbox_money_put(outbox_msg_t *m) {
+	bool kept = true;
+
+	xSemaphoreTake(s_spill_lock, portMAX_DELAY);
+	if (s_spill_head != NULL || xQueueSend(s_queue[OUTBOX_MONEY], &m, 0) != pdTRUE) {
+		if (s_spill_count < OUTBOX_MONEY_SPILL_MAX) {
+			m->next = NULL;
+			if (s_spill_tail) s_spill_tail->next = m; else s_spill_head = m;
+			s_spill_tail = m;
+			s_spill_count++;
+		} else {
+			kept = false;
+		}
+	}
+	xSemaphoreGive(s_spill_lock);
+
+	if (!kept) outbox_drop(OUTBOX_MONEY, m);
+	return kept;
+}
+
+// The queue holds the older money messages, the spill list the newer ones.
+static bool outbox_money_take(outbox_msg_t **m) {
+	if (xQueueReceive(s_queue[OUTBOX_MONEY], m, 0) == pdTRUE) return true;
+
+	xSemaphoreTake(s_spill_lock, portMAX_DELAY);
+	*m = s_spill_head;
+	if (*m) {
+		s_spill_head = (*m)->next;
+		if (s_spill_head == NULL) s_spill_tail = NULL;
+		s_spill_count--;
+	}
+	xSemaphoreGive(s_spill_lock);
+
+	return *m != NULL;
+}
+
+// Park a failed message for its backoff; a second failure meanwhile goes to the back of its class.
+static void outbox_retry_later(outbox_class_t cls, outbox_msg_t *m) {
+	if (cls != OUTBOX_MONEY && ++m->tries >= OUTBOX_RETRY_MAX) {
+		outbox_drop(cls, m);
+		return;
+	}
+	if (cls == OUTBOX_MONEY && m->tries < UINT8_MAX) m->tries++;
+
+	if (s_retry == NULL) {
+		int64_t backoff_us = (1000 * 1000LL) << (m->tries < 6 ? m->tries - 1 : 5);
+		s_retry = m;
+		s_retry_cls = cls;
+		s_retry_at_us = esp_timer_get_time() + (backoff_us < OUTBOX_RETRY_BACKOFF_MAX_US ? backoff_us : OUTBOX_RETRY_BACKOFF_MAX_US);
+	} else if (cls == OUTBOX_MONEY) {
+		outbox_money_put(m);
+	} else if (xQueueSend(s_queue[cls], &m, 0) != pdTRUE) {
+		outbox_drop(cls, m);
+	}
+}
+
+// Free the oldest message of the lowest-value sheddable class. Returns false if there was nothing to shed.
+static bool outbox_shed_one(void) {
+	for (int c = OUTBOX_CLASS_MAX - 1; c >= 0; c--) {
+		outbox_msg_t *old;
+		if (s_class_cfg[c].shed && xQueueReceive(s_queue[c], &old, 0) == pdTRUE) {
+			outbox_drop(c, old);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void outbox_bulk_refill(void) {
+	int64_t now = esp_timer_get_time();
+	if (now < s_bulk_refill_us) return;
+
+	int64_t intervals = (now - s_bulk_refill_us) / OUTBOX_BULK_INTERVAL_US + 1;
+	int64_t tokens = s_bulk_tokens + intervals * OUTBOX_BULK_BUDGET_BYTES;
+
+	s_bulk_tokens = tokens > OUTBOX_BULK_BUDGET_BYTES ? OUTBOX_BULK_BUDGET_BYTES : (int32_t) tokens;
+	s_bulk_refill_us += intervals * OUTBOX_BULK_INTERVAL_US;
+}
+
+// Dispatcher: strict priority across classes, one publish at a time so nothing queues up inside esp-mqtt behind a bulk write.
+static void outbox_task(void *arg) {
+	for (;;) {
+		TickType_t wait = portMAX_DELAY;
+		outbox_msg_t *m = NULL;
+		outbox_class_t cls = OUTBOX_MONEY;
+
+		if (s_connected) {
+			outbox_bulk_refill();
+
+			if (s_retry != NULL) {
+				int64_t until_us = s_retry_at_us - esp_timer_get_time();
+				if (until_us <= 0) {
+					m = s_retry;
+					cls = s_retry_cls;
+					s_retry = NULL;
+				} else {
+					wait = pdMS_TO_TICKS(until_us / 1000) + 1;
+				}
+			}
+
+			for (int c = 0; c < OUTBOX_CLASS_MAX && m == NULL; c++) {
+				if (c == OUTBOX_BULK && s_bulk_tokens <= 0) {
+					if (uxQueueMessagesWaiting(s_queue[c]) > 0) {
+						int64_t until_us = s_bulk_refill_us - esp_timer_get_time();
+						TickType_t bulk_wait = pdMS_TO_TICKS(until_us / 1000) + 1;
+						if (bulk_wait < wait) wait = bulk_wait;
+					}
+					continue;
+				}
+
+				if (c == OUTBOX_MONEY ? outbox_money_take(&m) : xQueueReceive(s_queue[c], &m, 0) == pdTRUE) cls = c;
+			}
+		}
+
+		if (m == NULL) {
+			ulTaskNotifyTake(pdTRUE, wait);
+			continue;
+		}
+
+		int rc = mqtt_session_publish(m->topic, m->data, m->len, s_class_cfg[cls].qos, m->retain, false);
+
+		if (rc == MQTT_SESSION_ERR_TOO_BIG) {
+			outbox_drop(cls, m);
+			continue;
+		}
+
+		if (rc < 0) {
+			metric_inc(&s_m_requeued);
+
+			// Usually the session dropped under us: hold off a second, the disconnect event is on its way.
+			outbox_retry_later(cls, m);
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+			continue;
+		}
+
+		metric_inc(&s_m_published);
+
+		if (cls == OUTBOX_BULK) s_bulk_tokens -= m->len;
+		outbox_free(m);
+	}
+}
+
+void mqtt_outbox_init(void) {
+	for (int c = 0; c < OUTBOX_CLASS_MAX; c++)
+		s_queue[c] = xQueueCreate(s_class_cfg[c].depth, sizeof(outbox_msg_t*));
+
+	s_spill_lock = xSemaphoreCreateMutex();
+	s_bulk_refill_us = esp_timer_get_time();
+
+	metrics_register(&s_m_published);
+	metrics_register(&s_m_requeued);
+	metrics_register(&s_m_dropped);
+
+	xTaskCreatePinnedToCore(outbox_task, "mqtt_outbox", 3072, NULL, 5, &s_task, 0);
+}
+
+void mqtt_outbox_set_connected(bool connected) {
+	s_connected = connected;
+
+	if (s_task) xTaskNotifyGive(s_task);
+}
+
+// Topic copied in, data copied after it unless the caller lends it (release != NULL).
+static bool outbox_put(outbox_class_t cls, const char *topic, const char *data, int len, int retain,
+		void (*release)(void *ctx), void *ctx) {
+	if (s_task == NULL || cls >= OUTBOX_CLASS_MAX) {
+		if (release) release(ctx);
+		return false;
+	}
+
+	if (len <= 0) len = strlen(data);
+
+	while (esp_get_free_heap_size() < OUTBOX_LOW_HEAP_BYTES && outbox_shed_one())
+		;
+
+	size_t topic_len = strlen(topic);
+	outbox_msg_t *m = malloc(sizeof(outbox_msg_t) + topic_len + 1 + (release ? 0 : len));
+	if (m == NULL) {
+		s_dropped[cls]++;
+		metric_inc(&s_m_dropped);
+		ESP_LOGE(TAG, "no memory for %s msg (%d B) on %s, total dropped %lu", s_class_name[cls], len, topic, (unsigned long) s_dropped[cls]);
+		if (release) release(ctx);
+		return false;
+	}
+
+	memcpy(m->topic, topic, topic_len + 1);
+	if (release) {
+		m->data = (char*) data;
+	} else {
+		m->data = m->topic + topic_len + 1;
+		memcpy(m->data, data, len);
+	}
+	m->release = release;
+	m->ctx = ctx;
+	m->next = NULL;
+	m->len = len;
+	m->retain = retain;
+	m->tries = 0;
+
+	if (cls == OUTBOX_MONEY) {
+		// Never published from the caller's task: the MDB task must not wait on a PUBACK before its reply.
+		if (!outbox_money_put(m)) return false;
+	} else if (xQueueSend(s_queue[cls], &m, 0) != pdTRUE) {
+		outbox_msg_t *old;
+
+		if (s_class_cfg[cls].shed && xQueueReceive(s_queue[cls], &old, 0) == pdTRUE) {
+			outbox_drop(cls, old);
+			if (xQueueSend(s_queue[cls], &m, 0) != pdTRUE) outbox_drop(cls, m);
+
+		} else {
+			outbox_drop(cls, m);
+			return false;
+		}
+	}
+
+	xTaskNotifyGive(s_task);
+	return true;
+}
+
+bool mqtt_outbox_publish(outbox_class_t cls, const char *topic, const char *data, int len, int retain) {
+	return outbox_put(cls, topic, data, len, retain, NULL, NULL);
+}
+
+bool mqtt_outbox_publish_ref(outbox_class_t cls, const char *topic, const char *data, int len, int retain,
+		void (*release)(void *ctx), void *ctx) {
+	return outbox_put(cls, topic, data, len, retain, release, ctx);
+}
@@ -0,0 +1,50 @@
+/*
+ * mqtt_outbox — priority scheduler in front of the esp-mqtt client.
+ *
+ * Every outbound publish is tagged with a traffic class and parked in that
+ * class's bounded queue. A single dispatcher task drains the queues in strict
+ * priority order (money > control > telemetry > bulk), so a sale confirmation
+ * never waits behind a multi-KB DEX dump. Bulk traffic is additionally held to
+ * a byte budget per interval, and the low-value classes drop their oldest
+ * message when their queue is full or the heap runs low.
+ *
+ * Money is only ever published by the dispatcher, never on the caller's task
+ * (the MDB task must answer the VMC on time). Past its queue it waits, in
+ * order, in a spill list of up to 64 messages; beyond that, or without
+ * memory, it is dropped, logged as an error and counted in mqtt.drop like
+ * any other drop. A failed publish is parked and retried with a backoff
+ * while the other messages go out; only money retries forever.
+ */
+#ifndef MQTT_OUTBOX_H
+#define MQTT_OUTBOX_H
+
+#include <stdbool.h>
+
+typedef enum {
+	OUTBOX_MONEY = 0,   /* sale, vend_fail — never shed */
+	OUTBOX_CONTROL,     /* RPC replies: confirm, echo, info */
+	OUTBOX_TELEMETRY,   /* paxcounter and other periodic reports */
+	OUTBOX_BULK,        /* DEX audit dumps; byte-budgeted */
+	OUTBOX_CLASS_MAX
+} outbox_class_t;
+
+/* Create the per-class queues and the dispatcher task. Messages go out through
+ * mqtt_session_publish(). Call once, after mqtt_session_init(). */
+void mqtt_outbox_init(void);
+
+/* Tell the dispatcher whether the broker session is up. Call from the
+ * MQTT_EVENT_CONNECTED / MQTT_EVENT_DISCONNECTED handlers. While down,
+ * messages stay queued under the class drop policy. */
+void mqtt_outbox_set_connected(bool connected);
+
+/* Copy topic and data (len 0 = strlen) into the class queue. QoS comes from the
+ * class. Never blocks; returns false if the message was not accepted. */
+bool mqtt_outbox_publish(outbox_class_t cls, const char *topic, const char *data, int len, int retain);
+
+/* Same, but data is not copied: it must stay valid and unchanged until the
+ * outbox calls release(ctx), once the message is sent or dropped. release is
+ * also called when false is returned. For large buffers (DEX audits). */
+bool mqtt_outbox_publish_ref(outbox_class_t cls, const char *topic, const char *data, int len, int retain,
+		void (*release)(void *ctx), void *ctx);
+
+#endif /* MQTT_OUTBOX_H */
@@ -0,0 +1,487 @@
+#include "mqtt-session.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <nvs_flash.h>
+
+#include "rpc-exec.h"
+#include "mqtt-outbox.h"
+#include "fleet.h"
+#include "metrics.h"
+#include "trace.h"
+#if CONFIG_VMFLOW_MQTTSN
+#include "mqtt-sn.h"
+#endif
+
+#define TAG "mqtt_session"
+
+#define SESSION_CONNECT_VARHDR      10  // CONNECT variable header: protocol name, level, flags, keepalive
+#define SESSION_SN_FALLBACK         5   // MQTT-SN connects in a row without a session before going back to TCP (~3 min)
+
+#if CONFIG_VMFLOW_MQTT_PERSISTENT_SESSION
+#define SESSION_PERSISTENT          true
+#else
+#define SESSION_PERSISTENT          false
+#endif
+
+#if CONFIG_VMFLOW_MQTT_TOPIC_ALIASES
+// One alias per distinct outbound topic; the device publishes to fewer than this.
+#define SESSION_ALIAS_MAX           8
+#endif
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+static esp_mqtt_client_handle_t s_client;
+static SemaphoreHandle_t s_publish_lock;
+static mqtt_session_state_cb_t s_state_cb;
+static bool s_sn;
+
+static char s_client_id[32];
+static char s_status_topic[64];
+static char s_rpc_topic[64];
+
+static int s_sub_msg_id = -1;
+static bool s_fleet_subscribed;     // fleet / group topics subscribed since boot
+static int64_t s_attempt_us;
+static int64_t s_down_us;
+static uint32_t s_connect_bytes;
+static mqtt_session_stats_t s_stats;
+static metric_t s_m_ready_ms = METRIC_HISTOGRAM("mqtt.ready_ms", 100, 250, 500, 1000, 2500, 5000, 10000);
+
+// Read by the uplink task; written from the MQTT event loop and the publishing tasks.
+static portMUX_TYPE s_health_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_connected;
+static int s_ack_msg_id;            // the QoS 1 publish being timed, 0 if none
+static int64_t s_ack_sent_us;
+static int32_t s_ack_rtt_ms = -1;
+
+#if CONFIG_VMFLOW_MQTT_TOPIC_ALIASES
+static char s_alias_topic[SESSION_ALIAS_MAX][64];
+static bool s_alias_live[SESSION_ALIAS_MAX];    // topic->alias mapping already sent on this connection
+static bool s_alias_off;                        // broker refused an alias on this connection
+#endif
+
+static uint32_t session_varint_len(uint32_t n) {
+	return n < 128 ? 1 : n < 16384 ? 2 : n < 2097152 ? 3 : 4;
+}
+
+// Size on the wire of a packet with the given remaining length (fixed header included).
+static uint32_t session_packet_len(uint32_t rem) {
+	return 1 + session_varint_len(rem) + rem;
+}
+
+static uint32_t session_publish_len(const char *topic, int len, int qos) {
+	uint32_t rem = 2 + strlen(topic) + (qos > 0 ? 2 : 0) + len;
+	if (s_stats.v5) rem += 1;   // empty property block
+
+	return session_packet_len(rem);
+}
+
+// Time one QoS 1 publish at a time to its PUBACK: enough to see the connection stall, nothing to allocate.
+static void session_ack_start(int msg_id) {
+	taskENTER_CRITICAL(&s_health_lock);
+	if (s_connected && s_ack_msg_id == 0) {
+		s_ack_msg_id = msg_id;
+		s_ack_sent_us = esp_timer_get_time();
+	}
+	taskEXIT_CRITICAL(&s_health_lock);
+}
+
+static void session_ack_done(int msg_id) {
+	taskENTER_CRITICAL(&s_health_lock);
+	if (s_ack_msg_id != 0 && s_ack_msg_id == msg_id) {
+		s_ack_rtt_ms = (int32_t) ((esp_timer_get_time() - s_ack_sent_us) / 1000);
+		s_ack_msg_id = 0;
+	}
+	taskEXIT_CRITICAL(&s_health_lock);
+}
+
+// A publish still waiting from the last connection says nothing about the next one.
+static void session_set_connected(bool connected) {
+	taskENTER_CRITICAL(&s_health_lock);
+	s_connected = connected;
+	s_ack_msg_id = 0;
+	taskEXIT_CRITICAL(&s_health_lock);
+}
+
+#if CONFIG_VMFLOW_MQTT_TOPIC_ALIASES
+static uint16_t session_alias(const char *topic) {
+	for (int i = 0; i < SESSION_ALIAS_MAX; i++) {
+		if (s_alias_topic[i][0] == '\0') {
+			if (strlen(topic) >= sizeof(s_alias_topic[i])) return 0;
+			strcpy(s_alias_topic[i], topic);
+		}
+		if (strcmp(s_alias_topic[i], topic) == 0) return i + 1;
+	}
+	return 0;
+}
+#endif
+
+int mqtt_session_publish(const char *topic, const char *data, int len, int qos, int retain, bool store) {
+#if CONFIG_VMFLOW_MQTTSN
+	if (s_sn) {
+		// QoS 1 blocks until the PUBACK; a failed one stays unacknowledged until the session goes down.
+		if (qos > 0) session_ack_start(-1);
+		int rc = mqttsn_publish(topic, data, len, qos, retain);
+		if (qos > 0 && rc == 0) session_ack_done(-1);
+		return rc == -2 ? MQTT_SESSION_ERR_TOO_BIG : rc;
+	}
+#endif
+
+	if (s_client == NULL) return -1;
+
+	xSemaphoreTake(s_publish_lock, portMAX_DELAY);
+
+#if CONFIG_VMFLOW_MQTT_TOPIC_ALIASES
+	// Only QoS 0 uses the short form: esp-mqtt may replay a stored QoS 1 packet on a
+	// new connection, where an alias-only topic would no longer resolve.
+	uint16_t alias = (qos == 0 && !s_alias_off) ? session_alias(topic) : 0;
+
+	if (alias) {
+		esp_mqtt5_publish_property_config_t prop = { .topic_alias = alias };
+		esp_mqtt5_client_set_publish_property(s_client, &prop);
+
+		const char *wire_topic = s_alias_live[alias - 1] ? "" : topic;
+		int msg_id = store ? esp_mqtt_client_enqueue(s_client, wire_topic, data, len, qos, retain, true)
+		                   : esp_mqtt_client_publish(s_client, wire_topic, data, len, qos, retain);
+
+		if (msg_id >= 0) {
+			s_alias_live[alias - 1] = true;
+			if (qos > 0 && msg_id > 0) session_ack_start(msg_id);
+			xSemaphoreGive(s_publish_lock);
+			return msg_id;
+		}
+
+		// The broker's Topic Alias Maximum is below ours (or 0): publish plainly for the rest of this connection.
+		ESP_LOGW(TAG, "topic alias %u refused, disabling aliases", alias);
+		s_alias_off = true;
+		esp_mqtt5_client_set_publish_property(s_client, &(esp_mqtt5_publish_property_config_t) { 0 });
+	}
+#endif
+
+	int msg_id = store ? esp_mqtt_client_enqueue(s_client, topic, data, len, qos, retain, true)
+	                   : esp_mqtt_client_publish(s_client, topic, data, len, qos, retain);
+	if (qos > 0 && msg_id > 0) session_ack_start(msg_id);
+
+	xSemaphoreGive(s_publish_lock);
+	return msg_id;
+}
+
+static void session_ready(void) {
+	int64_t now = esp_timer_get_time();
+
+	s_stats.last_ready_ms = (uint32_t) ((now - s_attempt_us) / 1000);
+	metric_observe(&s_m_ready_ms, s_stats.last_ready_ms);
+	s_stats.last_offline_ms = s_down_us ? (uint32_t) ((now - s_down_us) / 1000) : 0;
+	s_down_us = 0;
+
+	ESP_LOGI(TAG, "ready in %lu ms (offline %lu ms, %lu B sent, session %s)",
+		(unsigned long) s_stats.last_ready_ms, (unsigned long) s_stats.last_offline_ms,
+		(unsigned long) s_stats.last_tx_bytes, s_sub_msg_id < 0 ? "resumed" : "new");
+}
+
+static void session_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
+	esp_mqtt_event_handle_t event = event_data;
+
+	switch ((esp_mqtt_event_id_t) event_id) {
+	case MQTT_EVENT_BEFORE_CONNECT:
+		s_attempt_us = esp_timer_get_time();
+		break;
+
+	case MQTT_EVENT_CONNECTED: {
+		session_set_connected(true);
+		s_stats.connects++;
+		s_stats.last_tx_bytes = s_connect_bytes;
+
+#if CONFIG_VMFLOW_MQTT_TOPIC_ALIASES
+		memset(s_alias_live, 0, sizeof(s_alias_live));
+		s_alias_off = false;
+#endif
+
+		// The broker already holds our subscription (and any RPCs queued while we were away).
+		bool resumed = SESSION_PERSISTENT && event->session_present;
+		trace_emit(TRACE_MQTT_CONNECTED, resumed, 0);
+
+		// Fleet membership is read at boot and may have changed since the session was created,
+		// so the broadcast topics are subscribed once per boot even when the session is resumed.
+		esp_mqtt_topic_t topics[1 + FLEET_GROUPS_MAX + 1];
+		size_t count = 0;
+
+		if (resumed) {
+			s_stats.resumes++;
+			s_sub_msg_id = -1;
+		} else {
+			topics[count++] = (esp_mqtt_topic_t) { .filter = s_rpc_topic, .qos = 1 };
+		}
+
+		if (!resumed || !s_fleet_subscribed) {
+			const char *fleet[FLEET_GROUPS_MAX + 1];
+			size_t n = fleet_topics(fleet, FLEET_GROUPS_MAX + 1);
+			for (size_t i = 0; i < n; i++) topics[count++] = (esp_mqtt_topic_t) { .filter = fleet[i], .qos = 1 };
+			s_fleet_subscribed = true;
+		}
+
+		if (count > 0) {
+			int msg_id = esp_mqtt_client_subscribe_multiple(event->client, topics, (int) count);
+			if (!resumed) s_sub_msg_id = msg_id;
+
+			uint32_t rem = 2;
+			if (s_stats.v5) rem += 1;
+			for (size_t i = 0; i < count; i++) rem += 2 + strlen(topics[i].filter) + 1;
+			s_stats.last_tx_bytes += session_packet_len(rem);
+		}
+
+		// The LWT fired if the last connection dropped uncleanly, so "online" is re-announced every time.
+		char buf[32];
+		snprintf(buf, sizeof(buf), "online,%d", (int) esp_reset_reason());
+		mqtt_session_publish(s_status_topic, buf, 0, 1, 1, true);
+		s_stats.last_tx_bytes += session_publish_len(s_status_topic, strlen(buf), 1);
+
+		if (resumed) session_ready();
+
+		s_state_cb(true);
+		break;
+	}
+
+	case MQTT_EVENT_SUBSCRIBED:
+		if (event->msg_id == s_sub_msg_id) {
+			ESP_LOGI(TAG, "subscribed: %s", s_rpc_topic);
+			session_ready();
+		}
+		break;
+
+	case MQTT_EVENT_PUBLISHED:
+		session_ack_done(event->msg_id);
+		break;
+
+	case MQTT_EVENT_DISCONNECTED:
+		session_set_connected(false);
+		trace_emit(TRACE_MQTT_DISCONNECTED, 0, 0);
+		if (s_down_us == 0) s_down_us = esp_timer_get_time();
+		s_state_cb(false);
+		break;
+
+	case MQTT_EVENT_DATA:
+		// Only copy and enqueue here; verification and dispatch run on the rpc_exec task.
+		if (event->topic_len == strlen(s_rpc_topic) && strncmp(event->topic, s_rpc_topic, event->topic_len) == 0) {
+			rpc_exec_submit(event->data, event->data_len);
+		} else if (fleet_match(event->topic, event->topic_len)) {
+			rpc_exec_submit_broadcast(event->topic, event->topic_len, event->data, event->data_len);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+#if CONFIG_VMFLOW_MQTTSN
+static void session_sn_state(bool connected) {
+	if (connected) {
+		// Queued rather than published here: this runs on the MQTT-SN task, which must stay free to receive the PUBACK.
+		char buf[32];
+		snprintf(buf, sizeof(buf), "online,%d", (int) esp_reset_reason());
+		mqtt_outbox_publish(OUTBOX_CONTROL, s_status_topic, buf, 0, 1);
+	}
+
+	session_set_connected(connected);
+	s_state_cb(connected);
+}
+
+static void session_sn_rpc(const char *data, int len) {
+	rpc_exec_submit(data, len);
+}
+
+// No gateway answers: a device switched to MQTT-SN must not go dark, so go back to esp-mqtt,
+// from where the transport RPC can try again.
+static void session_sn_connect_failed(uint32_t in_a_row) {
+	if (in_a_row < SESSION_SN_FALLBACK) return;
+
+	ESP_LOGE(TAG, "no MQTT-SN session after %lu connects, back to mqtt", (unsigned long) in_a_row);
+	if (mqtt_session_set_transport("mqtt") != ESP_OK) return;
+	esp_restart();
+}
+#endif
+
+static bool session_use_sn(void) {
+#if CONFIG_VMFLOW_MQTTSN
+#if CONFIG_VMFLOW_MQTTSN_DEFAULT
+	bool sn = true;
+#else
+	bool sn = false;
+#endif
+
+	nvs_handle_t handle;
+	if (nvs_open("vmflow", NVS_READONLY, &handle) == ESP_OK) {
+		char name[12];
+		size_t s_len = sizeof(name);
+		if (nvs_get_str(handle, "transport", name, &s_len) == ESP_OK) sn = strcmp(name, "mqtt-sn") == 0;
+		nvs_close(handle);
+	}
+	return sn;
+#else
+	return false;
+#endif
+}
+
+const char *mqtt_session_transport(void) {
+	return s_sn ? "mqtt-sn" : "mqtt";
+}
+
+esp_err_t mqtt_session_set_transport(const char *name) {
+	if (strcmp(name, "mqtt") != 0 && strcmp(name, "mqtt-sn") != 0) return ESP_ERR_INVALID_ARG;
+#if !CONFIG_VMFLOW_MQTTSN
+	if (strcmp(name, "mqtt-sn") == 0) return ESP_ERR_NOT_SUPPORTED;
+#endif
+
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open("vmflow", NVS_READWRITE, &handle);
+	if (err != ESP_OK) return err;
+
+	err = nvs_set_str(handle, "transport", name);
+	if (err == ESP_OK) err = nvs_commit(handle);
+	nvs_close(handle);
+
+	return err;
+}
+
+void mqtt_session_leave_fleet(void) {
+	if (s_sn || s_client == NULL) return;
+
+	const char *topics[FLEET_GROUPS_MAX + 1];
+	size_t n = fleet_topics(topics, FLEET_GROUPS_MAX + 1);
+	for (size_t i = 0; i < n; i++) esp_mqtt_client_unsubscribe(s_client, topics[i]);
+}
+
+bool mqtt_session_config(esp_mqtt_client_config_t *cfg) {
+	s_sn = session_use_sn();
+
+	// Stable across reboots so the broker can hand the same session back.
+	if (my_subdomain[0] != '\0') {
+		snprintf(s_client_id, sizeof(s_client_id), "vmflow-%s", my_subdomain);
+	} else {
+		uint8_t mac[6];
+		esp_efuse_mac_get_default(mac);
+		snprintf(s_client_id, sizeof(s_client_id), "vmflow-%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	}
+
+	snprintf(s_status_topic, sizeof(s_status_topic), "domain.vmflow.xyz/%s/status", my_subdomain);
+	snprintf(s_rpc_topic, sizeof(s_rpc_topic), "%s.vmflow.xyz/rpc", my_subdomain);
+
+	cfg->credentials.client_id = s_client_id;
+	cfg->session.disable_clean_session = SESSION_PERSISTENT;
+
+	cfg->session.last_will.topic = s_status_topic;
+	cfg->session.last_will.msg = "offline";
+	cfg->session.last_will.qos = 1;
+	cfg->session.last_will.retain = 1;
+
+#if CONFIG_VMFLOW_MQTT_V5
+	cfg->session.protocol_ver = MQTT_PROTOCOL_V_5;
+	s_stats.v5 = true;
+#else
+	cfg->session.protocol_ver = MQTT_PROTOCOL_V_3_1_1;
+#endif
+
+	uint32_t rem = SESSION_CONNECT_VARHDR + 2 + strlen(s_client_id) + 2 + strlen(s_status_topic) + 2 + strlen("offline");
+	if (s_stats.v5) {
+		uint32_t props = 3;                                                 // receive maximum
+		if (SESSION_PERSISTENT) props += 5;                                 // session expiry
+		rem += session_varint_len(props) + props + 1;                       // + empty will properties
+	}
+	s_connect_bytes = session_packet_len(rem);
+
+	return !s_sn;
+}
+
+void mqtt_session_init(esp_mqtt_client_handle_t client, mqtt_session_state_cb_t state_cb) {
+	s_client = client;
+	s_state_cb = state_cb;
+	s_publish_lock = xSemaphoreCreateMutex();
+	metrics_register(&s_m_ready_ms);
+
+#if CONFIG_VMFLOW_MQTTSN
+	if (s_sn) {
+		mqttsn_config_t sn_cfg = {
+			.client_id = s_client_id,
+			.will_topic = s_status_topic,
+			.will_msg = "offline",
+			.rpc_topic = s_rpc_topic,
+			.clean_session = !SESSION_PERSISTENT,
+			.on_state = session_sn_state,
+			.on_rpc = session_sn_rpc,
+			.on_connect_failed = session_sn_connect_failed,
+		};
+		mqttsn_init(&sn_cfg);
+		return;
+	}
+#endif
+
+#if CONFIG_VMFLOW_MQTT_V5
+	esp_mqtt5_connection_property_config_t connect_prop = {
+#if CONFIG_VMFLOW_MQTT_PERSISTENT_SESSION
+		.session_expiry_interval = CONFIG_VMFLOW_MQTT_SESSION_EXPIRY,
+#endif
+		// At most this many unacknowledged QoS 1 RPCs in flight towards the device (rpc_exec queues 8).
+		.receive_maximum = CONFIG_VMFLOW_MQTT_RECEIVE_MAXIMUM,
+	};
+	esp_mqtt5_client_set_connect_property(client, &connect_prop);
+#endif
+
+	esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, session_event_handler, NULL);
+}
+
+void mqtt_session_start(void) {
+#if CONFIG_VMFLOW_MQTTSN
+	if (s_sn) {
+		mqttsn_start();
+		return;
+	}
+#endif
+	esp_mqtt_client_start(s_client);
+}
+
+void mqtt_session_reconnect(void) {
+#if CONFIG_VMFLOW_MQTTSN
+	if (s_sn) {
+		mqttsn_reconnect();
+		return;
+	}
+#endif
+	// Drop the socket pinned to the old route and reconnect at once instead of waiting out keepalive.
+	esp_mqtt_client_disconnect(s_client);
+	esp_mqtt_client_reconnect(s_client);
+}
+
+void mqtt_session_get_stats(mqtt_session_stats_t *out) {
+	*out = s_stats;
+
+#if CONFIG_VMFLOW_MQTTSN
+	if (s_sn) {
+		mqttsn_stats_t sn;
+		mqttsn_get_stats(&sn);
+
+		out->connects = sn.connects;
+		out->resumes = sn.wakes;
+		out->last_ready_ms = sn.last_ready_ms;
+		out->last_offline_ms = sn.last_offline_ms;
+		out->last_tx_bytes = sn.last_handshake_bytes;
+	}
+#endif
+}
+
+void mqtt_session_get_health(mqtt_session_health_t *out) {
+	taskENTER_CRITICAL(&s_health_lock);
+	out->connected = s_connected;
+	out->rtt_ms = s_ack_rtt_ms;
+	out->ack_wait_ms = s_ack_msg_id != 0 ? (uint32_t) ((esp_timer_get_time() - s_ack_sent_us) / 1000) : 0;
+	taskEXIT_CRITICAL(&s_health_lock);
+}
@@ -0,0 +1,93 @@
+/*
+ * mqtt_session — broker session policy for the esp-mqtt client.
+ *
+ * Owns the client id, the status LWT, the RPC subscription and the retained
+ * "online" announcement. With a persistent session (menuconfig → VMflow →
+ * MQTT) the broker keeps the subscription and queues QoS 1 RPCs while the
+ * device is offline (the backend publishes credits at QoS 1 for this); a
+ * reconnect that finds its session skips SUBSCRIBE entirely. A queued RPC is
+ * still checked for freshness on arrival, and one older than
+ * RPC_FRESHNESS_SEC + HAL_TIME_SLACK_MAX_S (10 + 2 s) is rejected as stale,
+ * so the queue only bridges outages of a few seconds. Optional MQTT 5 adds session expiry, receive-maximum flow control
+ * and topic aliases on QoS 0 publishes. Every reconnect is timed and its
+ * handshake bytes are counted, and one QoS 1 publish at a time is timed to
+ * its PUBACK, so the uplink manager sees a stalled connection.
+ *
+ * The transport is esp-mqtt over TCP or, when selected in menuconfig or NVS
+ * ("transport" = "mqtt-sn"), MQTT-SN over UDP (mqtt-sn.c). Callers publish
+ * and receive RPCs the same way with either. When no gateway gives MQTT-SN a
+ * session for 5 connects in a row, NVS goes back to "mqtt" and the device
+ * restarts on esp-mqtt, so a bad switch cannot leave it unreachable.
+ *
+ * Over esp-mqtt the session also subscribes the fleet and group broadcast
+ * topics (fleet.c), once per boot, and hands their messages to
+ * rpc_exec_submit_broadcast(). MQTT-SN carries only the device's own topics.
+ */
+#ifndef MQTT_SESSION_H
+#define MQTT_SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <mqtt_client.h>
+
+typedef struct {
+	uint32_t connects;          /* CONNACKs since boot */
+	uint32_t resumes;           /* ... of which found the session on the broker */
+	uint32_t last_ready_ms;     /* connect attempt -> ready (CONNACK, or SUBACK when resubscribing) */
+	uint32_t last_offline_ms;   /* disconnect -> ready */
+	uint32_t last_tx_bytes;     /* MQTT bytes sent for the last reconnect: CONNECT, SUBSCRIBE, status */
+	bool v5;
+} mqtt_session_stats_t;
+
+/* mqtt_session_publish() result for a message the transport can never carry
+ * (larger than an MQTT-SN datagram); the caller should drop it. esp-mqtt
+ * itself returns -1 and -2. */
+#define MQTT_SESSION_ERR_TOO_BIG    (-3)
+
+/* The session's own connection, which the uplink manager judges the active
+ * link by instead of opening probe connections to the broker. */
+typedef struct {
+	bool connected;
+	int32_t rtt_ms;             /* last QoS 1 publish -> PUBACK, -1 before the first */
+	uint32_t ack_wait_ms;       /* age of the QoS 1 publish being timed, 0 if none is unacknowledged */
+} mqtt_session_health_t;
+
+typedef void (*mqtt_session_state_cb_t)(bool connected);
+
+/* Pick the transport and fill the session part of cfg: client id,
+ * clean-session flag, protocol version and the status LWT. Returns false
+ * when MQTT-SN is selected and no esp-mqtt client is needed. */
+bool mqtt_session_config(esp_mqtt_client_config_t *cfg);
+
+/* Set MQTT 5 connect properties and register the session event handler, or
+ * set up MQTT-SN (client is NULL then). state_cb is told when the session
+ * comes up or goes down; RPCs are handed to rpc_exec_submit(). Call after
+ * esp_mqtt_client_init() and before any other event handler. */
+void mqtt_session_init(esp_mqtt_client_handle_t client, mqtt_session_state_cb_t state_cb);
+
+/* Start connecting (first link up) / drop the connection and reconnect on the
+ * new default route. Called by the uplink manager. */
+void mqtt_session_start(void);
+void mqtt_session_reconnect(void);
+
+/* Publish through the session (topic aliases applied here). store = true
+ * queues inside esp-mqtt without blocking (esp_mqtt_client_enqueue).
+ * Returns the message id (0 with MQTT-SN), or a negative value on failure. */
+int mqtt_session_publish(const char *topic, const char *data, int len, int qos, int retain, bool store);
+
+/* "mqtt" or "mqtt-sn". */
+const char *mqtt_session_transport(void);
+
+/* Persist the transport for the next boot ("mqtt" or "mqtt-sn"). */
+esp_err_t mqtt_session_set_transport(const char *name);
+
+/* Unsubscribe the current fleet / group topics, before the membership is
+ * changed; a persistent session would otherwise keep them on the broker. */
+void mqtt_session_leave_fleet(void);
+
+void mqtt_session_get_stats(mqtt_session_stats_t *out);
+
+/* Safe to call from any task. */
+void mqtt_session_get_health(mqtt_session_health_t *out);
+
+#endif /* MQTT_SESSION_H */
@@ -0,0 +1,183 @@
+#include "mqtt-sn-packet.h"
+
+#include <string.h>
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+	return p + 2;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+	return (uint16_t) ((p[0] << 8) | p[1]);
+}
+
+size_t mqttsn_encode(uint8_t *buf, size_t buf_sz, const mqttsn_packet_t *p) {
+	uint8_t body[16];
+	uint8_t *b = body;
+	const uint8_t *data = p->data;
+	size_t data_len = p->data_len;
+
+	switch (p->type) {
+	case MQTTSN_CONNECT:
+		*b++ = p->flags;
+		*b++ = 0x01;                // protocol id
+		b = put_u16(b, p->duration);
+		break;
+	case MQTTSN_WILLTOPIC:
+		*b++ = p->flags;
+		break;
+	case MQTTSN_REGISTER:
+		b = put_u16(b, p->topic_id);
+		b = put_u16(b, p->msg_id);
+		break;
+	case MQTTSN_REGACK:
+	case MQTTSN_PUBACK:
+		b = put_u16(b, p->topic_id);
+		b = put_u16(b, p->msg_id);
+		*b++ = p->rc;
+		data_len = 0;
+		break;
+	case MQTTSN_PUBLISH:
+		*b++ = p->flags;
+		b = put_u16(b, p->topic_id);
+		b = put_u16(b, p->msg_id);
+		break;
+	case MQTTSN_SUBSCRIBE:
+		*b++ = p->flags;
+		b = put_u16(b, p->msg_id);
+		if ((p->flags & MQTTSN_TOPIC_TYPE_MASK) != MQTTSN_TOPIC_NORMAL) {
+			b = put_u16(b, p->topic_id);
+			data_len = 0;
+		}
+		break;
+	case MQTTSN_SUBACK:
+		*b++ = p->flags;
+		b = put_u16(b, p->topic_id);
+		b = put_u16(b, p->msg_id);
+		*b++ = p->rc;
+		data_len = 0;
+		break;
+	case MQTTSN_CONNACK:
+		*b++ = p->rc;
+		data_len = 0;
+		break;
+	case MQTTSN_DISCONNECT:
+		if (p->duration) b = put_u16(b, p->duration);
+		data_len = 0;
+		break;
+	case MQTTSN_WILLMSG:
+	case MQTTSN_PINGREQ:            // optional client id: a sleeping client polling for buffered messages
+		break;
+	default:                        // WILLTOPICREQ, WILLMSGREQ, PINGRESP: header only
+		data_len = 0;
+		break;
+	}
+
+	size_t body_len = (size_t) (b - body) + 1 + data_len;     // + msg type
+	size_t hdr_len = body_len + 1 <= 255 ? 1 : 3;
+	size_t total = hdr_len + body_len;
+
+	if (total > buf_sz || total > 0xffff) return 0;
+
+	uint8_t *o = buf;
+	if (hdr_len == 1) {
+		*o++ = (uint8_t) total;
+	} else {
+		*o++ = 0x01;
+		o = put_u16(o, (uint16_t) total);
+	}
+	*o++ = p->type;
+	memcpy(o, body, b - body);
+	o += b - body;
+	if (data_len) memcpy(o, data, data_len);
+
+	return total;
+}
+
+bool mqttsn_decode(const uint8_t *buf, size_t len, mqttsn_packet_t *p) {
+	memset(p, 0, sizeof(*p));
+	if (len < 2) return false;
+
+	size_t total, hdr_len;
+	if (buf[0] == 0x01) {
+		if (len < 4) return false;
+		total = get_u16(buf + 1);
+		hdr_len = 3;
+	} else {
+		total = buf[0];
+		hdr_len = 1;
+	}
+	if (total > len || total < hdr_len + 1) return false;
+
+	p->type = buf[hdr_len];
+	const uint8_t *b = buf + hdr_len + 1;
+	size_t n = total - hdr_len - 1;
+
+	// Fixed part of the variable header per type; whatever follows is data.
+	size_t fixed;
+	switch (p->type) {
+	case MQTTSN_CONNECT:    fixed = 4; break;
+	case MQTTSN_CONNACK:    fixed = 1; break;
+	case MQTTSN_WILLTOPIC:  fixed = n ? 1 : 0; break;
+	case MQTTSN_REGISTER:   fixed = 4; break;
+	case MQTTSN_REGACK:
+	case MQTTSN_PUBACK:     fixed = 5; break;
+	case MQTTSN_PUBLISH:    fixed = 5; break;
+	case MQTTSN_SUBSCRIBE:  fixed = 3; break;
+	case MQTTSN_SUBACK:     fixed = 6; break;
+	case MQTTSN_DISCONNECT: fixed = n >= 2 ? 2 : 0; break;
+	default:                fixed = 0; break;
+	}
+	if (n < fixed) return false;
+
+	switch (p->type) {
+	case MQTTSN_CONNECT:
+		p->flags = b[0];
+		p->duration = get_u16(b + 2);
+		break;
+	case MQTTSN_CONNACK:
+		p->rc = b[0];
+		break;
+	case MQTTSN_WILLTOPIC:
+		if (fixed) p->flags = b[0];
+		break;
+	case MQTTSN_REGISTER:
+		p->topic_id = get_u16(b);
+		p->msg_id = get_u16(b + 2);
+		break;
+	case MQTTSN_REGACK:
+	case MQTTSN_PUBACK:
+		p->topic_id = get_u16(b);
+		p->msg_id = get_u16(b + 2);
+		p->rc = b[4];
+		break;
+	case MQTTSN_PUBLISH:
+		p->flags = b[0];
+		p->topic_id = get_u16(b + 1);
+		p->msg_id = get_u16(b + 3);
+		break;
+	case MQTTSN_SUBSCRIBE:
+		p->flags = b[0];
+		p->msg_id = get_u16(b + 1);
+		if ((p->flags & MQTTSN_TOPIC_TYPE_MASK) != MQTTSN_TOPIC_NORMAL) {
+			if (n < 5) return false;
+			p->topic_id = get_u16(b + 3);
+			fixed = 5;
+		}
+		break;
+	case MQTTSN_SUBACK:
+		p->flags = b[0];
+		p->topic_id = get_u16(b + 1);
+		p->msg_id = get_u16(b + 3);
+		p->rc = b[5];
+		break;
+	case MQTTSN_DISCONNECT:
+		if (fixed) p->duration = get_u16(b);
+		break;
+	}
+
+	p->data = b + fixed;
+	p->data_len = n - fixed;
+	return true;
+}
@@ -0,0 +1,64 @@
+/*
+ * mqtt_sn_packet — MQTT-SN v1.2 packet encoder/decoder.
+ *
+ * Plain C with no ESP-IDF dependencies, so the same code can run against a
+ * gateway on a Linux host. Only the packets the device exchanges are covered:
+ * connect/will handshake, register, publish, subscribe, ping and disconnect.
+ */
+#ifndef MQTT_SN_PACKET_H
+#define MQTT_SN_PACKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MQTTSN_WILLTOPICREQ     0x00
+#define MQTTSN_WILLTOPIC        0x01
+#define MQTTSN_WILLMSGREQ       0x02
+#define MQTTSN_WILLMSG          0x03
+#define MQTTSN_CONNECT          0x04
+#define MQTTSN_CONNACK          0x05
+#define MQTTSN_REGISTER         0x0A
+#define MQTTSN_REGACK           0x0B
+#define MQTTSN_PUBLISH          0x0C
+#define MQTTSN_PUBACK           0x0D
+#define MQTTSN_SUBSCRIBE        0x12
+#define MQTTSN_SUBACK           0x13
+#define MQTTSN_PINGREQ          0x16
+#define MQTTSN_PINGRESP         0x17
+#define MQTTSN_DISCONNECT       0x18
+
+#define MQTTSN_FLAG_DUP         0x80
+#define MQTTSN_FLAG_QOS0        0x00
+#define MQTTSN_FLAG_QOS1        0x20
+#define MQTTSN_FLAG_QOSM1       0x60    /* QoS -1: publish without a connection */
+#define MQTTSN_FLAG_QOS_MASK    0x60
+#define MQTTSN_FLAG_RETAIN      0x10
+#define MQTTSN_FLAG_WILL        0x08
+#define MQTTSN_FLAG_CLEAN       0x04
+#define MQTTSN_TOPIC_NORMAL     0x00
+#define MQTTSN_TOPIC_PREDEFINED 0x01
+#define MQTTSN_TOPIC_SHORT      0x02
+#define MQTTSN_TOPIC_TYPE_MASK  0x03
+
+#define MQTTSN_RC_ACCEPTED      0x00
+#define MQTTSN_RC_INVALID_TOPIC 0x02
+
+typedef struct {
+	uint8_t type;
+	uint8_t flags;
+	uint8_t rc;
+	uint16_t topic_id;
+	uint16_t msg_id;
+	uint16_t duration;          /* CONNECT keepalive, DISCONNECT sleep (0 = none) */
+	const uint8_t *data;        /* client id, topic name, will text or payload */
+	size_t data_len;
+} mqttsn_packet_t;
+
+/* Encode p into buf. Returns the packet length, or 0 if it does not fit. */
+size_t mqttsn_encode(uint8_t *buf, size_t buf_sz, const mqttsn_packet_t *p);
+
+/* Decode one datagram. p->data points into buf. Returns false if malformed. */
+bool mqttsn_decode(const uint8_t *buf, size_t len, mqttsn_packet_t *p);
+
+#endif /* MQTT_SN_PACKET_H */
@@ -0,0 +1,599 @@
+#include "mqtt-sn.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+
+#include "mqtt-sn-packet.h"
+
+#define TAG "mqtt_sn"
+
+#define SN_MAX_PACKET       1280                // one datagram, below the PPP / NB-IoT MTU
+#define SN_T_RETRY_US       (5000 * 1000)       // spec suggests 10-15 s; NB-IoT RTT is 1-3 s
+#define SN_N_RETRY          3
+#define SN_BACKOFF_US       (15000 * 1000)
+#define SN_IDLE_SLEEP_US    (10000 * 1000)      // idle this long before telling the gateway we sleep
+#define SN_POLL_MS          200
+#define SN_REG_MAX          8
+
+enum SN_BIT {
+	SN_BIT_ACTIVE   = (1 << 0),
+	SN_BIT_REGACK   = (1 << 1),
+	SN_BIT_PUBACK   = (1 << 2),
+};
+
+typedef enum {
+	SN_IDLE = 0,        // no socket; (re)connect when started and the backoff has passed
+	SN_CONNECTING,
+	SN_SUBSCRIBING,
+	SN_ACTIVE,
+	SN_ASLEEP,
+	SN_AWAKE,           // asleep, PINGREQ sent to collect buffered messages
+} sn_state_t;
+
+// Predefined topic ids, suffixes of domain.vmflow.xyz/<sub>/. The gateway holds the same
+// table per client id (tools/mqttsn-gateway.py); id 1 is the inbound <sub>.vmflow.xyz/rpc.
+#define SN_TOPIC_RPC        1
+
+static const char *s_predefined[] = {
+	[2] = "status",
+	[3] = "sale",
+	[4] = "vend_fail",
+	[5] = "paxcounter",
+	[6] = "uplink",
+	[7] = "rpc/info",
+	[8] = "rpc/dex",
+	[9] = "rpc/confirm",
+	[10] = "rpc/echo",
+};
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+static mqttsn_config_t s_cfg;
+static char s_prefix[48];
+
+static int s_sock = -1;
+static volatile sn_state_t s_state = SN_IDLE;
+static volatile bool s_started;
+static volatile bool s_wake_req;
+static volatile bool s_reconnect_req;
+static volatile bool s_busy;
+static bool s_up;
+static bool s_resume;
+static bool s_ping_pending;
+static uint8_t s_retries;
+static uint16_t s_msg_id;
+static uint16_t s_sub_msg_id;
+
+static int64_t s_deadline_us;
+static int64_t s_last_tx_us;
+static volatile int64_t s_last_pub_us;
+static int64_t s_connect_us;
+static uint32_t s_connect_fails;    // fresh connects in a row that got no session
+static int64_t s_down_us;
+static uint32_t s_handshake_start;
+
+static volatile uint16_t s_ack_msg_id;
+static volatile uint16_t s_ack_topic_id;
+static volatile uint8_t s_ack_rc;
+
+static struct {
+	char topic[64];
+	uint16_t id;
+} s_reg[SN_REG_MAX];
+
+static EventGroupHandle_t s_events;
+static SemaphoreHandle_t s_tx_lock;
+static SemaphoreHandle_t s_pub_lock;
+static TaskHandle_t s_task;
+static uint8_t s_tx_buf[SN_MAX_PACKET];
+static uint8_t s_rx_buf[SN_MAX_PACKET];
+
+static mqttsn_stats_t s_stats;
+
+static uint16_t sn_predefined_id(const char *topic) {
+	if (strcmp(topic, s_cfg.rpc_topic) == 0) return SN_TOPIC_RPC;
+
+	size_t n = strlen(s_prefix);
+	if (strncmp(topic, s_prefix, n) != 0) return 0;
+
+	for (int i = 0; i < sizeof(s_predefined) / sizeof(s_predefined[0]); i++) {
+		if (s_predefined[i] && strcmp(topic + n, s_predefined[i]) == 0) return i;
+	}
+	return 0;
+}
+
+static uint16_t sn_next_msg_id(void) {
+	if (++s_msg_id == 0) s_msg_id = 1;
+	return s_msg_id;
+}
+
+static bool sn_send(const mqttsn_packet_t *p) {
+	xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+
+	size_t n = mqttsn_encode(s_tx_buf, sizeof(s_tx_buf), p);
+	bool ok = n > 0 && s_sock >= 0 && send(s_sock, s_tx_buf, n, 0) == (int) n;
+
+	if (ok) {
+		s_stats.tx_bytes += n;
+		s_last_tx_us = esp_timer_get_time();
+	}
+
+	xSemaphoreGive(s_tx_lock);
+	return ok;
+}
+
+static bool sn_open(void) {
+	char port[8];
+	snprintf(port, sizeof(port), "%d", CONFIG_VMFLOW_MQTTSN_PORT);
+
+	struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+	struct addrinfo *res = NULL;
+
+	if (getaddrinfo(CONFIG_VMFLOW_MQTTSN_GATEWAY, port, &hints, &res) != 0 || res == NULL) {
+		ESP_LOGW(TAG, "cannot resolve %s", CONFIG_VMFLOW_MQTTSN_GATEWAY);
+		return false;
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock >= 0 && connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+		close(sock);
+		sock = -1;
+	}
+	freeaddrinfo(res);
+
+	xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+	s_sock = sock;
+	xSemaphoreGive(s_tx_lock);
+
+	return sock >= 0;
+}
+
+static void sn_close(void) {
+	xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+	if (s_sock >= 0) close(s_sock);
+	s_sock = -1;
+	xSemaphoreGive(s_tx_lock);
+}
+
+static void sn_send_connect(void) {
+	uint8_t flags = 0;
+	if (!s_resume) {
+		if (s_cfg.clean_session) flags |= MQTTSN_FLAG_CLEAN;
+		if (s_cfg.will_topic) flags |= MQTTSN_FLAG_WILL;
+	}
+
+	mqttsn_packet_t p = {
+		.type = MQTTSN_CONNECT,
+		.flags = flags,
+		.duration = CONFIG_VMFLOW_MQTTSN_KEEPALIVE,
+		.data = (const uint8_t *) s_cfg.client_id,
+		.data_len = strlen(s_cfg.client_id),
+	};
+	sn_send(&p);
+}
+
+static void sn_send_subscribe(void) {
+	mqttsn_packet_t p = {
+		.type = MQTTSN_SUBSCRIBE,
+		.flags = MQTTSN_FLAG_QOS1 | MQTTSN_TOPIC_PREDEFINED,
+		.msg_id = s_sub_msg_id,
+		.topic_id = SN_TOPIC_RPC,
+	};
+	sn_send(&p);
+}
+
+static void sn_send_pingreq(bool with_client_id) {
+	mqttsn_packet_t p = { .type = MQTTSN_PINGREQ };
+	if (with_client_id) {
+		p.data = (const uint8_t *) s_cfg.client_id;
+		p.data_len = strlen(s_cfg.client_id);
+	}
+	sn_send(&p);
+}
+
+static void sn_arm(sn_state_t state) {
+	s_state = state;
+	s_retries = 0;
+	s_deadline_us = esp_timer_get_time() + SN_T_RETRY_US;
+}
+
+static void sn_lost(int64_t backoff_us) {
+	sn_close();
+	s_state = SN_IDLE;
+	s_ping_pending = false;
+	s_deadline_us = esp_timer_get_time() + backoff_us;
+	xEventGroupClearBits(s_events, SN_BIT_ACTIVE);
+
+	if (s_up) {
+		s_up = false;
+		s_down_us = esp_timer_get_time();
+		ESP_LOGW(TAG, "session lost");
+		s_cfg.on_state(false);
+	}
+}
+
+// A fresh connect (not a wake-up) that got no session: no socket, refused, or no answer.
+static void sn_connect_failed(void) {
+	s_connect_fails++;
+	if (s_cfg.on_connect_failed) s_cfg.on_connect_failed(s_connect_fails);
+}
+
+static void sn_activate(void) {
+	int64_t now = esp_timer_get_time();
+	s_connect_fails = 0;
+
+	s_state = SN_ACTIVE;
+	s_retries = 0;
+	s_ping_pending = false;
+	s_last_pub_us = now;
+
+	s_stats.connects++;
+	if (s_resume) s_stats.wakes++;
+	s_stats.last_ready_ms = (uint32_t) ((now - s_connect_us) / 1000);
+	s_stats.last_handshake_bytes = s_stats.tx_bytes - s_handshake_start;
+
+	xEventGroupSetBits(s_events, SN_BIT_ACTIVE);
+
+	if (!s_up) {
+		s_stats.last_offline_ms = s_down_us ? (uint32_t) ((now - s_down_us) / 1000) : 0;
+		s_down_us = 0;
+		s_up = true;
+
+		ESP_LOGI(TAG, "active in %lu ms (offline %lu ms, %lu B sent)", (unsigned long) s_stats.last_ready_ms,
+			(unsigned long) s_stats.last_offline_ms, (unsigned long) s_stats.last_handshake_bytes);
+		s_cfg.on_state(true);
+	}
+}
+
+static void sn_begin_connect(bool resume) {
+	s_resume = resume;
+	s_connect_us = esp_timer_get_time();
+	s_handshake_start = s_stats.tx_bytes;
+
+	// Topic ids registered in a previous session are only valid if the gateway kept it.
+	if (!resume) memset(s_reg, 0, sizeof(s_reg));
+
+	sn_send_connect();
+	sn_arm(SN_CONNECTING);
+}
+
+static void sn_handle(const mqttsn_packet_t *p) {
+	switch (p->type) {
+	case MQTTSN_WILLTOPICREQ: {
+		mqttsn_packet_t r = {
+			.type = MQTTSN_WILLTOPIC,
+			.flags = MQTTSN_FLAG_QOS1 | MQTTSN_FLAG_RETAIN,
+			.data = (const uint8_t *) s_cfg.will_topic,
+			.data_len = strlen(s_cfg.will_topic),
+		};
+		sn_send(&r);
+		s_deadline_us = esp_timer_get_time() + SN_T_RETRY_US;
+		break;
+	}
+
+	case MQTTSN_WILLMSGREQ: {
+		mqttsn_packet_t r = {
+			.type = MQTTSN_WILLMSG,
+			.data = (const uint8_t *) s_cfg.will_msg,
+			.data_len = strlen(s_cfg.will_msg),
+		};
+		sn_send(&r);
+		s_deadline_us = esp_timer_get_time() + SN_T_RETRY_US;
+		break;
+	}
+
+	case MQTTSN_CONNACK:
+		if (s_state != SN_CONNECTING) break;
+
+		if (p->rc != MQTTSN_RC_ACCEPTED) {
+			ESP_LOGW(TAG, "connection refused: %u", p->rc);
+			sn_lost(SN_BACKOFF_US);
+			if (!s_resume) sn_connect_failed();
+		} else if (s_resume) {
+			// Waking from sleep: the gateway kept the session and its subscription.
+			sn_activate();
+		} else {
+			s_sub_msg_id = sn_next_msg_id();
+			sn_send_subscribe();
+			sn_arm(SN_SUBSCRIBING);
+		}
+		break;
+
+	case MQTTSN_SUBACK:
+		if (s_state == SN_SUBSCRIBING && p->msg_id == s_sub_msg_id) {
+			if (p->rc == MQTTSN_RC_ACCEPTED) sn_activate();
+			else ESP_LOGW(TAG, "RPC subscription refused: %u", p->rc);
+		}
+		break;
+
+	case MQTTSN_REGACK:
+	case MQTTSN_PUBACK:
+		s_ack_msg_id = p->msg_id;
+		s_ack_topic_id = p->topic_id;
+		s_ack_rc = p->rc;
+		xEventGroupSetBits(s_events, p->type == MQTTSN_REGACK ? SN_BIT_REGACK : SN_BIT_PUBACK);
+		break;
+
+	case MQTTSN_PUBLISH:
+		if (p->topic_id == SN_TOPIC_RPC && (p->flags & MQTTSN_TOPIC_TYPE_MASK) == MQTTSN_TOPIC_PREDEFINED) {
+			s_cfg.on_rpc((const char *) p->data, p->data_len);
+		}
+		if ((p->flags & MQTTSN_FLAG_QOS_MASK) == MQTTSN_FLAG_QOS1) {
+			mqttsn_packet_t r = { .type = MQTTSN_PUBACK, .topic_id = p->topic_id, .msg_id = p->msg_id, .rc = MQTTSN_RC_ACCEPTED };
+			sn_send(&r);
+		}
+		break;
+
+	case MQTTSN_PINGRESP:
+		if (s_state == SN_ACTIVE) {
+			s_ping_pending = false;
+			s_retries = 0;
+		} else if (s_state == SN_AWAKE) {
+			// Buffered messages (if any) arrived before this; back to sleep until the next poll.
+			s_state = SN_ASLEEP;
+			s_deadline_us = esp_timer_get_time() + (int64_t) CONFIG_VMFLOW_MQTTSN_SLEEP * 900 * 1000;
+		}
+		break;
+
+	case MQTTSN_DISCONNECT:
+		// Our own sleep request is acknowledged with DISCONNECT; anything else means the gateway dropped us.
+		if (s_state != SN_ASLEEP) sn_lost(0);
+		break;
+	}
+}
+
+static void sn_tick(void) {
+	int64_t now = esp_timer_get_time();
+
+	if (s_reconnect_req) {
+		s_reconnect_req = false;
+		if (s_state != SN_IDLE) sn_lost(0);
+	}
+
+	switch (s_state) {
+	case SN_IDLE:
+		if (!s_started || now < s_deadline_us) break;
+
+		if (sn_open()) {
+			sn_begin_connect(false);
+		} else {
+			s_deadline_us = now + SN_BACKOFF_US;
+			sn_connect_failed();
+		}
+		break;
+
+	case SN_CONNECTING:
+	case SN_SUBSCRIBING:
+	case SN_AWAKE:
+		if (now < s_deadline_us) break;
+
+		if (++s_retries > SN_N_RETRY) {
+			bool connecting = s_state == SN_SUBSCRIBING || (s_state == SN_CONNECTING && !s_resume);
+			sn_lost(SN_BACKOFF_US);
+			if (connecting) sn_connect_failed();
+			break;
+		}
+
+		s_stats.retries++;
+		s_deadline_us = now + SN_T_RETRY_US;
+
+		if (s_state == SN_CONNECTING) sn_send_connect();
+		else if (s_state == SN_SUBSCRIBING) sn_send_subscribe();
+		else sn_send_pingreq(true);
+		break;
+
+	case SN_ACTIVE:
+		if (s_ping_pending) {
+			if (now < s_deadline_us) break;
+			if (++s_retries > SN_N_RETRY) {
+				sn_lost(0);
+				break;
+			}
+			s_stats.retries++;
+			s_deadline_us = now + SN_T_RETRY_US;
+			sn_send_pingreq(false);
+
+		} else if (now - s_last_tx_us >= (int64_t) CONFIG_VMFLOW_MQTTSN_KEEPALIVE * 750 * 1000) {
+			s_ping_pending = true;
+			s_retries = 0;
+			s_deadline_us = now + SN_T_RETRY_US;
+			sn_send_pingreq(false);
+
+		} else if (CONFIG_VMFLOW_MQTTSN_SLEEP > 0 && !s_busy && now - s_last_pub_us >= SN_IDLE_SLEEP_US) {
+			mqttsn_packet_t p = { .type = MQTTSN_DISCONNECT, .duration = CONFIG_VMFLOW_MQTTSN_SLEEP };
+			xEventGroupClearBits(s_events, SN_BIT_ACTIVE);
+			s_state = SN_ASLEEP;
+			s_deadline_us = now + (int64_t) CONFIG_VMFLOW_MQTTSN_SLEEP * 900 * 1000;
+			s_stats.sleeps++;
+			sn_send(&p);
+		}
+		break;
+
+	case SN_ASLEEP:
+		if (s_wake_req) {
+			s_wake_req = false;
+			sn_begin_connect(true);
+		} else if (now >= s_deadline_us) {
+			sn_send_pingreq(true);
+			sn_arm(SN_AWAKE);
+		}
+		break;
+	}
+}
+
+static void mqttsn_task(void *arg) {
+	for (;;) {
+		sn_tick();
+
+		if (s_sock < 0) {
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SN_POLL_MS * 5));
+			continue;
+		}
+
+		fd_set rfds;
+		FD_ZERO(&rfds);
+		FD_SET(s_sock, &rfds);
+		struct timeval tv = { .tv_sec = 0, .tv_usec = SN_POLL_MS * 1000 };
+
+		if (select(s_sock + 1, &rfds, NULL, NULL, &tv) != 1) continue;
+
+		int n = recv(s_sock, s_rx_buf, sizeof(s_rx_buf), 0);
+		if (n <= 0) continue;
+
+		s_stats.rx_bytes += n;
+
+		mqttsn_packet_t p;
+		if (mqttsn_decode(s_rx_buf, n, &p)) sn_handle(&p);
+	}
+}
+
+static bool sn_wait_active(void) {
+	if (s_state == SN_ASLEEP || s_state == SN_AWAKE) {
+		s_wake_req = true;
+		xTaskNotifyGive(s_task);
+	}
+
+	EventBits_t bits = xEventGroupWaitBits(s_events, SN_BIT_ACTIVE, pdFALSE, pdTRUE, pdMS_TO_TICKS((SN_N_RETRY + 1) * SN_T_RETRY_US / 1000));
+	return bits & SN_BIT_ACTIVE;
+}
+
+// Send a QoS 0/1 request and wait for its ack (REGACK or PUBACK) with the spec's retry policy.
+static bool sn_request(mqttsn_packet_t *p, EventBits_t ack_bit) {
+	for (int attempt = 0; attempt <= SN_N_RETRY; attempt++) {
+		if (attempt > 0) {
+			s_stats.retries++;
+			if (p->type == MQTTSN_PUBLISH) p->flags |= MQTTSN_FLAG_DUP;
+		}
+
+		xEventGroupClearBits(s_events, ack_bit);
+		if (!sn_send(p)) return false;
+
+		int64_t deadline = esp_timer_get_time() + SN_T_RETRY_US;
+		for (;;) {
+			int64_t left_us = deadline - esp_timer_get_time();
+			if (left_us <= 0) break;
+
+			if (xEventGroupWaitBits(s_events, ack_bit, pdTRUE, pdTRUE, pdMS_TO_TICKS(left_us / 1000) + 1) & ack_bit) {
+				if (s_ack_msg_id == p->msg_id) return true;
+			}
+		}
+	}
+	return false;
+}
+
+static uint16_t sn_register(const char *topic) {
+	for (int i = 0; i < SN_REG_MAX; i++) {
+		if (s_reg[i].id && strcmp(s_reg[i].topic, topic) == 0) return s_reg[i].id;
+	}
+
+	mqttsn_packet_t p = {
+		.type = MQTTSN_REGISTER,
+		.msg_id = sn_next_msg_id(),
+		.data = (const uint8_t *) topic,
+		.data_len = strlen(topic),
+	};
+
+	if (!sn_request(&p, SN_BIT_REGACK) || s_ack_rc != MQTTSN_RC_ACCEPTED) return 0;
+
+	for (int i = 0; i < SN_REG_MAX; i++) {
+		if (s_reg[i].id == 0 && strlen(topic) < sizeof(s_reg[i].topic)) {
+			strcpy(s_reg[i].topic, topic);
+			s_reg[i].id = s_ack_topic_id;
+			break;
+		}
+	}
+	return s_ack_topic_id;
+}
+
+static void sn_forget(uint16_t topic_id) {
+	for (int i = 0; i < SN_REG_MAX; i++) {
+		if (s_reg[i].id == topic_id) s_reg[i].id = 0;
+	}
+}
+
+int mqttsn_publish(const char *topic, const char *data, int len, int qos, int retain) {
+	if (len <= 0) len = strlen(data);
+	if (len + 8 > SN_MAX_PACKET) {
+		ESP_LOGW(TAG, "%d B on %s does not fit a datagram", len, topic);
+		return -2;
+	}
+
+	xSemaphoreTake(s_pub_lock, portMAX_DELAY);
+	s_busy = true;
+
+	uint16_t topic_id = sn_predefined_id(topic);
+	bool ok = false;
+
+	mqttsn_packet_t p = {
+		.type = MQTTSN_PUBLISH,
+		.flags = (retain ? MQTTSN_FLAG_RETAIN : 0) | MQTTSN_TOPIC_PREDEFINED,
+		.topic_id = topic_id,
+		.data = (const uint8_t *) data,
+		.data_len = len,
+	};
+
+	if (qos == 0 && topic_id) {
+		// QoS -1: fire-and-forget on a predefined id, no connection or wake-up needed.
+		p.flags |= MQTTSN_FLAG_QOSM1;
+		ok = sn_send(&p);
+
+	} else if (sn_wait_active()) {
+		if (topic_id == 0) {
+			topic_id = sn_register(topic);
+			p.topic_id = topic_id;
+			p.flags = (p.flags & ~MQTTSN_TOPIC_TYPE_MASK) | MQTTSN_TOPIC_NORMAL;
+		}
+
+		if (topic_id) {
+			if (qos > 0) {
+				p.flags |= MQTTSN_FLAG_QOS1;
+				p.msg_id = sn_next_msg_id();
+				ok = sn_request(&p, SN_BIT_PUBACK) && s_ack_rc == MQTTSN_RC_ACCEPTED;
+				if (!ok && s_ack_rc == MQTTSN_RC_INVALID_TOPIC) sn_forget(topic_id);
+			} else {
+				ok = sn_send(&p);
+			}
+		}
+	}
+
+	s_last_pub_us = esp_timer_get_time();
+	s_busy = false;
+	xSemaphoreGive(s_pub_lock);
+
+	return ok ? 0 : -1;
+}
+
+void mqttsn_init(const mqttsn_config_t *cfg) {
+	s_cfg = *cfg;
+	snprintf(s_prefix, sizeof(s_prefix), "domain.vmflow.xyz/%s/", my_subdomain);
+
+	s_events = xEventGroupCreate();
+	s_tx_lock = xSemaphoreCreateMutex();
+	s_pub_lock = xSemaphoreCreateMutex();
+
+	xTaskCreatePinnedToCore(mqttsn_task, "mqtt_sn", 3072, NULL, 5, &s_task, 0);
+}
+
+void mqttsn_start(void) {
+	s_started = true;
+	xTaskNotifyGive(s_task);
+}
+
+void mqttsn_reconnect(void) {
+	s_reconnect_req = true;
+	xTaskNotifyGive(s_task);
+}
+
+void mqttsn_get_stats(mqttsn_stats_t *out) {
+	*out = s_stats;
+}
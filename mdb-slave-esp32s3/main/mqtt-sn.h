@@ -0,0 +1,55 @@
+/*
+ * mqtt_sn — MQTT-SN over UDP client, the low-airtime alternative to esp-mqtt.
+ *
+ * Intended for NB-IoT: no TCP handshake, one-datagram CONNECT, long keepalive,
+ * and the device's fixed topics use predefined topic ids so most publishes
+ * need no REGISTER. QoS 1 is used for money and control traffic; QoS 0
+ * publishes on a predefined topic go out as QoS -1, without a connection.
+ * With a sleep duration set, the client tells the gateway it is asleep when
+ * idle, polls for buffered RPCs with PINGREQ, and reconnects on the next
+ * publish. Used through mqtt_session; selected in menuconfig or NVS.
+ */
+#ifndef MQTT_SN_H
+#define MQTT_SN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+	const char *client_id;
+	const char *will_topic;     /* full topic; must have a predefined id */
+	const char *will_msg;
+	const char *rpc_topic;      /* inbound RPC topic; must have a predefined id */
+	bool clean_session;
+	void (*on_state)(bool connected);
+	void (*on_rpc)(const char *data, int len);
+	void (*on_connect_failed)(uint32_t in_a_row);  /* may be NULL; a connect got no session */
+} mqttsn_config_t;
+
+typedef struct {
+	uint32_t connects;          /* CONNACKs since boot, wake-ups included */
+	uint32_t wakes;             /* ... of which resumed a sleeping session */
+	uint32_t last_ready_ms;     /* CONNECT -> active */
+	uint32_t last_offline_ms;   /* link lost -> active */
+	uint32_t last_handshake_bytes;
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;
+	uint32_t retries;           /* retransmitted CONNECT/REGISTER/PUBLISH/SUBSCRIBE/PINGREQ */
+	uint32_t sleeps;
+} mqttsn_stats_t;
+
+void mqttsn_init(const mqttsn_config_t *cfg);
+
+/* Allow the client to connect (first link up). */
+void mqttsn_start(void);
+
+/* Drop the socket and reconnect, e.g. after the default route moved. */
+void mqttsn_reconnect(void);
+
+/* Publish on the calling task; QoS 1 blocks until PUBACK or retries run out.
+ * Returns 0 on success, -1 on failure, -2 if the message can never fit a datagram. */
+int mqttsn_publish(const char *topic, const char *data, int len, int qos, int retain);
+
+void mqttsn_get_stats(mqttsn_stats_t *out);
+
+#endif /* MQTT_SN_H */
@@ -9,50 +9,84 @@
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
 #include "nimble.h"
+#include <sdkconfig.h>
 #include <time.h>
 #include <esp_timer.h>
+#include "metrics.h"
+#include "trace.h"
+#include "pax-stats.h"
+#include "scan-sched.h"
+#include "ble-cmd.h"
+#include "beacon.h"
+#include "rpc-auth.h"
+
+#if !CONFIG_BT_NIMBLE_EXT_ADV
+#error "nimble.c advertises with extended advertising sets: enable CONFIG_BT_NIMBLE_EXT_ADV (sdkconfig.defaults)"
+#endif
+#include <esp_random.h>
 
 #define TAG "mdb_cashless"
 
+// Scan and PAX state below belong to the NimBLE host task: other tasks post to it (ble_scan_start/stop).
 static bool scanning = false;
 
-#define MAX_DEVICES             1024
+// The current PAX report window: one slot per scan, reported after the last.
+static pax_stats_t pax_stats;
+static uint8_t pax_slot;
 
-typedef struct {
-    uint8_t addr[6];
-} ble_device_t;
-
-typedef struct {
-    ble_device_t entries[MAX_DEVICES];
-    uint16_t count;
-    time_t count_begin_time;
-} ble_device_list_t;
+// How the current slot's scan runs (scan-sched.h), and the retry while it is paused.
+static scan_plan_t pax_plan;
+static uint32_t pax_scan_base_ms;
+static int64_t pax_scan_begin_us;
+static int64_t pax_slot_end_us;
+static struct ble_npl_callout pax_retry_callout;
+static struct ble_npl_event pax_start_ev, pax_stop_ev;
 
-ble_device_list_t ble_device_list = { 0 };
+_Static_assert(PAX_SLOTS * (uint64_t) PAX_SCAN_INTERVAL_US == PAX_REPORT_INTERVAL_SEC * 1000000ULL, "a PAX report window is PAX_SLOTS scans");
 
 // Variáveis globais
 static uint8_t own_addr_type;
-bool notify_state;
 uint16_t notification_handle;
-uint16_t conn_handle;
+
+// One entry per connected phone. Written by the host task (connect, subscribe, MTU, disconnect),
+// read by the ble_cmd worker and the MDB task: every access holds ble_conns_lock.
+typedef struct {
+    uint16_t handle;        /* BLE_HS_CONN_HANDLE_NONE = free entry */
+    uint16_t mtu;
+    bool notify;            /* subscribed to the characteristic */
+    bool owns_session;      /* started the MDB session in progress (0x02) */
+    bool phy_2m;
+    uint32_t nonce;         /* v2 frames are signed over it (ble-cmd.h) */
+    uint32_t seq;           /* last accepted v2 SEQ */
+} ble_conn_t;
+
+static ble_conn_t ble_conns[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+static uint8_t ble_conn_count;
+static bool ble_session_owned;  // the session in progress was started by a phone (which may have left)
+static portMUX_TYPE ble_conns_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert(BLE_CONN_NONE == BLE_HS_CONN_HANDLE_NONE, "nimble.h mirrors the NimBLE value");
 static bool ble_initialized = false;
 static TaskHandle_t ble_host_task_handle = NULL;
+static metric_t s_m_writes = METRIC_COUNTER("ble.writes");
+static metric_t s_m_conns = METRIC_GAUGE("ble.conns");
 
 // UUIDs
 static const ble_uuid128_t gatt_svr_svc_uuid = BLE_UUID128_INIT(0x02, 0x00, 0x12, 0xac, 0x42, 0x02, 0x78, 0xb8, 0xed, 0x11, 0xda, 0x46, 0x42, 0xc6, 0xbb, 0xb2);
 static const ble_uuid128_t gatt_svr_chr_uuid = BLE_UUID128_INIT(0x02, 0x00, 0x12, 0xac, 0x42, 0x02, 0x78, 0xb8, 0xed, 0x11, 0xde, 0x46, 0x76, 0x9c, 0xaf, 0xc9);
 
-// Buffer para dados da característica
-char characteristic_tosend_value[50] = "I am characteristic value";
-char characteristic_received_value[500];
-
 // Callback externo
-void (*ble_event_report_handler)(char*);
-void (*ble_pax_report_handler)(int devices_count);
+void (*ble_pax_report_handler)(uint32_t devices_count, const char *report);
 int gatt_svr_init(void);
 void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
 
 static int ble_gap_event_cb(struct ble_gap_event *event, void *arg);
+static ble_conn_t *ble_conn_find(uint16_t handle);
+static void pax_window_reset(void);
+static void pax_scan_retry_ev(struct ble_npl_event *ev);
+static void pax_scan_start_ev(struct ble_npl_event *ev);
+static void pax_scan_stop_ev(struct ble_npl_event *ev);
+static void pax_scan_stop(void);
 
 // Funções auxiliares
 static int ble_gatt_char_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len, void *dst, uint16_t *len) {
@@ -64,24 +98,60 @@ static int ble_gatt_char_write(struct os_mbuf *om, uint16_t min_len, uint16_t ma
     return ble_hs_mbuf_to_flat(om, dst, max_len, len);
 }
 
+static void ble_put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Hello v2 (ble-cmd.h), lido pelo app logo após conectar.
+static int ble_hello(uint16_t handle, uint8_t hello[BLE_V2_HELLO_LEN]) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = ble_conn_find(handle);
+    ble_conn_t copy = conn ? *conn : (ble_conn_t) { 0 };
+    taskEXIT_CRITICAL(&ble_conns_lock);
+
+    if (conn == NULL) return -1;
+
+    hello[0] = BLE_V2_MAGIC;
+    hello[1] = BLE_V2_VERSION;
+    ble_put_u32(&hello[2], copy.nonce);
+    hello[6] = copy.mtu >> 8;
+    hello[7] = copy.mtu;
+    hello[8] = (rpc_auth_has_key() ? BLE_V2_F_PROVISIONED : 0) | (copy.phy_2m ? BLE_V2_F_PHY_2M : 0);
+    return 0;
+}
+
 // Callback de acesso à característica
 static int ble_gatt_char_access_cb(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
 
     int rc;
 
     switch (ctxt->op) {
-    case BLE_GATT_ACCESS_OP_READ_CHR:
-        rc = os_mbuf_append(ctxt->om, characteristic_tosend_value, sizeof(characteristic_tosend_value));
+    case BLE_GATT_ACCESS_OP_READ_CHR: {
+        uint8_t hello[BLE_V2_HELLO_LEN];
+        if (ble_hello(conn_handle, hello) != 0) return BLE_ATT_ERR_UNLIKELY;
+
+        rc = os_mbuf_append(ctxt->om, hello, sizeof(hello));
         return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
 
-    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+    case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+        metric_inc(&s_m_writes);
 
-        memset(&characteristic_received_value, 0, sizeof(characteristic_received_value));
-        rc = ble_gatt_char_write(ctxt->om, 1, sizeof(characteristic_received_value) - 1, characteristic_received_value, NULL);
+        // Copy and hand over: the command runs on the ble_cmd worker, never on this task (ble-cmd.h).
+        uint8_t data[BLE_CMD_MSG_MAX];
+        uint16_t len;
+        rc = ble_gatt_char_write(ctxt->om, 1, sizeof(data), data, &len);
+        trace_emit(TRACE_BLE_WRITE, rc == 0 ? data[0] : 0, OS_MBUF_PKTLEN(ctxt->om));
 
-        ble_event_report_handler( (char*) &characteristic_received_value );
+        if (rc == 0) {
+            ble_cmd_submit(conn_handle, data, len);
+        }
 
         return rc;
+    }
 
     default:
         return BLE_ATT_ERR_UNLIKELY;
@@ -115,12 +185,42 @@ void ble_host_task(void *param) {
     vTaskDelete(NULL);
 }
 
-// Advertising
+// Advertising: instance 0 is the connectable legacy advertisement every phone sees,
+// instance 1 the extended, non-connectable status beacon (beacon.h).
+#define ADV_INSTANCE_CONN       0
+#define ADV_INSTANCE_BEACON     1
+
+static uint8_t beacon_data[BEACON_LEN];
+static uint8_t beacon_len;
+static bool beacon_configured;
+static bool ble_synced;
+
 static void ble_adv_start(void) {
-    struct ble_gap_adv_params adv_params;
+    struct ble_gap_ext_adv_params adv_params;
     struct ble_hs_adv_fields fields;
     const char *name;
 
+    if (!ble_synced || ble_gap_ext_adv_active(ADV_INSTANCE_CONN)) {
+        return;
+    }
+
+    memset(&adv_params, 0, sizeof(adv_params));
+    adv_params.connectable = 1;
+    adv_params.scannable = 1;
+    adv_params.legacy_pdu = 1;
+    adv_params.itvl_min = BLE_GAP_ADV_FAST_INTERVAL1_MIN;
+    adv_params.itvl_max = BLE_GAP_ADV_FAST_INTERVAL1_MAX;
+    adv_params.own_addr_type = own_addr_type;
+    adv_params.primary_phy = BLE_HCI_LE_PHY_1M;
+    adv_params.secondary_phy = BLE_HCI_LE_PHY_1M;
+    adv_params.tx_power = 127;  // sem preferência
+    adv_params.sid = ADV_INSTANCE_CONN;
+
+    int rc = ble_gap_ext_adv_configure(ADV_INSTANCE_CONN, &adv_params, NULL, ble_gap_event_cb, NULL);
+    if (rc != 0) {
+        return;
+    }
+
     memset(&fields, 0, sizeof(fields));
     fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
     fields.tx_pwr_lvl_is_present = 1;
@@ -131,30 +231,119 @@ static void ble_adv_start(void) {
     fields.name_len = strlen(name);
     fields.name_is_complete = 1;
 
-    int rc = ble_gap_adv_set_fields(&fields);
+    struct os_mbuf *om = os_msys_get_pkthdr(BLE_HS_ADV_MAX_SZ, 0);
+    if (om == NULL) {
+        return;
+    }
+
+    rc = ble_hs_adv_set_fields_mbuf(&fields, om);
     if (rc != 0) {
+        os_mbuf_free_chain(om);
         return;
     }
 
-    memset(&adv_params, 0, sizeof(adv_params));
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
-    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+    rc = ble_gap_ext_adv_set_data(ADV_INSTANCE_CONN, om);    // takes the mbuf
+    if (rc != 0) {
+        return;
+    }
 
-    ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &adv_params, ble_gap_event_cb, NULL);
+    ble_gap_ext_adv_start(ADV_INSTANCE_CONN, 0, 0);
+}
+
+// esp_timer task only (beacon.c): (re)load the beacon's data, configuring the set on first use.
+static void ble_beacon_refresh(void) {
+    struct ble_hs_adv_fields fields;
+
+    if (!ble_synced || beacon_len == 0) {
+        return;
+    }
+
+    if (!beacon_configured) {
+        struct ble_gap_ext_adv_params adv_params;
+        memset(&adv_params, 0, sizeof(adv_params));
+        adv_params.itvl_min = BLE_GAP_ADV_ITVL_MS(BEACON_ADV_ITVL_MS);
+        adv_params.itvl_max = BLE_GAP_ADV_ITVL_MS(BEACON_ADV_ITVL_MS);
+        adv_params.own_addr_type = own_addr_type;
+        adv_params.primary_phy = BLE_HCI_LE_PHY_1M;
+        adv_params.secondary_phy = BLE_HCI_LE_PHY_1M;
+        adv_params.tx_power = 127;
+        adv_params.sid = ADV_INSTANCE_BEACON;
+
+        if (ble_gap_ext_adv_configure(ADV_INSTANCE_BEACON, &adv_params, NULL, NULL, NULL) != 0) {
+            return;
+        }
+        beacon_configured = true;
+    }
+
+    // Beyond the 31 bytes of a legacy advertisement: the 128-bit service UUID lets an app filter the scan.
+    memset(&fields, 0, sizeof(fields));
+    fields.uuids128 = &gatt_svr_svc_uuid;
+    fields.num_uuids128 = 1;
+    fields.uuids128_is_complete = 1;
+    fields.mfg_data = beacon_data;
+    fields.mfg_data_len = beacon_len;
+
+    struct os_mbuf *om = os_msys_get_pkthdr(BLE_HS_ADV_MAX_SZ + BEACON_LEN, 0);
+    if (om == NULL) {
+        return;
+    }
+
+    if (ble_hs_adv_set_fields_mbuf(&fields, om) != 0) {
+        os_mbuf_free_chain(om);
+        return;
+    }
+
+    if (ble_gap_ext_adv_set_data(ADV_INSTANCE_BEACON, om) != 0) {
+        return;
+    }
+
+    if (!ble_gap_ext_adv_active(ADV_INSTANCE_BEACON)) {
+        ble_gap_ext_adv_start(ADV_INSTANCE_BEACON, 0, 0);
+    }
+}
+
+void ble_beacon_set(const uint8_t *data, uint8_t len) {
+    if (len > sizeof(beacon_data)) {
+        return;
+    }
+
+    memcpy(beacon_data, data, len);
+    beacon_len = len;
+
+    ble_beacon_refresh();
+}
+
+uint8_t ble_conn_slots_free(void) {
+    return CONFIG_BT_NIMBLE_MAX_CONNECTIONS - ble_conn_count;
 }
 
 // Callback de sincronização
 static void ble_on_sync_cb(void) {
     ble_hs_id_infer_auto(0, &own_addr_type);
+    ble_synced = true;
+    beacon_configured = false;  // a host reset dropped the advertising sets
     ble_adv_start();
+    beacon_refresh();           // re-signed and loaded on the esp_timer task
 }
 
 // Call this function to start BLE
-void ble_init(char *deviceName, void* ble_event_handler_, void* ble_pax_report_handler_){
-    ble_event_report_handler = ble_event_handler_;
+void ble_init(char *deviceName, void* ble_pax_report_handler_){
     ble_pax_report_handler = ble_pax_report_handler_;
 
+    metrics_register(&s_m_writes);
+    metrics_register(&s_m_conns);
+    pax_window_reset();
+
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        ble_conns[i].handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+
     nimble_port_init();
+
+    // Run on the host task, like the scan's own GAP events.
+    ble_npl_callout_init(&pax_retry_callout, nimble_port_get_dflt_eventq(), pax_scan_retry_ev, NULL);
+    ble_npl_event_init(&pax_start_ev, pax_scan_start_ev, NULL);
+    ble_npl_event_init(&pax_stop_ev, pax_scan_stop_ev, NULL);
     ble_hs_cfg.sync_cb = ble_on_sync_cb;
     ble_hs_cfg.gatts_register_cb = gatt_svr_register_cb;
 
@@ -165,6 +354,9 @@ void ble_init(char *deviceName, void* ble_event_handler_, void* ble_pax_report_h
     gatt_svr_init();
     ble_svc_gap_device_name_set(deviceName);
 
+    // MTU oferecido na troca iniciada em cada conexão: um frame v2 inteiro numa escrita.
+    ble_att_set_preferred_mtu(BLE_V2_MTU);
+
     nimble_port_freertos_init(ble_host_task);
     ble_initialized = true;
 }
@@ -177,7 +369,7 @@ void ble_set_device_name(char *deviceName) {
     ble_svc_gap_device_name_set(deviceName);
 
     // Opcional: reiniciar advertising para refletir o novo nome
-    ble_gap_adv_stop();   // para advertising atual
+    ble_gap_ext_adv_stop(ADV_INSTANCE_CONN);   // para advertising atual
     ble_adv_start();  // inicia advertising novamente com o novo nome
 }
 
@@ -197,27 +389,108 @@ int gatt_svr_init(void) {
     return ble_gatts_add_svcs(gatt_svr_svcs);
 }
 
+// Tabela de conexões; call with ble_conns_lock held.
+static ble_conn_t *ble_conn_find(uint16_t handle) {
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        if (ble_conns[i].handle == handle) {
+            return &ble_conns[i];
+        }
+    }
+    return NULL;
+}
+
+static void ble_conn_open(uint16_t handle) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = ble_conn_find(BLE_HS_CONN_HANDLE_NONE);
+    if (conn) {
+        *conn = (ble_conn_t) { .handle = handle, .mtu = BLE_ATT_MTU_DFLT, .nonce = esp_random() };
+        ble_conn_count++;
+    }
+    uint8_t count = ble_conn_count;
+    taskEXIT_CRITICAL(&ble_conns_lock);
+
+    metric_set(&s_m_conns, count);
+
+    // Link rápido: 2M PHY, pacotes longos (DLE) e MTU grande. Um telefone sem suporte recusa e fica em 1M/27/23.
+    ble_gap_set_prefered_le_phy(handle, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_CODED_ANY);
+    ble_gap_set_data_len(handle, BLE_V2_DATA_LEN, BLE_V2_DATA_TIME);
+    ble_gattc_exchange_mtu(handle, NULL, NULL);
+}
+
+static void ble_conn_close(uint16_t handle) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = ble_conn_find(handle);
+    if (conn) {
+        conn->handle = BLE_HS_CONN_HANDLE_NONE;     // a session it owned stays owned, by nobody
+        ble_conn_count--;
+    }
+    uint8_t count = ble_conn_count;
+    taskEXIT_CRITICAL(&ble_conns_lock);
+
+    metric_set(&s_m_conns, count);
+}
+
 // Eventos GAP
 static int ble_gap_event_cb(struct ble_gap_event *event, void *arg) {
     switch (event->type) {
     case BLE_GAP_EVENT_CONNECT:
-        if (event->connect.status != 0) {
+        trace_emit(TRACE_BLE_CONNECT, event->connect.conn_handle, event->connect.status);
+        if (event->connect.status == 0) {
+            ble_conn_open(event->connect.conn_handle);
+            pax_scan_stop();    // the phone's link gets the radio (scan-sched.h)
+        }
+        // Advertising stops on a connection: keep it going while there is room for another phone.
+        if (ble_conn_count < CONFIG_BT_NIMBLE_MAX_CONNECTIONS) {
+            ble_adv_start();
+        }
+        beacon_refresh();
+        break;
+
+    case BLE_GAP_EVENT_ADV_COMPLETE:
+        // The set ends when a phone connects; the CONNECT event may have seen it still active.
+        if (ble_conn_count < CONFIG_BT_NIMBLE_MAX_CONNECTIONS) {
             ble_adv_start();
         }
-        conn_handle = event->connect.conn_handle;
         break;
 
     case BLE_GAP_EVENT_DISCONNECT:
-        conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        trace_emit(TRACE_BLE_DISCONNECT, event->disconnect.conn.conn_handle, event->disconnect.reason);
+        ble_conn_close(event->disconnect.conn.conn_handle);
         ble_adv_start();
+        beacon_refresh();
         break;
 
     case BLE_GAP_EVENT_SUBSCRIBE:
         if (event->subscribe.attr_handle == notification_handle) {
-            notify_state = event->subscribe.cur_notify;
+            taskENTER_CRITICAL(&ble_conns_lock);
+            ble_conn_t *conn = ble_conn_find(event->subscribe.conn_handle);
+            if (conn) {
+                conn->notify = event->subscribe.cur_notify;
+            }
+            taskEXIT_CRITICAL(&ble_conns_lock);
         }
         break;
 
+    case BLE_GAP_EVENT_MTU: {
+        taskENTER_CRITICAL(&ble_conns_lock);
+        ble_conn_t *conn = ble_conn_find(event->mtu.conn_handle);
+        if (conn) {
+            conn->mtu = event->mtu.value;
+        }
+        taskEXIT_CRITICAL(&ble_conns_lock);
+        break;
+    }
+
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE: {
+        taskENTER_CRITICAL(&ble_conns_lock);
+        ble_conn_t *conn = ble_conn_find(event->phy_updated.conn_handle);
+        if (conn && event->phy_updated.status == 0) {
+            conn->phy_2m = event->phy_updated.tx_phy == BLE_HCI_LE_PHY_2M && event->phy_updated.rx_phy == BLE_HCI_LE_PHY_2M;
+        }
+        taskEXIT_CRITICAL(&ble_conns_lock);
+        break;
+    }
+
     default:
         break;
     }
@@ -225,35 +498,136 @@ static int ble_gap_event_cb(struct ble_gap_event *event, void *arg) {
     return 0;
 }
 
-// Envio de notificações
-void ble_notify_send(char *notification, int notification_length) {
-    if (!notify_state || !ble_initialized || conn_handle == BLE_HS_CONN_HANDLE_NONE) {
-        return;
+bool ble_conn_nonce(uint16_t handle, uint32_t *nonce) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = ble_conn_find(handle);
+    if (conn) {
+        *nonce = conn->nonce;
+    }
+    taskEXIT_CRITICAL(&ble_conns_lock);
+    return conn != NULL;
+}
+
+bool ble_conn_seq_advance(uint16_t handle, uint32_t seq) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = ble_conn_find(handle);
+    bool fresh = conn && seq > conn->seq;
+    if (fresh) {
+        conn->seq = seq;
     }
+    taskEXIT_CRITICAL(&ble_conns_lock);
+    return fresh;
+}
 
+static bool ble_notify_conn(uint16_t handle, const char *notification, int notification_length) {
     struct os_mbuf *om = ble_hs_mbuf_from_flat(notification, notification_length);
-    ble_gattc_notify_custom(conn_handle, notification_handle, om);
+    if (om == NULL) {
+        return false;   // sem mbufs: o host ainda está enviando as anteriores
+    }
+    return ble_gattc_notify_custom(handle, notification_handle, om) == 0;
 }
 
-void ble_device_list_add(ble_device_list_t *list, const uint8_t addr[6]){
+// Envio de notificações
+bool ble_notify_send(uint16_t handle, const char *notification, int notification_length) {
+    if (!ble_initialized) {
+        return false;
+    }
 
-    for (int i = 0; i < list->count; i++) {
-        if (memcmp(list->entries[i].addr, addr, 6) == 0) {
-            return;
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = ble_conn_find(handle);
+    bool send = conn && conn->notify && notification_length <= conn->mtu - 3;
+    taskEXIT_CRITICAL(&ble_conns_lock);
+
+    return send && ble_notify_conn(handle, notification, notification_length);
+}
+
+uint16_t ble_conn_mtu(uint16_t handle) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = ble_conn_find(handle);
+    uint16_t mtu = conn && conn->notify ? conn->mtu : 0;
+    taskEXIT_CRITICAL(&ble_conns_lock);
+    return mtu;
+}
+
+void ble_session_begin(uint16_t handle) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = handle != BLE_HS_CONN_HANDLE_NONE ? ble_conn_find(handle) : NULL;
+    if (conn) {
+        conn->owns_session = true;
+    }
+    ble_session_owned = handle != BLE_HS_CONN_HANDLE_NONE;
+    taskEXIT_CRITICAL(&ble_conns_lock);
+}
+
+void ble_session_end(void) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        ble_conns[i].owns_session = false;
+    }
+    ble_session_owned = false;
+    taskEXIT_CRITICAL(&ble_conns_lock);
+}
+
+bool ble_session_allows(uint16_t handle) {
+    taskENTER_CRITICAL(&ble_conns_lock);
+    ble_conn_t *conn = ble_conn_find(handle);
+    bool allowed = !ble_session_owned || (conn && conn->owns_session);
+    taskEXIT_CRITICAL(&ble_conns_lock);
+
+    return allowed;
+}
+
+void ble_notify_session(const char *notification, int notification_length) {
+    if (!ble_initialized) {
+        return;
+    }
+
+    // The owner only; every subscribed phone when the session came over MQTT; nobody if the owner left.
+    uint16_t targets[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    int n = 0;
+
+    taskENTER_CRITICAL(&ble_conns_lock);
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        ble_conn_t *conn = &ble_conns[i];
+        if (conn->handle == BLE_HS_CONN_HANDLE_NONE || !conn->notify || notification_length > conn->mtu - 3) {
+            continue;
+        }
+        if (ble_session_owned ? conn->owns_session : true) {
+            targets[n++] = conn->handle;
         }
     }
+    taskEXIT_CRITICAL(&ble_conns_lock);
+
+    for (int i = 0; i < n; i++) {
+        ble_notify_conn(targets[i], notification, notification_length);
+    }
+}
 
-    if (list->count >= MAX_DEVICES) {
+static void pax_window_reset(void) {
+    pax_stats_reset(&pax_stats, ((uint64_t) esp_random() << 32) | esp_random());
+    pax_slot = 0;
+}
+
+static void pax_scan_complete(uint32_t radio_ms) {
+    pax_stats_end_scan(&pax_stats, radio_ms);
+
+    if (++pax_slot < PAX_SLOTS) {
         return;
     }
 
-    ble_device_t *d = &list->entries[list->count++];
-    memcpy(d->addr, addr, 6);
+    uint32_t devices = pax_stats_unique(&pax_stats);
+    if (devices > 0) {
+        static char report[400];
+        pax_stats_format(&pax_stats, report, sizeof(report));
+        ble_pax_report_handler(devices, report);
+    }
+    scan_sched_record(devices, pax_stats_radio_ms(&pax_stats));
 
-    // printf("Device address: %02x:%02x:%02x:%02x:%02x:%02x\n", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+    pax_window_reset();
 }
 
-static int ble_scan_event_cb(struct ble_gap_event *event, void *arg) {
+// Count the advertiser if it looks like a phone.
+static void pax_offer(const uint8_t *data, uint8_t length_data, const uint8_t addr[6], int8_t rssi) {
 
     struct ble_hs_adv_fields fields;
 
@@ -268,55 +642,53 @@ static int ble_scan_event_cb(struct ble_gap_event *event, void *arg) {
 
     bool is_phone = 0;
 
-    switch (event->type) {
-    case BLE_GAP_EVENT_DISC:
-
-        // Parseia os dados de advertising
-        int rc = ble_hs_adv_parse_fields(&fields, event->disc.data, event->disc.length_data);
-        if (rc != 0) {
-            return 0;
-        }
-
-        // if(event->disc.rssi <= -85) break;
+    // Parseia os dados de advertising
+    int rc = ble_hs_adv_parse_fields(&fields, data, length_data);
+    if (rc != 0) {
+        return;
+    }
 
-        /* 1. Manufacturer Data */
-        if (fields.mfg_data_len >= 2) {
-            uint16_t cid = fields.mfg_data[1] << 8 | fields.mfg_data[0];
+    // if(rssi <= -85) return;
 
-            for (int i = 0; i < sizeof(PHONE_CID) / sizeof(PHONE_CID[0]); i++) {
-                if (cid == PHONE_CID[i]) {
-                    is_phone = true;
-                    break;
-                }
-            }
-        }
+    /* 1. Manufacturer Data */
+    if (fields.mfg_data_len >= 2) {
+        uint16_t cid = fields.mfg_data[1] << 8 | fields.mfg_data[0];
 
-        /* 2. Appearance */
-        if (fields.appearance_is_present) {
-            if (fields.appearance == 0x0040 /*Generic Phone*/ || fields.appearance == 0x0041 /*Generic Phone (variant)*/) {
+        for (int i = 0; i < sizeof(PHONE_CID) / sizeof(PHONE_CID[0]); i++) {
+            if (cid == PHONE_CID[i]) {
                 is_phone = true;
+                break;
             }
         }
+    }
 
-        if(is_phone){
-            ble_device_list_add(&ble_device_list, event->disc.addr.val);
+    /* 2. Appearance */
+    if (fields.appearance_is_present) {
+        if (fields.appearance == 0x0040 /*Generic Phone*/ || fields.appearance == 0x0041 /*Generic Phone (variant)*/) {
+            is_phone = true;
         }
+    }
 
-        time_t now = time(NULL);
-        if((now - ble_device_list.count_begin_time /*elapsed*/) > PAX_REPORT_INTERVAL_SEC){
+    if(is_phone){
+        pax_stats_add(&pax_stats, addr, rssi);
+    }
+}
 
-            if(ble_device_list.count > 0){
-                ble_pax_report_handler(ble_device_list.count);
-            }
+static int ble_scan_event_cb(struct ble_gap_event *event, void *arg) {
 
-            memset(&ble_device_list, 0, sizeof(ble_device_list));
-            ble_device_list.count_begin_time = time(NULL);
-        }
+    switch (event->type) {
+    case BLE_GAP_EVENT_DISC:
+        pax_offer(event->disc.data, event->disc.length_data, event->disc.addr.val, event->disc.rssi);
+    break;
 
+    // With extended advertising enabled the host scans with the extended commands (legacy reports included).
+    case BLE_GAP_EVENT_EXT_DISC:
+        pax_offer(event->ext_disc.data, event->ext_disc.length_data, event->ext_disc.addr.val, event->ext_disc.rssi);
     break;
 
     case BLE_GAP_EVENT_DISC_COMPLETE:
         scanning = false;
+        pax_scan_complete(scan_sched_done(&pax_plan, (esp_timer_get_time() - pax_scan_begin_us) / 1000));
     break;
 
     default:
@@ -326,39 +698,98 @@ static int ble_scan_event_cb(struct ble_gap_event *event, void *arg) {
     return 0;
 }
 
-void ble_scan_start(void *arg) {
+// One try at the current slot's scan; a paused scan is retried until the slot can no longer fit it.
+static void pax_scan_try(void) {
+    if (scanning) {
+        return;
+    }
+
+    scan_sched_plan(ble_conn_count > 0, pax_scan_base_ms, &pax_plan);
+
+    if (pax_plan.mode != SCAN_PAUSE) {
+        struct ble_gap_disc_params disc_params;
+        memset(&disc_params, 0, sizeof(disc_params));
+
+        // Configurações do scan
+        disc_params.filter_duplicates = 1;  // Filtra duplicatas
+        disc_params.passive = pax_plan.mode == SCAN_PASSIVE;
+        disc_params.itvl = BLE_GAP_SCAN_ITVL_MS(pax_plan.itvl_ms);
+        disc_params.window = BLE_GAP_SCAN_WIN_MS(pax_plan.window_ms);
+        disc_params.filter_policy = 0;      // Sem filtro
+        disc_params.limited = 0;            // Modo de descoberta geral
+
+        pax_stats_begin_scan(&pax_stats, pax_slot);
+        pax_scan_begin_us = esp_timer_get_time();
+
+        if (ble_gap_disc(own_addr_type, pax_plan.duration_ms, &disc_params, ble_scan_event_cb, NULL) == 0) {
+            scanning = true;
+            trace_emit(TRACE_BLE_SCAN, pax_plan.mode | pax_plan.boost << 8, pax_plan.window_ms * 100 / pax_plan.itvl_ms);
+            return;
+        }
+    }
+
+    trace_emit(TRACE_BLE_SCAN, SCAN_PAUSE, 0);
+
+    if (esp_timer_get_time() + PAX_SCAN_RETRY_US + pax_scan_base_ms * 1000LL < pax_slot_end_us) {
+        ble_npl_callout_reset(&pax_retry_callout, ble_npl_time_ms_to_ticks32(PAX_SCAN_RETRY_US / 1000));
+    } else {
+        pax_stats_begin_scan(&pax_stats, pax_slot);
+        pax_scan_complete(0);   // the slot stays empty
+    }
+}
+
+static void pax_scan_retry_ev(struct ble_npl_event *ev) {
+    pax_scan_try();
+}
+
+static void pax_scan_start_ev(struct ble_npl_event *ev) {
     if (scanning || esp_timer_get_time() < PAX_SCAN_INTERVAL_US) {
         return;
     }
 
-    int duration_seconds = (int) (uintptr_t) arg;
+    // The previous slot never found a quiet moment: close it empty.
+    if (ble_npl_callout_is_active(&pax_retry_callout)) {
+        ble_npl_callout_stop(&pax_retry_callout);
+        pax_stats_begin_scan(&pax_stats, pax_slot);
+        pax_scan_complete(0);
+    }
 
-    struct ble_gap_disc_params disc_params;
-    memset(&disc_params, 0, sizeof(disc_params));
+    pax_scan_base_ms = (uint32_t) (uintptr_t) ble_npl_event_get_arg(ev) * 1000;
+    pax_slot_end_us = esp_timer_get_time() + PAX_SCAN_INTERVAL_US;
 
-    // Configurações do scan
-    disc_params.filter_duplicates = 1;  // Filtra duplicatas
-    disc_params.passive = 0;            // Active scan (pode obter mais info)
-    disc_params.itvl = 0;               // Usa valores padrão
-    disc_params.window = 0;             // Usa valores padrão
-    disc_params.filter_policy = 0;      // Sem filtro
-    disc_params.limited = 0;            // Modo de descoberta geral
+    pax_scan_try();
+}
 
-    int rc = ble_gap_disc(own_addr_type, duration_seconds * 1000, &disc_params, ble_scan_event_cb, NULL);
+static void pax_scan_stop_ev(struct ble_npl_event *ev) {
+    pax_scan_stop();
+}
 
-    if (rc != 0) {
+// An event already queued is not queued again: a start posted twice runs once.
+void ble_scan_start(void *arg) {
+    if (!ble_initialized) {
         return;
     }
 
-    scanning = true;
+    ble_npl_event_set_arg(&pax_start_ev, arg);
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &pax_start_ev);
 }
 
-// Função para parar o scan
 void ble_scan_stop(void) {
+    if (!ble_initialized) {
+        return;
+    }
+
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &pax_stop_ev);
+}
+
+// Função para parar o scan
+static void pax_scan_stop(void) {
     if (!scanning) {
         return;
     }
 
     ble_gap_disc_cancel();
     scanning = false;
+    // A cancelled scan reports no DISC_COMPLETE.
+    pax_scan_complete(scan_sched_done(&pax_plan, (esp_timer_get_time() - pax_scan_begin_us) / 1000));
 }
\ No newline at end of file
@@ -1,14 +1,46 @@
 #ifndef NIMBLE_H
 #define NIMBLE_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #define PAX_REPORT_INTERVAL_SEC     (60*60)         // 1 hora
 #define PAX_SCAN_DURATION_SEC       (7)             // 7 segundos
 #define PAX_SCAN_INTERVAL_US        (5*60*1000000)  // 5 minutos
+#define PAX_SCAN_RETRY_US           (30*1000000)    // scan adiado (scan-sched.h): nova tentativa
+
+#define BLE_CONN_NONE               0xffff          // sem conexão (crédito via MQTT)
+
+// Notifica uma conexão, se ela assinou a característica. false: não enviada (sem assinatura,
+// maior que o MTU, ou sem buffers no host — tente de novo em seguida).
+bool ble_notify_send(uint16_t conn_handle, const char *notification, int notification_length);
+// MTU de uma conexão que assinou a característica; 0 se não está conectada ou não assinou.
+uint16_t ble_conn_mtu(uint16_t conn_handle);
+
+// Sessão MDB: as notificações de venda vão só para o telefone que iniciou a sessão (0x02).
+// conn_handle BLE_CONN_NONE: sessão via MQTT, notifica todos os telefones conectados.
+void ble_session_begin(uint16_t conn_handle);
+void ble_session_end(void);
+void ble_notify_session(const char *notification, int notification_length);
+// Um comando de sessão (0x03, 0x04) vindo desta conexão pode agir sobre a sessão atual?
+bool ble_session_allows(uint16_t conn_handle);
+
+#define BEACON_ADV_ITVL_MS          500             // beacon de status (beacon.h)
+
+// Conteúdo do beacon de status (manufacturer data); chamado só pela task do esp_timer.
+void ble_beacon_set(const uint8_t *data, uint8_t len);
+// Conexões GATT ainda disponíveis.
+uint8_t ble_conn_slots_free(void);
+
+// Frames v2 (ble-cmd.h): nonce aleatório da conexão, e SEQ que só avança (false: repetido ou antigo).
+bool ble_conn_nonce(uint16_t conn_handle, uint32_t *nonce);
+bool ble_conn_seq_advance(uint16_t conn_handle, uint32_t seq);
 
-void ble_notify_send(char *notification, int notification_length);
-void ble_init(char *deviceName, void* ble_event_handler_, void* ble_pax_event_handler_);
+void ble_init(char *deviceName, void* ble_pax_event_handler_);
 void ble_set_device_name(char *deviceName);
 
+// Scan PAX: postados na task do host NimBLE, dona do scan e da janela PAX; podem ser chamados de qualquer task.
+// arg de ble_scan_start: duração do scan em segundos.
 void ble_scan_start(void *arg);
 void ble_scan_stop(void);
 
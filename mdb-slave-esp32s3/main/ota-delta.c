@@ -0,0 +1,366 @@
+#include "ota-delta.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+#include <miniz.h>
+
+#define TAG "ota_delta"
+
+#define DELTA_MAGIC         "VMDP"
+#define DELTA_VERSION       1
+#define DELTA_HEADER_SIZE   80
+#define DELTA_RECORD_SIZE   12
+#define DELTA_CHUNK         4096        // HTTP read, source window and flash write size
+#define DELTA_MAX_REDIRECTS 5
+
+typedef enum {
+	DELTA_HEADER = 0,
+	DELTA_RECORD,
+	DELTA_ADD,
+	DELTA_EXTRA,
+	DELTA_DONE,
+} delta_state_t;
+
+typedef struct {
+	delta_state_t state;
+	uint8_t hdr[DELTA_HEADER_SIZE];
+	size_t hdr_len;
+	uint8_t rec[DELTA_RECORD_SIZE];
+	size_t rec_len;
+
+	bool deflate;
+	uint32_t src_size;
+	uint32_t new_size;
+	uint8_t new_sha[32];
+
+	uint32_t add_left;
+	uint32_t extra_left;
+	int32_t seek;
+	int64_t src_pos;            // read cursor in the running image
+	uint32_t written;           // bytes of the new image produced
+
+	const esp_partition_t *src;
+	const esp_partition_t *dst;
+	esp_ota_handle_t ota;
+	bool ota_open;
+
+	uint8_t *src_buf;           // window of the running image at src_buf_off
+	uint32_t src_buf_off;
+	size_t src_buf_len;
+	uint8_t *out_buf;
+	size_t out_len;
+	mbedtls_sha256_context sha;
+
+	tinfl_decompressor *inflator;
+	uint8_t *dict;              // inflate output ring, TINFL_LZ_DICT_SIZE bytes
+	size_t dict_pos;
+} delta_t;
+
+static uint32_t get_u32(const uint8_t *p) {
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static esp_err_t delta_flush(delta_t *d) {
+	if (d->out_len == 0) return ESP_OK;
+
+	mbedtls_sha256_update(&d->sha, d->out_buf, d->out_len);
+	esp_err_t err = esp_ota_write(d->ota, d->out_buf, d->out_len);
+	d->out_len = 0;
+	return err;
+}
+
+static esp_err_t delta_emit(delta_t *d, uint8_t b) {
+	d->out_buf[d->out_len++] = b;
+	d->written++;
+	return d->out_len == DELTA_CHUNK ? delta_flush(d) : ESP_OK;
+}
+
+static esp_err_t delta_src_byte(delta_t *d, uint8_t *out) {
+	uint32_t pos = (uint32_t) d->src_pos;
+	if (pos < d->src_buf_off || pos >= d->src_buf_off + d->src_buf_len) {
+		size_t n = d->src_size - pos < DELTA_CHUNK ? d->src_size - pos : DELTA_CHUNK;
+		esp_err_t err = esp_partition_read(d->src, pos, d->src_buf, n);
+		if (err != ESP_OK) return err;
+		d->src_buf_off = pos;
+		d->src_buf_len = n;
+	}
+	*out = d->src_buf[pos - d->src_buf_off];
+	d->src_pos++;
+	return ESP_OK;
+}
+
+// Hash the first src_size bytes of the running partition: the patch only applies to the image it was built from.
+static esp_err_t delta_check_source(delta_t *d, const uint8_t *want) {
+	mbedtls_sha256_context sha;
+	uint8_t got[32];
+
+	mbedtls_sha256_init(&sha);
+	mbedtls_sha256_starts(&sha, 0);
+	esp_err_t err = ESP_OK;
+	for (uint32_t off = 0; off < d->src_size && err == ESP_OK; off += DELTA_CHUNK) {
+		size_t n = d->src_size - off < DELTA_CHUNK ? d->src_size - off : DELTA_CHUNK;
+		err = esp_partition_read(d->src, off, d->src_buf, n);
+		if (err == ESP_OK) mbedtls_sha256_update(&sha, d->src_buf, n);
+	}
+	mbedtls_sha256_finish(&sha, got);
+	mbedtls_sha256_free(&sha);
+
+	if (err != ESP_OK) return err;
+	return memcmp(got, want, sizeof(got)) == 0 ? ESP_OK : ESP_ERR_INVALID_VERSION;
+}
+
+static esp_err_t delta_header(delta_t *d) {
+	const uint8_t *h = d->hdr;
+
+	if (memcmp(h, DELTA_MAGIC, 4) != 0 || h[4] != DELTA_VERSION || h[5] > 1) {
+		ESP_LOGE(TAG, "not a VMDP v%d patch", DELTA_VERSION);
+		return ESP_ERR_INVALID_RESPONSE;
+	}
+	d->deflate = h[5] == 1;
+	d->src_size = get_u32(h + 8);
+	d->new_size = get_u32(h + 12);
+	memcpy(d->new_sha, h + 48, sizeof(d->new_sha));
+
+	if (d->src_size > d->src->size || d->new_size > d->dst->size) {
+		ESP_LOGE(TAG, "patch sizes %lu -> %lu do not fit the partitions", (unsigned long) d->src_size, (unsigned long) d->new_size);
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	esp_err_t err = delta_check_source(d, h + 16);
+	if (err == ESP_ERR_INVALID_VERSION) ESP_LOGW(TAG, "running image is not the patch source");
+	if (err != ESP_OK) return err;
+
+	err = esp_ota_begin(d->dst, OTA_WITH_SEQUENTIAL_WRITES, &d->ota);
+	if (err != ESP_OK) return err;
+	d->ota_open = true;
+
+	if (d->deflate) {
+		d->inflator = malloc(sizeof(tinfl_decompressor));
+		d->dict = malloc(TINFL_LZ_DICT_SIZE);
+		if (d->inflator == NULL || d->dict == NULL) return ESP_ERR_NO_MEM;
+		tinfl_init(d->inflator);
+	}
+
+	ESP_LOGI(TAG, "patch %s, %lu B image from %lu B source", d->deflate ? "deflated" : "stored",
+			(unsigned long) d->new_size, (unsigned long) d->src_size);
+	d->state = DELTA_RECORD;
+	return ESP_OK;
+}
+
+static void delta_next_record(delta_t *d) {
+	d->src_pos += d->seek;
+	d->state = d->written == d->new_size ? DELTA_DONE : DELTA_RECORD;
+}
+
+// Apply inflated body bytes: records, add blocks and extra bytes.
+static esp_err_t delta_body(delta_t *d, const uint8_t *p, size_t len) {
+	esp_err_t err = ESP_OK;
+
+	while (len > 0 && err == ESP_OK) {
+		switch (d->state) {
+		case DELTA_RECORD:
+			d->rec[d->rec_len++] = *p++;
+			len--;
+			if (d->rec_len < DELTA_RECORD_SIZE) break;
+
+			d->rec_len = 0;
+			d->add_left = get_u32(d->rec);
+			d->extra_left = get_u32(d->rec + 4);
+			d->seek = (int32_t) get_u32(d->rec + 8);
+
+			if ((uint64_t) d->written + d->add_left + d->extra_left > d->new_size ||
+					d->src_pos < 0 || d->src_pos + d->add_left > d->src_size) {
+				ESP_LOGE(TAG, "record out of range at %lu", (unsigned long) d->written);
+				return ESP_ERR_INVALID_RESPONSE;
+			}
+			if (d->add_left) d->state = DELTA_ADD;
+			else if (d->extra_left) d->state = DELTA_EXTRA;
+			else delta_next_record(d);
+			break;
+
+		case DELTA_ADD:
+			for (; len > 0 && d->add_left > 0 && err == ESP_OK; len--, d->add_left--) {
+				uint8_t b;
+				err = delta_src_byte(d, &b);
+				if (err == ESP_OK) err = delta_emit(d, b + *p++);
+			}
+			if (d->add_left == 0) {
+				if (d->extra_left) d->state = DELTA_EXTRA;
+				else delta_next_record(d);
+			}
+			break;
+
+		case DELTA_EXTRA:
+			for (; len > 0 && d->extra_left > 0 && err == ESP_OK; len--, d->extra_left--) {
+				err = delta_emit(d, *p++);
+			}
+			if (d->extra_left == 0) delta_next_record(d);
+			break;
+
+		case DELTA_DONE:
+			return ESP_OK;      // trailing bytes after the last record are ignored
+
+		default:
+			return ESP_ERR_INVALID_STATE;
+		}
+	}
+	return err;
+}
+
+// Feed downloaded patch bytes: header first, then the body (inflated through the dictionary ring when deflated).
+static esp_err_t delta_feed(delta_t *d, const uint8_t *p, size_t len) {
+	if (d->state == DELTA_HEADER) {
+		size_t n = DELTA_HEADER_SIZE - d->hdr_len < len ? DELTA_HEADER_SIZE - d->hdr_len : len;
+		memcpy(d->hdr + d->hdr_len, p, n);
+		d->hdr_len += n;
+		p += n;
+		len -= n;
+		if (d->hdr_len < DELTA_HEADER_SIZE) return ESP_OK;
+
+		esp_err_t err = delta_header(d);
+		if (err != ESP_OK) return err;
+	}
+
+	if (!d->deflate) return delta_body(d, p, len);
+
+	for (;;) {
+		size_t in_sz = len;
+		size_t out_sz = TINFL_LZ_DICT_SIZE - d->dict_pos;
+		tinfl_status st = tinfl_decompress(d->inflator, p, &in_sz, d->dict, d->dict + d->dict_pos, &out_sz,
+				TINFL_FLAG_HAS_MORE_INPUT);
+		p += in_sz;
+		len -= in_sz;
+
+		if (out_sz > 0) {
+			esp_err_t err = delta_body(d, d->dict + d->dict_pos, out_sz);
+			if (err != ESP_OK) return err;
+			d->dict_pos = (d->dict_pos + out_sz) & (TINFL_LZ_DICT_SIZE - 1);
+		}
+
+		if (st < TINFL_STATUS_DONE) {
+			ESP_LOGE(TAG, "inflate failed (%d)", st);
+			return ESP_ERR_INVALID_RESPONSE;
+		}
+		if (st == TINFL_STATUS_DONE) return ESP_OK;
+		if (st == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0) return ESP_OK;
+	}
+}
+
+static esp_err_t delta_finish(delta_t *d) {
+	if (d->state != DELTA_DONE || d->written != d->new_size) {
+		ESP_LOGE(TAG, "patch truncated: %lu of %lu B", (unsigned long) d->written, (unsigned long) d->new_size);
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	esp_err_t err = delta_flush(d);
+	if (err != ESP_OK) return err;
+
+	uint8_t got[32];
+	mbedtls_sha256_finish(&d->sha, got);
+	if (memcmp(got, d->new_sha, sizeof(got)) != 0) {
+		ESP_LOGE(TAG, "rebuilt image hash mismatch");
+		return ESP_ERR_INVALID_CRC;
+	}
+
+	d->ota_open = false;
+	err = esp_ota_end(d->ota);          // also runs the image's own checksum and digest checks
+	if (err != ESP_OK) return err;
+
+	return esp_ota_set_boot_partition(d->dst);
+}
+
+// Open the URL, following GitHub's redirect to the release asset host.
+static esp_err_t delta_http_open(esp_http_client_handle_t client) {
+	for (int redirects = 0; ; redirects++) {
+		esp_err_t err = esp_http_client_open(client, 0);
+		if (err != ESP_OK) return err;
+
+		esp_http_client_fetch_headers(client);
+		int status = esp_http_client_get_status_code(client);
+
+		if (status >= 300 && status < 400 && redirects < DELTA_MAX_REDIRECTS) {
+			esp_http_client_set_redirection(client);
+			esp_http_client_flush_response(client, NULL);
+			esp_http_client_close(client);
+			continue;
+		}
+		if (status == 200) return ESP_OK;
+
+		ESP_LOGW(TAG, "HTTP %d", status);
+		return status == 404 ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+	}
+}
+
+esp_err_t ota_delta_update(const esp_http_client_config_t *http_cfg) {
+	delta_t *d = calloc(1, sizeof(delta_t));
+	uint8_t *buf = malloc(DELTA_CHUNK);
+	esp_http_client_handle_t client = NULL;
+	esp_err_t err = ESP_ERR_NO_MEM;
+
+	if (d == NULL || buf == NULL) goto out;
+
+	d->src = esp_ota_get_running_partition();
+	d->dst = esp_ota_get_next_update_partition(NULL);
+	d->src_buf = malloc(DELTA_CHUNK);
+	d->out_buf = malloc(DELTA_CHUNK);
+	mbedtls_sha256_init(&d->sha);
+	mbedtls_sha256_starts(&d->sha, 0);
+	if (d->src_buf == NULL || d->out_buf == NULL) goto out;
+
+	err = ESP_ERR_NOT_FOUND;
+	if (d->dst == NULL) goto out;
+
+	client = esp_http_client_init(http_cfg);
+	err = client ? delta_http_open(client) : ESP_FAIL;
+	if (err != ESP_OK) goto out;
+
+	ESP_LOGI(TAG, "applying %s to %s", http_cfg->url, d->dst->label);
+
+	uint32_t received = 0, logged = 0;
+	for (;;) {
+		int n = esp_http_client_read(client, (char *) buf, DELTA_CHUNK);
+		if (n < 0) {
+			err = ESP_FAIL;
+			break;
+		}
+		if (n == 0) {
+			err = esp_http_client_is_complete_data_received(client) ? delta_finish(d) : ESP_ERR_INVALID_SIZE;
+			break;
+		}
+
+		err = delta_feed(d, buf, n);
+		if (err != ESP_OK) break;
+
+		received += n;
+		if (received - logged >= 64 * 1024) {
+			ESP_LOGI(TAG, "%lu B patch -> %lu / %lu B image", (unsigned long) received,
+					(unsigned long) d->written, (unsigned long) d->new_size);
+			logged = received;
+		}
+	}
+
+	if (err == ESP_OK) {
+		ESP_LOGI(TAG, "installed %lu B image from %lu B patch", (unsigned long) d->new_size, (unsigned long) received);
+	}
+
+out:
+	if (client) {
+		esp_http_client_close(client);
+		esp_http_client_cleanup(client);
+	}
+	if (d) {
+		if (d->ota_open) esp_ota_abort(d->ota);
+		mbedtls_sha256_free(&d->sha);
+		free(d->inflator);
+		free(d->dict);
+		free(d->src_buf);
+		free(d->out_buf);
+		free(d);
+	}
+	free(buf);
+	return err;
+}
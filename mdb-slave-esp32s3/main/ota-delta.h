@@ -0,0 +1,25 @@
+/*
+ * ota_delta — delta OTA: rebuild the new app image from the running one.
+ *
+ * Downloads a patch made by tools/ota-delta.py and applies it as it streams
+ * in: the body is inflated with the ROM miniz, add blocks combine patch bytes
+ * with bytes read from the running partition, and the result is written to
+ * the next OTA slot. The running image is hashed before anything is written
+ * and the rebuilt image after; the boot partition only changes when both
+ * match the patch header. See tools/ota-delta.py for the patch format.
+ */
+#ifndef OTA_DELTA_H
+#define OTA_DELTA_H
+
+#include <esp_err.h>
+#include <esp_http_client.h>
+
+/* Download the patch at http_cfg->url, install it into the inactive slot and
+ * make that slot the boot partition. Does not reboot. Errors include
+ * ESP_ERR_NOT_FOUND (no patch published for this version), ESP_ERR_INVALID_VERSION
+ * (the running image is not the patch's source) and ESP_ERR_INVALID_CRC (the
+ * rebuilt image does not hash to the expected value); on any error the slot
+ * is left unbootable and the caller can fall back to the full image. */
+esp_err_t ota_delta_update(const esp_http_client_config_t *http_cfg);
+
+#endif /* OTA_DELTA_H */
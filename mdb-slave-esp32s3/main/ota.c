@@ -0,0 +1,334 @@
+#include "ota.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_app_desc.h>
+#include <esp_ota_ops.h>
+#include <esp_https_ota.h>
+#include <esp_http_client.h>
+#include <esp_crt_bundle.h>
+#include <nvs_flash.h>
+
+#include "mqtt-outbox.h"
+#include "ota-delta.h"
+
+#define TAG "ota"
+
+#define OTA_RELEASES_URL        "https://github.com/nodestark/mdb-esp32-cashless/releases/"
+#define OTA_REQUEST_SIZE        (64 * 1024)     // one Range request; a drop loses at most this much
+#define OTA_CHECKPOINT_BYTES    (32 * 1024)     // NVS write interval
+#define OTA_SECTOR              4096            // checkpoints are sector-aligned, so a resume never re-erases written data
+#define OTA_REPORT_US           (30 * 1000 * 1000LL)
+#define OTA_MAX_STALLS          5               // attempts in a row without progress before giving up
+#define OTA_RETRY_MS            10000           // x stalls, capped at OTA_RETRY_MAX_MS
+#define OTA_RETRY_MAX_MS        60000
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+static ota_stats_t s_stats;
+static char s_base[128];        // release download URL, ending in '/'
+static char s_corr[9];
+
+static int64_t s_report_us;
+static uint32_t s_report_bytes;
+static int s_report_pct;
+
+static void ota_report(const char *fmt, ...) {
+	char topic[64], msg[96], line[112];
+
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	snprintf(line, sizeof(line), "%s:%s", msg, s_corr);
+	snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/rpc/ota", my_subdomain);
+	mqtt_outbox_publish(OUTBOX_CONTROL, topic, line, 0, 0);
+	ESP_LOGI(TAG, "%s", line);
+}
+
+// Progress at every 10% step or OTA_REPORT_US, whichever comes first; throughput since the last report.
+static void ota_progress(bool force) {
+	int64_t now = esp_timer_get_time();
+	int pct = s_stats.total ? (int) ((uint64_t) s_stats.bytes * 100 / s_stats.total) : 0;
+
+	if (!force && pct / 10 == s_report_pct / 10 && now - s_report_us < OTA_REPORT_US) return;
+
+	uint32_t bps = now > s_report_us ? (uint32_t) ((uint64_t) (s_stats.bytes - s_report_bytes) * 1000000 / (now - s_report_us)) : 0;
+	ota_report("download,%d,%lu,%lu,%lu", pct, (unsigned long) s_stats.bytes, (unsigned long) s_stats.total, (unsigned long) bps);
+
+	s_report_us = now;
+	s_report_bytes = s_stats.bytes;
+	s_report_pct = pct;
+}
+
+// Resume offset for url, or 0 when the checkpoint belongs to another download.
+static uint32_t ota_checkpoint_load(const char *url) {
+	nvs_handle_t handle;
+	uint32_t offset = 0;
+	char saved[192];
+	size_t len = sizeof(saved);
+
+	if (nvs_open("vmflow", NVS_READONLY, &handle) != ESP_OK) return 0;
+	if (nvs_get_str(handle, "ota_url", saved, &len) == ESP_OK && strcmp(saved, url) == 0) {
+		nvs_get_u32(handle, "ota_off", &offset);
+	}
+	nvs_close(handle);
+	return offset;
+}
+
+static void ota_checkpoint_save(const char *url, uint32_t offset) {
+	nvs_handle_t handle;
+	if (nvs_open("vmflow", NVS_READWRITE, &handle) != ESP_OK) return;
+
+	if (url) {
+		nvs_set_str(handle, "ota_url", url);
+		nvs_set_u32(handle, "ota_off", offset);
+	} else {
+		nvs_erase_key(handle, "ota_url");
+		nvs_erase_key(handle, "ota_off");
+	}
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
+// Remember which version was installed and for which request, to report the health check after the reboot.
+static void ota_pending_save(const char *version) {
+	nvs_handle_t handle;
+	if (nvs_open("vmflow", NVS_READWRITE, &handle) != ESP_OK) return;
+
+	if (version) {
+		nvs_set_str(handle, "ota_ver", version);
+		nvs_set_str(handle, "ota_corr", s_corr);
+	} else {
+		nvs_erase_key(handle, "ota_ver");
+		nvs_erase_key(handle, "ota_corr");
+	}
+	nvs_commit(handle);
+	nvs_close(handle);
+}
+
+// One esp_https_ota session from *offset; advances *offset to the last sector-aligned byte written.
+static esp_err_t ota_download_once(const char *url, esp_http_client_config_t *http_cfg, uint32_t *offset) {
+	esp_https_ota_config_t ota_cfg = {
+		.http_config = http_cfg,
+		.partial_http_download = true,
+		.max_http_request_size = OTA_REQUEST_SIZE,
+		.ota_resumption = *offset > 0,
+		.ota_image_bytes_written = *offset,
+	};
+
+	esp_https_ota_handle_t h = NULL;
+	esp_err_t err = esp_https_ota_begin(&ota_cfg, &h);
+	if (err != ESP_OK) return err;
+
+	if (*offset == 0) ota_checkpoint_save(url, 0);
+	s_stats.resumed_from = *offset;
+
+	int size = esp_https_ota_get_image_size(h);
+	if (size > 0) s_stats.total = size;
+
+	while ((err = esp_https_ota_perform(h)) == ESP_ERR_HTTPS_OTA_IN_PROGRESS) {
+		s_stats.bytes = esp_https_ota_get_image_len_read(h);
+
+		uint32_t aligned = s_stats.bytes & ~(OTA_SECTOR - 1);
+		if (aligned >= *offset + OTA_CHECKPOINT_BYTES) {
+			*offset = aligned;
+			ota_checkpoint_save(url, aligned);
+		}
+		ota_progress(false);
+	}
+
+	if (err == ESP_OK && !esp_https_ota_is_complete_data_received(h)) err = ESP_ERR_INVALID_SIZE;
+	if (err != ESP_OK) {
+		// Everything read so far is already in flash; resume from it.
+		uint32_t aligned = (uint32_t) esp_https_ota_get_image_len_read(h) & ~(OTA_SECTOR - 1);
+		if (aligned > *offset) {
+			*offset = aligned;
+			ota_checkpoint_save(url, aligned);
+		}
+		esp_https_ota_abort(h);
+		return err;
+	}
+
+	s_stats.bytes = s_stats.total;
+	ota_progress(true);
+	return esp_https_ota_finish(h);     // validates the image, then sets the boot partition
+}
+
+// Full image with Range resume: retries until OTA_MAX_STALLS attempts in a row make no progress.
+static esp_err_t ota_download(const char *url, esp_http_client_config_t *http_cfg) {
+	uint32_t offset = ota_checkpoint_load(url);
+	int stalls = 0;
+
+	if (offset) ota_report("resume,%lu", (unsigned long) offset);
+
+	for (;;) {
+		uint32_t start = offset;
+		s_stats.attempts++;
+
+		esp_err_t err = ota_download_once(url, http_cfg, &offset);
+		if (err == ESP_OK) {
+			ota_checkpoint_save(NULL, 0);
+			return ESP_OK;
+		}
+
+		if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
+			// Bad image: possibly a resume across two different builds behind the same URL. Start over once.
+			ota_checkpoint_save(NULL, 0);
+			if (start == 0) return err;
+			offset = 0;
+			continue;
+		}
+
+		stalls = offset > start ? 0 : stalls + 1;
+		if (stalls >= OTA_MAX_STALLS) return err;
+
+		int delay_ms = OTA_RETRY_MS * (stalls + 1);
+		if (delay_ms > OTA_RETRY_MAX_MS) delay_ms = OTA_RETRY_MAX_MS;
+
+		ota_report("retry,%lu,%lu,%s", (unsigned long) s_stats.attempts, (unsigned long) offset, esp_err_to_name(err));
+		vTaskDelay(pdMS_TO_TICKS(delay_ms));
+	}
+}
+
+static void ota_task(void *arg) {
+	char url[192];
+
+	esp_http_client_config_t http_cfg = {
+		.url = url,
+		.crt_bundle_attach = esp_crt_bundle_attach,  // GitHub redirects to release-assets.githubusercontent.com (S3)
+		.timeout_ms = 30000,
+		.keep_alive_enable = true,
+		// The S3 redirect target is a ~900-char signed URL; the default 512 B tx buffer can't hold the request line, yielding "HTTP_CLIENT: Out of buffer".
+		.buffer_size = 2048,
+		.buffer_size_tx = 4096,
+	};
+
+	int64_t t0 = esp_timer_get_time();
+	s_report_us = t0;
+	s_report_bytes = 0;
+	s_report_pct = 0;
+
+	esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+#if CONFIG_VMFLOW_OTA_DELTA
+	// Patches are small and not resumable; skip them when a full download is half done.
+	const esp_app_desc_t *app = esp_app_get_description();
+	snprintf(url, sizeof(url), "%smdb-slave-esp32s3.bin", s_base);
+	if (ota_checkpoint_load(url) == 0) {
+		snprintf(url, sizeof(url), "%smdb-slave-esp32s3-%s.patch", s_base, app->version);
+		ota_report("delta,%s", app->version);
+		err = ota_delta_update(&http_cfg);
+		if (err != ESP_OK) ESP_LOGW(TAG, "Delta OTA failed (%s), pulling the full image", esp_err_to_name(err));
+	}
+#endif
+
+	if (err != ESP_OK) {
+		snprintf(url, sizeof(url), "%smdb-slave-esp32s3.bin", s_base);
+		err = ota_download(url, &http_cfg);
+	}
+
+	s_stats.last_err = err;
+	if (err == ESP_OK) {
+		esp_app_desc_t desc;
+		const char *version = "?";
+		if (esp_ota_get_partition_description(esp_ota_get_boot_partition(), &desc) == ESP_OK) version = desc.version;
+
+		ota_pending_save(version);
+		ota_report("done,%s,%lu", version, (unsigned long) ((esp_timer_get_time() - t0) / 1000000));
+		ESP_LOGW(TAG, "OTA success, rebooting into %s", version);
+		vTaskDelay(pdMS_TO_TICKS(2000));   // let the outbox send the report
+		esp_restart();
+	}
+
+	ota_report("error,%s", esp_err_to_name(err));
+	s_stats.running = false;
+	vTaskDelete(NULL);
+}
+
+esp_err_t ota_start(const char *tag, const char *corr) {
+	if (s_stats.running) return ESP_ERR_INVALID_STATE;
+	if (s_stats.pending_verify) return ESP_ERR_OTA_ROLLBACK_INVALID_STATE;
+
+	if (tag)
+		snprintf(s_base, sizeof(s_base), OTA_RELEASES_URL "download/%s/", tag);
+	else
+		snprintf(s_base, sizeof(s_base), OTA_RELEASES_URL "latest/download/");
+	snprintf(s_corr, sizeof(s_corr), "%s", corr ? corr : "");
+
+	s_stats.running = true;
+	s_stats.bytes = s_stats.total = s_stats.resumed_from = s_stats.attempts = 0;
+
+	ESP_LOGW(TAG, "OTA from %s", s_base);
+	if (xTaskCreate(ota_task, "ota_task", 8192, NULL, 5, NULL) != pdPASS) {
+		s_stats.running = false;
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+static struct {
+	EventGroupHandle_t status;
+	EventBits_t healthy;
+	char version[32];           // version the last update installed, from NVS
+} s_health;
+
+static void ota_health_task(void *arg) {
+	const char *running = esp_app_get_description()->version;
+
+	if (s_stats.pending_verify) {
+		ESP_LOGW(TAG, "new image %s pending verification", running);
+
+		EventBits_t bits = xEventGroupWaitBits(s_health.status, s_health.healthy, pdFALSE, pdTRUE,
+				pdMS_TO_TICKS(CONFIG_VMFLOW_OTA_HEALTH_TIMEOUT * 1000));
+
+		if ((bits & s_health.healthy) != s_health.healthy) {
+			// The old image reports the rollback after the reboot (ota_ver != running version).
+			ESP_LOGE(TAG, "health check timed out, rolling back");
+			esp_ota_mark_app_invalid_rollback_and_reboot();
+		}
+
+		esp_ota_mark_app_valid_cancel_rollback();
+		s_stats.pending_verify = false;
+	}
+
+	if (s_health.version[0]) {
+		ota_report(strcmp(s_health.version, running) == 0 ? "valid,%s" : "rollback,%s", s_health.version);
+		ota_pending_save(NULL);
+	}
+	vTaskDelete(NULL);
+}
+
+void ota_health_check(EventGroupHandle_t status, EventBits_t healthy) {
+	esp_ota_img_states_t state;
+
+	s_health.status = status;
+	s_health.healthy = healthy;
+
+	s_stats.pending_verify = esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+			state == ESP_OTA_IMG_PENDING_VERIFY;
+
+	nvs_handle_t handle;
+	if (nvs_open("vmflow", NVS_READONLY, &handle) == ESP_OK) {
+		size_t len = sizeof(s_health.version);
+		nvs_get_str(handle, "ota_ver", s_health.version, &len);
+		len = sizeof(s_corr);
+		nvs_get_str(handle, "ota_corr", s_corr, &len);
+		nvs_close(handle);
+	}
+
+	if (!s_stats.pending_verify && s_health.version[0] == '\0') return;
+
+	xTaskCreate(ota_health_task, "ota_health", 3072, NULL, 5, NULL);
+}
+
+void ota_get_stats(ota_stats_t *out) {
+	*out = s_stats;
+}
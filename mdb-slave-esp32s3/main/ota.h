@@ -0,0 +1,46 @@
+/*
+ * ota — resumable firmware update with progress reports and rollback.
+ *
+ * The ota RPC starts a task that first tries a delta patch (ota-delta.c) and
+ * otherwise downloads the full release image with esp_https_ota in HTTP Range
+ * requests. The written offset is checkpointed in NVS, so a dropped
+ * connection, or a reboot followed by the same ota RPC, resumes where it
+ * stopped instead of starting again from byte 0. Progress, retries and the
+ * result are published on domain.vmflow.xyz/<sub>/rpc/ota.
+ *
+ * A new image boots pending verification. ota_health_check() marks it valid
+ * once the status bits it is given are all set (MQTT connected, and the VMC
+ * has enabled the reader), or rolls back to the previous image on timeout.
+ */
+#ifndef OTA_H
+#define OTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+
+typedef struct {
+	bool running;
+	bool pending_verify;        /* this image has not passed its health check yet */
+	uint32_t bytes;             /* image bytes written by the current / last download */
+	uint32_t total;
+	uint32_t resumed_from;      /* offset the last download resumed at, 0 if fresh */
+	uint32_t attempts;
+	esp_err_t last_err;
+} ota_stats_t;
+
+/* Start the OTA task for a release tag (NULL = latest). corr is echoed in every
+ * progress report. ESP_ERR_INVALID_STATE if an update is already running. */
+esp_err_t ota_start(const char *tag, const char *corr);
+
+/* Call once at boot. If this image is pending verification, wait until all of
+ * `healthy` are set in `status`, then mark it valid, or roll back and reboot
+ * after CONFIG_VMFLOW_OTA_HEALTH_TIMEOUT seconds. Also reports the outcome of
+ * the update that led to this boot on .../rpc/ota. */
+void ota_health_check(EventGroupHandle_t status, EventBits_t healthy);
+
+void ota_get_stats(ota_stats_t *out);
+
+#endif /* OTA_H */
@@ -0,0 +1,91 @@
+#include "pax-set.h"
+
+#include <string.h>
+#include <math.h>
+
+#define PAX_SET_MAX     (PAX_SET_SLOTS * 3 / 4)
+
+_Static_assert((PAX_SET_SLOTS & (PAX_SET_SLOTS - 1)) == 0, "PAX_SET_SLOTS must be a power of two");
+
+// SplitMix64 finalizer over the salted address: every input bit reaches every output bit.
+uint64_t pax_set_hash(uint64_t salt, const uint8_t addr[6]) {
+	uint64_t x = salt;
+	for (int i = 0; i < 6; i++) x ^= (uint64_t) addr[i] << (8 * i);
+
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	// A second round keyed by the salt again, so the salt is not a plain XOR on the input.
+	x ^= salt >> 17;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+void pax_set_reset(pax_set_t *s, uint64_t salt) {
+	memset(s, 0, sizeof(*s));
+	s->salt = salt;
+}
+
+static void pax_hll_add(pax_set_t *s, uint64_t h) {
+	uint32_t index = (uint32_t) (h >> (64 - PAX_HLL_BITS));
+	uint64_t rest = h << PAX_HLL_BITS;
+
+	// Rank: position of the first 1 bit in the remaining 55 bits.
+	uint8_t rank = rest ? (uint8_t) (__builtin_clzll(rest) + 1) : (64 - PAX_HLL_BITS + 1);
+	if (rank > s->reg[index]) s->reg[index] = rank;
+}
+
+bool pax_set_add(pax_set_t *s, const uint8_t addr[6]) {
+	return pax_set_add_hash(s, pax_set_hash(s->salt, addr));
+}
+
+bool pax_set_add_hash(pax_set_t *s, uint64_t h) {
+	pax_hll_add(s, h);
+
+	if (s->full) return false;
+
+	// Bits 32-40 pick the slot and the low word is the fingerprint; the sketch used the top bits.
+	uint32_t fp = (uint32_t) h | 1;
+	uint32_t i = (uint32_t) (h >> 32) & (PAX_SET_SLOTS - 1);
+
+	for (;;) {
+		if (s->slot[i] == fp) return false;
+		if (s->slot[i] == 0) break;
+		i = (i + 1) & (PAX_SET_SLOTS - 1);
+	}
+
+	if (s->count >= PAX_SET_MAX) {
+		s->full = true;
+		return false;
+	}
+
+	s->slot[i] = fp;
+	s->count++;
+	return true;
+}
+
+uint32_t pax_set_count(const pax_set_t *s) {
+	if (!s->full) return s->count;
+
+	const float m = PAX_HLL_REGISTERS;
+	float sum = 0;
+	int zeros = 0;
+
+	for (int i = 0; i < PAX_HLL_REGISTERS; i++) {
+		sum += ldexpf(1.0f, -s->reg[i]);
+		if (s->reg[i] == 0) zeros++;
+	}
+
+	float estimate = 0.7213f / (1.0f + 1.079f / m) * m * m / sum;
+
+	// Small-range correction: linear counting while registers are still empty.
+	if (estimate <= 2.5f * m && zeros > 0) estimate = m * logf(m / zeros);
+
+	// The set held this many distinct addresses exactly when it filled up.
+	if (estimate < s->count) estimate = s->count;
+
+	return (uint32_t) (estimate + 0.5f);
+}
@@ -0,0 +1,51 @@
+/*
+ * pax_set — distinct-device counter for the PAX scan, in fixed memory.
+ *
+ * Every advertisement from a phone is offered to the set; the count of
+ * distinct addresses seen in a report window is the PAX figure. Addresses
+ * are hashed with a salt drawn at each reset, so the set never holds a MAC
+ * and a crafted address stream cannot aim at one probe chain.
+ *
+ * Two structures are fed on every insert, both O(1):
+ *
+ *   - an open-addressing hash set of 32-bit fingerprints (linear probing),
+ *     exact while it is at most 3/4 full (PAX_SET_SLOTS * 3/4 devices);
+ *   - a HyperLogLog sketch (PAX_HLL_REGISTERS registers, ~4.6% standard
+ *     error), which takes over once the set is full, so counts keep going
+ *     above the set's capacity instead of stopping.
+ *
+ * 2 KB + 512 B in all, against the 6 KB of the address list this replaces.
+ * Plain C with no IDF dependency: tools/pax-bench.c builds it on Linux.
+ */
+#ifndef PAX_SET_H
+#define PAX_SET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PAX_SET_SLOTS       512     /* power of two */
+#define PAX_HLL_BITS        9
+#define PAX_HLL_REGISTERS   (1 << PAX_HLL_BITS)
+
+typedef struct {
+	uint64_t salt;
+	uint16_t count;         /* fingerprints in the set */
+	bool full;              /* the set stopped taking entries; count comes from the sketch */
+	uint32_t slot[PAX_SET_SLOTS];   /* 0 = empty */
+	uint8_t reg[PAX_HLL_REGISTERS];
+} pax_set_t;
+
+/* Empty the set and start hashing with a new salt. */
+void pax_set_reset(pax_set_t *s, uint64_t salt);
+
+/* Offer one address. Returns true if it was not seen before (exact while the set is not full). */
+bool pax_set_add(pax_set_t *s, const uint8_t addr[6]);
+
+/* The same in two steps, for callers that feed one hash to several sets with the same salt. */
+uint64_t pax_set_hash(uint64_t salt, const uint8_t addr[6]);
+bool pax_set_add_hash(pax_set_t *s, uint64_t h);
+
+/* Distinct addresses since the reset: exact, or the sketch's estimate once the set is full. */
+uint32_t pax_set_count(const pax_set_t *s);
+
+#endif /* PAX_SET_H */
@@ -0,0 +1,152 @@
+#include "pax-stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PAX_DWELL_MAX   (PAX_DWELL_ENTRIES * 3 / 4)
+
+_Static_assert((PAX_DWELL_ENTRIES & (PAX_DWELL_ENTRIES - 1)) == 0, "PAX_DWELL_ENTRIES must be a power of two");
+_Static_assert(PAX_SLOTS <= 16, "dwell_slots is a 16-bit map");
+
+void pax_stats_reset(pax_stats_t *p, uint64_t salt) {
+	memset(p, 0, sizeof(*p));
+	p->salt = salt;
+	pax_set_reset(&p->window, salt);
+	pax_set_reset(&p->scan, salt);
+}
+
+void pax_stats_begin_scan(pax_stats_t *p, uint8_t slot) {
+	p->slot = slot < PAX_SLOTS ? slot : PAX_SLOTS - 1;
+	pax_set_reset(&p->scan, p->salt);
+}
+
+void pax_stats_end_scan(pax_stats_t *p, uint32_t radio_ms) {
+	p->radio_ms[p->slot] = radio_ms < UINT16_MAX ? radio_ms : UINT16_MAX;
+	if (!p->scan.full) return;
+
+	uint16_t *band = p->band[p->slot];
+	uint32_t counted = band[0] + band[1] + band[2], total = pax_set_count(&p->scan);
+	if (counted == 0 || total <= counted) return;
+
+	for (int b = 0; b < PAX_BANDS; b++) {
+		uint32_t v = (uint32_t) ((uint64_t) band[b] * total / counted);
+		band[b] = v < UINT16_MAX ? v : UINT16_MAX;
+	}
+}
+
+// Bits 1.. of the fingerprint decide the sample; bits 16.. the home position.
+static bool dwell_sampled(const pax_stats_t *p, uint32_t fp) {
+	return ((fp >> 1) & ((1u << p->sample_shift) - 1)) == 0;
+}
+
+static uint32_t dwell_home(uint32_t fp) {
+	return (fp >> 16) & (PAX_DWELL_ENTRIES - 1);
+}
+
+static void dwell_insert(pax_stats_t *p, uint32_t fp, uint16_t slots) {
+	uint32_t i = dwell_home(fp);
+	while (p->dwell_fp[i] != 0) i = (i + 1) & (PAX_DWELL_ENTRIES - 1);
+
+	p->dwell_fp[i] = fp;
+	p->dwell_slots[i] = slots;
+}
+
+// Halve the sample: drop the phones outside it and re-place the rest.
+static void dwell_downsample(pax_stats_t *p) {
+	p->sample_shift++;
+
+	uint32_t start = 0;
+	while (p->dwell_fp[start] != 0) start++;     // the table is never full: an empty slot exists
+
+	// Walking from an empty slot, a re-placed entry only moves back along its own probe run.
+	for (uint32_t n = 0; n < PAX_DWELL_ENTRIES; n++) {
+		uint32_t i = (start + n) & (PAX_DWELL_ENTRIES - 1);
+		uint32_t fp = p->dwell_fp[i];
+		if (fp == 0) continue;
+
+		uint16_t slots = p->dwell_slots[i];
+		p->dwell_fp[i] = 0;
+		p->dwell_slots[i] = 0;
+
+		if (dwell_sampled(p, fp)) {
+			dwell_insert(p, fp, slots);
+		} else {
+			p->dwell_count--;
+		}
+	}
+}
+
+static void dwell_add(pax_stats_t *p, uint32_t fp) {
+	if (!dwell_sampled(p, fp)) return;
+
+	uint32_t i = dwell_home(fp);
+	for (;;) {
+		if (p->dwell_fp[i] == fp) {
+			p->dwell_slots[i] |= 1u << p->slot;
+			return;
+		}
+		if (p->dwell_fp[i] == 0) break;
+		i = (i + 1) & (PAX_DWELL_ENTRIES - 1);
+	}
+
+	if (p->dwell_count >= PAX_DWELL_MAX) {
+		dwell_downsample(p);
+		if (!dwell_sampled(p, fp)) return;
+	}
+
+	dwell_insert(p, fp, 1u << p->slot);
+	p->dwell_count++;
+}
+
+void pax_stats_add(pax_stats_t *p, const uint8_t addr[6], int8_t rssi) {
+	uint64_t h = pax_set_hash(p->salt, addr);
+
+	pax_set_add_hash(&p->window, h);
+
+	if (pax_set_add_hash(&p->scan, h)) {
+		int band = rssi >= PAX_RSSI_NEAR ? 0 : rssi >= PAX_RSSI_MID ? 1 : 2;
+		if (p->band[p->slot][band] < UINT16_MAX) p->band[p->slot][band]++;
+	}
+
+	// Independent of the bits pax_set uses for its slot (32-40) and sketch (55-63).
+	dwell_add(p, (uint32_t) (h >> 8) | 1);
+}
+
+uint32_t pax_stats_unique(const pax_stats_t *p) {
+	return pax_set_count(&p->window);
+}
+
+uint32_t pax_stats_radio_ms(const pax_stats_t *p) {
+	uint32_t ms = 0;
+	for (int s = 0; s < PAX_SLOTS; s++) ms += p->radio_ms[s];
+	return ms;
+}
+
+int pax_stats_format(const pax_stats_t *p, char *buf, size_t size) {
+	uint32_t dwell[PAX_DWELL_BUCKETS] = { 0 }, returning = 0;
+
+	for (uint32_t i = 0; i < PAX_DWELL_ENTRIES; i++) {
+		uint16_t slots = p->dwell_slots[i];
+		if (p->dwell_fp[i] == 0 || slots == 0) continue;
+
+		int first = __builtin_ctz(slots);
+		int span = 32 - __builtin_clz(slots) - first;      // first to last slot, inclusive
+
+		// 1, 2, 3-4, 5-8, 9-16 slots.
+		int bucket = span <= 1 ? 0 : 32 - __builtin_clz(span - 1);
+		dwell[bucket < PAX_DWELL_BUCKETS ? bucket : PAX_DWELL_BUCKETS - 1]++;
+
+		if (__builtin_popcount(slots) < span) returning++;
+	}
+
+	int shift = p->sample_shift;
+	int n = snprintf(buf, size, "%lu,%lu,%lu/%lu/%lu/%lu/%lu", (unsigned long) pax_stats_unique(p), (unsigned long) returning << shift,
+		(unsigned long) dwell[0] << shift, (unsigned long) dwell[1] << shift, (unsigned long) dwell[2] << shift,
+		(unsigned long) dwell[3] << shift, (unsigned long) dwell[4] << shift);
+
+	for (int s = 0; s < PAX_SLOTS && n >= 0 && (size_t) n < size; s++) {
+		n += snprintf(buf + n, size - n, ",%u/%u/%u/%u", p->band[s][0], p->band[s][1], p->band[s][2], p->radio_ms[s]);
+	}
+
+	return n;
+}
@@ -0,0 +1,80 @@
+/*
+ * pax_stats — hourly PAX report: per-scan counts by distance, dwell, returns.
+ *
+ * A report window is PAX_SLOTS scans (one hour of 7 s scans every 5 min).
+ * For every scan slot the distinct phones are counted in three RSSI bands
+ * (near >= PAX_RSSI_NEAR dBm, mid >= PAX_RSSI_MID, far below). Across slots,
+ * a fixed-size table records in which slots each phone was seen, giving:
+ *
+ *   dwell      how long a phone stayed, from first to last slot it was seen
+ *   returning  phones seen, then absent for at least a slot, then seen again
+ *
+ * Addresses are hashed with a salt that rotates with the window (pax_set.h),
+ * so nothing links a phone across windows and no MAC is kept. The table
+ * holds PAX_DWELL_ENTRIES * 3/4 phones; past that it keeps a 1-in-2^k hash
+ * sample and the dwell and return counts are scaled by 2^k. Phones rotate
+ * their private addresses about every 15 minutes, so dwell beyond that is
+ * undercounted.
+ *
+ * The window is published once, on .../paxcounter, replacing the single count:
+ *
+ *   "<unique>,<returning>,<d1>/<d2>/<d3-4>/<d5-8>/<d9-12>,<near>/<mid>/<far>/<radio_ms>,...:<ts>:<hmac>"
+ *
+ * <unique> is the window's distinct count (pax_set), the dN fields count phones
+ * whose first-to-last span covered that many slots, and one near/mid/far
+ * group follows per slot, oldest first. <radio_ms> is the radio time the
+ * slot's scan got (scan time x duty cycle, scan-sched.h): the scheduler
+ * changes it with the uplink and the hour, so compare slots by count per
+ * radio time. 0 is a slot that never found a quiet moment. Plain C, no IDF
+ * dependency.
+ */
+#ifndef PAX_STATS_H
+#define PAX_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pax-set.h"
+
+#define PAX_SLOTS           12
+#define PAX_BANDS           3
+#define PAX_RSSI_NEAR       (-60)
+#define PAX_RSSI_MID        (-75)
+#define PAX_DWELL_ENTRIES   256     /* power of two */
+#define PAX_DWELL_BUCKETS   5
+
+typedef struct {
+	uint64_t salt;
+	uint8_t slot;               /* scan slot being filled, 0..PAX_SLOTS-1 */
+	uint8_t sample_shift;       /* dwell table keeps 1 in 2^sample_shift phones */
+	uint16_t dwell_count;
+	uint16_t band[PAX_SLOTS][PAX_BANDS];
+	uint16_t radio_ms[PAX_SLOTS];
+	pax_set_t window;           /* distinct phones in the window */
+	pax_set_t scan;             /* distinct phones in the current slot */
+	uint32_t dwell_fp[PAX_DWELL_ENTRIES];   /* 0 = empty */
+	uint16_t dwell_slots[PAX_DWELL_ENTRIES];    /* bit n: seen in slot n */
+} pax_stats_t;
+
+/* Start a new window hashed with `salt`; the first scan fills slot 0. */
+void pax_stats_reset(pax_stats_t *p, uint64_t salt);
+
+/* Start scan `slot` of the window (clamped to the last slot). */
+void pax_stats_begin_scan(pax_stats_t *p, uint8_t slot);
+
+/* Close the current scan, which had radio_ms of radio time. Past the scan set's exact range the band split is a sample: scale it to the set's estimate. */
+void pax_stats_end_scan(pax_stats_t *p, uint32_t radio_ms);
+
+/* Offer one phone advertisement heard at `rssi` dBm during the current scan. */
+void pax_stats_add(pax_stats_t *p, const uint8_t addr[6], int8_t rssi);
+
+/* Distinct phones in the window. */
+uint32_t pax_stats_unique(const pax_stats_t *p);
+
+/* Radio time of all the window's scans. */
+uint32_t pax_stats_radio_ms(const pax_stats_t *p);
+
+/* Write the report line (without ":<ts>:<hmac>"). Returns its length, as snprintf. */
+int pax_stats_format(const pax_stats_t *p, char *buf, size_t size);
+
+#endif /* PAX_STATS_H */
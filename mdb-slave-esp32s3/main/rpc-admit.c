@@ -0,0 +1,118 @@
+#include "rpc-admit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "rpc-auth.h"
+
+// A request stays fresh from ts - window to ts + window: as long as that, it must not run again.
+#define RPC_SEEN_HOLD_US    (2 * (RPC_FRESHNESS_SEC + HAL_TIME_SLACK_MAX_S) * 1000000LL)
+
+typedef struct {
+	char corr[sizeof(((rpc_request_t *) 0)->corr)];
+	int64_t at_us;
+} rpc_seen_t;
+
+static rpc_seen_t s_seen[RPC_SEEN_MAX];
+static rpc_broadcast_verify_t s_verify;
+
+static const char *s_names[] = {
+	[RPC_ADMIT_OK] = "ok",
+	[RPC_ADMIT_MALFORMED] = "malformed",
+	[RPC_ADMIT_BAD_SIGNATURE] = "bad signature",
+	[RPC_ADMIT_NO_CLOCK] = "clock not set yet",
+	[RPC_ADMIT_STALE] = "stale ts",
+	[RPC_ADMIT_REPEATED] = "already run",
+	[RPC_ADMIT_BUSY] = "too many requests in the freshness window",
+};
+
+bool rpc_arg_none(const char *args, rpc_arg_t *arg) {
+	arg->text = NULL;
+	return true;
+}
+
+bool rpc_arg_int(const char *args, rpc_arg_t *arg) {
+	char *end;
+	long v = strtol(args, &end, 10);
+	if (end == args || *end != '\0') return false;
+
+	arg->num = (int32_t) v;
+	return true;
+}
+
+bool rpc_arg_text(const char *args, rpc_arg_t *arg) {
+	arg->text = (args[0] != '\0' && strcmp(args, "-") != 0) ? args : NULL;
+	return true;
+}
+
+void rpc_admit_init(rpc_broadcast_verify_t verify) {
+	s_verify = verify;
+	memset(s_seen, 0, sizeof(s_seen));
+}
+
+rpc_admit_t rpc_admit_parse(const char *topic, const char *data, rpc_request_t *req, uint32_t *jitter_s) {
+	const char *last_colon = strrchr(data, ':');
+	if (last_colon == NULL) return RPC_ADMIT_MALFORMED;
+
+	size_t prefix_len = last_colon - data;
+	const char *sig = last_colon + 1;
+	bool broadcast = topic[0] != '\0';
+
+	if (!broadcast && !rpc_verify_hmac(data, prefix_len, sig)) return RPC_ADMIT_BAD_SIGNATURE;
+	if (broadcast && (s_verify == NULL || !s_verify(topic, data, prefix_len, sig))) return RPC_ADMIT_BAD_SIGNATURE;
+
+	snprintf(req->corr, sizeof(req->corr), "%.8s", sig);
+
+	unsigned int ts, jitter = 0;
+	int fields = sscanf(data, "%31[^:]:%63[^:]:%u:%u", req->cmd, req->args, &ts, &jitter);
+	if (fields < 3 || (broadcast && fields != 4)) return RPC_ADMIT_MALFORMED;
+
+	req->ts = ts;
+	*jitter_s = broadcast ? jitter : 0;
+	return RPC_ADMIT_OK;
+}
+
+rpc_admit_t rpc_admit_fresh(uint32_t ts) {
+	int slack = hal_time_slack_s();
+	if (slack < 0) return RPC_ADMIT_NO_CLOCK;
+
+	long dt = (long) (hal_time() - (int64_t) ts);
+	return labs(dt) > RPC_FRESHNESS_SEC + slack ? RPC_ADMIT_STALE : RPC_ADMIT_OK;
+}
+
+// An entry is only reused once its request can no longer pass rpc_admit_fresh().
+rpc_admit_t rpc_admit_once(const char *corr) {
+	int64_t now = hal_now_us();
+	size_t slot = RPC_SEEN_MAX;     // a free entry, else the oldest
+
+	for (size_t i = 0; i < RPC_SEEN_MAX; i++) {
+		if (s_seen[i].corr[0] == '\0') {
+			if (slot == RPC_SEEN_MAX || s_seen[slot].corr[0] != '\0') slot = i;
+			continue;
+		}
+		if (strcmp(s_seen[i].corr, corr) == 0) return RPC_ADMIT_REPEATED;
+		if (slot == RPC_SEEN_MAX || (s_seen[slot].corr[0] != '\0' && s_seen[i].at_us < s_seen[slot].at_us)) slot = i;
+	}
+
+	if (s_seen[slot].corr[0] != '\0' && now - s_seen[slot].at_us < RPC_SEEN_HOLD_US) return RPC_ADMIT_BUSY;
+
+	snprintf(s_seen[slot].corr, sizeof(s_seen[slot].corr), "%s", corr);
+	s_seen[slot].at_us = now;
+	return RPC_ADMIT_OK;
+}
+
+void rpc_admit_tag_reply(char *reply, size_t reply_sz, const char *corr) {
+	size_t n = strlen(reply);
+
+	if (n >= 2 && reply[0] == '{' && reply[n - 1] == '}') {
+		snprintf(reply + n - 1, reply_sz - n + 1, "%s\"corr\":\"%s\"}", n > 2 ? "," : "", corr);
+	} else {
+		snprintf(reply + n, reply_sz - n, ":%s", corr);
+	}
+}
+
+const char *rpc_admit_name(rpc_admit_t result) {
+	return (size_t) result < sizeof(s_names) / sizeof(s_names[0]) ? s_names[result] : "?";
+}
@@ -0,0 +1,83 @@
+/*
+ * rpc_admit — parsing and admission of signed RPCs, the portable half of rpc_exec.
+ *
+ * Splits a request, checks its signature, its timestamp against the wall
+ * clock and that it has not run before, and tags the reply with its
+ * correlation id (the first 8 hex chars of the signature):
+ *
+ *   unicast    "<cmd>:<args>:<ts>:<hmac>"             HMAC over the passkey (rpc-auth.h)
+ *   broadcast  "<cmd>:<args>:<ts>:<jitter_s>:<sig>"   fleet signature over "<topic>:" + the same prefix
+ *
+ * Reaches the clock only through hal.h, so it is tested on Linux
+ * (host/core-test.c). The queue, the command table and the executor task
+ * stay in rpc-exec.c.
+ */
+#ifndef RPC_ADMIT_H
+#define RPC_ADMIT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RPC_FRESHNESS_SEC   10
+#define RPC_SEEN_MAX        32      /* requests remembered, each while it can still pass rpc_admit_fresh() */
+
+typedef struct {
+	char cmd[32];
+	char args[64];
+	uint32_t ts;
+	char corr[9];           /* correlation id: request HMAC[:8] */
+	int64_t rx_us;          /* hal_now_us: payload copied off the MQTT task */
+	int64_t verified_us;    /* hal_now_us: signature and freshness checked */
+} rpc_request_t;
+
+typedef union {
+	int32_t num;
+	const char *text;   /* NULL when the sender passed the "-" sentinel */
+} rpc_arg_t;
+
+/* Parse the <args> field into arg. Returns false to reject the request. */
+typedef bool (*rpc_arg_parser_t)(const char *args, rpc_arg_t *arg);
+
+/* Stock argument parsers. */
+bool rpc_arg_none(const char *args, rpc_arg_t *arg);    /* ignores <args> */
+bool rpc_arg_int(const char *args, rpc_arg_t *arg);     /* required decimal integer */
+bool rpc_arg_text(const char *args, rpc_arg_t *arg);    /* optional free text */
+
+typedef enum {
+	RPC_ADMIT_OK = 0,
+	RPC_ADMIT_MALFORMED,
+	RPC_ADMIT_BAD_SIGNATURE,
+	RPC_ADMIT_NO_CLOCK,         /* wall clock not set yet */
+	RPC_ADMIT_STALE,
+	RPC_ADMIT_REPEATED,         /* already run */
+	RPC_ADMIT_BUSY,             /* RPC_SEEN_MAX requests still fresh: turned away rather than risk a second run */
+} rpc_admit_t;
+
+/* Broadcast signature check, fleet_verify() on the board. */
+typedef bool (*rpc_broadcast_verify_t)(const char *topic, const char *msg, size_t msg_len, const char *sig_hex);
+
+/* Forget every request seen. verify may be NULL: broadcasts are then refused. */
+void rpc_admit_init(rpc_broadcast_verify_t verify);
+
+/* Split and authenticate the NUL-terminated data. topic is "" for the
+ * device's own RPC topic, else the broadcast topic it came on. Fills cmd,
+ * args, ts and corr; *jitter_s is 0 for a unicast request. */
+rpc_admit_t rpc_admit_parse(const char *topic, const char *data, rpc_request_t *req, uint32_t *jitter_s);
+
+/* ts within RPC_FRESHNESS_SEC of hal_time(), widened by hal_time_slack_s(). */
+rpc_admit_t rpc_admit_fresh(uint32_t ts);
+
+/* Record corr as run. A QoS 1 redelivery, or a fleet and a group message
+ * signed once each, is RPC_ADMIT_REPEATED for as long as it is fresh. */
+rpc_admit_t rpc_admit_once(const char *corr);
+
+/* Append the correlation id to the reply in place: ":<corr>", or a "corr"
+ * member when the reply is a JSON object, so it stays valid JSON. The tag
+ * takes at most RPC_TAG_MAX more bytes than the reply. */
+#define RPC_TAG_MAX         19
+void rpc_admit_tag_reply(char *reply, size_t reply_sz, const char *corr);
+
+const char *rpc_admit_name(rpc_admit_t result);
+
+#endif /* RPC_ADMIT_H */
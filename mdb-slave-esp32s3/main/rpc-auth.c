@@ -2,7 +2,8 @@
 
 #include <string.h>
 #include <stdio.h>
-#include <mbedtls/md.h>
+
+#include "hal.h"
 
 /* Device passkey, by reference (the owner keeps the buffer alive). */
 static const char *s_key = "";
@@ -11,16 +12,16 @@ void rpc_auth_set_key(const char *passkey) {
 	s_key = passkey ? passkey : "";
 }
 
-void calculate_hmac(const char *payload, size_t payload_len, unsigned char *output_hmac) {
-	mbedtls_md_context_t ctx;
-	mbedtls_md_init(&ctx);
+bool rpc_auth_has_key(void) {
+	return s_key[0] != '\0';
+}
 
-	mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
-	mbedtls_md_hmac_starts(&ctx, (const unsigned char *) s_key, strlen(s_key));
-	mbedtls_md_hmac_update(&ctx, (const unsigned char *) payload, payload_len);
-	mbedtls_md_hmac_finish(&ctx, output_hmac);
+void calculate_hmac_with_key(const char *key, size_t key_len, const void *payload, size_t payload_len, unsigned char *output_hmac) {
+	hal_hmac_sha256(key, key_len, payload, payload_len, output_hmac);
+}
 
-	mbedtls_md_free(&ctx);
+void calculate_hmac(const char *payload, size_t payload_len, unsigned char *output_hmac) {
+	calculate_hmac_with_key(s_key, strlen(s_key), payload, payload_len, output_hmac);
 }
 
 bool rpc_verify_hmac(const char *msg, size_t msg_len, const char *sig_hex) {
@@ -15,9 +15,15 @@
  * in-place updates to the buffer take effect. Call once at boot. */
 void rpc_auth_set_key(const char *passkey);
 
+/* True once a passkey is set (the buffer is not empty). */
+bool rpc_auth_has_key(void);
+
 /* HMAC-SHA256(passkey, payload[0..payload_len)) -> output_hmac (32 bytes). */
 void calculate_hmac(const char *payload, size_t payload_len, unsigned char *output_hmac);
 
+/* Same with an explicit key, for a passkey that is being provisioned. */
+void calculate_hmac_with_key(const char *key, size_t key_len, const void *payload, size_t payload_len, unsigned char *output_hmac);
+
 /* True if sig_hex equals the lowercase-hex HMAC of msg[0..msg_len). */
 bool rpc_verify_hmac(const char *msg, size_t msg_len, const char *sig_hex);
 
@@ -0,0 +1,234 @@
+#include "rpc-exec.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+
+#include "fleet.h"
+#include "metrics.h"
+#include "trace.h"
+#include "mqtt-outbox.h"
+
+#define TAG "rpc_exec"
+
+#define RPC_MSG_MAX         255    // a broadcast carries a 128-char ECDSA signature
+#define RPC_TOPIC_MAX       FLEET_TOPIC_MAX
+#define RPC_QUEUE_DEPTH     8
+#define RPC_DEFER_MAX       4      // broadcasts waiting out their jitter
+#define RPC_REPLY_MAX       1024   // rpc/info JSON is the largest reply
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+typedef struct {
+	int64_t rx_us;
+	uint8_t len;
+	char topic[RPC_TOPIC_MAX];  // broadcast topic, "" for the device's own
+	char data[RPC_MSG_MAX + 1];
+} rpc_msg_t;
+
+typedef struct {
+	int64_t due_us;
+	const rpc_command_t *command;   // NULL = free slot
+	rpc_request_t req;
+} rpc_deferred_t;
+
+static QueueHandle_t s_rpc_queue;
+static rpc_deferred_t s_deferred[RPC_DEFER_MAX];
+
+static metric_t s_m_run = METRIC_COUNTER("rpc.run");
+static metric_t s_m_failed = METRIC_COUNTER("rpc.fail");
+static metric_t s_m_rejected = METRIC_COUNTER("rpc.reject");
+static const rpc_command_t *s_commands;
+static size_t s_command_count;
+
+static const rpc_command_t *rpc_lookup(const char *name) {
+	for (size_t i = 0; i < s_command_count; i++) {
+		if (strcmp(s_commands[i].name, name) == 0) return &s_commands[i];
+	}
+	return NULL;
+}
+
+static void rpc_run(const rpc_command_t *command, const rpc_request_t *req) {
+	static char reply[RPC_REPLY_MAX];
+	reply[0] = '\0';
+
+	rpc_arg_t arg = { 0 };
+	esp_err_t err = command->parse(req->args, &arg) ? command->handler(req, &arg, reply, sizeof(reply) - RPC_TAG_MAX) : ESP_ERR_INVALID_ARG;
+
+	metric_inc(&s_m_run);
+
+	uint32_t name = 0;
+	memcpy(&name, req->cmd, strnlen(req->cmd, sizeof(name)));
+	trace_emit(TRACE_RPC_RUN, (uint16_t) err, name);
+
+	if (err != ESP_OK) {
+		metric_inc(&s_m_failed);
+		ESP_LOGW(TAG, "RPC %s failed: %s", req->cmd, esp_err_to_name(err));
+		snprintf(reply, sizeof(reply) - RPC_TAG_MAX, "error,%s", esp_err_to_name(err));
+	}
+
+	if (command->reply == NULL) return;
+
+	char topic[64];
+	snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/rpc/%s", my_subdomain, command->reply);
+
+	rpc_admit_tag_reply(reply, sizeof(reply), req->corr);
+	mqtt_outbox_publish(OUTBOX_CONTROL, topic, reply, 0, 0);
+}
+
+// Verify and look up; NULL if the request is rejected.
+static const rpc_command_t *rpc_check(rpc_msg_t *msg, rpc_request_t *req, uint32_t *jitter_s) {
+	rpc_admit_t result = rpc_admit_parse(msg->topic, msg->data, req, jitter_s);
+	if (result != RPC_ADMIT_OK) {
+		ESP_LOGW(TAG, "RPC rejected%s%s: %s", msg->topic[0] ? " on " : "", msg->topic, rpc_admit_name(result));
+		return NULL;
+	}
+
+	const rpc_command_t *command = rpc_lookup(req->cmd);
+	if (command == NULL) {
+		ESP_LOGW(TAG, "RPC unknown command: %s", req->cmd);
+		return NULL;
+	}
+
+	if (!command->untimed && (result = rpc_admit_fresh(req->ts)) != RPC_ADMIT_OK) {
+		ESP_LOGW(TAG, "RPC %s rejected: %s (ts %lu)", req->cmd, rpc_admit_name(result), (unsigned long) req->ts);
+		return NULL;
+	}
+
+	if (msg->topic[0] != '\0' && !command->broadcast) {
+		ESP_LOGW(TAG, "RPC %s not allowed on %s", req->cmd, msg->topic);
+		return NULL;
+	}
+
+	return command;
+}
+
+static void rpc_execute(rpc_msg_t *msg) {
+	rpc_request_t req = { 0 };
+	uint32_t jitter_s;
+
+	const rpc_command_t *command = rpc_check(msg, &req, &jitter_s);
+	if (command == NULL) {
+		metric_inc(&s_m_rejected);
+		return;
+	}
+
+	req.rx_us = msg->rx_us;
+	req.verified_us = esp_timer_get_time();
+
+	// QoS 1 redelivery after a reconnect must not run twice.
+	rpc_admit_t result = rpc_admit_once(req.corr);
+	if (result != RPC_ADMIT_OK) {
+		ESP_LOGW(TAG, "RPC %s %s rejected: %s", req.cmd, req.corr, rpc_admit_name(result));
+		metric_inc(&s_m_rejected);
+		return;
+	}
+
+	if (msg->topic[0] == '\0') {
+		rpc_run(command, &req);
+		return;
+	}
+
+	if (jitter_s > CONFIG_VMFLOW_FLEET_JITTER_MAX) jitter_s = CONFIG_VMFLOW_FLEET_JITTER_MAX;
+	uint32_t delay_ms = esp_random() % (jitter_s * 1000 + 1);
+
+	for (size_t i = 0; i < RPC_DEFER_MAX; i++) {
+		if (s_deferred[i].command != NULL) continue;
+
+		s_deferred[i].due_us = esp_timer_get_time() + (int64_t) delay_ms * 1000;
+		s_deferred[i].command = command;
+		s_deferred[i].req = req;
+
+		ESP_LOGI(TAG, "RPC %s from %s runs in %lu ms", req.cmd, msg->topic, (unsigned long) delay_ms);
+		return;
+	}
+
+	ESP_LOGW(TAG, "RPC %s dropped: %d broadcasts already waiting", req.cmd, RPC_DEFER_MAX);
+}
+
+// Run the broadcasts whose delay has passed; returns how long to wait for the next one.
+static TickType_t rpc_run_due(void) {
+	TickType_t wait = portMAX_DELAY;
+
+	for (size_t i = 0; i < RPC_DEFER_MAX; i++) {
+		if (s_deferred[i].command == NULL) continue;
+
+		int64_t left_us = s_deferred[i].due_us - esp_timer_get_time();
+		if (left_us <= 0) {
+			const rpc_command_t *command = s_deferred[i].command;
+			s_deferred[i].command = NULL;
+			rpc_run(command, &s_deferred[i].req);
+			continue;
+		}
+
+		TickType_t ticks = pdMS_TO_TICKS(left_us / 1000) + 1;
+		if (ticks < wait) wait = ticks;
+	}
+
+	return wait;
+}
+
+static void rpc_exec_task(void *arg) {
+	rpc_msg_t msg;
+	TickType_t wait = portMAX_DELAY;
+
+	for (;;) {
+		if (xQueueReceive(s_rpc_queue, &msg, wait) == pdTRUE) {
+			rpc_execute(&msg);
+		}
+		wait = rpc_run_due();
+	}
+}
+
+void rpc_exec_init(const rpc_command_t *commands, size_t count) {
+	s_commands = commands;
+	s_command_count = count;
+	rpc_admit_init(fleet_verify);
+
+	s_rpc_queue = xQueueCreate(RPC_QUEUE_DEPTH, sizeof(rpc_msg_t));
+
+	metrics_register(&s_m_run);
+	metrics_register(&s_m_failed);
+	metrics_register(&s_m_rejected);
+
+	xTaskCreatePinnedToCore(rpc_exec_task, "rpc_exec", 4096, NULL, 5, NULL, 0);
+}
+
+static bool rpc_exec_enqueue(const char *topic, int topic_len, const char *data, int len) {
+	if (s_rpc_queue == NULL) return false;
+
+	rpc_msg_t msg;
+	if (topic && topic_len >= (int) sizeof(msg.topic)) {
+		ESP_LOGW(TAG, "RPC dropped: topic longer than %u B", (unsigned) sizeof(msg.topic) - 1);
+		return false;
+	}
+
+	msg.rx_us = esp_timer_get_time();
+	msg.topic[0] = '\0';
+	if (topic) snprintf(msg.topic, sizeof(msg.topic), "%.*s", topic_len, topic);
+
+	msg.len = len < RPC_MSG_MAX ? len : RPC_MSG_MAX;
+	memcpy(msg.data, data, msg.len);
+	msg.data[msg.len] = '\0';
+
+	if (xQueueSend(s_rpc_queue, &msg, 0) != pdTRUE) {
+		ESP_LOGW(TAG, "RPC dropped: executor queue full");
+		return false;
+	}
+	return true;
+}
+
+bool rpc_exec_submit(const char *data, int len) {
+	return rpc_exec_enqueue(NULL, 0, data, len);
+}
+
+bool rpc_exec_submit_broadcast(const char *topic, int topic_len, const char *data, int len) {
+	return rpc_exec_enqueue(topic, topic_len, data, len);
+}
@@ -0,0 +1,54 @@
+/*
+ * rpc_exec — signed RPC executor, decoupled from the MQTT event handler.
+ *
+ * The esp-mqtt task only copies an inbound "<cmd>:<args>:<ts>:<hmac>" message
+ * into a bounded queue (rpc_exec_submit). A dedicated executor task verifies
+ * the HMAC and freshness (rpc-admit.c, portable and tested on Linux), looks
+ * the command up in a registry table, parses its argument and runs the
+ * handler. The handler's reply is published on
+ * domain.vmflow.xyz/<sub>/rpc/<reply> as "<result>:<corr>", where <corr> is
+ * the first 8 hex chars of the request's HMAC, so the sender can match
+ * replies to requests. A JSON object reply carries it as a "corr" member
+ * instead. Adding a command is a table entry. A request runs at most once:
+ * the corr of everything admitted is kept for as long as its timestamp can
+ * still pass the freshness check, so a QoS 1 redelivery is dropped.
+ *
+ * Commands flagged `broadcast` may also arrive on the fleet and group topics
+ * (fleet.c): those carry a fleet signature instead of the HMAC and run after a
+ * random delay inside the sender's jitter window; replies still go to this
+ * device's own reply topic.
+ */
+#ifndef RPC_EXEC_H
+#define RPC_EXEC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "rpc-admit.h"
+
+/* Run the command. Any text written to reply is published on the command's
+ * reply topic; an error is published as "error,<esp_err_name>". */
+typedef esp_err_t (*rpc_handler_t)(const rpc_request_t *req, const rpc_arg_t *arg, char *reply, size_t reply_sz);
+
+typedef struct {
+	const char *name;
+	rpc_arg_parser_t parse;
+	rpc_handler_t handler;
+	const char *reply;  /* subtopic under .../rpc/, or NULL for no reply */
+	bool broadcast;     /* accepted on fleet / group topics */
+	bool untimed;       /* skip the freshness check: the handler matches a one-time nonce instead */
+} rpc_command_t;
+
+/* Register the command table (kept by reference) and start the executor task. */
+void rpc_exec_init(const rpc_command_t *commands, size_t count);
+
+/* Copy a raw RPC payload into the executor queue. Never blocks; safe to call
+ * from the esp-mqtt task. Returns false if the queue is full. */
+bool rpc_exec_submit(const char *data, int len);
+
+/* Same for a payload received on one of the fleet / group topics. */
+bool rpc_exec_submit_broadcast(const char *topic, int topic_len, const char *data, int len);
+
+#endif /* RPC_EXEC_H */
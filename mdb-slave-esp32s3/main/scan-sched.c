@@ -0,0 +1,141 @@
+#include "scan-sched.h"
+
+#include <string.h>
+#include <time.h>
+#include <esp_log.h>
+
+#include "hal.h"
+#include "metrics.h"
+#include "nimble.h"
+#include "ota.h"
+#include "pax-stats.h"
+#include "timesync.h"
+#include "uplink.h"
+
+#define TAG "scan_sched"
+
+// Hourly averages are kept x16, updated with weight 1/4 per report.
+#define HOUR_SCALE      16
+#define HOUR_WEIGHT     2       /* log2 of the averaging divisor */
+
+// Counts are learnt per the radio time of an unboosted active hour: PAX_SLOTS scans at 50% duty.
+#define REF_DUTY_PCT    50
+
+static bool (*s_session_active)(void);
+
+// Planned, accounted and learnt on the NimBLE host task only (nimble.c posts every scan change there).
+static uint16_t s_hour_avg[24];
+static uint32_t s_base_ms;
+
+static metric_t s_m_airtime = METRIC_COUNTER("ble.scan_ms");
+static metric_t s_m_paused = METRIC_COUNTER("ble.scan_paused");
+static metric_t s_m_boosted = METRIC_COUNTER("ble.scan_boosted");
+
+void scan_sched_init(bool (*session_active)(void)) {
+	s_session_active = session_active;
+
+	metrics_register(&s_m_airtime);
+	metrics_register(&s_m_paused);
+	metrics_register(&s_m_boosted);
+
+	size_t len = sizeof(s_hour_avg);
+	if (!hal_kv_get("pax_hours", s_hour_avg, &len) || len != sizeof(s_hour_avg)) {
+		memset(s_hour_avg, 0, sizeof(s_hour_avg));
+	}
+}
+
+static bool scan_hour(time_t t, int *hour) {
+	if (timesync_source() == TIMESYNC_NONE) return false;
+
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	*hour = tm.tm_hour;
+	return true;
+}
+
+static bool scan_busy_hour(void) {
+	int hour;
+	if (!scan_hour(time(NULL), &hour)) return false;
+
+	uint32_t sum = 0, hours = 0;
+	for (int h = 0; h < 24; h++) {
+		if (s_hour_avg[h] == 0) continue;
+		sum += s_hour_avg[h];
+		hours++;
+	}
+
+	uint32_t avg = s_hour_avg[hour];
+	if (hours == 0 || avg < SCAN_BUSY_MIN_DEVICES * HOUR_SCALE) return false;
+
+	return avg * 2 * hours >= sum * 3;
+}
+
+void scan_sched_plan(bool gatt_connected, uint32_t base_duration_ms, scan_plan_t *out) {
+	ota_stats_t ota;
+	ota_get_stats(&ota);
+
+	uplink_stats_t link;
+	uplink_get_stats(&link);
+	bool wifi = link.active == UPLINK_WIFI;
+
+	s_base_ms = base_duration_ms;
+	*out = (scan_plan_t) { .mode = SCAN_ACTIVE, .itvl_ms = 100, .window_ms = 50, .duration_ms = base_duration_ms, .why = "idle" };
+
+	if (gatt_connected) {
+		out->mode = SCAN_PAUSE;
+		out->why = "gatt";
+	} else if (s_session_active && s_session_active()) {
+		out->mode = SCAN_PAUSE;
+		out->why = "session";
+	} else if (ota.running && wifi) {
+		out->mode = SCAN_PAUSE;
+		out->why = "ota";
+	} else if (ota.running || wifi) {
+		out->mode = SCAN_PASSIVE;
+		out->itvl_ms = 120;
+		out->window_ms = 30;
+		out->why = ota.running ? "ota" : "wifi";
+	}
+
+	if (out->mode == SCAN_PAUSE) {
+		metric_inc(&s_m_paused);
+		return;
+	}
+
+	// Not while an update downloads: the boost is for counting, not worth slowing the update.
+	if (!ota.running && scan_busy_hour()) {
+		out->boost = true;
+		out->window_ms = out->window_ms * 2 > out->itvl_ms ? out->itvl_ms : out->window_ms * 2;
+		out->duration_ms *= 2;
+		metric_inc(&s_m_boosted);
+	}
+}
+
+uint32_t scan_sched_done(const scan_plan_t *plan, uint32_t elapsed_ms) {
+	if (plan->itvl_ms == 0) return 0;
+
+	uint32_t radio_ms = elapsed_ms * plan->window_ms / plan->itvl_ms;
+	metric_add(&s_m_airtime, radio_ms);
+	return radio_ms;
+}
+
+void scan_sched_record(uint32_t devices, uint32_t radio_ms) {
+	// The report closes the window: attribute it to the hour around the window's middle.
+	int hour;
+	if (!scan_hour(time(NULL) - PAX_REPORT_INTERVAL_SEC / 2, &hour)) return;
+
+	// A boosted, passive or half-paused hour counts at another radio time: scale it to the reference.
+	// Distinct phones grow slower than radio time, so a boosted hour is under- rather than over-credited.
+	uint64_t ref_ms = (uint64_t) PAX_SLOTS * s_base_ms * REF_DUTY_PCT / 100;
+	if (ref_ms == 0 || radio_ms < ref_ms / 4) return;     // too little listening to tell anything
+
+	uint64_t norm = (uint64_t) devices * ref_ms / radio_ms;
+	uint32_t sample = norm > UINT16_MAX / HOUR_SCALE ? UINT16_MAX : (uint32_t) norm * HOUR_SCALE;
+	int32_t avg = s_hour_avg[hour];
+	s_hour_avg[hour] = avg == 0 ? sample : (uint16_t) (avg + (((int32_t) sample - avg) >> HOUR_WEIGHT));
+
+	hal_kv_set("pax_hours", s_hour_avg, sizeof(s_hour_avg));
+
+	ESP_LOGD(TAG, "hour %d: %lu devices in %lu ms of radio, average %u", hour, (unsigned long) devices, (unsigned long) radio_ms,
+		s_hour_avg[hour] / HOUR_SCALE);
+}
@@ -0,0 +1,68 @@
+/*
+ * scan_sched — picks how each PAX scan uses the radio.
+ *
+ * The ESP32-S3 has one 2.4 GHz radio shared between Wi-Fi and BLE, and the
+ * BLE controller also serves the phone's GATT link. Foot-traffic counting
+ * must never cost a purchase or an update, so before every scan the
+ * scheduler looks at what the radio is doing and returns a plan:
+ *
+ *   pause     a phone is connected over GATT, an MDB payment session is open
+ *             or queued, or an OTA download runs over Wi-Fi. The scan is
+ *             retried within its 5-minute slot, else the slot stays empty.
+ *   passive   the MQTT uplink is Wi-Fi (or OTA runs over PPP): no scan
+ *             requests, and a 25% duty cycle leaves Wi-Fi most of the airtime.
+ *   active    cellular uplink, radio otherwise idle: 50% duty cycle.
+ *
+ * Hours that were historically busy get a boost: double duty cycle (full
+ * duty when active) and a scan twice as long. Busy means the hour's average
+ * PAX count, learnt from the hourly reports and kept in NVS, is at least 1.5
+ * times the average over all hours. Hours are UTC and are only learnt once
+ * the clock is set.
+ *
+ * Counts are only learnt normalised to the radio time of an unboosted
+ * active hour (devices x reference / radio time actually spent), so a boost,
+ * a passive Wi-Fi hour or paused slots do not make an hour look busier or
+ * quieter than it was, and a boost cannot feed itself. The report carries
+ * each slot's radio time for the same reason (pax-stats.h).
+ *
+ * Metrics: ble.scan_ms (radio time spent scanning, i.e. scan time x duty
+ * cycle), ble.scan_paused, and ble.scan_boosted.
+ */
+#ifndef SCAN_SCHED_H
+#define SCAN_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCAN_BUSY_MIN_DEVICES   10      /* an hour below this average is never busy */
+
+typedef enum {
+	SCAN_PAUSE = 0,
+	SCAN_PASSIVE,
+	SCAN_ACTIVE,
+} scan_mode_t;
+
+typedef struct {
+	scan_mode_t mode;
+	bool boost;
+	uint16_t itvl_ms;           /* duty cycle = window_ms / itvl_ms */
+	uint16_t window_ms;
+	uint32_t duration_ms;
+	const char *why;            /* "gatt", "session", "ota", "wifi", "idle" */
+} scan_plan_t;
+
+/* Load the hourly history. session_active tells whether an MDB session is open or queued. */
+void scan_sched_init(bool (*session_active)(void));
+
+/* plan, done and record run on the NimBLE host task only, which owns the scan (nimble.c). */
+
+/* Plan the next scan of base_duration_ms; gatt_connected comes from the BLE host. */
+void scan_sched_plan(bool gatt_connected, uint32_t base_duration_ms, scan_plan_t *out);
+
+/* Account a finished (or cancelled) scan that ran elapsed_ms under `plan`. Returns its radio time in ms. */
+uint32_t scan_sched_done(const scan_plan_t *plan, uint32_t elapsed_ms);
+
+/* Learn the current hour's traffic from an hourly PAX report: devices seen in radio_ms of scanning. */
+void scan_sched_record(uint32_t devices, uint32_t radio_ms);
+
+#endif /* SCAN_SCHED_H */
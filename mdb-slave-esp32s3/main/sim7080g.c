@@ -0,0 +1,397 @@
+#include "sim7080g.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <esp_event.h>
+#include <esp_timer.h>
+#include <esp_netif_ppp.h>
+#include <esp_modem_api.h>
+#include <driver/gpio.h>
+#include <nvs_flash.h>
+
+#include "timesync.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define TAG "sim7080g"
+
+#define STRINGIFY_IMPL(x)   #x
+#define STRINGIFY(x)        STRINGIFY_IMPL(x)
+
+#define PIN_SIM7080G_RX     GPIO_NUM_18
+#define PIN_SIM7080G_TX     GPIO_NUM_17
+#define PIN_SIM7080G_PWR    GPIO_NUM_14
+
+// Registration budgets: the cached band/RAT gets a short window before the full scan takes over.
+#define SIM7080G_FAST_ATTACH_MS     20000
+#define SIM7080G_FULL_ATTACH_MS     90000
+#define SIM7080G_PPP_TIMEOUT_MS     30000
+#define SIM7080G_RETRY_MS           60000
+
+// Every band the module supports per RAT, restored when the cached band does not register.
+#define SIM7080G_BANDS_CATM     "1,2,3,4,5,8,12,13,14,18,19,20,25,26,27,28,66,85"
+#define SIM7080G_BANDS_NBIOT    "1,2,3,4,5,8,12,13,18,19,20,25,28,66,71,85"
+
+enum MODEM_BIT {
+	MODEM_BIT_CPIN_READY    = (1 << 0),
+	MODEM_BIT_SMS_READY     = (1 << 1),
+	MODEM_BIT_REGISTERED    = (1 << 2),
+	MODEM_BIT_PPP_GOT_IP    = (1 << 3),
+	MODEM_BIT_PPP_LOST_IP   = (1 << 4),
+};
+
+static EventGroupHandle_t s_modem_events;
+static esp_modem_dce_t *s_dce;
+static sim7080g_stats_t s_stats;
+
+static metric_t s_m_attach_ms = METRIC_HISTOGRAM("modem.attach_ms", 2000, 5000, 10000, 20000, 40000, 90000);
+
+// "+CEREG: <stat>" (URC, n=1), "+CEREG: <stat>,"<tac>",..." (URC, n=2) or "+CEREG: <n>,<stat>" (query).
+static void sim7080g_parse_cereg(const char *buf, size_t len) {
+	const char *p = memmem(buf, len, "+CEREG: ", 8);
+	if (p == NULL) return;
+
+	const char *end = buf + len;
+	p += 8;
+
+	int stat = 0;
+	while (p < end && *p >= '0' && *p <= '9') stat = stat * 10 + (*p++ - '0');
+
+	if (p + 1 < end && *p == ',' && p[1] >= '0' && p[1] <= '9') {
+		stat = 0;
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++) stat = stat * 10 + (*p - '0');
+	}
+
+	trace_emit(TRACE_MODEM_CEREG, stat, 0);
+
+	if (stat == 1 || stat == 5) {
+		xEventGroupSetBits(s_modem_events, MODEM_BIT_REGISTERED);
+	} else {
+		xEventGroupClearBits(s_modem_events, MODEM_BIT_REGISTERED);
+	}
+}
+
+// URC handler (command mode only): runs on the esp_modem DTE task, so it only sets event bits.
+static esp_err_t sim7080g_urc_cb(uint8_t *data, size_t len) {
+	const char *buf = (const char *) data;
+
+	if (memmem(buf, len, "+CPIN: READY", 12)) xEventGroupSetBits(s_modem_events, MODEM_BIT_CPIN_READY);
+	if (memmem(buf, len, "SMS Ready", 9)) xEventGroupSetBits(s_modem_events, MODEM_BIT_SMS_READY | MODEM_BIT_CPIN_READY);
+
+	sim7080g_parse_cereg(buf, len);
+
+	return ESP_OK;
+}
+
+static void sim7080g_ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+	if (event_id == IP_EVENT_PPP_GOT_IP) xEventGroupSetBits(s_modem_events, MODEM_BIT_PPP_GOT_IP);
+	if (event_id == IP_EVENT_PPP_LOST_IP) xEventGroupSetBits(s_modem_events, MODEM_BIT_PPP_LOST_IP);
+}
+
+static bool sim7080g_wait_bits(EventBits_t bits, int timeout_ms) {
+	return (xEventGroupWaitBits(s_modem_events, bits, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms)) & bits) == bits;
+}
+
+// PWRKEY needs >1 s low pulse; AT is answered a few seconds later, so poll instead of sleeping a fixed 5 s.
+static esp_err_t sim7080g_power_on(void) {
+	for (int attempt = 0; attempt < 2; attempt++) {
+		gpio_set_level(PIN_SIM7080G_PWR, 1);
+		vTaskDelay(pdMS_TO_TICKS(1200));
+		gpio_set_level(PIN_SIM7080G_PWR, 0);
+
+		ESP_LOGI(TAG, "waiting for SIM7080G boot...");
+		for (int i = 0; i < 20; i++) {
+			if (esp_modem_sync(s_dce) == ESP_OK) return ESP_OK;
+			vTaskDelay(pdMS_TO_TICKS(500));
+		}
+		// A modem that was on but unresponsive has just been switched off; pulse again.
+	}
+
+	return ESP_ERR_NOT_FOUND;
+}
+
+static bool sim7080g_query_registered(void) {
+	char resp[128] = { 0 };
+	if (esp_modem_at(s_dce, "AT+CEREG?", resp, 3000) == ESP_OK) sim7080g_parse_cereg(resp, strlen(resp));
+
+	return xEventGroupGetBits(s_modem_events) & MODEM_BIT_REGISTERED;
+}
+
+// Wait for a +CEREG URC; re-query every 10 s in case one was missed while the handler was busy.
+static esp_err_t sim7080g_wait_registered(int timeout_ms) {
+	int64_t deadline = esp_timer_get_time() + (int64_t) timeout_ms * 1000;
+
+	while (!sim7080g_query_registered()) {
+		int64_t left_ms = (deadline - esp_timer_get_time()) / 1000;
+		if (left_ms <= 0) {
+			ESP_LOGW(TAG, "registration timeout (%d ms)", timeout_ms);
+			return ESP_ERR_TIMEOUT;
+		}
+
+		sim7080g_wait_bits(MODEM_BIT_REGISTERED, left_ms < 10000 ? left_ms : 10000);
+	}
+
+	return ESP_OK;
+}
+
+static void sim7080g_cache_load(void) {
+	nvs_handle_t handle;
+	if (nvs_open("vmflow", NVS_READONLY, &handle) != ESP_OK) return;
+
+	size_t s_len = sizeof(s_stats.oper);
+	nvs_get_str(handle, "mdm_oper", s_stats.oper, &s_len);
+	nvs_get_u8(handle, "mdm_band", &s_stats.band);
+	nvs_get_u8(handle, "mdm_rat", &s_stats.rat);
+
+	nvs_close(handle);
+}
+
+// "+CPSI: LTE CAT-M1,Online,724-05,0x1234,12345678,123,EUTRAN-BAND3,..." -> oper "72405", band 3, rat 1.
+static void sim7080g_cache_save(void) {
+	char resp[128] = { 0 };
+	if (esp_modem_at(s_dce, "AT+CPSI?", resp, 3000) != ESP_OK) return;
+
+	const char *p = strstr(resp, "+CPSI: ");
+	if (p == NULL) return;
+	p += 7;
+
+	uint8_t rat;
+	if (strncmp(p, "LTE CAT-M1", 10) == 0) rat = 1;
+	else if (strncmp(p, "LTE NB-IOT", 10) == 0) rat = 2;
+	else return;
+
+	const char *field = strchr(p, ',');
+	if (field) field = strchr(field + 1, ',');
+	if (field == NULL) return;
+
+	char oper[sizeof(s_stats.oper)];
+	size_t n = 0;
+	for (field++; *field && *field != ',' && n < sizeof(oper) - 1; field++) {
+		if (*field >= '0' && *field <= '9') oper[n++] = *field;
+	}
+	oper[n] = '\0';
+
+	const char *b = strstr(p, "EUTRAN-BAND");
+	uint8_t band = b ? (uint8_t) atoi(b + 11) : 0;
+
+	if (band == 0 || (rat == s_stats.rat && band == s_stats.band && strcmp(oper, s_stats.oper) == 0)) return;
+
+	strcpy(s_stats.oper, oper);
+	s_stats.band = band;
+	s_stats.rat = rat;
+
+	nvs_handle_t handle;
+	if (nvs_open("vmflow", NVS_READWRITE, &handle) != ESP_OK) return;
+
+	nvs_set_str(handle, "mdm_oper", s_stats.oper);
+	nvs_set_u8(handle, "mdm_band", s_stats.band);
+	nvs_set_u8(handle, "mdm_rat", s_stats.rat);
+	nvs_commit(handle);
+	nvs_close(handle);
+
+	ESP_LOGI(TAG, "cached network: oper=%s band=%u rat=%u", s_stats.oper, s_stats.band, s_stats.rat);
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date (H. Hinnant's days_from_civil).
+static int64_t sim7080g_days(int y, int m, int d) {
+	y -= m <= 2;
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return (int64_t) era * 146097 + doe - 719468;
+}
+
+// Network time: "+CCLK: "26/10/19,14:03:22+08"" is local time, the zone in quarter hours.
+// Without NITZ the modem reports its RTC default (1980), which timesync rejects.
+static void sim7080g_read_clock(void) {
+	char resp[64] = { 0 };
+	if (esp_modem_at(s_dce, "AT+CCLK?", resp, 3000) != ESP_OK) return;
+
+	const char *p = strstr(resp, "+CCLK: \"");
+	int yy, mo, dd, hh, mi, ss, tz;
+	if (p == NULL || sscanf(p + 8, "%d/%d/%d,%d:%d:%d%d", &yy, &mo, &dd, &hh, &mi, &ss, &tz) != 7) return;
+
+	int64_t unix_s = sim7080g_days(2000 + yy, mo, dd) * 86400 + hh * 3600 + mi * 60 + ss - tz * 15 * 60;
+
+	// Whole seconds, read over a 115200 baud AT exchange.
+	timesync_set(TIMESYNC_MODEM, unix_s * 1000000 + 500000, 1500);
+}
+
+static bool sim7080g_cache_usable(void) {
+	if (s_stats.band == 0 || (s_stats.rat != 1 && s_stats.rat != 2)) return false;
+
+	return CONFIG_SIM7080G_CMNB == 3 || CONFIG_SIM7080G_CMNB == s_stats.rat;
+}
+
+// Radio off, apply RAT/band/power-saving settings, radio on. Uses the cached band/RAT when asked and usable.
+static bool sim7080g_configure(bool use_cache) {
+	char cmd[96];
+	bool cached = use_cache && sim7080g_cache_usable();
+
+	xEventGroupClearBits(s_modem_events, MODEM_BIT_REGISTERED);
+
+	esp_modem_at(s_dce, "AT+CFUN=0", NULL, 5000);
+	esp_modem_at(s_dce, "AT+CNMP=38", NULL, 3000);
+
+	if (cached) {
+		snprintf(cmd, sizeof(cmd), "AT+CMNB=%u", s_stats.rat);
+		esp_modem_at(s_dce, cmd, NULL, 3000);
+		snprintf(cmd, sizeof(cmd), "AT+CBANDCFG=\"%s\",%u", s_stats.rat == 1 ? "CAT-M" : "NB-IOT", s_stats.band);
+		esp_modem_at(s_dce, cmd, NULL, 3000);
+	} else {
+		esp_modem_at(s_dce, "AT+CMNB=" STRINGIFY(CONFIG_SIM7080G_CMNB), NULL, 3000);
+		esp_modem_at(s_dce, "AT+CBANDCFG=\"CAT-M\"," SIM7080G_BANDS_CATM, NULL, 3000);
+		esp_modem_at(s_dce, "AT+CBANDCFG=\"NB-IOT\"," SIM7080G_BANDS_NBIOT, NULL, 3000);
+	}
+
+#if CONFIG_SIM7080G_PSM
+	esp_modem_at(s_dce, "AT+CPSMS=1,,,\"" CONFIG_SIM7080G_PSM_TAU "\",\"" CONFIG_SIM7080G_PSM_ACTIVE "\"", NULL, 3000);
+#else
+	esp_modem_at(s_dce, "AT+CPSMS=0", NULL, 3000);
+#endif
+
+#if CONFIG_SIM7080G_EDRX
+	// AcT type 4 = LTE Cat-M, 5 = NB-IoT.
+	snprintf(cmd, sizeof(cmd), "AT+CEDRXS=1,%d,\"" CONFIG_SIM7080G_EDRX_CYCLE "\"", (cached ? s_stats.rat : CONFIG_SIM7080G_CMNB) == 2 ? 5 : 4);
+	esp_modem_at(s_dce, cmd, NULL, 3000);
+#else
+	esp_modem_at(s_dce, "AT+CEDRXS=0", NULL, 3000);
+#endif
+
+	esp_modem_at(s_dce, "AT+CEREG=1", NULL, 3000);
+	esp_modem_at(s_dce, "AT+CLTS=1", NULL, 3000);
+	esp_modem_at(s_dce, "AT+CFUN=1", NULL, 10000);
+
+	return cached;
+}
+
+// Get the modem registered and ready for data mode. *cold is set when a power-on or radio reconfiguration was needed.
+static esp_err_t sim7080g_bringup(bool *cold) {
+	esp_modem_set_mode(s_dce, ESP_MODEM_MODE_COMMAND);
+
+	if (esp_modem_sync(s_dce) == ESP_OK) {
+		// Warm path: PPP dropped (or the ESP rebooted) but the modem is up and still attached.
+		esp_modem_at(s_dce, "AT+CEREG=1", NULL, 3000);
+		if (sim7080g_wait_registered(5000) == ESP_OK) {
+			*cold = false;
+			sim7080g_read_clock();
+			return ESP_OK;
+		}
+		ESP_LOGI(TAG, "modem on but not registered, reconfiguring radio");
+	} else {
+		xEventGroupClearBits(s_modem_events, MODEM_BIT_CPIN_READY | MODEM_BIT_SMS_READY);
+
+		if (sim7080g_power_on() != ESP_OK) return ESP_ERR_NOT_FOUND;
+
+		// +CPIN: READY / SMS Ready arrive as URCs a moment after AT is answered; query once in case they already went by.
+		char resp[128] = { 0 };
+		if (esp_modem_at(s_dce, "AT+CPIN?", resp, 3000) == ESP_OK && strstr(resp, "READY"))
+			xEventGroupSetBits(s_modem_events, MODEM_BIT_CPIN_READY);
+
+		if (!sim7080g_wait_bits(MODEM_BIT_CPIN_READY, 10000)) ESP_LOGW(TAG, "SIM not ready");
+	}
+
+	*cold = true;
+
+	bool cached = sim7080g_configure(true);
+	esp_err_t err = sim7080g_wait_registered(cached ? SIM7080G_FAST_ATTACH_MS : SIM7080G_FULL_ATTACH_MS);
+
+	if (err != ESP_OK && cached) {
+		ESP_LOGW(TAG, "cached band %u / rat %u did not register, full scan", s_stats.band, s_stats.rat);
+		cached = false;
+		sim7080g_configure(false);
+		err = sim7080g_wait_registered(SIM7080G_FULL_ATTACH_MS);
+	}
+
+	if (err == ESP_OK) {
+		s_stats.last_attach_cached = cached;
+		sim7080g_cache_save();
+		sim7080g_read_clock();
+	}
+
+	return err;
+}
+
+// Owns the SIM7080G lifecycle: bring-up, PPP, and re-bring-up on IP_EVENT_PPP_LOST_IP.
+static void sim7080g_task(void *pvParameters) {
+	for (;;) {
+		int64_t start_us = esp_timer_get_time();
+		xEventGroupClearBits(s_modem_events, MODEM_BIT_PPP_GOT_IP | MODEM_BIT_PPP_LOST_IP);
+
+		bool cold = true;
+		esp_err_t err = sim7080g_bringup(&cold);
+
+		if (err == ESP_ERR_NOT_FOUND) {
+			ESP_LOGE(TAG, "modem not found, skip PPP");
+			vTaskDelete(NULL);
+		}
+
+		if (err != ESP_OK) {
+			vTaskDelay(pdMS_TO_TICKS(SIM7080G_RETRY_MS));
+			continue;
+		}
+
+		esp_modem_set_mode(s_dce, ESP_MODEM_MODE_DATA);
+
+		if (!sim7080g_wait_bits(MODEM_BIT_PPP_GOT_IP, SIM7080G_PPP_TIMEOUT_MS)) {
+			ESP_LOGW(TAG, "PPP did not come up");
+			continue;
+		}
+
+		s_stats.attach_count++;
+		s_stats.last_attach_ms = (uint32_t) ((esp_timer_get_time() - start_us) / 1000);
+		s_stats.last_attach_cold = cold;
+		metric_observe(&s_m_attach_ms, s_stats.last_attach_ms);
+		trace_emit(TRACE_MODEM_PPP_UP, cold, s_stats.last_attach_ms);
+		ESP_LOGI(TAG, "time-to-IP %lu ms (%s, %s)", (unsigned long) s_stats.last_attach_ms, cold ? "cold" : "warm", s_stats.last_attach_cached ? "cached" : "full scan");
+
+		sim7080g_wait_bits(MODEM_BIT_PPP_LOST_IP, portMAX_DELAY);
+		trace_emit(TRACE_MODEM_PPP_DOWN, 0, 0);
+	}
+}
+
+esp_netif_t *sim7080g_start(void) {
+	gpio_set_direction(PIN_SIM7080G_PWR, GPIO_MODE_OUTPUT);
+	gpio_set_level(PIN_SIM7080G_PWR, 0);
+
+	s_modem_events = xEventGroupCreate();
+	sim7080g_cache_load();
+	metrics_register(&s_m_attach_ms);
+
+	esp_modem_dte_config_t dte_config = ESP_MODEM_DTE_DEFAULT_CONFIG();
+	dte_config.uart_config.port_num   = UART_NUM_2;
+	dte_config.uart_config.baud_rate  = 115200;
+	dte_config.uart_config.tx_io_num  = PIN_SIM7080G_TX;
+	dte_config.uart_config.rx_io_num  = PIN_SIM7080G_RX;
+	dte_config.uart_config.rts_io_num = -1;
+	dte_config.uart_config.cts_io_num = -1;
+
+	esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG(CONFIG_SIM7080G_APN);
+
+	esp_netif_config_t netif_cfg = ESP_NETIF_DEFAULT_PPP();
+	esp_netif_t *ppp_netif = esp_netif_new(&netif_cfg);
+	esp_netif_set_route_prio(ppp_netif, 100);
+
+	s_dce = esp_modem_new_dev(ESP_MODEM_DCE_SIM7070, &dte_config, &dce_config, ppp_netif);
+	assert(s_dce);
+
+	esp_modem_set_urc(s_dce, sim7080g_urc_cb);
+
+	esp_event_handler_instance_register(IP_EVENT, IP_EVENT_PPP_GOT_IP, sim7080g_ip_event_handler, NULL, NULL);
+	esp_event_handler_instance_register(IP_EVENT, IP_EVENT_PPP_LOST_IP, sim7080g_ip_event_handler, NULL, NULL);
+
+	xTaskCreatePinnedToCore(sim7080g_task, "sim7080g_task", 4096, NULL, 5, NULL, 0);
+
+	return ppp_netif;
+}
+
+void sim7080g_get_stats(sim7080g_stats_t *out) {
+	*out = s_stats;
+}
@@ -0,0 +1,35 @@
+/*
+ * sim7080g — event-driven SIM7080G bring-up (LTE-M / NB-IoT over PPP).
+ *
+ * Bring-up reacts to the modem's unsolicited result codes (+CPIN, SMS Ready,
+ * +CEREG) instead of sleeping for fixed intervals. The last good operator,
+ * band and RAT are cached in NVS; the next attach first scans only that band
+ * and RAT and falls back to the full configuration if it does not register in
+ * time. On PPP loss the modem is re-entered in command mode and, if it is
+ * still registered, put straight back into data mode without a reset.
+ * PSM and eDRX are optional (menuconfig → VMflow → SIM7080G).
+ */
+#ifndef SIM7080G_H
+#define SIM7080G_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_netif.h>
+
+typedef struct {
+	uint32_t attach_count;      /* PPP sessions established since boot */
+	uint32_t last_attach_ms;    /* bring-up start -> PPP got IP */
+	bool last_attach_cold;      /* last attach needed a power-on or CFUN reset */
+	bool last_attach_cached;    /* last attach registered on the cached band/RAT */
+	char oper[8];               /* cached PLMN, e.g. "72405" */
+	uint8_t band;
+	uint8_t rat;                /* CMNB value: 1 = Cat-M, 2 = NB-IoT */
+} sim7080g_stats_t;
+
+/* Create the PPP netif and the modem DCE, then start the modem task.
+ * Returns the PPP netif for the uplink manager. */
+esp_netif_t *sim7080g_start(void);
+
+void sim7080g_get_stats(sim7080g_stats_t *out);
+
+#endif /* SIM7080G_H */
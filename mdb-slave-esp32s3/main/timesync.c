@@ -0,0 +1,200 @@
+#include "timesync.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_sntp.h>
+
+#include "mqtt-outbox.h"
+
+#define TAG "timesync"
+
+#define TIMESYNC_FLOOR_S        1767225600  // 2026-01-01: anything earlier is a modem RTC default or garbage
+#define TIMESYNC_STALE_S        86400       // after a day without its source, any source may replace the time
+#define TIMESYNC_RTC_MAGIC      0x54494d45
+#define TIMESYNC_RTC_RESET_MS   500         // RC slow clock error across one reset
+#define TIMESYNC_RTC_MAX_MS     5000
+#define TIMESYNC_BROKER_MAX_US  (2 * 1000000LL)  // slower answers are retried: half the trip is the uncertainty
+#define TIMESYNC_BROKER_TRIES   3
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+// Survives software, panic, watchdog and deep-sleep resets; meaningless after power-on.
+typedef struct {
+	uint32_t magic;
+	uint32_t source;
+	uint32_t uncertainty_ms;
+	int64_t set_s;
+} timesync_rtc_t;
+
+static RTC_NOINIT_ATTR timesync_rtc_t s_rtc;
+
+static SemaphoreHandle_t s_lock;
+static timesync_stats_t s_stats;
+static int64_t s_set_us;            // esp_timer time of the last accepted update
+
+static char s_nonce[9];
+static int64_t s_request_us;
+static uint8_t s_request_tries;
+
+static const char *s_source_name[] = {
+	[TIMESYNC_NONE]   = "none",
+	[TIMESYNC_RTC]    = "rtc",
+	[TIMESYNC_MODEM]  = "modem",
+	[TIMESYNC_BROKER] = "broker",
+	[TIMESYNC_SNTP]   = "sntp",
+};
+
+const char *timesync_source_name(timesync_source_t source) {
+	return source <= TIMESYNC_SNTP ? s_source_name[source] : "?";
+}
+
+// Caller holds s_lock. already_set: the clock was set by someone else (SNTP, or the RTC across a reset).
+static bool timesync_apply(timesync_source_t source, int64_t unix_us, uint32_t uncertainty_ms, bool already_set) {
+	if (unix_us / 1000000 < TIMESYNC_FLOOR_S) {
+		ESP_LOGW(TAG, "%s time %lld rejected: implausible", timesync_source_name(source), (long long) (unix_us / 1000000));
+		return false;
+	}
+
+	int64_t now_us = esp_timer_get_time();
+	bool stale = s_stats.source != TIMESYNC_NONE && now_us - s_set_us > TIMESYNC_STALE_S * 1000000LL;
+	if (source < s_stats.source && !stale) return false;
+
+	int64_t step_us = 0;
+	if (!already_set) {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		step_us = unix_us - ((int64_t) tv.tv_sec * 1000000 + tv.tv_usec);
+
+		tv.tv_sec = (time_t) (unix_us / 1000000);
+		tv.tv_usec = (suseconds_t) (unix_us % 1000000);
+		settimeofday(&tv, NULL);
+	}
+
+	if (s_stats.ready_ms == 0) s_stats.ready_ms = (uint32_t) (now_us / 1000);
+	if (s_stats.source != source || s_stats.updates == 0 || step_us > 1000000 || step_us < -1000000) {
+		ESP_LOGI(TAG, "clock from %s (step %lld ms, +/-%lu ms)", timesync_source_name(source), (long long) (step_us / 1000), (unsigned long) uncertainty_ms);
+	}
+
+	s_stats.source = source;
+	s_stats.uncertainty_ms = uncertainty_ms;
+	s_stats.updates++;
+	s_stats.last_step_ms = (int32_t) (step_us / 1000);
+	s_set_us = now_us;
+
+	s_rtc = (timesync_rtc_t) {
+		.magic = TIMESYNC_RTC_MAGIC,
+		.source = source,
+		.uncertainty_ms = uncertainty_ms,
+		.set_s = unix_us / 1000000,
+	};
+
+	return true;
+}
+
+bool timesync_set(timesync_source_t source, int64_t unix_us, uint32_t uncertainty_ms) {
+	xSemaphoreTake(s_lock, portMAX_DELAY);
+	bool ok = timesync_apply(source, unix_us, uncertainty_ms, false);
+	xSemaphoreGive(s_lock);
+
+	return ok;
+}
+
+// lwIP has already stepped the clock when this runs.
+static void timesync_sntp_cb(struct timeval *tv) {
+	xSemaphoreTake(s_lock, portMAX_DELAY);
+	timesync_apply(TIMESYNC_SNTP, (int64_t) tv->tv_sec * 1000000 + tv->tv_usec, 100, true);
+	xSemaphoreGive(s_lock);
+}
+
+void timesync_init(void) {
+	s_lock = xSemaphoreCreateMutex();
+
+	esp_reset_reason_t reason = esp_reset_reason();
+	bool warm = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT && reason != ESP_RST_UNKNOWN;
+	time_t now = time(NULL);
+
+	if (warm && s_rtc.magic == TIMESYNC_RTC_MAGIC && s_rtc.source != TIMESYNC_NONE && now >= s_rtc.set_s) {
+		uint32_t uncertainty_ms = s_rtc.uncertainty_ms + TIMESYNC_RTC_RESET_MS;
+		if (uncertainty_ms > TIMESYNC_RTC_MAX_MS) uncertainty_ms = TIMESYNC_RTC_MAX_MS;
+
+		timesync_apply(TIMESYNC_RTC, (int64_t) now * 1000000, uncertainty_ms, true);
+	} else {
+		s_rtc.magic = 0;
+	}
+
+	esp_sntp_setoperatingmode(ESP_SNTP_OPMODE_POLL);
+	esp_sntp_setservername(0, "pool.ntp.org");
+	sntp_set_time_sync_notification_cb(timesync_sntp_cb);
+	esp_sntp_init();
+}
+
+timesync_source_t timesync_source(void) {
+	return s_stats.source;
+}
+
+int timesync_slack_s(void) {
+	int slack = (int) ((s_stats.uncertainty_ms + 999) / 1000);
+	return slack < TIMESYNC_SLACK_MAX_S ? slack : TIMESYNC_SLACK_MAX_S;
+}
+
+static void timesync_send_request(void) {
+	if (s_stats.source >= TIMESYNC_BROKER) return;
+
+	char topic[64];
+	snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/time", my_subdomain);
+
+	xSemaphoreTake(s_lock, portMAX_DELAY);
+	snprintf(s_nonce, sizeof(s_nonce), "%08lx", (unsigned long) esp_random());
+	s_request_us = esp_timer_get_time();
+	xSemaphoreGive(s_lock);
+
+	mqtt_outbox_publish(OUTBOX_CONTROL, topic, s_nonce, 0, 0);
+}
+
+void timesync_request_broker(void) {
+	s_request_tries = 1;
+	timesync_send_request();
+}
+
+esp_err_t timesync_broker_reply(const char *nonce, uint32_t unix_s) {
+	esp_err_t err = ESP_OK;
+
+	xSemaphoreTake(s_lock, portMAX_DELAY);
+
+	int64_t rtt_us = esp_timer_get_time() - s_request_us;
+
+	if (nonce == NULL || s_nonce[0] == '\0' || strcmp(nonce, s_nonce) != 0) {
+		err = ESP_ERR_INVALID_STATE;
+	} else if (rtt_us > TIMESYNC_BROKER_MAX_US) {
+		err = ESP_ERR_TIMEOUT;
+	} else {
+		// The server truncates to whole seconds: take the middle of that second, plus the trip back.
+		int64_t unix_us = (int64_t) unix_s * 1000000 + 500000 + rtt_us / 2;
+		timesync_apply(TIMESYNC_BROKER, unix_us, (uint32_t) (500 + rtt_us / 2000), false);
+	}
+
+	if (err != ESP_ERR_INVALID_STATE) s_nonce[0] = '\0';
+
+	xSemaphoreGive(s_lock);
+
+	// A slow answer is too uncertain to trust; ask again, the next trip may be quicker.
+	if (err == ESP_ERR_TIMEOUT && s_request_tries < TIMESYNC_BROKER_TRIES) {
+		s_request_tries++;
+		timesync_send_request();
+	}
+	return err;
+}
+
+void timesync_get_stats(timesync_stats_t *out) {
+	*out = s_stats;
+}
@@ -0,0 +1,69 @@
+/*
+ * timesync — layered wall-clock time for the RPC and BLE freshness checks.
+ *
+ * Signed RPCs and BLE credits carry Unix seconds and are rejected when the
+ * clock disagrees, so while the clock still reads 1970 every one of them
+ * fails. SNTP alone can take tens of seconds on a cellular link, and some
+ * carriers block it. The clock is set by whichever source answers first and
+ * afterwards only by a source of equal or higher confidence:
+ *
+ *   rtc     time kept across a warm reboot: IDF keeps the system clock in the
+ *           RTC over software, panic, watchdog and deep-sleep resets
+ *   modem   network time (NITZ) read with AT+CCLK? once the SIM7080G registers
+ *   broker  server time from the backend, HMAC-signed, bound to a nonce the
+ *           device sent and corrected by half the round trip
+ *   sntp    pool.ntp.org, the refinement
+ *
+ * Each update records an uncertainty; the freshness windows are widened by
+ * it (timesync_slack_s()), 2 s at most. A broker answer that took more than
+ * 2 s is dropped and asked for again, up to 3 times per request.
+ */
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#define TIMESYNC_SLACK_MAX_S    2   /* freshness windows never widen by more than this */
+
+typedef enum {
+	TIMESYNC_NONE = 0,
+	TIMESYNC_RTC,
+	TIMESYNC_MODEM,
+	TIMESYNC_BROKER,
+	TIMESYNC_SNTP,
+} timesync_source_t;
+
+typedef struct {
+	timesync_source_t source;
+	uint32_t uncertainty_ms;
+	uint32_t ready_ms;      /* boot -> first time from any source, 0 if not yet */
+	uint32_t updates;       /* accepted updates since boot */
+	int32_t last_step_ms;   /* correction applied by the last update */
+} timesync_stats_t;
+
+/* Restore the clock kept across a warm reboot and start SNTP. Call early in app_main(). */
+void timesync_init(void);
+
+/* Offer a time from `source`. Applied if the source is at least as trusted as the
+ * current one; returns false if it was ignored or implausible. */
+bool timesync_set(timesync_source_t source, int64_t unix_us, uint32_t uncertainty_ms);
+
+timesync_source_t timesync_source(void);
+const char *timesync_source_name(timesync_source_t source);
+
+/* Extra seconds to allow in freshness checks for the current source's uncertainty (0-2). */
+int timesync_slack_s(void);
+
+/* Ask the backend for its time (domain.vmflow.xyz/<sub>/time, payload "<nonce>")
+ * unless the clock already comes from the broker or SNTP. Call when MQTT comes up. */
+void timesync_request_broker(void);
+
+/* Answer to timesync_request_broker(): the signed "time:<nonce>:<unix>" RPC.
+ * ESP_ERR_INVALID_STATE if no request with this nonce is outstanding. */
+esp_err_t timesync_broker_reply(const char *nonce, uint32_t unix_s);
+
+void timesync_get_stats(timesync_stats_t *out);
+
+#endif /* TIMESYNC_H */
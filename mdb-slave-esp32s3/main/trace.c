@@ -0,0 +1,74 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+
+#include "mqtt-outbox.h"
+
+#define TAG "trace"
+
+#define TRACE_MAGIC         "VMTR"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_LEN    28
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+#if CONFIG_VMFLOW_TRACE_RECORDS
+
+trace_ring_t trace_rings[HAL_CORES];
+
+esp_err_t trace_dump(const char *corr) {
+	uint32_t count[HAL_CORES], total = 0, overwritten = 0;
+
+	for (int c = 0; c < HAL_CORES; c++) {
+		uint32_t head = __atomic_load_n(&trace_rings[c].head, __ATOMIC_RELAXED);
+		count[c] = head < CONFIG_VMFLOW_TRACE_RECORDS ? head : CONFIG_VMFLOW_TRACE_RECORDS;
+		overwritten += head - count[c];
+		total += count[c];
+	}
+
+	size_t len = TRACE_HEADER_LEN + total * sizeof(trace_rec_t);
+	uint8_t *buf = malloc(len);
+	if (buf == NULL) return ESP_ERR_NO_MEM;
+
+	uint16_t records = (uint16_t) total;
+	uint64_t now_us = (uint64_t) hal_now_us();
+
+	memcpy(buf, TRACE_MAGIC, 4);
+	buf[4] = TRACE_VERSION;
+	buf[5] = sizeof(trace_rec_t);
+	memcpy(buf + 6, &records, 2);
+	memcpy(buf + 8, &overwritten, 4);
+	memcpy(buf + 12, &now_us, 8);
+	memset(buf + 20, 0, 8);
+	memcpy(buf + 20, corr, strnlen(corr, 8));
+
+	// Oldest first per core; the decoder merges the cores by timestamp.
+	trace_rec_t *out = (trace_rec_t *) (buf + TRACE_HEADER_LEN);
+	for (int c = 0; c < HAL_CORES; c++) {
+		uint32_t head = __atomic_load_n(&trace_rings[c].head, __ATOMIC_RELAXED);
+		for (uint32_t i = head - count[c]; i != head; i++) {
+			*out++ = trace_rings[c].rec[i & (CONFIG_VMFLOW_TRACE_RECORDS - 1)];
+		}
+	}
+
+	char topic[64];
+	snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/rpc/trace", my_subdomain);
+
+	bool queued = mqtt_outbox_publish(OUTBOX_BULK, topic, (const char *) buf, len, 0);
+	free(buf);
+
+	ESP_LOGI(TAG, "dump: %u records, %lu overwritten, %u B", (unsigned) total, (unsigned long) overwritten, (unsigned) len);
+	return queued ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+#else
+
+esp_err_t trace_dump(const char *corr) {
+	return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * trace — binary event trace for field debugging, dumped on request.
+ *
+ * Hot paths (the MDB state machine, BLE callbacks, MQTT events, the modem
+ * task) record what happened as fixed-size binary records instead of log
+ * lines:
+ *
+ *   trace_emit(TRACE_MDB_VEND_REQUEST, item_price, item_number);
+ *
+ * A record is a timestamp, an event id and two arguments, 12 bytes. Each core
+ * has its own ring of CONFIG_VMFLOW_TRACE_RECORDS records; an emit costs one
+ * atomic add on the core's ring head, a systimer read and three stores, with
+ * no lock, no formatting and no UART wait, so it is safe in the MDB reply
+ * window and from ISRs. The oldest records are overwritten.
+ *
+ * The signed `trace` RPC publishes the rings as one binary message on
+ * domain.vmflow.xyz/<sub>/rpc/trace (bulk class), little-endian:
+ *
+ *   "VMTR" | u8 version (1) | u8 record size (12) | u16 records |
+ *   u32 overwritten | u64 esp_timer now (us) | char corr[8] | records...
+ *
+ *   record: u32 esp_timer us (low 32 bits) | u8 event | u8 core | u16 a | u32 b
+ *
+ * tools/trace-decode.py turns a dump into a timeline. It reads the event
+ * names and argument formats from TRACE_EVENTS below, so new events only
+ * need a line here. Append: ids are positions in this list.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <sdkconfig.h>
+
+#include "hal.h"
+
+/* X(name, decoder format over {a}, {b} and {b4} = b as 4 ASCII chars) */
+#define TRACE_EVENTS(X) \
+	X(MDB_RESET,         "") \
+	X(MDB_SETUP,         "feature_level={a}") \
+	X(MDB_PRICES,        "max={a} min={b}") \
+	X(MDB_VEND_REQUEST,  "price={a} item={b}") \
+	X(MDB_VEND_CANCEL,   "") \
+	X(MDB_VEND_SUCCESS,  "price={a} item={b}") \
+	X(MDB_VEND_FAILURE,  "price={a} item={b}") \
+	X(MDB_SESSION_END,   "") \
+	X(MDB_CASH_SALE,     "price={a} item={b}") \
+	X(MDB_READER,        "disable/enable/cancel={a}") \
+	X(MDB_REQUEST_ID,    "") \
+	X(MDB_REPLY,         "code=0x{a:02x} len={b}") \
+	X(MDB_CHK_ERR,       "sum=0x{a:02x} got=0x{b:03x}") \
+	X(BLE_CONNECT,       "conn={a} status={b}") \
+	X(BLE_DISCONNECT,    "conn={a} reason=0x{b:x}") \
+	X(BLE_WRITE,         "cmd=0x{a:02x} len={b}") \
+	X(BLE_PAX,           "devices={b}") \
+	X(MQTT_CONNECTED,    "resumed={a}") \
+	X(MQTT_DISCONNECTED, "") \
+	X(MQTT_DATA,         "topic_len={a} len={b}") \
+	X(MQTT_PUBLISHED,    "msg_id={b}") \
+	X(RPC_RUN,           "cmd={b4} err=0x{a:x}") \
+	X(MODEM_CEREG,       "stat={a}") \
+	X(MODEM_PPP_UP,      "cold={a} attach_ms={b}") \
+	X(MODEM_PPP_DOWN,    "") \
+	X(BLE_SCAN,          "mode={a} duty={b}%") \
+	X(BLE_CMD,           "cmd=0x{a:02x} err=0x{b:x}") \
+	X(DEX_BLE,           "state={a} off={b}")
+
+#define TRACE_ENUM(name, fmt) TRACE_##name,
+typedef enum {
+	TRACE_EVENTS(TRACE_ENUM)
+	TRACE_EVENT_MAX
+} trace_event_t;
+#undef TRACE_ENUM
+
+typedef struct {
+	uint32_t ts_us;
+	uint8_t event;
+	uint8_t core;
+	uint16_t a;
+	uint32_t b;
+} trace_rec_t;
+
+#if CONFIG_VMFLOW_TRACE_RECORDS
+
+_Static_assert((CONFIG_VMFLOW_TRACE_RECORDS & (CONFIG_VMFLOW_TRACE_RECORDS - 1)) == 0, "VMFLOW_TRACE_RECORDS must be a power of two");
+
+typedef struct {
+	uint32_t head;      /* records ever written; the slot is head % CONFIG_VMFLOW_TRACE_RECORDS */
+	trace_rec_t rec[CONFIG_VMFLOW_TRACE_RECORDS];
+} trace_ring_t;
+
+extern trace_ring_t trace_rings[HAL_CORES];
+
+static inline void trace_emit(trace_event_t event, uint16_t a, uint32_t b) {
+	uint8_t core = hal_core_id();
+	trace_ring_t *ring = &trace_rings[core];
+
+	// The add claims the slot, so a task or ISR preempting this one on the same core takes the next.
+	uint32_t i = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) & (CONFIG_VMFLOW_TRACE_RECORDS - 1);
+	ring->rec[i] = (trace_rec_t) { (uint32_t) hal_now_us(), event, core, a, b };
+}
+
+#else
+
+static inline void trace_emit(trace_event_t event, uint16_t a, uint32_t b) {
+}
+
+#endif
+
+#ifdef ESP_PLATFORM
+#include <esp_err.h>
+
+/* Publish the rings on .../rpc/trace, tagged with the request's corr. ESP_ERR_NOT_SUPPORTED
+ * when tracing is compiled out. Records keep being written while the dump is copied. */
+esp_err_t trace_dump(const char *corr);
+#endif
+
+#endif /* TRACE_H */
@@ -0,0 +1,322 @@
+#include "uplink.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+#include <net/if.h>
+#include <sdkconfig.h>
+
+#include "rpc-auth.h"
+#include "mqtt-outbox.h"
+#include "mqtt-session.h"
+
+#define TAG "uplink"
+
+#define UPLINK_BROKER_HOST          "mqtt.vmflow.xyz"
+#define UPLINK_BROKER_PORT          1883
+
+// The active link is judged by the MQTT session on it: while the session is up and its QoS 1
+// publishes are acknowledged in time, nothing else is sent. A TCP connect to the broker, bound
+// to the interface, probes the standby, and the active link only once its session is in trouble.
+#define UPLINK_CHECK_US             (500 * 1000)        // how often the session's health is read
+#define UPLINK_PROBE_ACTIVE_US      (10000 * 1000)      // active link with its session down: esp-mqtt retries every 15 s
+#define UPLINK_PROBE_RETRY_US       (250 * 1000)
+#define UPLINK_PROBE_STANDBY_US     (60000 * 1000)      // often enough to keep its NAT binding warm
+
+// On Wi-Fi, airtime is free: a QoS 1 heartbeat keeps a PUBACK always in flight, so a link that
+// goes silent misses its 1 s deadline even when there is nothing else to send. Cellular relies on
+// real traffic and the MQTT keepalive, and its standby is not probed under PSM: the modem sleeps.
+#define UPLINK_HEARTBEAT_US         (500 * 1000)
+#define UPLINK_HEARTBEAT_TOPIC      "%s.vmflow.xyz/hb"  // write-only, nobody subscribes
+#define UPLINK_PROBE_NEVER          INT64_MAX
+
+#define UPLINK_FAIL_THRESHOLD       2   // consecutive failed probes before a link is considered down
+#define UPLINK_FAILBACK_OKS         3   // consecutive good Wi-Fi probes before leaving PPP (~3 min)
+
+// Route priorities: the active link always outranks the standby (esp_netif picks the default netif by prio).
+#define UPLINK_PRIO_ACTIVE          250
+#define UPLINK_PRIO_STANDBY         50
+
+// Owned by the main translation unit.
+extern char my_subdomain[];
+
+typedef struct {
+	esp_netif_t *netif;
+	int probe_timeout_ms;
+	uint32_t ack_timeout_ms;    // longest PUBACK wait the active link's session may see
+	bool has_ip;
+	uint8_t fails;
+	uint8_t oks;
+	int32_t rtt_ms;
+	int64_t next_probe_us;
+	uint32_t probe_failures;
+} uplink_state_t;
+
+typedef struct {
+	uplink_t link;
+	bool has_ip;
+} uplink_event_t;
+
+static const char *s_name[UPLINK_MAX] = { "none", "wifi", "ppp" };
+
+static uplink_state_t s_link[UPLINK_MAX];
+static volatile uplink_t s_active = UPLINK_NONE;
+static volatile uint32_t s_switches;
+
+static bool s_mqtt_started;
+
+static QueueHandle_t s_event_queue;
+static TaskHandle_t s_task;
+
+static struct sockaddr_in s_broker;
+static int64_t s_broker_resolved_us;
+
+static int64_t s_heartbeat_us;
+
+const char *uplink_name(uplink_t link) {
+	return link < UPLINK_MAX ? s_name[link] : "?";
+}
+
+// Resolve the broker once and re-resolve every 10 min; a stale address beats none while the active link is failing.
+static bool uplink_resolve_broker(void) {
+	int64_t now = esp_timer_get_time();
+	if (s_broker_resolved_us != 0 && now - s_broker_resolved_us < 600LL * 1000 * 1000) return true;
+
+	struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *res = NULL;
+
+	if (getaddrinfo(UPLINK_BROKER_HOST, NULL, &hints, &res) != 0 || res == NULL) {
+		return s_broker_resolved_us != 0;
+	}
+
+	memcpy(&s_broker, res->ai_addr, sizeof(s_broker));
+	s_broker.sin_port = htons(UPLINK_BROKER_PORT);
+	freeaddrinfo(res);
+
+	s_broker_resolved_us = now;
+	return true;
+}
+
+// Keep one QoS 1 publish in flight on an idle Wi-Fi session: queued into esp-mqtt, so this task never blocks on the socket.
+static void uplink_heartbeat(const mqtt_session_health_t *h, int64_t now) {
+	if (h->ack_wait_ms > 0 || now - s_heartbeat_us < UPLINK_HEARTBEAT_US) return;
+	if (strcmp(mqtt_session_transport(), "mqtt") != 0) return;     // an MQTT-SN QoS 1 publish waits for its PUBACK
+
+	char topic[64];
+	snprintf(topic, sizeof(topic), UPLINK_HEARTBEAT_TOPIC, my_subdomain);
+	mqtt_session_publish(topic, "", 0, 1, 0, true);
+	s_heartbeat_us = now;
+}
+
+// The session vouches for the active link while it is connected and not waiting on a PUBACK for too long.
+static bool uplink_session_healthy(uplink_t link, uplink_state_t *st, int64_t now) {
+	mqtt_session_health_t h;
+	mqtt_session_get_health(&h);
+	if (!h.connected || h.ack_wait_ms >= st->ack_timeout_ms) return false;
+
+	if (h.rtt_ms >= 0) st->rtt_ms = h.rtt_ms;
+	if (link == UPLINK_WIFI) uplink_heartbeat(&h, now);
+	return true;
+}
+
+// Next probe of a link after a probe; under PSM the cellular standby waits until it is needed.
+static int64_t uplink_next_probe(uplink_t link, const uplink_state_t *st, int64_t now) {
+	if (st->fails > 0 && st->fails < UPLINK_FAIL_THRESHOLD) return now + UPLINK_PROBE_RETRY_US;
+	if (link == s_active) return now + UPLINK_PROBE_ACTIVE_US;
+#if CONFIG_SIM7080G_PSM
+	if (link == UPLINK_PPP) return UPLINK_PROBE_NEVER;
+#endif
+	return now + UPLINK_PROBE_STANDBY_US;
+}
+
+// Broker RTT probe: non-blocking TCP connect bound to the link's interface. Returns RTT in ms, or -1.
+static int32_t uplink_probe(uplink_state_t *st) {
+	if (!uplink_resolve_broker()) return -1;
+
+	int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	if (sock < 0) return -1;
+
+	struct ifreq ifr = { 0 };
+	esp_netif_get_netif_impl_name(st->netif, ifr.ifr_name);
+	setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, &ifr, sizeof(ifr));
+
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+	int32_t rtt_ms = -1;
+	int64_t t0 = esp_timer_get_time();
+
+	if (connect(sock, (struct sockaddr *) &s_broker, sizeof(s_broker)) == 0 || errno == EINPROGRESS) {
+		fd_set wfds;
+		FD_ZERO(&wfds);
+		FD_SET(sock, &wfds);
+		struct timeval tv = { .tv_sec = st->probe_timeout_ms / 1000, .tv_usec = (st->probe_timeout_ms % 1000) * 1000 };
+
+		int so_error = -1;
+		socklen_t so_len = sizeof(so_error);
+
+		if (select(sock + 1, NULL, &wfds, NULL, &tv) == 1 && getsockopt(sock, SOL_SOCKET, SO_ERROR, &so_error, &so_len) == 0 && so_error == 0) {
+			rtt_ms = (int32_t) ((esp_timer_get_time() - t0) / 1000);
+		}
+	}
+
+	close(sock);
+	return rtt_ms;
+}
+
+static bool uplink_healthy(uplink_t link) {
+	const uplink_state_t *st = &s_link[link];
+	return st->has_ip && st->oks > 0 && st->fails < UPLINK_FAIL_THRESHOLD;
+}
+
+static uplink_t uplink_pick(void) {
+	if (s_active != UPLINK_NONE && uplink_healthy(s_active)) {
+		// Fail back to Wi-Fi only once it has been stable for a while, to avoid flapping.
+		if (s_active == UPLINK_PPP && uplink_healthy(UPLINK_WIFI) && s_link[UPLINK_WIFI].oks >= UPLINK_FAILBACK_OKS)
+			return UPLINK_WIFI;
+
+		return s_active;
+	}
+
+	if (uplink_healthy(UPLINK_WIFI)) return UPLINK_WIFI;
+	if (uplink_healthy(UPLINK_PPP)) return UPLINK_PPP;
+
+	return s_active;
+}
+
+static void uplink_publish_change(uplink_t link) {
+	char topic[64], msg[64], line[160];
+	snprintf(msg, sizeof(msg), "%s,%lu,%ld:%lld", s_name[link], (unsigned long) s_switches, (long) s_link[link].rtt_ms, (long long) time(NULL));
+	rpc_sign_text(msg, line, sizeof(line));
+
+	snprintf(topic, sizeof(topic), "domain.vmflow.xyz/%s/uplink", my_subdomain);
+	mqtt_outbox_publish(OUTBOX_TELEMETRY, topic, line, 0, 0);
+}
+
+static void uplink_activate(uplink_t link) {
+	uplink_t prev = s_active;
+
+	for (int l = UPLINK_WIFI; l < UPLINK_MAX; l++) {
+		if (s_link[l].netif) esp_netif_set_route_prio(s_link[l].netif, l == link ? UPLINK_PRIO_ACTIVE : UPLINK_PRIO_STANDBY);
+	}
+
+	s_active = link;
+	if (prev != UPLINK_NONE) s_switches++;
+
+	ESP_LOGW(TAG, "uplink %s -> %s (rtt %ld ms)", s_name[prev], s_name[link], (long) s_link[link].rtt_ms);
+
+	if (!s_mqtt_started) {
+		mqtt_session_start();
+		s_mqtt_started = true;
+	} else {
+		mqtt_session_reconnect();
+	}
+
+	uplink_publish_change(link);
+}
+
+static void uplink_task(void *arg) {
+	for (;;) {
+		uplink_event_t ev;
+		while (xQueueReceive(s_event_queue, &ev, 0) == pdTRUE) {
+			uplink_state_t *st = &s_link[ev.link];
+
+			st->has_ip = ev.has_ip;
+			st->oks = 0;
+			st->fails = ev.has_ip ? 0 : UPLINK_FAIL_THRESHOLD;
+			st->rtt_ms = -1;
+			st->next_probe_us = 0;
+		}
+
+		int64_t now = esp_timer_get_time();
+		int64_t next_us = now + UPLINK_PROBE_STANDBY_US;
+
+		for (int l = UPLINK_WIFI; l < UPLINK_MAX; l++) {
+			uplink_state_t *st = &s_link[l];
+			if (st->netif == NULL || !st->has_ip) continue;
+
+			if (l == s_active && s_mqtt_started && uplink_session_healthy(l, st, now)) {
+				st->fails = 0;
+				if (st->oks == 0) st->oks = 1;
+				st->next_probe_us = 0;  // probed at once when the session runs into trouble
+
+				if (now + UPLINK_CHECK_US < next_us) next_us = now + UPLINK_CHECK_US;
+				continue;
+			}
+
+			// The session's trouble is the first failure: one failed probe confirms it.
+			if (l == s_active && s_mqtt_started && st->next_probe_us == 0 && st->fails == 0) st->fails = 1;
+
+			// A standby left unprobed (PSM) is probed once the active link is down; Wi-Fi, checked first, is up to date.
+			if (st->next_probe_us == UPLINK_PROBE_NEVER && !uplink_healthy(s_active)) st->next_probe_us = 0;
+
+			if (now >= st->next_probe_us) {
+				st->rtt_ms = uplink_probe(st);
+
+				if (st->rtt_ms >= 0) {
+					st->fails = 0;
+					if (st->oks < UINT8_MAX) st->oks++;
+				} else {
+					st->oks = 0;
+					if (st->fails < UINT8_MAX) st->fails++;
+					st->probe_failures++;
+				}
+
+				now = esp_timer_get_time();
+				st->next_probe_us = uplink_next_probe(l, st, now);
+			}
+
+			if (st->next_probe_us < next_us) next_us = st->next_probe_us;
+		}
+
+		uplink_t best = uplink_pick();
+		if (best != UPLINK_NONE && best != s_active) {
+			uplink_activate(best);
+			continue;
+		}
+
+		int64_t wait_us = next_us - esp_timer_get_time();
+		ulTaskNotifyTake(pdTRUE, wait_us > 0 ? pdMS_TO_TICKS(wait_us / 1000) + 1 : 0);
+	}
+}
+
+void uplink_init(esp_netif_t *wifi, esp_netif_t *ppp) {
+	s_link[UPLINK_WIFI] = (uplink_state_t) { .netif = wifi, .probe_timeout_ms = 500, .ack_timeout_ms = 1000, .rtt_ms = -1 };
+	s_link[UPLINK_PPP]  = (uplink_state_t) { .netif = ppp,  .probe_timeout_ms = 1500, .ack_timeout_ms = 8000, .rtt_ms = -1 };
+
+	// A link may already have its address if DHCP finished before the manager started.
+	for (int l = UPLINK_WIFI; l < UPLINK_MAX; l++) {
+		esp_netif_ip_info_t ip_info;
+		if (s_link[l].netif && esp_netif_get_ip_info(s_link[l].netif, &ip_info) == ESP_OK && ip_info.ip.addr != 0)
+			s_link[l].has_ip = true;
+	}
+
+	s_event_queue = xQueueCreate(8, sizeof(uplink_event_t));
+
+	xTaskCreatePinnedToCore(uplink_task, "uplink", 4096, NULL, 5, &s_task, 0);
+}
+
+void uplink_set_ip(uplink_t link, bool has_ip) {
+	if (s_event_queue == NULL || link == UPLINK_NONE || link >= UPLINK_MAX) return;
+
+	uplink_event_t ev = { .link = link, .has_ip = has_ip };
+	xQueueSend(s_event_queue, &ev, 0);
+	xTaskNotifyGive(s_task);
+}
+
+void uplink_get_stats(uplink_stats_t *out) {
+	memset(out, 0, sizeof(*out));
+
+	out->active = s_active;
+	out->switches = s_switches;
+	for (int l = UPLINK_WIFI; l < UPLINK_MAX; l++) {
+		out->rtt_ms[l] = s_link[l].has_ip ? s_link[l].rtt_ms : -1;
+		out->probe_failures[l] = s_link[l].probe_failures;
+	}
+}
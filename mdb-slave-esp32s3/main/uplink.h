@@ -0,0 +1,54 @@
+/*
+ * uplink — hot-standby link manager for Wi-Fi and SIM7080G PPP.
+ *
+ * Both uplinks are kept up independently and the MQTT session stays on the
+ * best healthy one. The active link is judged by the session itself: it is
+ * healthy while the session is connected and its QoS 1 publishes get their
+ * PUBACK within 1 s on Wi-Fi (8 s over PPP). On Wi-Fi a QoS 1 heartbeat on
+ * .../hb keeps a publish in flight every 500 ms, so even an idle link that
+ * goes silent misses a deadline within about a second. Only then is the
+ * active link probed with a TCP connect to the broker, bound to its
+ * interface; the session's trouble counts as the first failure, so one
+ * failed probe (500 / 1500 ms timeout) marks it down. Over PPP there is no
+ * heartbeat and the MQTT keepalive stays at 120 s, so the modem can sleep: an
+ * idle cellular link that dies silently is noticed by real traffic or the
+ * keepalive. The standby is probed once a minute, except the cellular one
+ * with PSM enabled, which is probed when it gets its address and again only
+ * once Wi-Fi is down. The session is moved by re-prioritising the default
+ * route and reconnecting MQTT — no modem reset.
+ * Wi-Fi is preferred when both are healthy, and taken back from PPP after
+ * three good probes in a row.
+ */
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_netif.h>
+
+typedef enum {
+	UPLINK_NONE = 0,
+	UPLINK_WIFI,
+	UPLINK_PPP,
+	UPLINK_MAX
+} uplink_t;
+
+typedef struct {
+	uplink_t active;
+	uint32_t switches;                  /* active-link changes since boot */
+	int32_t rtt_ms[UPLINK_MAX];         /* PUBACK RTT on the active link, last probe RTT on the standby; -1 if down or failing */
+	uint32_t probe_failures[UPLINK_MAX];
+} uplink_stats_t;
+
+/* Start the link manager. It owns mqtt_session_start(): the session is
+ * started as soon as the first link passes a probe. */
+void uplink_init(esp_netif_t *wifi, esp_netif_t *ppp);
+
+/* Report IP gained/lost on a link. Call from the IP event handler. */
+void uplink_set_ip(uplink_t link, bool has_ip);
+
+void uplink_get_stats(uplink_stats_t *out);
+
+const char *uplink_name(uplink_t link);
+
+#endif /* UPLINK_H */
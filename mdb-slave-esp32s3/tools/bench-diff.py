@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+#
+# bench-diff.py — compare two core benchmark runs (main/core-bench.h).
+#
+# A run is the JSON lines core-bench prints: the -o file of the host build,
+# or a board's console log with CONFIG_VMFLOW_BENCH (other log lines are
+# skipped). Kernels are matched by name and compared on their median time,
+# in cycles when both runs have them, else in ns:
+#   build-host/core-bench -o before.json
+#   ... change, rebuild ...
+#   build-host/core-bench -o after.json
+#   ./bench-diff.py before.json after.json            # exit 1 on a >10% regression
+#   idf.py monitor | tee boot.log; ./bench-diff.py board-v1.4.log boot.log -t 5
+#
+# Host timings move a few percent from run to run; compare runs from the same
+# machine, and use -t to set how much slower counts as a regression.
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    header, kernels = {}, {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            start = line.find("{")
+            if start < 0:
+                continue
+            try:
+                obj = json.loads(line[start:])
+            except ValueError:
+                continue
+            if "bench" in obj:
+                header = obj
+            elif "kernel" in obj:
+                kernels[obj["kernel"]] = obj
+    return header, kernels
+
+
+def main():
+    ap = argparse.ArgumentParser(description="core benchmark comparison")
+    ap.add_argument("before")
+    ap.add_argument("after")
+    ap.add_argument("-t", "--threshold", type=float, default=10.0, help="regression threshold, %% slower (10)")
+    a = ap.parse_args()
+
+    hb, before = load(a.before)
+    ha, after = load(a.after)
+    if hb.get("target") != ha.get("target"):
+        print(f"warning: comparing {hb.get('target', '?')} with {ha.get('target', '?')}", file=sys.stderr)
+
+    regressions = 0
+    print(f"{'kernel':<22} {'before':>12} {'after':>12} {'change':>8}")
+    for name in list(before) + [k for k in after if k not in before]:
+        b, n = before.get(name), after.get(name)
+        if b is None or n is None:
+            print(f"{name:<22} {'-' if b is None else 'only before':>12} {'-' if n is None else 'only after':>12}")
+            continue
+
+        unit = "cycles_p50" if "cycles_p50" in b and "cycles_p50" in n else "ns_p50"
+        change = (n[unit] / b[unit] - 1) * 100 if b[unit] else 0.0
+        flag = ""
+        if change > a.threshold:
+            flag = "  slower"
+            regressions += 1
+        elif change < -a.threshold:
+            flag = "  faster"
+        print(f"{name:<22} {b[unit]:>12.1f} {n[unit]:>12.1f} {change:>+7.1f}%{flag}")
+
+    print(f"\n{regressions} kernel(s) more than {a.threshold:g}% slower, on the median")
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+#
+# dex-ble-standin.py — host stand-in for the DEX-over-BLE transfer (main/dex-ble.c).
+#
+# A connection-event model of the BLE link carries the dex_ble notification
+# stream to a scripted phone: start, MTU-sized chunks paced by credits, end with
+# the signed digest. The phone grants credits in v2 frames (main/ble-cmd.h)
+# when half its window is used, reassembles the audit by offset, and checks
+# the SHA-256/HMAC digest the way the backend would once it forwards the audit.
+# A scenario can drop the link part-way; the phone then reconnects and resumes
+# from the bytes it holds, with the audit ID.
+#
+# The link model: per connection event, the central and the peripheral swap
+# packets (T_IFS 150 us apart, empty when one side has nothing) until the
+# event length or the phone's packets-per-event cap is reached. Notifications
+# are L2CAP-fragmented to the LL data length; the board's host holds at most
+# --host-bufs notifications in flight (the mbuf pool ble_notify_send() retries
+# on). Times are simulated, not measured on a radio.
+#
+# Usage:
+#   ./dex-ble-standin.py                       # all links, 20 KB audit
+#   ./dex-ble-standin.py --size 8000 --credits 8 --drop 0.5
+
+import argparse
+import hashlib
+import hmac
+import os
+import struct
+
+T_IFS = 150e-6
+ATT_NOTIFY_HDR = 3
+L2CAP_HDR = 4
+V2_TAG = 16
+
+DEX_BLE_START, DEX_BLE_CHUNK, DEX_BLE_END = 0x0f, 0x10, 0x11
+DEX_BLE_CREDITS_MAX = 32
+
+PASSKEY = b"route-passkey-0001"
+
+# name: (ATT MTU, LL data length, PHY Mb/s, connection interval s)
+LINKS = {
+    "mtu23-1M":     (23, 27, 1, 0.030),
+    "mtu247-1M":    (247, 27, 1, 0.030),
+    "dle-1M":       (247, 251, 1, 0.030),
+    "dle-2M":       (247, 251, 2, 0.030),
+    "dle-2M-15ms":  (247, 251, 2, 0.015),
+}
+
+
+def airtime(payload, phy):
+    preamble = 2 if phy == 2 else 1
+    return (preamble + 4 + 2 + 3 + payload) * 8 / (phy * 1e6)
+
+
+def fragments(att_len, dle):
+    sdu = att_len + L2CAP_HDR
+    out = []
+    while sdu > 0:
+        out.append(min(sdu, dle))
+        sdu -= out[-1]
+    return out
+
+
+def sign(audit_id, ts, data):
+    msg = struct.pack(">III", len(data), audit_id, ts) + hashlib.sha256(data).digest()
+    return hmac.new(PASSKEY, msg, hashlib.sha256).digest()
+
+
+class Board:
+    """main/dex-ble.c: one transfer, chunks while there is credit, end without credit."""
+
+    def __init__(self, audit, audit_id, ts, mtu, host_bufs):
+        self.audit, self.id, self.ts = audit, audit_id, ts
+        self.mtu = mtu
+        self.host_bufs = host_bufs
+        self.queue = []             # notifications handed to the host, not yet on air
+        self.offset = None
+        self.credits = 0
+
+    def pull(self, offset, credits, audit_id):
+        if self.mtu < 64 or offset > len(self.audit) or (offset and audit_id != self.id):
+            return False
+        self.offset, self.credits = offset, min(credits, DEX_BLE_CREDITS_MAX)
+        self.queue.append(struct.pack(">BIIII", DEX_BLE_START, len(self.audit), self.id, self.ts, offset))
+        return True
+
+    def credit(self, n):
+        if self.offset is not None:
+            self.credits = min(self.credits + n, DEX_BLE_CREDITS_MAX)
+
+    def refill(self):
+        while self.offset is not None and len(self.queue) < self.host_bufs:
+            if self.offset == len(self.audit):
+                self.queue.append(struct.pack(">BIII", DEX_BLE_END, len(self.audit), self.id, self.ts) + sign(self.id, self.ts, self.audit))
+                self.offset = None
+            elif self.credits:
+                n = min(self.mtu - 3 - 5, len(self.audit) - self.offset)
+                self.queue.append(struct.pack(">BI", DEX_BLE_CHUNK, self.offset) + self.audit[self.offset:self.offset + n])
+                self.offset += n
+                self.credits -= 1
+            else:
+                break
+
+
+class Phone:
+    """A route app: v2 pull, credit refills at half window, reassembly, digest check."""
+
+    def __init__(self, window):
+        self.window = window
+        self.buf = bytearray()
+        self.size = None
+        self.id = 0
+        self.ts = 0
+        self.since_grant = 0
+        self.done = False
+        self.valid = False
+        self.writes = []            # v2 frames waiting for a connection event
+
+    def v2_frame(self, records):
+        body = bytes([0xb2]) + struct.pack(">I", 1) + b"".join(bytes([c, len(a)]) + a for c, a in records)
+        return body + bytes(V2_TAG)
+
+    def pull_frame(self):
+        return self.v2_frame([(0x08, struct.pack(">IBI", len(self.buf), self.window, self.id))])
+
+    def notified(self, value):
+        kind = value[0]
+        if kind == DEX_BLE_START:
+            size, audit_id, ts, offset = struct.unpack(">IIII", value[1:17])
+            assert offset == len(self.buf)
+            self.size, self.id, self.ts = size, audit_id, ts
+        elif kind == DEX_BLE_CHUNK:
+            (offset,) = struct.unpack(">I", value[1:5])
+            assert offset == len(self.buf), "chunk out of order"
+            self.buf += value[5:]
+            self.since_grant += 1
+            if self.since_grant >= self.window // 2:
+                self.writes.append(self.v2_frame([(0x09, bytes([self.since_grant]))]))
+                self.since_grant = 0
+        elif kind == DEX_BLE_END:
+            size, audit_id, ts = struct.unpack(">III", value[1:13])
+            self.valid = size == len(self.buf) and value[13:45] == sign(audit_id, ts, bytes(self.buf))
+            self.done = True
+
+
+def run(link, size, window, host_bufs, max_pkts, drop, reconnect_s, cmd_s):
+    mtu, dle, phy, itvl = link
+    audit = bytes(os.urandom(size))
+    board = Board(audit, 0x1234abcd, 1760000000, mtu, host_bufs)
+    phone = Phone(window)
+    if not board.pull(0, window, 0):
+        return None
+
+    t = 0.0
+    dropped = drop is None
+    rx_frags = []                   # fragments of the notification being received
+    tx_frags = []                   # fragments of the phone's write being sent
+    credit_at = []                  # (time, credits): ble_cmd worker latency
+    air = 0.0
+
+    while not phone.done:
+        if not dropped and len(phone.buf) >= drop * size:
+            # Link lost: the board drops the transfer; the phone reconnects and resumes.
+            dropped = True
+            board.queue.clear()
+            board.offset = None
+            rx_frags, tx_frags, credit_at = [], [], []
+            phone.writes.clear()
+            phone.since_grant = 0
+            t += reconnect_s
+            if not board.pull(len(phone.buf), window, phone.id):
+                return None
+            continue
+
+        for at, n in [c for c in credit_at if c[0] <= t]:
+            board.credit(n)
+        credit_at = [c for c in credit_at if c[0] > t]
+        board.refill()
+
+        # One connection event.
+        used, pkts = 0.0, 0
+        while pkts < max_pkts:
+            if not tx_frags and phone.writes:
+                tx_frags = fragments(len(phone.writes[0]) + 3, dle)
+            if not rx_frags and board.queue:
+                rx_frags = fragments(len(board.queue[0]) + ATT_NOTIFY_HDR, dle)
+
+            c = tx_frags[0] if tx_frags else 0
+            p = rx_frags[0] if rx_frags else 0
+            cost = airtime(c, phy) + T_IFS + airtime(p, phy) + T_IFS
+            if used + cost > itvl - T_IFS or (pkts and not c and not p):
+                break
+            used += cost
+            air += cost
+            pkts += 1
+
+            if tx_frags:
+                tx_frags.pop(0)
+                if not tx_frags:
+                    frame = phone.writes.pop(0)
+                    credit_at.append((t + used + cmd_s, frame[7]))
+            if rx_frags:
+                rx_frags.pop(0)
+                if not rx_frags:
+                    phone.notified(board.queue.pop(0))
+                    board.refill()
+        t += itvl
+
+    return t, phone.valid, air / t
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--size", type=int, default=20 * 1024, help="audit bytes (default %(default)s)")
+    ap.add_argument("--credits", type=int, default=16, help="phone credit window (default %(default)s)")
+    ap.add_argument("--host-bufs", type=int, default=8, help="notifications the board's host holds (default %(default)s)")
+    ap.add_argument("--max-pkts", type=int, default=6, help="phone packets per connection event (default %(default)s)")
+    ap.add_argument("--drop", type=float, help="drop the link after this fraction of the audit, then resume")
+    ap.add_argument("--reconnect-ms", type=float, default=800, help="reconnect + MTU/PHY + pull (default %(default)s)")
+    ap.add_argument("--cmd-ms", type=float, default=2, help="ble_cmd worker: verify a v2 frame (default %(default)s)")
+    ap.add_argument("--link", choices=sorted(LINKS), action="append")
+    args = ap.parse_args()
+
+    print("%-12s %8s %10s %8s %6s" % ("link", "time s", "kB/s", "airtime", "sig"))
+    for name in args.link or LINKS:
+        r = run(LINKS[name], args.size, args.credits, args.host_bufs, args.max_pkts, args.drop, args.reconnect_ms / 1000, args.cmd_ms / 1000)
+        if r is None:
+            print("%-12s %8s" % (name, "refused"))
+            continue
+        t, valid, duty = r
+        print("%-12s %8.2f %10.1f %7.0f%% %6s" % (name, t, args.size / 1024 / t, duty * 100, "ok" if valid else "BAD"))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+#
+# fleet-rpc.py — sign and send fleet / group broadcast RPCs (main/fleet.c).
+#
+# Topic:    fleet.vmflow.xyz/<fleet>/rpc            every device in the fleet
+#           fleet.vmflow.xyz/<fleet>/<group>/rpc    every device in the group
+# Payload:  "<cmd>:<args>:<ts>:<jitter_s>:<sig>"
+#           sig = ECDSA-P256-SHA256(fleet key, "<topic>:<cmd>:<args>:<ts>:<jitter_s>"),
+#           r || s as 128 hex chars
+#
+# Each device runs the command after a random delay within <jitter_s> seconds
+# (capped by CONFIG_VMFLOW_FLEET_JITTER_MAX) and replies on its own
+# domain.vmflow.xyz/<sub>/rpc/<reply> as "<result>:<corr>", where <corr> is the
+# first 8 hex chars of <sig>; the info JSON carries it as "corr":"<corr>". Only
+# dex, info, echo, metrics, restart and ota are accepted on broadcast topics.
+# Devices join with the unicast fleet RPC:
+#   ./rpc.sh -s 51 -k <key> -a acme,north fleet      (then restart)
+#
+# Usage:
+#   ./fleet-rpc.py keygen fleet.pem              # prints the public key for menuconfig / NVS
+#   ./fleet-rpc.py send -K fleet.pem -f acme info
+#   ./fleet-rpc.py send -K fleet.pem -f acme -g north -j 1800 -a v1.4.0 ota
+#   ./fleet-rpc.py send -K fleet.pem -f acme -w 60 echo       # collect replies for 60 s
+#   ./fleet-rpc.py verify <pubkey hex> <topic> <payload>      # check as a device would
+#
+# Needs openssl and, for send, mosquitto_pub / mosquitto_sub. Broker auth/TLS:
+# pass extra mosquitto flags after `--`, e.g. send ... info -- -u user -P pass
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+# DER SubjectPublicKeyInfo prefix for an uncompressed prime256v1 point.
+SPKI_P256 = bytes.fromhex("3059301306072a8648ce3d020106082a8648ce3d030107034200")
+
+
+def openssl(*args, data=None):
+    return subprocess.run(("openssl",) + args, input=data, capture_output=True, check=True).stdout
+
+
+def public_key(pem):
+    der = openssl("ec", "-in", pem, "-pubout", "-outform", "DER")
+    return der[len(SPKI_P256):]
+
+
+def der_int(buf, i):
+    # INTEGER at buf[i]: returns (value bytes without sign padding, next index).
+    assert buf[i] == 0x02
+    n = buf[i + 1]
+    return buf[i + 2:i + 2 + n].lstrip(b"\0"), i + 2 + n
+
+
+def sign(pem, text):
+    der = openssl("dgst", "-sha256", "-sign", pem, data=text.encode())
+    assert der[0] == 0x30
+    i = 3 if der[1] & 0x80 else 2
+    r, i = der_int(der, i)
+    s, _ = der_int(der, i)
+    return (r.rjust(32, b"\0") + s.rjust(32, b"\0")).hex()
+
+
+def der_len(n):
+    return bytes([n]) if n < 128 else bytes([0x81, n])
+
+
+def verify(pub_hex, topic, payload):
+    prefix, _, sig = payload.rpartition(":")
+    raw = bytes.fromhex(sig)
+    ints = b""
+    for v in (raw[:32], raw[32:]):
+        v = v.lstrip(b"\0") or b"\0"
+        if v[0] & 0x80:
+            v = b"\0" + v
+        ints += b"\x02" + der_len(len(v)) + v
+    der_sig = b"\x30" + der_len(len(ints)) + ints
+
+    with tempfile.TemporaryDirectory() as tmp:
+        key, sig_file = os.path.join(tmp, "pub.der"), os.path.join(tmp, "sig.der")
+        open(key, "wb").write(SPKI_P256 + bytes.fromhex(pub_hex))
+        open(sig_file, "wb").write(der_sig)
+        r = subprocess.run(("openssl", "dgst", "-sha256", "-keyform", "DER", "-verify", key, "-signature", sig_file),
+                           input=("%s:%s" % (topic, prefix)).encode(), capture_output=True)
+    return r.returncode == 0
+
+
+def cmd_keygen(a):
+    if os.path.exists(a.key):
+        sys.exit("error: %s exists" % a.key)
+    openssl("ecparam", "-name", "prime256v1", "-genkey", "-noout", "-out", a.key)
+    os.chmod(a.key, 0o600)
+    print(public_key(a.key).hex())
+
+
+def cmd_pubkey(a):
+    print(public_key(a.key).hex())
+
+
+def cmd_send(a):
+    topic = "fleet.vmflow.xyz/%s/%s%s" % (a.fleet, a.group + "/" if a.group else "", "rpc")
+    msg = "%s:%s:%d:%d" % (a.cmd, a.args, int(time.time()), a.jitter)
+    sig = sign(a.key, "%s:%s" % (topic, msg))
+    payload = "%s:%s" % (msg, sig)
+
+    print("-> %s  %s  '%s'  corr=%s" % (a.host, topic, payload, sig[:8]), file=sys.stderr)
+    if a.dry_run:
+        return
+
+    replies = None
+    if a.wait:
+        # Replies come back on each device's own topic; collect every one tagged with this corr.
+        replies = subprocess.Popen(["mosquitto_sub", "-h", a.host, "-t", "domain.vmflow.xyz/+/rpc/#", "-v",
+                                    "-W", str(a.jitter + a.wait)] + a.extra, stdout=subprocess.PIPE, text=True)
+        time.sleep(0.3)
+
+    subprocess.run(["mosquitto_pub", "-h", a.host, "-t", topic, "-m", payload, "-q", "1"] + a.extra, check=True)
+
+    if replies:
+        print("<- collecting replies for %d s" % (a.jitter + a.wait), file=sys.stderr)
+        count = 0
+        for line in replies.stdout:
+            line_end = line.rstrip()
+            if line_end.endswith(":" + sig[:8]) or line_end.endswith('"corr":"%s"}' % sig[:8]):
+                count += 1
+                print(line, end="")
+        replies.wait()
+        print("%d replies" % count, file=sys.stderr)
+
+
+def cmd_verify(a):
+    ok = verify(a.pubkey, a.topic, a.payload)
+    print("ok" if ok else "bad signature")
+    sys.exit(0 if ok else 1)
+
+
+def main():
+    argv = sys.argv[1:]
+    extra = []
+    if "--" in argv:
+        i = argv.index("--")
+        argv, extra = argv[:i], argv[i + 1:]
+
+    ap = argparse.ArgumentParser(description="fleet broadcast RPC tool")
+    sub = ap.add_subparsers(dest="sub", required=True)
+
+    p = sub.add_parser("keygen", help="create a fleet signing key and print its public key")
+    p.add_argument("key")
+    p.set_defaults(func=cmd_keygen)
+
+    p = sub.add_parser("pubkey", help="print the public key of a fleet signing key")
+    p.add_argument("key")
+    p.set_defaults(func=cmd_pubkey)
+
+    p = sub.add_parser("send", help="sign and publish a broadcast RPC")
+    p.add_argument("-K", "--key", required=True, help="fleet signing key (PEM)")
+    p.add_argument("-f", "--fleet", required=True)
+    p.add_argument("-g", "--group", help="send to one group instead of the whole fleet")
+    p.add_argument("-a", "--args", default="-", help="command parameter ('-' for none)")
+    p.add_argument("-j", "--jitter", type=int, default=300, help="devices spread execution over this many seconds")
+    p.add_argument("-H", "--host", default="mqtt.vmflow.xyz")
+    p.add_argument("-w", "--wait", type=int, default=0, metavar="S", help="collect replies for jitter + S seconds")
+    p.add_argument("-n", "--dry-run", action="store_true", help="print the message without publishing")
+    p.add_argument("cmd")
+    p.set_defaults(func=cmd_send)
+
+    p = sub.add_parser("verify", help="check a broadcast payload against a public key")
+    p.add_argument("pubkey")
+    p.add_argument("topic")
+    p.add_argument("payload")
+    p.set_defaults(func=cmd_verify)
+
+    a = ap.parse_args(argv)
+    a.extra = extra
+    a.func(a)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,303 @@
+#!/usr/bin/env python3
+#
+# mqttsn-gateway.py — local MQTT-SN gateway stand-in for the firmware's
+# MQTT-SN transport (main/mqtt-sn.c).
+#
+# Speaks the subset of MQTT-SN v1.2 the device uses over UDP: CONNECT with the
+# will handshake, REGISTER, PUBLISH at QoS -1/0/1, SUBSCRIBE to predefined
+# ids, PINGREQ/PINGRESP, and sleeping clients (DISCONNECT with a duration,
+# messages buffered until the client polls with PINGREQ). Publishes are
+# printed instead of forwarded to a broker; per-client bytes are counted, so
+# the airtime cost of each exchange is visible.
+#
+# RPCs are injected on stdin:
+#   rpc <sub> <cmd>:<args>     signed with --passkey and the current time
+#   raw <sub> <payload>        sent as-is
+#
+# Usage:
+#   ./mqttsn-gateway.py --port 1884 --passkey af6c51a556fd71b345
+#   ./mqttsn-gateway.py --drop 0.2          # lose 20% of datagrams both ways
+#
+# Point the device at it with CONFIG_VMFLOW_MQTTSN_GATEWAY / _PORT.
+
+import argparse
+import hashlib
+import hmac
+import random
+import select
+import socket
+import struct
+import sys
+import time
+
+WILLTOPICREQ, WILLTOPIC, WILLMSGREQ, WILLMSG = 0x00, 0x01, 0x02, 0x03
+CONNECT, CONNACK, REGISTER, REGACK = 0x04, 0x05, 0x0A, 0x0B
+PUBLISH, PUBACK, SUBSCRIBE, SUBACK = 0x0C, 0x0D, 0x12, 0x13
+PINGREQ, PINGRESP, DISCONNECT = 0x16, 0x17, 0x18
+
+FLAG_DUP, FLAG_RETAIN, FLAG_WILL, FLAG_CLEAN = 0x80, 0x10, 0x08, 0x04
+QOS = {0x00: 0, 0x20: 1, 0x40: 2, 0x60: -1}
+TOPIC_NORMAL, TOPIC_PREDEFINED = 0x00, 0x01
+
+# Same table as s_predefined[] in main/mqtt-sn.c.
+PREDEFINED = {
+    1: "{sub}.vmflow.xyz/rpc",
+    2: "domain.vmflow.xyz/{sub}/status",
+    3: "domain.vmflow.xyz/{sub}/sale",
+    4: "domain.vmflow.xyz/{sub}/vend_fail",
+    5: "domain.vmflow.xyz/{sub}/paxcounter",
+    6: "domain.vmflow.xyz/{sub}/uplink",
+    7: "domain.vmflow.xyz/{sub}/rpc/info",
+    8: "domain.vmflow.xyz/{sub}/rpc/dex",
+    9: "domain.vmflow.xyz/{sub}/rpc/confirm",
+    10: "domain.vmflow.xyz/{sub}/rpc/echo",
+}
+
+NAMES = {
+    WILLTOPICREQ: "WILLTOPICREQ", WILLMSGREQ: "WILLMSGREQ", CONNACK: "CONNACK", REGACK: "REGACK",
+    PUBLISH: "PUBLISH", PUBACK: "PUBACK", SUBACK: "SUBACK", PINGRESP: "PINGRESP", DISCONNECT: "DISCONNECT",
+}
+
+
+def packet(ptype, body=b""):
+    n = len(body) + 2
+    if n <= 255:
+        return bytes([n, ptype]) + body
+    return b"\x01" + struct.pack(">H", n + 2) + bytes([ptype]) + body
+
+
+def parse(buf):
+    if len(buf) >= 4 and buf[0] == 0x01:
+        n, off = struct.unpack(">H", buf[1:3])[0], 3
+    else:
+        n, off = buf[0], 1
+    if n > len(buf) or n < off + 1:
+        return None, None
+    return buf[off], buf[off + 1:n]
+
+
+class Client:
+    def __init__(self, addr):
+        self.addr = addr
+        self.client_id = None
+        self.sub = "?"
+        self.state = "disconnected"     # connecting, active, asleep, lost
+        self.will = None                # [topic, msg]
+        self.will_flags = 0
+        self.subscribed = set()
+        self.registered = {}
+        self.buffered = []
+        self.duration = 0
+        self.last_rx = time.monotonic()
+        self.tx = self.rx = 0
+        self.msg_id = 0
+
+    def topic(self, topic_id, ttype):
+        if ttype == TOPIC_PREDEFINED and topic_id in PREDEFINED:
+            return PREDEFINED[topic_id].format(sub=self.sub)
+        if ttype == TOPIC_NORMAL and topic_id in self.registered:
+            return self.registered[topic_id]
+        return None
+
+
+class Gateway:
+    def __init__(self, args):
+        self.args = args
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind((args.host, args.port))
+        self.clients = {}
+        self.next_topic_id = 100
+        print("MQTT-SN gateway on udp://%s:%d" % (args.host, args.port), flush=True)
+
+    def log(self, c, msg):
+        print("%8.3f %-18s %s" % (time.monotonic() % 100000, c.client_id or "%s:%d" % c.addr, msg), flush=True)
+
+    def send(self, c, ptype, body=b""):
+        data = packet(ptype, body)
+        c.tx += len(data)
+        if random.random() < self.args.drop:
+            self.log(c, "-> %s (dropped)" % NAMES.get(ptype, ptype))
+            return
+        self.sock.sendto(data, c.addr)
+
+    def deliver(self, c, topic_id, payload):
+        c.msg_id = c.msg_id % 0xffff + 1
+        body = bytes([0x20 | TOPIC_PREDEFINED]) + struct.pack(">HH", topic_id, c.msg_id) + payload
+        self.send(c, PUBLISH, body)
+
+    def client_for_sub(self, sub):
+        for c in self.clients.values():
+            if c.sub == sub:
+                return c
+        return None
+
+    def inject(self, line):
+        parts = line.strip().split(" ", 2)
+        if len(parts) != 3 or parts[0] not in ("rpc", "raw"):
+            print("usage: rpc <sub> <cmd>:<args> | raw <sub> <payload>", flush=True)
+            return
+        kind, sub, payload = parts
+        if kind == "rpc":
+            msg = "%s:%d" % (payload, int(time.time()))
+            sig = hmac.new(self.args.passkey.encode(), msg.encode(), hashlib.sha256).hexdigest()
+            payload = msg + ":" + sig
+
+        c = self.client_for_sub(sub)
+        if c is None:
+            print("no client for sub %s" % sub, flush=True)
+        elif 1 not in c.subscribed:
+            print("%s is not subscribed to rpc" % sub, flush=True)
+        elif c.state == "asleep":
+            c.buffered.append(payload.encode())
+            self.log(c, "buffered RPC for sleeping client (%d queued)" % len(c.buffered))
+        else:
+            self.deliver(c, 1, payload.encode())
+            self.log(c, "-> rpc %s" % payload)
+
+    def handle(self, data, addr):
+        if random.random() < self.args.drop:
+            return
+
+        c = self.clients.get(addr)
+        if c is None:
+            c = self.clients[addr] = Client(addr)
+        c.rx += len(data)
+        c.last_rx = time.monotonic()
+
+        ptype, b = parse(data)
+        if ptype is None:
+            self.log(c, "malformed datagram")
+            return
+
+        if ptype == CONNECT:
+            flags, _, c.duration = b[0], b[1], struct.unpack(">H", b[2:4])[0]
+            c.client_id = b[4:].decode()
+            c.sub = c.client_id[7:] if c.client_id.startswith("vmflow-") else c.client_id
+            waking = c.state == "asleep"
+            if flags & FLAG_CLEAN:
+                c.subscribed.clear()
+                c.registered.clear()
+                c.buffered.clear()
+            self.log(c, "CONNECT %d B keepalive=%ds%s%s%s" % (len(data), c.duration, " clean" if flags & FLAG_CLEAN else "",
+                                                              " will" if flags & FLAG_WILL else "", " (wake)" if waking else ""))
+            if flags & FLAG_WILL:
+                c.state = "connecting"
+                self.send(c, WILLTOPICREQ)
+            else:
+                self.connack(c)
+
+        elif ptype == WILLTOPIC:
+            c.will_flags, c.will = b[0], [b[1:].decode(), ""]
+            self.send(c, WILLMSGREQ)
+
+        elif ptype == WILLMSG:
+            if c.will:
+                c.will[1] = b.decode()
+            self.connack(c)
+
+        elif ptype == REGISTER:
+            _, msg_id = struct.unpack(">HH", b[:4])
+            name = b[4:].decode()
+            topic_id = next((k for k, v in c.registered.items() if v == name), None)
+            if topic_id is None:
+                topic_id = self.next_topic_id
+                self.next_topic_id += 1
+                c.registered[topic_id] = name
+            self.log(c, "REGISTER %s -> %d" % (name, topic_id))
+            self.send(c, REGACK, struct.pack(">HHB", topic_id, msg_id, 0))
+
+        elif ptype == PUBLISH:
+            flags = b[0]
+            topic_id, msg_id = struct.unpack(">HH", b[1:5])
+            qos = QOS[flags & 0x60]
+            topic = c.topic(topic_id, flags & 0x03)
+            if topic is None:
+                self.log(c, "PUBLISH to unknown topic id %d" % topic_id)
+                if qos == 1:
+                    self.send(c, PUBACK, struct.pack(">HHB", topic_id, msg_id, 0x02))
+                return
+            self.log(c, "PUBLISH q%d%s%s %d B [%s] %s" % (qos, " retain" if flags & FLAG_RETAIN else "",
+                                                        " dup" if flags & FLAG_DUP else "", len(data), topic, b[5:].decode(errors="replace")))
+            if qos == 1:
+                self.send(c, PUBACK, struct.pack(">HHB", topic_id, msg_id, 0))
+
+        elif ptype == PUBACK:
+            pass
+
+        elif ptype == SUBSCRIBE:
+            flags = b[0]
+            msg_id = struct.unpack(">H", b[1:3])[0]
+            topic_id = struct.unpack(">H", b[3:5])[0] if flags & 0x03 == TOPIC_PREDEFINED else 0
+            rc = 0 if topic_id in PREDEFINED else 0x02
+            if rc == 0:
+                c.subscribed.add(topic_id)
+            self.log(c, "SUBSCRIBE %s" % (PREDEFINED.get(topic_id, "?").format(sub=c.sub)))
+            self.send(c, SUBACK, bytes([0x20]) + struct.pack(">HHB", topic_id, msg_id, rc))
+
+        elif ptype == PINGREQ:
+            if b and c.state == "asleep":
+                self.log(c, "PINGREQ poll, %d buffered" % len(c.buffered))
+                for payload in c.buffered:
+                    self.deliver(c, 1, payload)
+                c.buffered.clear()
+            self.send(c, PINGRESP)
+
+        elif ptype == DISCONNECT:
+            if len(b) >= 2:
+                c.duration = struct.unpack(">H", b[:2])[0]
+                c.state = "asleep"
+                self.log(c, "asleep for %ds" % c.duration)
+            else:
+                c.state = "disconnected"
+                c.will = None
+                self.log(c, "DISCONNECT")
+            self.send(c, DISCONNECT)
+
+    def connack(self, c):
+        c.state = "active"
+        self.send(c, CONNACK, b"\x00")
+
+    def expire(self):
+        now = time.monotonic()
+        for c in self.clients.values():
+            if c.state in ("active", "asleep") and c.duration and now - c.last_rx > c.duration * 1.5:
+                c.state = "lost"
+                if c.will:
+                    self.log(c, "lost; will PUBLISH [%s] %s" % tuple(c.will))
+                else:
+                    self.log(c, "lost")
+
+    def stats(self):
+        for c in self.clients.values():
+            print("%-18s rx %6d B  tx %6d B  state %s" % (c.client_id or c.addr, c.rx, c.tx, c.state))
+
+    def run(self):
+        try:
+            while True:
+                r, _, _ = select.select([self.sock, sys.stdin], [], [], 1.0)
+                if self.sock in r:
+                    data, addr = self.sock.recvfrom(2048)
+                    self.handle(data, addr)
+                if sys.stdin in r:
+                    line = sys.stdin.readline()
+                    if not line:
+                        break
+                    if line.strip():
+                        self.inject(line)
+                self.expire()
+        except KeyboardInterrupt:
+            pass
+        self.stats()
+
+
+def main():
+    ap = argparse.ArgumentParser(description="MQTT-SN gateway stand-in")
+    ap.add_argument("--host", default="0.0.0.0")
+    ap.add_argument("--port", type=int, default=1884)
+    ap.add_argument("--passkey", default="", help="device passkey, to sign injected RPCs")
+    ap.add_argument("--drop", type=float, default=0.0, help="probability of losing each datagram")
+    Gateway(ap.parse_args()).run()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+#
+# ota-delta.py — build and check delta OTA patches for main/ota-delta.c.
+#
+# A patch rebuilds a new app image from the image the device is running.
+# The format is bsdiff-style, packed as one stream so the device can apply it
+# while downloading:
+#
+#   header (80 B, uncompressed, little-endian)
+#     "VMDP" | version u8 = 1 | compression u8 (0 stored, 1 raw deflate) | 0 u16
+#     src_size u32 | new_size u32 | sha256(src image) | sha256(new image)
+#   body (deflated when compression = 1): records until new_size bytes are out
+#     add_len u32 | extra_len u32 | seek i32
+#     add_len bytes:   new[i] = old[pos + i] + diff[i]   (mod 256), pos += add_len
+#     extra_len bytes: copied to the output as-is
+#     pos += seek
+#
+# Relinking moves code, so most of a new image is old bytes at a shifted offset
+# with a few changed pointers. Those regions become add blocks whose diff bytes
+# are nearly all zero, and deflate shrinks them to almost nothing.
+#
+# Usage:
+#   ./ota-delta.py diff old.bin new.bin -o old-to-new.patch
+#   ./ota-delta.py apply old.bin old-to-new.patch -o check.bin
+#   ./ota-delta.py info old-to-new.patch
+#
+# The release workflow names patches mdb-slave-esp32s3-<from version>.patch;
+# the ota RPC asks for the one matching the running version and falls back
+# to the full image when there is none.
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"VMDP"
+VERSION = 1
+HEADER = struct.Struct("<4sBBHII32s32s")
+RECORD = struct.Struct("<IIi")
+
+SEED = 8            # bytes hashed to find match candidates
+MIN_MATCH = 16      # shortest exact match that starts a new add block
+MAX_CANDIDATES = 8  # positions kept per seed; runs of 0x00/0xff fill up fast
+GIVE_UP = 32        # stop extending a block once mismatches lead by this much
+
+
+def match_len(a, ai, b, bi):
+    # Exact match length, comparing in growing slices.
+    n = min(len(a) - ai, len(b) - bi)
+    length, step = 0, 16
+    while length < n:
+        k = min(step, n - length)
+        if a[ai + length:ai + length + k] == b[bi + length:bi + length + k]:
+            length += k
+            step *= 2
+        elif k == 1:
+            break
+        else:
+            step = max(1, k // 2)
+    return length
+
+
+def build_index(old):
+    index = {}
+    for p in range(len(old) - SEED + 1):
+        lst = index.setdefault(old[p:p + SEED], [])
+        if len(lst) < MAX_CANDIDATES:
+            lst.append(p)
+    return index
+
+
+def find_blocks(old, new):
+    # Greedy: at each position take the longest exact match (preferring the
+    # current alignment), then extend it forward while matches outnumber
+    # mismatches. Returns [(new_start, old_start, length)].
+    index = build_index(old)
+    blocks = []
+    i, n = 0, len(new)
+    delta = None        # old_start - new_start of the last block
+
+    while i <= n - SEED:
+        best_pos, best_len = -1, 0
+        if delta is not None and 0 <= i + delta < len(old):
+            best_len = match_len(new, i, old, i + delta)
+            if best_len >= SEED:
+                best_pos = i + delta
+            else:
+                best_len = 0
+        for p in index.get(new[i:i + SEED], ()):
+            if best_len >= 1024:
+                break
+            m = match_len(new, i, old, p)
+            if m > best_len:
+                best_pos, best_len = p, m
+
+        if best_len < MIN_MATCH and not (best_pos >= 0 and best_pos == i + (delta or 0) and best_len >= SEED):
+            i += 1
+            continue
+
+        # Approximate forward extension (bsdiff's lenf).
+        j, o = i + best_len, best_pos + best_len
+        score = top = k = 0
+        length = best_len
+        limit = min(n - j, len(old) - o)
+        while k < limit:
+            score += 1 if new[j + k] == old[o + k] else -1
+            k += 1
+            if score > top:
+                top, length = score, best_len + k
+            elif score < top - GIVE_UP:
+                break
+
+        blocks.append((i, best_pos, length))
+        delta = best_pos - i
+        i += length
+
+    return blocks
+
+
+def make_patch(old, new, compress=True):
+    blocks = find_blocks(old, new)
+    body = bytearray()
+    pos = 0             # old cursor, as the device tracks it
+    out = 0             # bytes of new emitted so far
+
+    if not blocks or blocks[0][0] > 0:
+        first_new = blocks[0][0] if blocks else len(new)
+        first_old = blocks[0][1] if blocks else 0
+        body += RECORD.pack(0, first_new, first_old)
+        body += new[:first_new]
+        pos, out = first_old, first_new
+
+    for k, (ns, os_, ln) in enumerate(blocks):
+        assert ns == out and os_ == pos
+        next_new, next_old = (blocks[k + 1][0], blocks[k + 1][1]) if k + 1 < len(blocks) else (len(new), os_ + ln)
+        extra = new[ns + ln:next_new]
+        body += RECORD.pack(ln, len(extra), next_old - (os_ + ln))
+        body += bytes((new[ns + t] - old[os_ + t]) & 0xff for t in range(ln))
+        body += extra
+        pos, out = next_old, next_new
+
+    if compress:
+        z = zlib.compressobj(9, zlib.DEFLATED, -15, 9)
+        body = z.compress(bytes(body)) + z.flush()
+
+    header = HEADER.pack(MAGIC, VERSION, 1 if compress else 0, 0, len(old), len(new),
+                         hashlib.sha256(old).digest(), hashlib.sha256(new).digest())
+    return header + bytes(body), len(blocks)
+
+
+def apply_patch(old, patch):
+    magic, version, comp, _, src_size, new_size, src_sha, new_sha = HEADER.unpack_from(patch)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a VMDP v1 patch")
+    old = old[:src_size]
+    if len(old) != src_size or hashlib.sha256(old).digest() != src_sha:
+        raise ValueError("source image does not match the patch")
+
+    body = patch[HEADER.size:]
+    if comp == 1:
+        body = zlib.decompress(body, -15)
+
+    new = bytearray()
+    pos = off = 0
+    while len(new) < new_size:
+        add, extra, seek = RECORD.unpack_from(body, off)
+        off += RECORD.size
+        if pos < 0 or pos + add > len(old) or len(new) + add + extra > new_size:
+            raise ValueError("record out of range")
+        new += bytes((old[pos + t] + body[off + t]) & 0xff for t in range(add))
+        off += add
+        pos += add
+        new += body[off:off + extra]
+        off += extra
+        pos += seek
+
+    if hashlib.sha256(new).digest() != new_sha:
+        raise ValueError("result hash mismatch")
+    return bytes(new)
+
+
+def cmd_diff(a):
+    old, new = open(a.old, "rb").read(), open(a.new, "rb").read()
+    t0 = time.monotonic()
+    patch, nblocks = make_patch(old, new, not a.stored)
+    dt = time.monotonic() - t0
+    if apply_patch(old, patch) != new:
+        sys.exit("internal error: patch does not reproduce the new image")
+    open(a.output, "wb").write(patch)
+    full = len(zlib.compress(new, 9))
+    print("%s: %d B -> %d B patch (%d blocks, %.1fx smaller than the image, %.1fx than the deflated image, %.1f s)"
+          % (a.output, len(new), len(patch), nblocks, len(new) / len(patch), full / len(patch), dt))
+
+
+def cmd_apply(a):
+    new = apply_patch(open(a.old, "rb").read(), open(a.patch, "rb").read())
+    open(a.output, "wb").write(new)
+    print("%s: %d B, sha256 %s" % (a.output, len(new), hashlib.sha256(new).hexdigest()))
+
+
+def cmd_info(a):
+    patch = open(a.patch, "rb").read()
+    magic, version, comp, _, src_size, new_size, src_sha, new_sha = HEADER.unpack_from(patch)
+    print("magic %s v%d, %s, %d B" % (magic.decode(errors="replace"), version, ("stored", "deflate")[comp], len(patch)))
+    print("src %d B sha256 %s" % (src_size, src_sha.hex()))
+    print("new %d B sha256 %s" % (new_size, new_sha.hex()))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="delta OTA patch tool")
+    sub = ap.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("diff", help="build a patch from old.bin to new.bin")
+    p.add_argument("old")
+    p.add_argument("new")
+    p.add_argument("-o", "--output", required=True)
+    p.add_argument("--stored", action="store_true", help="do not deflate the body")
+    p.set_defaults(func=cmd_diff)
+
+    p = sub.add_parser("apply", help="rebuild new.bin from old.bin and a patch")
+    p.add_argument("old")
+    p.add_argument("patch")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(func=cmd_apply)
+
+    p = sub.add_parser("info", help="print a patch header")
+    p.add_argument("patch")
+    p.set_defaults(func=cmd_info)
+
+    a = ap.parse_args()
+    a.func(a)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,128 @@
+/*
+ * pax-bench.c — replay synthetic advertisement streams through the PAX counter.
+ *
+ * Compares main/pax-set.c with the linear 1024-entry address list it
+ * replaced: time per advertisement and the count each reports, for crowds
+ * from a quiet shop to a station concourse. Each scenario is repeated with
+ * fresh salts to show the sketch's error spread once the set is full.
+ *
+ * Build and run on Linux:
+ *   cc -O2 -I../main -o pax-bench pax-bench.c ../main/pax-set.c -lm
+ *   ./pax-bench [adverts per device (20)] [trials (20)]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "pax-set.h"
+
+// The structure pax_set replaced (nimble.c before): linear scan, stops at 1024.
+#define LIST_MAX 1024
+
+typedef struct {
+	uint8_t addr[LIST_MAX][6];
+	uint16_t count;
+} addr_list_t;
+
+static void list_add(addr_list_t *l, const uint8_t addr[6]) {
+	for (int i = 0; i < l->count; i++) {
+		if (memcmp(l->addr[i], addr, 6) == 0) return;
+	}
+	if (l->count >= LIST_MAX) return;
+	memcpy(l->addr[l->count++], addr, 6);
+}
+
+static uint64_t s_rng = 0x853c49e6748fea9bULL;
+
+static uint64_t rng(void) {
+	s_rng ^= s_rng << 13;
+	s_rng ^= s_rng >> 7;
+	s_rng ^= s_rng << 17;
+	return s_rng;
+}
+
+// n distinct random (resolvable-private-style) addresses, each advertising `repeat` times, interleaved.
+static uint8_t (*make_stream(uint32_t n, uint32_t repeat, size_t *len))[6] {
+	uint8_t (*devices)[6] = malloc((size_t) n * 6);
+	for (uint32_t i = 0; i < n; i++) {
+		uint64_t r = rng();
+		memcpy(devices[i], &r, 6);
+		devices[i][5] = (devices[i][5] & 0x3f) | 0x40;
+	}
+
+	*len = (size_t) n * repeat;
+	uint8_t (*stream)[6] = malloc(*len * 6);
+	for (size_t i = 0; i < *len; i++) memcpy(stream[i], devices[i % n], 6);
+
+	// Shuffle so a device's adverts are spread over the window.
+	for (size_t i = *len - 1; i > 0; i--) {
+		size_t j = rng() % (i + 1);
+		uint8_t t[6];
+		memcpy(t, stream[i], 6);
+		memcpy(stream[i], stream[j], 6);
+		memcpy(stream[j], t, 6);
+	}
+
+	free(devices);
+	return stream;
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+	uint32_t repeat = argc > 1 ? (uint32_t) atoi(argv[1]) : 20;
+	int trials = argc > 2 ? atoi(argv[2]) : 20;
+	static const uint32_t crowds[] = { 50, 200, 384, 1000, 2000, 5000, 20000, 100000 };
+
+	static addr_list_t list;
+	static pax_set_t set;
+
+	printf("memory: list %zu B, pax_set %zu B; %u adverts per device, %d trials\n\n", sizeof(list), sizeof(set), repeat, trials);
+	printf("%8s %10s | %12s %8s | %12s %8s %9s %9s\n", "devices", "adverts", "list ns/adv", "count", "set ns/adv", "count", "mean err", "max err");
+
+	for (size_t c = 0; c < sizeof(crowds) / sizeof(crowds[0]); c++) {
+		uint32_t n = crowds[c];
+		size_t len;
+		uint8_t (*stream)[6] = make_stream(n, repeat, &len);
+
+		// The list is quadratic: skip it where one run would take minutes.
+		double list_ns = NAN;
+		if (n <= 20000) {
+			memset(&list, 0, sizeof(list));
+			double t0 = now_ns();
+			for (size_t i = 0; i < len; i++) list_add(&list, stream[i]);
+			list_ns = (now_ns() - t0) / len;
+		}
+
+		double set_ns = 0, err_sum = 0, err_max = 0;
+		uint32_t count = 0;
+		for (int t = 0; t < trials; t++) {
+			pax_set_reset(&set, rng());
+			double t0 = now_ns();
+			for (size_t i = 0; i < len; i++) pax_set_add(&set, stream[i]);
+			count = pax_set_count(&set);
+			set_ns += (now_ns() - t0) / len;
+
+			double err = fabs((double) count - n) / n * 100;
+			err_sum += err;
+			if (err > err_max) err_max = err;
+		}
+
+		if (isnan(list_ns)) {
+			printf("%8u %10zu | %12s %8s |", n, len, "-", "-");
+		} else {
+			printf("%8u %10zu | %12.1f %8u |", n, len, list_ns, list.count);
+		}
+		printf(" %12.1f %8u %8.2f%% %8.2f%%\n", set_ns / trials, count, err_sum / trials, err_max);
+
+		free(stream);
+	}
+
+	return 0;
+}
@@ -6,7 +6,9 @@
 # Topic:    <sub>.vmflow.xyz/rpc        Reply: domain.vmflow.xyz/<sub>/rpc/<cmd>
 # Commands with no parameter use "-" as <args>.
 #
-# Every command publishes to domain.vmflow.xyz/<sub>/rpc/* on completion.
+# Every command publishes to domain.vmflow.xyz/<sub>/rpc/* on completion as
+# "<result>:<corr>", where <corr> is the first 8 hex chars of <hmac>; the info
+# JSON carries it as its "corr" member instead.
 # -w subscribes to rpc/# and captures the first reply regardless of subtopic.
 #
 # Usage:
@@ -16,7 +18,8 @@
 #   ./rpc.sh -s 51 -k <key> -w info           # -w: also wait for the reply
 #   ./rpc.sh -s 51 -k <key> -a v1.3.6 ota    # OTA to pinned tag
 #
-# Commands: dex info oos buzzer echo restart credit ota
+# Commands: dex info oos buzzer echo restart credit ota transport fleet metrics trace
+# Fleet / group broadcasts are signed with the fleet key instead: see fleet-rpc.py.
 #
 # Broker auth/TLS: pass through extra mosquitto flags after `--`, e.g.
 #   ./rpc.sh -s 51 -k <key> info -- -u user -P pass
@@ -71,7 +74,7 @@ if [ "$WAIT" -eq 1 ]; then
   sleep 0.3
 fi
 
-echo "-> $HOST  $SUB.vmflow.xyz/rpc  '$PAYLOAD'" >&2
+echo "-> $HOST  $SUB.vmflow.xyz/rpc  '$PAYLOAD'  corr=${SIG:0:8}" >&2
 mosquitto_pub -h "$HOST" -t "$SUB.vmflow.xyz/rpc" -m "$PAYLOAD" -q 1 "${EXTRA[@]}"
 
 if [ "$WAIT" -eq 1 ]; then
@@ -0,0 +1,481 @@
+#!/usr/bin/env python3
+#
+# sim7080g-standin.py — Linux stand-in for the SIM7080G bring-up.
+#
+# A scripted AT modem runs on one end of a pty and replays the SIM7080G boot,
+# URCs (+CPIN: READY, SMS Ready, +CEREG) and registration delays; registration
+# takes longer the more bands it has to scan, so a cached band/RAT attaches
+# faster than a full scan. Two host-side drivers replay the firmware sequences
+# on the other end of the pty and report time-to-IP:
+#
+#   legacy  fixed delays: PWRKEY + 5 s, AT+CFUN=1,1 + 8 s on warm start,
+#           AT+CEREG? polled every 2 s (mdb-slave-esp32s3.c before sim7080g.c)
+#   urc     main/sim7080g.c: AT polled during boot, URC-driven waits, cached
+#           band/RAT with full-scan fallback, no reset when still registered
+#
+# The drivers are Python ports of the C sequences, not the firmware itself;
+# delays are modelled, not measured on a module. Times are in simulated
+# seconds; --scale sets how many real seconds one simulated second takes.
+#
+# Usage:
+#   ./sim7080g-standin.py                  # all scenarios, both drivers
+#   ./sim7080g-standin.py --scale 0.05 --scenario link-loss
+
+import argparse
+import heapq
+import os
+import queue
+import select
+import threading
+import time
+import tty
+
+NETWORK_BAND = 3
+NETWORK_RAT = 1             # CMNB value: 1 = Cat-M, 2 = NB-IoT
+NETWORK_CPSI = "+CPSI: LTE CAT-M1,Online,724-05,0x1234,12345678,123,EUTRAN-BAND3,1800,5,5,-10,-90,-60,15"
+
+BANDS_CATM = [1, 2, 3, 4, 5, 8, 12, 13, 14, 18, 19, 20, 25, 26, 27, 28, 66, 85]
+BANDS_NBIOT = [1, 2, 3, 4, 5, 8, 12, 13, 18, 19, 20, 25, 28, 66, 71, 85]
+
+# Modem timing model (simulated seconds).
+T_BOOT_AT = 3.0             # PWRKEY -> AT answered
+T_BOOT_CPIN = 4.0           # PWRKEY -> +CPIN: READY
+T_BOOT_SMS = 6.0            # PWRKEY -> SMS Ready
+T_ATTACH_BASE = 2.5         # radio on -> first band scanned
+T_PER_BAND = 0.9            # per configured band, searched in the worst case
+T_PPP = 1.0                 # CONNECT -> PPP got IP
+T_ESCAPE = 1.0              # "+++" guard time
+
+SCALE = 0.02
+
+
+def sim_sleep(s):
+    time.sleep(s * SCALE)
+
+
+def sim_now():
+    return time.monotonic() / SCALE
+
+
+class Modem(threading.Thread):
+    """Scripted SIM7080G on the master side of a pty."""
+
+    def __init__(self, fd, powered, registered, cmnb=3):
+        super().__init__(daemon=True)
+        self.fd = fd
+        self.events = []            # heap of (sim_time, seq, callback)
+        self.seq = 0
+        self.lock = threading.Lock()
+        self.buf = b""
+
+        self.powered = powered
+        self.booting = False
+        self.data_mode = False
+        self.cfun = 1
+        self.cereg_n = 0
+        self.cpin = powered
+        self.cmnb = cmnb
+        self.bands = {1: list(BANDS_CATM), 2: list(BANDS_NBIOT)}
+        self.stat = 1 if registered else 0
+        self.scan_gen = 0
+
+    # -- scheduling -----------------------------------------------------
+
+    def at(self, delay, cb):
+        with self.lock:
+            self.seq += 1
+            heapq.heappush(self.events, (sim_now() + delay, self.seq, cb))
+
+    def send(self, line):
+        os.write(self.fd, ("\r\n" + line + "\r\n").encode())
+
+    def set_stat(self, stat):
+        if stat != self.stat:
+            self.stat = stat
+            if self.cereg_n and self.powered and not self.booting and not self.data_mode:
+                self.send("+CEREG: %d" % stat)
+
+    # -- radio ----------------------------------------------------------
+
+    def start_scan(self):
+        self.scan_gen += 1
+        gen = self.scan_gen
+        self.set_stat(2)
+
+        rats = [1, 2] if self.cmnb == 3 else [self.cmnb]
+        scanned = sum(len(self.bands[r]) for r in rats)
+        found = NETWORK_RAT in rats and NETWORK_BAND in self.bands[NETWORK_RAT]
+
+        if found:
+            self.at(T_ATTACH_BASE + T_PER_BAND * scanned, lambda: gen == self.scan_gen and self.set_stat(1))
+
+    def radio_changed(self):
+        if self.cfun == 1 and self.cpin:
+            self.start_scan()
+
+    def pwrkey(self):
+        if self.powered:
+            self.powered = False
+            self.data_mode = False
+            self.stat = 0
+            self.scan_gen += 1
+            return
+        self.boot()
+
+    def boot(self):
+        self.powered = True
+        self.booting = True
+        self.data_mode = False
+        self.cfun = 1
+        self.cereg_n = 0
+        self.cpin = False
+        self.stat = 0
+        self.scan_gen += 1
+
+        def ready():
+            self.booting = False
+
+        def cpin():
+            self.cpin = True
+            self.send("+CPIN: READY")
+            self.radio_changed()
+
+        self.at(T_BOOT_AT, ready)
+        self.at(T_BOOT_CPIN, cpin)
+        self.at(T_BOOT_SMS, lambda: self.send("SMS Ready"))
+
+    def drop_ppp(self):
+        """Network released the bearer: PPP is gone, registration is kept."""
+        self.data_mode = True   # the modem stays in data mode until "+++"
+
+    # -- AT -------------------------------------------------------------
+
+    def command(self, cmd):
+        if cmd == "AT" or cmd == "ATE0":
+            return "OK"
+        if cmd == "AT+CPIN?":
+            return "+CPIN: READY\r\n\r\nOK" if self.cpin else "ERROR"
+        if cmd == "AT+CEREG?":
+            return "+CEREG: %d,%d\r\n\r\nOK" % (self.cereg_n, self.stat)
+        if cmd.startswith("AT+CEREG="):
+            self.cereg_n = int(cmd[9:])
+            return "OK"
+        if cmd == "AT+CFUN=0":
+            self.cfun = 0
+            self.scan_gen += 1
+            self.set_stat(0)
+            return "OK"
+        if cmd == "AT+CFUN=1":
+            self.cfun = 1
+            self.radio_changed()
+            return "OK"
+        if cmd == "AT+CFUN=1,1":
+            self.at(0.1, self.boot)
+            return "OK"
+        if cmd.startswith("AT+CMNB="):
+            self.cmnb = int(cmd[8:])
+            if self.cfun == 1:
+                self.radio_changed()
+            return "OK"
+        if cmd.startswith("AT+CBANDCFG="):
+            rat, bands = cmd[12:].split(",", 1)
+            self.bands[1 if rat.strip('"') == "CAT-M" else 2] = [int(b) for b in bands.split(",")]
+            if self.cfun == 1:
+                self.radio_changed()
+            return "OK"
+        if cmd == "AT+CPSI?":
+            return (NETWORK_CPSI if self.stat in (1, 5) else "+CPSI: NO SERVICE,Online") + "\r\n\r\nOK"
+        if cmd.startswith(("AT+CNMP=", "AT+CPSMS", "AT+CEDRXS", "AT+CGDCONT")):
+            return "OK"
+        if cmd == "ATD*99#":
+            if self.stat in (1, 5):
+                self.data_mode = True
+                return "CONNECT"
+            return "NO CARRIER"
+        return "ERROR"
+
+    def handle(self, chunk):
+        if self.data_mode:
+            if b"+++" in chunk:
+                def escaped():
+                    self.data_mode = False
+                    self.send("OK")
+                self.at(T_ESCAPE, escaped)
+            return
+
+        self.buf += chunk
+        while b"\r" in self.buf:
+            line, self.buf = self.buf.split(b"\r", 1)
+            line = line.strip().decode(errors="replace")
+            if line and self.powered and not self.booting:
+                self.send(self.command(line))
+
+    def run(self):
+        while True:
+            with self.lock:
+                timeout = max(0.0, (self.events[0][0] - sim_now()) * SCALE) if self.events else 0.05
+            r, _, _ = select.select([self.fd], [], [], min(timeout, 0.05))
+            if r:
+                self.handle(os.read(self.fd, 1024))
+            while True:
+                with self.lock:
+                    if not self.events or self.events[0][0] > sim_now():
+                        break
+                    _, _, cb = heapq.heappop(self.events)
+                cb()
+
+
+class Dte:
+    """Host side of the pty: esp_modem_at()-style commands plus a URC callback."""
+
+    def __init__(self, fd, urc_cb=None):
+        self.fd = fd
+        self.urc_cb = urc_cb
+        self.lines = queue.Queue()
+        self.buf = b""
+        threading.Thread(target=self.reader, daemon=True).start()
+
+    def reader(self):
+        while True:
+            self.buf += os.read(self.fd, 1024)
+            while b"\n" in self.buf:
+                line, self.buf = self.buf.split(b"\n", 1)
+                line = line.strip().decode(errors="replace")
+                if not line:
+                    continue
+                if self.urc_cb:
+                    self.urc_cb(line)
+                self.lines.put(line)
+
+    def at(self, cmd, timeout_s):
+        """Returns (ok, response lines)."""
+        while not self.lines.empty():
+            self.lines.get_nowait()
+        os.write(self.fd, (cmd + "\r").encode())
+
+        resp = []
+        deadline = sim_now() + timeout_s
+        while True:
+            left = deadline - sim_now()
+            if left <= 0:
+                return False, resp
+            try:
+                line = self.lines.get(timeout=left * SCALE)
+            except queue.Empty:
+                return False, resp
+            if line in ("OK", "CONNECT"):
+                return True, resp
+            if line in ("ERROR", "NO CARRIER"):
+                return False, resp
+            resp.append(line)
+
+    def sync(self):
+        return self.at("AT", 0.5)[0]
+
+    def set_mode_command(self):
+        os.write(self.fd, b"+++")
+        deadline = sim_now() + T_ESCAPE + 1.0
+        while sim_now() < deadline:
+            try:
+                if self.lines.get(timeout=0.1 * SCALE) == "OK":
+                    break
+            except queue.Empty:
+                pass
+
+    def set_mode_data(self):
+        self.at('AT+CGDCONT=1,"IP","lf.br"', 1.0)
+        if self.at("ATD*99#", 3.0)[0]:
+            sim_sleep(T_PPP)
+            return True
+        return False
+
+
+def cereg_registered(resp):
+    for line in resp:
+        if line.startswith("+CEREG: "):
+            return line.endswith(",1") or line.endswith(",5")
+    return False
+
+
+class LegacyDriver:
+    """sim7080g_task() as it was in mdb-slave-esp32s3.c."""
+
+    def __init__(self, modem, dte):
+        self.modem, self.dte = modem, dte
+
+    def wait_registered(self):
+        for _ in range(30):
+            ok, resp = self.dte.at("AT+CEREG?", 3.0)
+            if ok and cereg_registered(resp):
+                return True
+            sim_sleep(2.0)
+        return False
+
+    def bringup(self):
+        self.dte.set_mode_command()
+        ok = self.dte.sync()
+        if not ok:
+            self.modem.pwrkey()
+            sim_sleep(1.2)
+            sim_sleep(5.0)
+            ok = self.dte.sync()
+            if not ok:
+                sim_sleep(2.0)
+                ok = self.dte.sync()
+        else:
+            self.dte.at("AT+CFUN=1,1", 3.0)
+            sim_sleep(8.0)
+
+        if not ok:
+            return False
+
+        self.dte.at("AT+CNMP=38", 3.0)
+        self.dte.at("AT+CMNB=3", 3.0)
+        self.dte.at("AT+CEREG=1", 3.0)
+
+        return self.wait_registered() and self.dte.set_mode_data()
+
+
+class UrcDriver:
+    """sim7080g_bringup() / sim7080g_task() from main/sim7080g.c."""
+
+    FAST_ATTACH = 20.0
+    FULL_ATTACH = 90.0
+
+    def __init__(self, modem, dte_fd, cache):
+        self.modem = modem
+        self.cache = cache          # (band, rat) or None, as loaded from NVS
+        self.cpin = threading.Event()
+        self.registered = threading.Event()
+        self.dte = Dte(dte_fd, self.urc)
+
+    def parse_cereg(self, line):
+        fields = line[8:].split(",")
+        stat = int(fields[0])
+        if len(fields) > 1 and fields[1].isdigit():
+            stat = int(fields[1])
+        (self.registered.set if stat in (1, 5) else self.registered.clear)()
+
+    def urc(self, line):
+        if line.startswith("+CPIN: READY") or line == "SMS Ready":
+            self.cpin.set()
+        if line.startswith("+CEREG: "):
+            self.parse_cereg(line)
+
+    def wait(self, ev, timeout_s):
+        return ev.wait(timeout_s * SCALE)
+
+    def power_on(self):
+        for _ in range(2):
+            self.modem.pwrkey()
+            sim_sleep(1.2)
+            for _ in range(20):
+                if self.dte.sync():
+                    return True
+                sim_sleep(0.5)
+        return False
+
+    def query_registered(self):
+        self.dte.at("AT+CEREG?", 3.0)
+        return self.registered.is_set()
+
+    def wait_registered(self, timeout_s):
+        deadline = sim_now() + timeout_s
+        while not self.query_registered():
+            left = deadline - sim_now()
+            if left <= 0:
+                return False
+            self.wait(self.registered, min(left, 10.0))
+        return True
+
+    def configure(self, use_cache):
+        cached = use_cache and self.cache is not None
+        self.registered.clear()
+
+        self.dte.at("AT+CFUN=0", 5.0)
+        self.dte.at("AT+CNMP=38", 3.0)
+        if cached:
+            band, rat = self.cache
+            self.dte.at("AT+CMNB=%d" % rat, 3.0)
+            self.dte.at('AT+CBANDCFG="%s",%d' % ("CAT-M" if rat == 1 else "NB-IOT", band), 3.0)
+        else:
+            self.dte.at("AT+CMNB=3", 3.0)
+            self.dte.at('AT+CBANDCFG="CAT-M",' + ",".join(map(str, BANDS_CATM)), 3.0)
+            self.dte.at('AT+CBANDCFG="NB-IOT",' + ",".join(map(str, BANDS_NBIOT)), 3.0)
+        self.dte.at("AT+CPSMS=0", 3.0)
+        self.dte.at("AT+CEDRXS=0", 3.0)
+        self.dte.at("AT+CEREG=1", 3.0)
+        self.dte.at("AT+CFUN=1", 10.0)
+        return cached
+
+    def bringup(self):
+        self.dte.set_mode_command()
+
+        if self.dte.sync():
+            self.dte.at("AT+CEREG=1", 3.0)
+            if self.wait_registered(5.0):
+                return self.dte.set_mode_data()
+        else:
+            self.cpin.clear()
+            if not self.power_on():
+                return False
+            ok, resp = self.dte.at("AT+CPIN?", 3.0)
+            if ok and any("READY" in r for r in resp):
+                self.cpin.set()
+            self.wait(self.cpin, 10.0)
+
+        cached = self.configure(True)
+        ok = self.wait_registered(self.FAST_ATTACH if cached else self.FULL_ATTACH)
+        if not ok and cached:
+            self.configure(False)
+            ok = self.wait_registered(self.FULL_ATTACH)
+
+        return ok and self.dte.set_mode_data()
+
+
+SCENARIOS = {
+    # name: (modem powered, modem registered, firmware cache)
+    "cold":        (False, False, None),
+    "cold-cached": (False, False, (NETWORK_BAND, NETWORK_RAT)),
+    "cold-stale":  (False, False, (20, 2)),
+    "link-loss":   (True, True, (NETWORK_BAND, NETWORK_RAT)),
+}
+
+
+def run(scenario, driver):
+    powered, registered, cache = SCENARIOS[scenario]
+
+    master, slave = os.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+
+    modem = Modem(master, powered, registered)
+    if scenario == "link-loss":
+        modem.cereg_n = 1
+        modem.drop_ppp()
+    modem.start()
+
+    d = LegacyDriver(modem, Dte(slave)) if driver == "legacy" else UrcDriver(modem, slave, cache)
+
+    t0 = sim_now()
+    ok = d.bringup()
+    return sim_now() - t0 if ok else None
+
+
+def main():
+    global SCALE
+
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--scale", type=float, default=SCALE, help="real seconds per simulated second (default %(default)s)")
+    ap.add_argument("--scenario", choices=sorted(SCENARIOS), action="append")
+    args = ap.parse_args()
+    SCALE = args.scale
+
+    print("%-12s %10s %10s" % ("scenario", "legacy s", "urc s"))
+    for scenario in args.scenario or SCENARIOS:
+        row = [run(scenario, drv) for drv in ("legacy", "urc")]
+        print("%-12s %10s %10s" % (scenario, *("%.1f" % t if t is not None else "fail" for t in row)))
+
+
+if __name__ == "__main__":
+    main()
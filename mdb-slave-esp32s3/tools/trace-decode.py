@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+#
+# trace-decode.py — render a binary event trace dump (main/trace.h) as a timeline.
+#
+# Ask the device for its trace with the signed RPC, and catch the dump on
+# domain.vmflow.xyz/<sub>/rpc/trace:
+#   ./trace-decode.py -s 51 &                    # waits for one dump
+#   ./rpc.sh -s 51 -k <key> trace
+#
+# or decode a dump saved earlier:
+#   mosquitto_sub -h mqtt.vmflow.xyz -t domain.vmflow.xyz/51/rpc/trace -C 1 -N > dump.bin
+#   ./trace-decode.py dump.bin
+#
+# Event names and argument formats are read from main/trace.h (TRACE_EVENTS),
+# so the decoder always matches the firmware source it sits next to; use -e
+# to point at the trace.h of the build the device runs.
+#
+# Output, one line per record, cores merged in time order:
+#   <seconds since boot>  <+delta ms>  c<core>  <event>  <arguments>
+
+import argparse
+import os
+import re
+import struct
+import subprocess
+import sys
+
+HEADER = struct.Struct("<4sBBHIQ8s")
+RECORD = struct.Struct("<IBBHI")
+
+
+def load_events(path):
+    with open(path) as f:
+        text = f.read()
+    block = text[text.index("#define TRACE_EVENTS(X)"):]
+    block = block[:block.index("\n\n")]
+    return re.findall(r'X\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', block)
+
+
+def decode(buf, events):
+    magic, version, rec_size, records, overwritten, now_us, corr = HEADER.unpack_from(buf)
+    if magic != b"VMTR" or version != 1 or rec_size != RECORD.size:
+        sys.exit(f"not a version 1 trace dump ({magic!r}, v{version}, {rec_size} B records)")
+
+    body = buf[HEADER.size:]
+    if len(body) < records * rec_size:
+        sys.exit(f"dump truncated: {len(body) // rec_size} of {records} records")
+
+    now_lo = now_us & 0xFFFFFFFF
+    recs = []
+    for i in range(records):
+        ts, event, core, a, b = RECORD.unpack_from(body, i * rec_size)
+        # Records carry the low 32 bits of esp_timer: place each one in the 71-minute window ending now.
+        recs.append((now_us - ((now_lo - ts) & 0xFFFFFFFF), core, event, a, b))
+    recs.sort()
+
+    print(f"# corr {corr.rstrip(bytes(1)).decode(errors='replace')}: {records} records, "
+          f"{overwritten} overwritten, device up {now_us / 1e6:.3f} s")
+
+    prev = recs[0][0] if recs else 0
+    for t, core, event, a, b in recs:
+        if event < len(events):
+            name, fmt = events[event]
+            args = fmt.format(a=a, b=b, b4=b.to_bytes(4, "little").rstrip(b"\0").decode(errors="replace"))
+        else:
+            name, args = f"event{event}", f"a={a} b={b}"
+
+        print(f"{t / 1e6:14.6f}  {(t - prev) / 1e3:+11.3f}  c{core}  {name:<18} {args}".rstrip())
+        prev = t
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+
+    ap = argparse.ArgumentParser(description="binary event trace decoder")
+    ap.add_argument("dump", nargs="?", help="dump file (default: wait for one over MQTT with -s)")
+    ap.add_argument("-s", "--sub", help="device subdomain to wait for")
+    ap.add_argument("-H", "--host", default="mqtt.vmflow.xyz")
+    ap.add_argument("-e", "--events", default=os.path.join(here, "..", "main", "trace.h"), help="trace.h with the event list")
+    ap.add_argument("extra", nargs=argparse.REMAINDER, help="-- extra mosquitto_sub flags")
+    a = ap.parse_args()
+
+    events = load_events(a.events)
+
+    if a.dump:
+        with open(a.dump, "rb") as f:
+            buf = f.read()
+    elif a.sub:
+        extra = a.extra[1:] if a.extra[:1] == ["--"] else a.extra
+        buf = subprocess.run(["mosquitto_sub", "-h", a.host, "-t", f"domain.vmflow.xyz/{a.sub}/rpc/trace", "-C", "1", "-N"] + extra,
+                             capture_output=True, check=True).stdout
+    else:
+        ap.error("give a dump file or -s <sub>")
+
+    decode(buf, events)
+
+
+if __name__ == "__main__":
+    main()